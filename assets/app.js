@@ -0,0 +1,69 @@
+// Shows each feeding in the browser's local time (the device renders UTC),
+// and follows feeds as they happen over /events.
+(function () {
+  function pad(n) { return n < 10 ? '0' + n : '' + n; }
+
+  function format(date) {
+    return date.getFullYear() + '-' + pad(date.getMonth() + 1) + '-' + pad(date.getDate()) + ' ' +
+      pad(date.getHours()) + ':' + pad(date.getMinutes()) + ':' + pad(date.getSeconds());
+  }
+
+  function convertTime(item) {
+    var epochSec = parseInt(item.getAttribute('data-epoch-sec'), 10);
+    if (!isNaN(epochSec)) {
+      item.textContent = format(new Date(epochSec * 1000));
+    }
+  }
+
+  document.querySelectorAll('.converted-time').forEach(convertTime);
+
+  var status = document.getElementById('liveStatus');
+  var feedings = document.getElementById('feedings');
+  if (!status || !feedings || !window.EventSource) return;
+
+  function show(text, warning) {
+    status.textContent = text;
+    status.className = 'alert mt-3 ' + (warning ? 'alert-warning' : 'alert-info');
+    status.hidden = false;
+  }
+
+  // the same row the device renders, for a feeding that started since
+  function addFeeding(feed) {
+    if (feedings.querySelector('[data-epoch-sec="' + feed.asOf + '"]')) return;
+    var row = feedings.insertRow(0);
+    row.className = 'measurement';
+    var time = row.insertCell();
+    time.className = 'asOfAdjustedSec converted-time';
+    time.setAttribute('data-epoch-sec', feed.asOf);
+    convertTime(time);
+    var dose = row.insertCell();
+    dose.className = 'rotations';
+    dose.textContent = feed.dose;
+  }
+
+  var dose = 0;
+  var forced = 0;
+  var events = new EventSource('/events?since=' + encodeURIComponent(status.getAttribute('data-since')));
+  events.addEventListener('feedStarted', function (e) {
+    var feed = JSON.parse(e.data);
+    dose = feed.dose;
+    forced = 0;
+    addFeeding(feed);
+    show('Feeding ' + dose + ' rotations...');
+  });
+  events.addEventListener('feedProgress', function (e) {
+    var progress = JSON.parse(e.data);
+    show('Feeding: ' + progress.dispensed + ' of ' + dose + ' rotations done', forced > 0);
+  });
+  events.addEventListener('rotationForced', function (e) {
+    var rotation = JSON.parse(e.data).rotation;
+    forced++;
+    show('Rotation ' + rotation + ' never reached home and was stopped on time, check the drum', true);
+  });
+  events.addEventListener('feedFinished', function (e) {
+    var feed = JSON.parse(e.data);
+    addFeeding(feed);
+    show('Fed ' + feed.dose + ' rotations in ' + (feed.durationMs / 1000).toFixed(1) + 's' +
+      (forced > 0 ? ', ' + forced + ' rotation(s) stopped on time' : ''), forced > 0);
+  });
+})();
@@ -15,33 +15,33 @@
 // Optional parameters:
 //    - Adjust the delay in milliseconds.
 //    - Pull-Up input.
-Debounce::Debounce(byte button, unsigned long delay, boolean pullup)
+Debounce::Debounce(uint8_t button, unsigned long delay, bool pullup)
 {
   _invert = false;
   if (pullup)
   {
-    pinMode(button, INPUT_PULLUP);
+    hal::pinMode(button, hal::PinMode::InputPullup);
     _invert = true;
   }
   
   _button = button;
   _delay = delay;
-  _state = _lastState = _reading = (_invert ? !digitalRead(_button) : digitalRead(_button));
-  _last = millis();
+  _state = _lastState = _reading = (_invert ? !hal::digitalRead(_button) : hal::digitalRead(_button));
+  _last = hal::millis();
   _count = 0;
 }
 
 // returns the debounced button state: LOW or HIGH.
-byte Debounce::read()
+uint8_t Debounce::read()
 {
-  _reading = (_invert ? !digitalRead(_button) : digitalRead(_button)); // get current button state.
+  _reading = (_invert ? !hal::digitalRead(_button) : hal::digitalRead(_button)); // get current button state.
   if (_reading != _lastState)
   {                   // detect edge: current vs last state:
-    _last = millis(); // store millis if change was detected.
+    _last = hal::millis(); // store millis if change was detected.
     _wait = true;     // Just to avoid calling millis() unnecessarily.
   }
 
-  if (_wait && (millis() - _last) > _delay)
+  if (_wait && (hal::millis() - _last) > _delay)
   { // after the delay has passed:
     if (_reading != _state)
     {                    // if the change wasn't stored yet:
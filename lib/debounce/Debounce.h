@@ -12,7 +12,9 @@
 #ifndef Debounce_h
 #define Debounce_h
 
-#include "Arduino.h"
+#include <cstdint>
+
+#include "hal.h"
 
 class Debounce
 {
@@ -22,18 +24,18 @@ public:
   //    - Adjust the delay in milliseconds.
   //    - Pull-Up input.
   // Button pin is required.
-  Debounce(byte button, unsigned long delay = 50, boolean pullup = true);
+  Debounce(uint8_t button, unsigned long delay = 50, bool pullup = true);
 
-  byte read();          // returns the debounced button state: LOW or HIGH.
+  uint8_t read();       // returns the debounced button state: LOW or HIGH.
   unsigned int count(); // Returns the number of times the button was pressed.
   void resetCount();    // Resets the button count number.
 
 private:
-  byte _button, _state, _lastState, _reading;
+  uint8_t _button, _state, _lastState, _reading;
   unsigned int _count;
   unsigned long _delay, _last;
-  boolean _wait;
-  boolean _invert;
+  bool _wait;
+  bool _invert;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+namespace feeder {
+
+struct SensorEdge {
+    unsigned long atMs;
+    bool inRotation;
+};
+
+/************************
+ * Debounces timestamped edges rather than polled reads.
+ *
+ * A burst of edges settles once no new edge has arrived for quietPeriodMs.
+ * If it settled on a different level than before, that's a transition, and
+ * it's dated at the first edge of the burst: when the sensor actually moved,
+ * not when the loop got around to noticing.
+ ************************/
+class EdgeDebouncer {
+   private:
+    const unsigned long _quietPeriodMs;
+
+    bool _inRotation = false;
+
+    bool _inBurst = false;
+    bool _burstLevel = false;
+    unsigned long _burstStartedAt = 0;
+    unsigned long _lastEdgeAt = 0;
+
+    unsigned int _rotationEndsPending = 0;
+    unsigned long _lastRotationEndedAt = 0;
+    unsigned long _transitions = 0;
+
+    void settle() {
+        _inBurst = false;
+        if (_burstLevel == _inRotation) {
+            return;
+        }
+
+        _inRotation = _burstLevel;
+        _transitions++;
+        if (!_inRotation) {
+            _rotationEndsPending++;
+            _lastRotationEndedAt = _burstStartedAt;
+        }
+    }
+
+   public:
+    EdgeDebouncer(const unsigned long quietPeriodMs, const bool inRotation) : _quietPeriodMs(quietPeriodMs), _inRotation(inRotation) {}
+
+    void onEdge(const SensorEdge& edge) {
+        if (_inBurst && edge.atMs - _lastEdgeAt >= _quietPeriodMs) {
+            settle();
+        }
+        if (!_inBurst) {
+            _inBurst = true;
+            _burstStartedAt = edge.atMs;
+        }
+        _burstLevel = edge.inRotation;
+        _lastEdgeAt = edge.atMs;
+    }
+
+    // settles the current burst if it's gone quiet, returns the debounced level
+    bool update(const unsigned long nowMs) {
+        if (_inBurst && nowMs - _lastEdgeAt >= _quietPeriodMs) {
+            settle();
+        }
+        return _inRotation;
+    }
+
+    // true once per settled in-rotation -> at-home transition. endedAt is when
+    // the sensor first moved.
+    bool takeRotationEnd(unsigned long& endedAt) {
+        if (_rotationEndsPending == 0) {
+            return false;
+        }
+        _rotationEndsPending--;
+        endedAt = _lastRotationEndedAt;
+        return true;
+    }
+
+    bool inRotation() const { return _inRotation; }
+    unsigned long getTransitionCount() const { return _transitions; }
+};
+
+}  // namespace feeder
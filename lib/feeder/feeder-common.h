@@ -1,8 +1,53 @@
 #pragma once
 
+#include <cstdint>
+#include <cstdio>
+
 namespace feeder {
+
+/************************
+ * Doses
+ *
+ * How much to feed, in whole rotations plus sixteenths of one. A sixteenth
+ * is ~600ms of motor time, about as fine as stopping by time gets.
+ ************************/
+const unsigned int SIXTEENTHS_PER_ROTATION = 16;
+
+struct Dose {
+    unsigned int rotations = 0;
+    uint8_t sixteenths = 0;
+
+    static Dose ofSixteenths(const unsigned long total) {
+        return {static_cast<unsigned int>(total / SIXTEENTHS_PER_ROTATION), static_cast<uint8_t>(total % SIXTEENTHS_PER_ROTATION)};
+    }
+
+    static Dose ofRotations(const unsigned int rotations) { return {rotations, 0}; }
+
+    unsigned long totalSixteenths() const { return static_cast<unsigned long>(rotations) * SIXTEENTHS_PER_ROTATION + sixteenths; }
+    bool isEmpty() const { return rotations == 0 && sixteenths == 0; }
+    bool operator==(const Dose& other) const { return totalSixteenths() == other.totalSixteenths(); }
+};
+
 struct Feeding {
     unsigned long asOfAdjustedSec;
     unsigned int rotations;
+    // on top of rotations, for sub-rotation doses
+    uint8_t sixteenths = 0;
+
+    Dose dose() const { return {rotations, sixteenths}; }
+    // an empty slot in a store
+    bool isEmpty() const { return rotations == 0 && sixteenths == 0; }
 };
+
+const size_t DOSE_BUFFER_SIZE = 16;
+
+// "2", or "0.25" for part of a rotation. Also valid as a JSON number.
+void formatDose(char (&out)[DOSE_BUFFER_SIZE], const Dose& dose) {
+    if (dose.sixteenths == 0) {
+        snprintf(out, DOSE_BUFFER_SIZE, "%u", dose.rotations);
+        return;
+    }
+    const unsigned int hundredths = (dose.sixteenths * 100 + SIXTEENTHS_PER_ROTATION / 2) / SIXTEENTHS_PER_ROTATION;
+    snprintf(out, DOSE_BUFFER_SIZE, "%u.%02u", dose.rotations, hundredths);
+}
 }  // namespace feeder
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <atomic>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+#include "event-log.h"
+#include "feeder.h"
+#include "hal.h"
+#include "latency-histogram.h"
+#include "spsc-ring.h"
+
+namespace feeder {
+
+/************************
+ * Feeder task
+ *
+ * The Rotator is owned by one task, pinned to its own core, so nothing on
+ * the network side (MQTT, the web server, NTP, OTA) can delay a motor stop.
+ * The two sides only talk through these rings: commands in, completions
+ * out. Each ring has exactly one producer and one consumer.
+ ************************/
+struct FeedCommand {
+    unsigned long adjustedStartedAtSec;
+    Dose dose;
+};
+
+struct FeedCompletion {
+    unsigned long adjustedStartedAtSec;
+    Dose dose;
+    unsigned long durationMs;
+    // what rotationTiming had learnt by the end of this feed, for persisting
+    RotationTimingSnapshot rotationTiming;
+    // where this feed left the drum, for persisting
+    uint8_t drumOffsetSixteenths;
+};
+
+// a rotation of the running feed finishing, for live progress
+struct FeedProgress {
+    unsigned long adjustedStartedAtSec;
+    unsigned int rotationsDone;
+    unsigned long dispensedSixteenths;
+    // finished on time, the sensor never saw home
+    bool forced;
+};
+
+const int FEEDER_TASK_CORE = 1;
+const int FEEDER_TASK_STACK_SIZE = 4096;
+// above the network task and Arduino's loopTask
+const int FEEDER_TASK_PRIORITY = 5;
+const unsigned long FEEDER_TASK_PERIOD_MS = 5;
+
+inline constexpr hal::EventInfo FEED_COMMANDS_FULL{hal::LogLevel::Warn, "Refusing to queue a feed, command queue is full"};
+inline constexpr hal::EventInfo FEED_COMPLETION_DROPPED{hal::LogLevel::Error, "Dropping a feed completion, nobody is draining the completion queue"};
+
+richiev::SpscRing<FeedCommand, 8> feedCommands;
+richiev::SpscRing<FeedCompletion, 8> feedCompletions;
+// a feed's worth of rotations and then some. Progress is only for show, so
+// a full ring just drops it.
+richiev::SpscRing<FeedProgress, 16> feedProgress;
+std::atomic<bool> feedInProgress{false};
+// how far the running feed has got, for status reports
+std::atomic<uint32_t> feedProgressSixteenths{0};
+// written by the feeder task only
+hal::LatencyHistogram feederPassTime("feeder_task_pass_duration_microseconds", "One pass of the feeder task's state machine");
+
+#ifdef ARDUINO
+TaskHandle_t feederTaskHandle = nullptr;
+#endif
+
+// network side
+bool enqueueFeed(const unsigned long adjustedStartedAtSec, const Dose dose) {
+    if (!feedCommands.push({adjustedStartedAtSec, dose})) {
+        hal::log<FEED_COMMANDS_FULL>();
+        return false;
+    }
+#ifdef ARDUINO
+    if (feederTaskHandle != nullptr) {
+        xTaskNotifyGive(feederTaskHandle);
+    }
+#endif
+    return true;
+}
+
+// network side
+bool isFeedPending() {
+    return feedInProgress.load() || !feedCommands.isEmpty();
+}
+
+// feeder side: one pass of the state machine
+void serviceFeeder(const unsigned long nowMs) {
+    hal::ScopedTimer timer(feederPassTime);
+    FeedCommand command;
+    if (!isInFeed() && !feedCommands.isEmpty()) {
+        // claimed before the pop, so isFeedPending() never sees an empty
+        // ring with no feed running in between
+        feedInProgress = true;
+        if (feedCommands.pop(command)) {
+            feedProgressSixteenths = 0;
+            beginFeed(nowMs, command.adjustedStartedAtSec, command.dose);
+        } else {
+            feedInProgress = false;
+        }
+    }
+
+    if (!isInFeed()) {
+        loopFeeder(nowMs);
+        return;
+    }
+
+    const unsigned long startedAt = rotator->getStartedAt();
+    const unsigned int rotationsBefore = rotator->getRotationsDone();
+    const unsigned long forcedBefore = rotationTiming.getTimedOutRotations();
+    const FeedCompletion completion = {
+        .adjustedStartedAtSec = rotator->getAdjustedStartedAtSec(),
+        .dose = rotator->getDose(),
+        .durationMs = 0,
+        .rotationTiming = {},
+        .drumOffsetSixteenths = 0};
+
+    loopFeeder(nowMs);
+
+    const bool forced = rotationTiming.getTimedOutRotations() != forcedBefore;
+    if (isInFeed()) {
+        feedProgressSixteenths = rotator->getDispensedSixteenths();
+        if (rotator->getRotationsDone() != rotationsBefore) {
+            feedProgress.push({completion.adjustedStartedAtSec, rotator->getRotationsDone(), rotator->getDispensedSixteenths(), forced});
+        }
+    } else {
+        // the last rotation, the completion says the rest
+        if (forced) {
+            feedProgress.push({completion.adjustedStartedAtSec, rotationsBefore + 1, completion.dose.totalSixteenths(), forced});
+        }
+        FeedCompletion finished = completion;
+        finished.durationMs = hal::millis() - startedAt;
+        finished.rotationTiming = rotationTiming.snapshot();
+        finished.drumOffsetSixteenths = drumOffsetSixteenths;
+        if (!feedCompletions.push(finished)) {
+            hal::log<FEED_COMPLETION_DROPPED>();
+        }
+        feedInProgress = false;
+    }
+}
+
+#ifdef ARDUINO
+void feederTask(void*) {
+    hal::eventLog.claimOwnRing();
+    for (;;) {
+        serviceFeeder(hal::millis());
+        // a new command wakes this early
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FEEDER_TASK_PERIOD_MS));
+    }
+}
+
+void startFeederTask() {
+    xTaskCreatePinnedToCore(feederTask, "feeder", FEEDER_TASK_STACK_SIZE, nullptr, FEEDER_TASK_PRIORITY, &feederTaskHandle, FEEDER_TASK_CORE);
+}
+#endif
+
+}  // namespace feeder
@@ -1,10 +1,15 @@
 #pragma once
 
-#include <Arduino.h>
-
+#include <atomic>
 #include <memory>
 
 #include "Debounce.h"
+#include "edge-debouncer.h"
+#include "event-log.h"
+#include "feeder-common.h"
+#include "hal.h"
+#include "rotation-timing.h"
+#include "spsc-ring.h"
 
 namespace feeder {
 struct RotationSensorPins {
@@ -15,17 +20,29 @@ struct MotorPins {
     int powerOutput;
 };
 
+enum class RotationSensing {
+    // Debounce::read() once per loopFeeder pass
+    Polled,
+    // edges timestamped by an interrupt, debounced on those timestamps
+    Interrupt
+};
+
 /************************
  * Config (via setup)
  ************************/
 RotationSensorPins nsRotationSensorPins;
 MotorPins nsMotorPins;
+RotationSensing nsRotationSensing = RotationSensing::Interrupt;
 
 const unsigned int sleepPeriodBetweenRotationsMS = 100;
 // const unsigned long DEBOUNCE_INTERVAL_MS = 300;
 const unsigned long DEBOUNCE_INTERVAL_MS = 125;
+// with every edge captured there's no need to wait out a polling interval,
+// just for the contact to stop chattering
+const unsigned long EDGE_QUIET_PERIOD_MS = 40;
 
-// based on running it a handful of times. Seems to take ~9500-9800ms for a clean rotation
+// based on running it a handful of times. Seems to take ~9500-9800ms for a
+// clean rotation. Only the timeout until rotationTiming has learnt better.
 const unsigned long APPROXIMATE_ROTATION_DURATION_MS = 9900;
 
 /************************
@@ -33,193 +50,360 @@ const unsigned long APPROXIMATE_ROTATION_DURATION_MS = 9900;
  ************************/
 bool wasRotating = false;
 unsigned long lastTimeSlice = 0;
+unsigned long continueAt = 0;
+
+// owned by the feeder side, the network side only restores it before the
+// feeder task starts and reads copies off FeedCompletion after that
+RotationTimingModel rotationTiming(APPROXIMATE_ROTATION_DURATION_MS);
+
+// how far past home the drum was left, in sixteenths of a rotation. Only
+// sub-rotation doses leave it anywhere but home.
+uint8_t drumOffsetSixteenths = 0;
+// false after a forced stop left it wherever the motor went off (most
+// likely just short of home), until the sensor next sees home
+bool drumPositionKnown = true;
+
+/************************
+ * Log events
+ *
+ * Everything here runs on the feeder task, so it goes through the event log
+ * rather than printing.
+ ************************/
+inline constexpr hal::EventInfo ROTATION_FINISHED{hal::LogLevel::Info, "Finished a rotation (%lu) out of (%lu), duration=%lu"};
+inline constexpr hal::EventInfo FORCED_ROTATION_FINISHED{hal::LogLevel::Info, "Reached home after a forced stop duration=%lu, counted with the forced rotation"};
+inline constexpr hal::EventInfo STOPPED_PART_WAY{hal::LogLevel::Info, "Stopped part way through a rotation sixteenths=%lu, drum_offset=%lu"};
+inline constexpr hal::EventInfo SENSOR_EDGES_DROPPED{hal::LogLevel::Warn, "WARNING: rotation sensor edges dropped, resyncing from the pin", 1000};
+inline constexpr hal::EventInfo NO_ROTATION_INPUT{hal::LogLevel::Error, "No rotation input, assuming in a rotation", 1000};
+inline constexpr hal::EventInfo ROTATOR_IN_FLIGHT{hal::LogLevel::Warn, "Refusing to create a new rotator when one is already in flight"};
+inline constexpr hal::EventInfo FEED_BEGAN{hal::LogLevel::Info, "Beginning a feed! rotationCount=%lu, sixteenths=%lu, adjustedStartedAtSec=%lu"};
+inline constexpr hal::EventInfo FEED_FINISHED{hal::LogLevel::Info, "Finished a feed! duration=%lu, sensor_rotations_since_boot=%lu"};
+inline constexpr hal::EventInfo ROTATION_FORCED{hal::LogLevel::Warn, "WARNING: based on time should have finished a rotation but didn't. Forcing a rotation finish to avoid infinitely dropping food. duration=%lu, expected_duration<=%lu"};
+inline constexpr hal::EventInfo ROTATIONS_SLOWING{hal::LogLevel::Warn, "WARNING: rotations are slowing down, check for a jam. mean_ms=%lu, sigma_ms=%lu, slow_rotations=%lu"};
+// every 300ms slice
+inline constexpr hal::EventInfo LOOP_STATE{hal::LogLevel::Debug, "digitalRead=%lu, curInRotation=%lu, justFinishedRotation=%lu"};
 
 /************************
  * Rotation management
+ *
+ * A dose is whole rotations, each ended by the sensor seeing home, plus
+ * possibly part of one. The part is stopped by time: that fraction of what
+ * rotationTiming expects a rotation to take, counted from the motor starting
+ * (less however far it coasted past home before the pause, from the edge's
+ * timestamp). A drum left part way round makes the next feed's first
+ * rotation short, which the next dose accounts for.
+ *
+ * A rotation forced to a stop is counted, but leaves the drum somewhere
+ * unknown: most likely just short of home (it was slow), or past it (the
+ * sensor missed home). Getting home from there isn't a rotation's time, so
+ * it's no sample for rotationTiming, and if it's under half a rotation it
+ * was the rest of the forced one and isn't counted again.
  ************************/
 class Rotator {
    public:
-    Rotator(unsigned int rotationCount, unsigned long startedAt, const unsigned long adjustedStartedAtSec, const MotorPins motorPins, unsigned long expectedRotationDuration) : _rotationCount(rotationCount), _startedAt(startedAt), _adjustedStartedAtSec(adjustedStartedAtSec), _motorPins(motorPins), _expectedRotationDuration(expectedRotationDuration){};
-
-    bool finishedARotation(const unsigned long endedAt) {
-        Serial.print("Finished a rotation (");
-        Serial.print(_numRotationsDone + 1);
-        Serial.print(") out of (");
-        Serial.print(_rotationCount);
-        Serial.print(", duration=");
-        Serial.print(currentRotationDuration(endedAt));
-        Serial.print(", totalDuration=");
-        Serial.print(endedAt - _startedAt);
-        Serial.print(", currentRotationStartAt=");
-        Serial.print(_currentRotationStartAt);
-        Serial.println();
+    Rotator(const Dose dose, unsigned long startedAt, const unsigned long adjustedStartedAtSec, const MotorPins motorPins, const uint8_t drumOffsetSixteenths,
+            const bool positionKnown = true)
+        : _dose(dose), _targetSixteenths(dose.totalSixteenths()), _startedAt(startedAt), _adjustedStartedAtSec(adjustedStartedAtSec), _motorPins(motorPins), _offsetSixteenths(drumOffsetSixteenths % SIXTEENTHS_PER_ROTATION), _positionKnown(positionKnown){};
+
+    // forced when the timeout stopped it rather than the sensor seeing home
+    bool finishedARotation(const unsigned long endedAt, const bool forced = false) {
+        const unsigned long durationMs = currentRotationDuration(endedAt);
+        _homeAt = endedAt;
+        _passedHome = true;
+        if (!forced && !_positionKnown && durationMs < rotationTiming.expectedMs() / 2) {
+            hal::log<FORCED_ROTATION_FINISHED>(durationMs);
+            _offsetSixteenths = 0;
+            _positionKnown = true;
+            return isDone();
+        }
+
+        hal::log<ROTATION_FINISHED>(_numRotationsDone + 1, _dose.rotations, durationMs);
 
         _numRotationsDone++;
+        _dispensedSixteenths += SIXTEENTHS_PER_ROTATION - _offsetSixteenths;
+        _offsetSixteenths = 0;
+        _positionKnown = !forced;
+
+        return isDone();
+    }
+
+    // the part of a rotation at the end of a dose
+    bool shouldStopPartWay(const unsigned long asOfMS) {
+        return hasStarted && _stopAfterMs != 0 && currentRotationDuration(asOfMS) >= _stopAfterMs;
+    }
 
+    bool stoppedPartWay() {
+        const unsigned long remaining = remainingSixteenths();
+        _dispensedSixteenths += remaining;
+        _offsetSixteenths += remaining;
+
+        hal::log<STOPPED_PART_WAY>(remaining, _offsetSixteenths);
         return isDone();
     }
 
-    bool shouldHaveFinishedARotation(const unsigned long asOfMS) {
+    bool shouldHaveFinishedARotation(const unsigned long asOfMS, const unsigned long timeoutMs) {
         return hasStarted &&
-               ((_currentRotationStartAt + _expectedRotationDuration) < asOfMS);
+               ((_currentRotationStartAt + timeoutMs) < asOfMS);
     }
 
-    const bool isDone() {
-        return _numRotationsDone >= _rotationCount;
+    bool isDone() const {
+        return _dispensedSixteenths >= _targetSixteenths;
     }
 
     void go(unsigned long asOf) {
         hasStarted = true;
         _currentRotationStartAt = asOf;
-        digitalWrite(_motorPins.powerOutput, HIGH);
-    }
-
-    void pause() {
-        digitalWrite(_motorPins.powerOutput, LOW);
+        _segmentFromHome = _positionKnown && _offsetSixteenths == 0;
+
+        // short of home, stop by time
+        const unsigned long remaining = remainingSixteenths();
+        _stopAfterMs = 0;
+        if (remaining < SIXTEENTHS_PER_ROTATION - _offsetSixteenths) {
+            const float partMs = rotationTiming.expectedMs() * remaining / SIXTEENTHS_PER_ROTATION;
+            _stopAfterMs = partMs > _coastedMs ? static_cast<unsigned long>(partMs - _coastedMs) : 1;
+        }
+        _coastedMs = 0;
+        hal::digitalWrite(_motorPins.powerOutput, hal::PIN_HIGH);
     }
 
-    const unsigned long projectedRotationEndAt() {
-        return _currentRotationStartAt + _expectedRotationDuration;
+    void pause(const unsigned long asOf) {
+        hal::digitalWrite(_motorPins.powerOutput, hal::PIN_LOW);
+        // how far past home it got before the motor went off
+        if (_passedHome) {
+            _coastedMs = asOf - _homeAt;
+            _passedHome = false;
+        }
     }
 
     const unsigned long currentRotationDuration(unsigned long asOfMS) {
         return asOfMS - _currentRotationStartAt;
     }
 
+    // whether the rotation running now started from home, so its duration
+    // is a whole rotation's
+    bool isFromHome() const { return _segmentFromHome; }
+
     const unsigned long getStartedAt() { return _startedAt; }
 
     const unsigned long getAdjustedStartedAtSec() { return _adjustedStartedAtSec; }
 
+    const unsigned int getRotationCount() { return _dose.rotations; }
+
+    const Dose& getDose() const { return _dose; }
+
+    uint8_t getDrumOffset() const { return _offsetSixteenths; }
+
+    bool isPositionKnown() const { return _positionKnown; }
+
+    unsigned long getDispensedSixteenths() const { return _dispensedSixteenths; }
+
+    unsigned int getRotationsDone() const { return _numRotationsDone; }
+
    private:
-    const unsigned int _rotationCount;
+    const Dose _dose;
+    const unsigned long _targetSixteenths;
     const unsigned long _startedAt;
     const unsigned long _adjustedStartedAtSec;
-    const unsigned long _expectedRotationDuration;
     const MotorPins _motorPins;
 
     unsigned int _numRotationsDone = 0;
+    unsigned long _dispensedSixteenths = 0;
+    uint8_t _offsetSixteenths;
+    bool _positionKnown;
+    bool _segmentFromHome = true;
+    unsigned long _stopAfterMs = 0;
+    unsigned long _homeAt = 0;
+    bool _passedHome = false;
+    unsigned long _coastedMs = 0;
     unsigned long _currentRotationStartAt = 0;
     bool hasStarted = false;
+
+    unsigned long remainingSixteenths() const { return isDone() ? 0 : _targetSixteenths - _dispensedSixteenths; }
 };
 
 std::unique_ptr<Rotator> rotator = nullptr;
 std::unique_ptr<Debounce> rotationInput = nullptr;
 
+/************************
+ * Interrupt driven rotation sensing
+ ************************/
+richiev::SpscRing<SensorEdge, 32> sensorEdges;
+std::atomic<unsigned long> droppedSensorEdges{0};
+std::unique_ptr<EdgeDebouncer> edgeDebouncer = nullptr;
+
+bool readSensorInRotation() {
+    return hal::digitalRead(nsRotationSensorPins.input) == hal::PIN_LOW;
+}
+
+HAL_ISR_ATTR void onRotationSensorEdge() {
+    if (!sensorEdges.push({hal::millis(), readSensorInRotation()})) {
+        droppedSensorEdges++;
+    }
+}
+
+void drainSensorEdges(const unsigned long nowMs) {
+    SensorEdge edge;
+    while (sensorEdges.pop(edge)) {
+        edgeDebouncer->onEdge(edge);
+    }
+
+    // the ring overflowed, so some edges are gone. Resync off the pin as if
+    // it had just changed.
+    if (droppedSensorEdges.exchange(0) > 0) {
+        hal::log<SENSOR_EDGES_DROPPED>();
+        edgeDebouncer->onEdge({nowMs, readSensorInRotation()});
+    }
+    edgeDebouncer->update(nowMs);
+}
+
+/************************
+ * Sensing
+ ************************/
+
 bool isInFeed() {
     return rotator != nullptr;
 }
 
 bool isInRotation() {
+    if (nsRotationSensing == RotationSensing::Interrupt && edgeDebouncer != nullptr) {
+        return edgeDebouncer->inRotation();
+    }
+
     // default to saying we're in a rotation so that we fail thinking we're feeding
     if (rotationInput == nullptr) {
-        Serial.println("early exit");
+        hal::log<NO_ROTATION_INPUT>();
         return true;
     }
 
     return rotationInput->read();
 }
 
-void beginFeed(const unsigned long rotationStartedAt, const unsigned long adjustedStartedAtSec, const int rotationCount) {
+// Called once per loopFeeder pass. Returns whether a rotation has ended since
+// the last call and, if so, when.
+bool pollRotationFinished(const unsigned long nowMs, bool& curInRotation, unsigned long& endedAt) {
+    if (nsRotationSensing == RotationSensing::Interrupt) {
+        drainSensorEdges(nowMs);
+        curInRotation = edgeDebouncer->inRotation();
+        return edgeDebouncer->takeRotationEnd(endedAt);
+    }
+
+    curInRotation = isInRotation();
+    endedAt = nowMs;
+    return wasRotating && !curInRotation;
+}
+
+bool beginFeed(const unsigned long rotationStartedAt, const unsigned long adjustedStartedAtSec, const Dose dose) {
     if (rotator != nullptr) {
-        Serial.println("Refusing to create a new rotator when one is already in flight");
+        hal::log<ROTATOR_IN_FLIGHT>();
+        return false;
     }
-    auto newRotator = std::make_unique<Rotator>(rotationCount, rotationStartedAt, adjustedStartedAtSec, nsMotorPins, APPROXIMATE_ROTATION_DURATION_MS);
+    auto newRotator = std::make_unique<Rotator>(dose, rotationStartedAt, adjustedStartedAtSec, nsMotorPins, drumOffsetSixteenths, drumPositionKnown);
 
-    Serial.print("Beginning a feed! rotationCount=");
-    Serial.print(rotationCount);
-    Serial.print(", rotationStartedAt=");
-    Serial.print(rotationStartedAt);
-    Serial.print(", adjustedStartedAtSec=");
-    Serial.print(adjustedStartedAtSec);
-    Serial.println();
+    hal::log<FEED_BEGAN>(dose.rotations, dose.sixteenths, adjustedStartedAtSec);
 
     newRotator->go(rotationStartedAt);
 
     rotator = std::move(newRotator);
+    return true;
 }
 
 void finishFeed(const unsigned long finishTime) {
+    const unsigned long startedAt = rotator ? rotator->getStartedAt() : finishTime;
     if (rotator) {
-        Serial.print("Finished a feed!");
-        Serial.print(" duration=");
-        Serial.print(finishTime - rotator->getStartedAt());
-        Serial.println();
+        drumOffsetSixteenths = rotator->getDrumOffset();
+        drumPositionKnown = rotator->isPositionKnown();
     }
     rotator = nullptr;
 
-    if (rotationInput) {
-        Serial.print("Total rotations since reboot: rotation_count=");
-        Serial.print(rotationInput->read());
-        Serial.print(", time_since_reboot=");
-        Serial.print(finishTime);
-        Serial.println();
-    }
+    // polled sensing's Debounce only knows the level, not a count
+    const unsigned long sensorRotations = edgeDebouncer ? edgeDebouncer->getTransitionCount() / 2 : 0;
+    hal::log<FEED_FINISHED>(finishTime - startedAt, sensorRotations);
 }
 
 /************************
  * Setup & Loop
  ************************/
-void setupFeeder(const RotationSensorPins rotationSensorPins, const MotorPins motorPins) {
-    digitalWrite(motorPins.powerOutput, LOW);
-    pinMode(motorPins.powerOutput, OUTPUT);
-
-    pinMode(rotationSensorPins.input, INPUT_PULLUP);
-    rotationInput = std::make_unique<Debounce>(rotationSensorPins.input, DEBOUNCE_INTERVAL_MS, true);
+void setupFeeder(const RotationSensorPins rotationSensorPins, const MotorPins motorPins, const RotationSensing sensing = RotationSensing::Interrupt) {
+    hal::digitalWrite(motorPins.powerOutput, hal::PIN_LOW);
+    hal::pinMode(motorPins.powerOutput, hal::PinMode::Output);
 
     nsRotationSensorPins = rotationSensorPins;
     nsMotorPins = motorPins;
-}
+    nsRotationSensing = sensing;
 
-unsigned long continueAt = 0;
+    rotator = nullptr;
+    wasRotating = false;
+    continueAt = 0;
+
+    hal::pinMode(rotationSensorPins.input, hal::PinMode::InputPullup);
+    if (sensing == RotationSensing::Interrupt) {
+        rotationInput = nullptr;
+        edgeDebouncer = std::make_unique<EdgeDebouncer>(EDGE_QUIET_PERIOD_MS, readSensorInRotation());
+        hal::attachEdgeInterrupt(rotationSensorPins.input, onRotationSensorEdge);
+    } else {
+        hal::detachEdgeInterrupt(rotationSensorPins.input);
+        edgeDebouncer = nullptr;
+        rotationInput = std::make_unique<Debounce>(rotationSensorPins.input, DEBOUNCE_INTERVAL_MS, true);
+    }
+}
 
 void loopFeeder(const unsigned long loopStartedAt) {
     const int curTimeSlice = loopStartedAt / 300;
 
-    const bool curInRotation = isInRotation();
-    bool justFinishedRotation = wasRotating && !curInRotation;
+    bool curInRotation;
+    unsigned long rotationEndedAt;
+    bool justFinishedRotation = pollRotationFinished(loopStartedAt, curInRotation, rotationEndedAt);
 
     if (rotator) {
-        if (continueAt != 0 && continueAt <= loopStartedAt) {
-            continueAt = 0;
-            rotator->go(millis());
-        } else {
-            auto finishTime = millis();
-            if (!justFinishedRotation && rotator->shouldHaveFinishedARotation(finishTime)) {
-                Serial.print("WARNING: based on time should have finished a rotation but didn't. Forcing a rotation finish to avoid infinitely dropping food.");
-                Serial.print(" duration=");
-                Serial.print(rotator->currentRotationDuration(finishTime));
-                Serial.print(", expected_duration<=");
-                Serial.print(APPROXIMATE_ROTATION_DURATION_MS);
-                Serial.println();
-
-                justFinishedRotation = true;
+        if (continueAt != 0) {
+            // paused between rotations
+            if (continueAt <= loopStartedAt) {
+                continueAt = 0;
+                rotator->go(hal::millis());
             }
+        } else {
+            auto finishTime = hal::millis();
+            if (!justFinishedRotation && rotator->shouldStopPartWay(finishTime)) {
+                rotator->pause(finishTime);
+                rotator->stoppedPartWay();
+                finishFeed(finishTime);
+            } else {
+                const unsigned long timeoutMs = rotationTiming.timeoutMs();
+                bool warnSlow = false;
+                bool forced = false;
+                if (!justFinishedRotation && rotator->shouldHaveFinishedARotation(finishTime, timeoutMs)) {
+                    hal::log<ROTATION_FORCED>(rotator->currentRotationDuration(finishTime), timeoutMs);
+
+                    justFinishedRotation = true;
+                    forced = true;
+                    rotationEndedAt = finishTime;
+                    warnSlow = rotationTiming.addTimeout();
+                } else if (justFinishedRotation && rotator->isFromHome()) {
+                    warnSlow = rotationTiming.addSample(rotator->currentRotationDuration(rotationEndedAt));
+                }
+
+                if (warnSlow) {
+                    hal::log<ROTATIONS_SLOWING>(static_cast<unsigned long>(rotationTiming.getMeanMs()),
+                                                static_cast<unsigned long>(rotationTiming.getSigmaMs()), rotationTiming.getSlowRotations());
+                }
 
-            if (justFinishedRotation) {
-                rotator->finishedARotation(finishTime);
+                if (justFinishedRotation) {
+                    rotator->finishedARotation(rotationEndedAt, forced);
 
-                rotator->pause();
+                    rotator->pause(finishTime);
 
-                if (rotator->isDone()) {
-                    finishFeed(finishTime);
-                } else {
-                    continueAt = finishTime + sleepPeriodBetweenRotationsMS;
+                    if (rotator->isDone()) {
+                        finishFeed(finishTime);
+                    } else {
+                        continueAt = finishTime + sleepPeriodBetweenRotationsMS;
+                    }
                 }
             }
         }
     }
 
     wasRotating = curInRotation;
-    if (curTimeSlice != lastTimeSlice || justFinishedRotation) {
-        Serial.print("\trotationInput->read()=");
-        Serial.print(rotationInput->read());
-        Serial.print(", digitalRead=");
-        Serial.print(digitalRead(nsRotationSensorPins.input));
-        Serial.print(", curInRotation=");
-        Serial.print(curInRotation);
-        Serial.print(", justFinishedRotation=");
-        Serial.print(justFinishedRotation);
-        Serial.println();
+    if (hal::logEnabled<LOOP_STATE>() && (curTimeSlice != lastTimeSlice || justFinishedRotation)) {
+        hal::log<LOOP_STATE>(hal::digitalRead(nsRotationSensorPins.input), curInRotation, justFinishedRotation);
     }
 
     lastTimeSlice = curTimeSlice;
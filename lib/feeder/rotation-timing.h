@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace feeder {
+
+/************************
+ * Rotation timing model
+ *
+ * Learns how long a rotation takes on this feeder (it drifts with supply
+ * voltage and how much food is in the drum) as an exponentially weighted
+ * mean and variance of the rotations the sensor saw finish. Rotations that
+ * had to be forced to a stop aren't samples, they'd teach it that jams are
+ * normal, and nor is the part rotation back to home after one.
+ *
+ * The timeout for forcing a stop is mean + k·σ, so the motor runs past a
+ * missed sensor edge for about as long as a real rotation's tail, not a
+ * fixed worst case. Until there are enough samples it uses the old fixed
+ * timeout. Each forced stop in a row widens it by TIMEOUT_WIDEN_FRACTION,
+ * so a feeder that really has got slower (a sagging supply) soon finishes
+ * rotations by the sensor again, and those teach it the new speed.
+ ************************/
+struct RotationTimingSnapshot {
+    float meanMs = 0;
+    float varianceMs2 = 0;
+    uint32_t samples = 0;
+};
+
+class RotationTimingModel {
+   public:
+    // roughly the last 8 rotations count
+    static constexpr float ALPHA = 1.0f / 8;
+    // one window's worth before trusting it
+    static constexpr uint32_t MIN_SAMPLES = 8;
+    // the first sample's spread, as a fraction of it. Generous on purpose,
+    // the variance only shrinks towards the real one as samples come in,
+    // where starting from 0 would undershoot and force stops early.
+    static constexpr float PRIOR_SIGMA_FRACTION = 0.02f;
+    static constexpr float TIMEOUT_SIGMAS = 4;
+    // slower than this is an early sign of a jam (or a flat supply)
+    static constexpr float SLOW_SIGMAS = 2.5f;
+    static constexpr unsigned int SLOW_STREAK_WARNING = 2;
+    // σ never counts as less than this, one quiet week shouldn't make the
+    // next slightly slow rotation look like a jam
+    static constexpr float MIN_SIGMA_MS = 40;
+    // room for the sensor's quiet period and a feeder task pass after the
+    // edge, otherwise a rotation that ends right on time gets forced
+    static constexpr unsigned long MIN_MARGIN_MS = 150;
+    static constexpr unsigned long MAX_TIMEOUT_MS = 15000;
+    static constexpr float TIMEOUT_WIDEN_FRACTION = 0.05f;
+
+   private:
+    unsigned long _fallbackTimeoutMs;
+    RotationTimingSnapshot _state;
+    unsigned int _slowStreak = 0;
+    unsigned long _slowRotations = 0;
+    unsigned long _timedOutRotations = 0;
+    // forced stops since the last sample
+    unsigned int _timeoutStreak = 0;
+
+    float sigmaMs() const {
+        const float sigma = std::sqrt(_state.varianceMs2);
+        return sigma < MIN_SIGMA_MS ? MIN_SIGMA_MS : sigma;
+    }
+
+    bool noteSlow(const bool slow) {
+        if (!slow) {
+            _slowStreak = 0;
+            return false;
+        }
+        _slowRotations++;
+        _slowStreak++;
+        return _slowStreak >= SLOW_STREAK_WARNING;
+    }
+
+   public:
+    explicit RotationTimingModel(const unsigned long fallbackTimeoutMs) : _fallbackTimeoutMs(fallbackTimeoutMs) {}
+
+    void restore(const RotationTimingSnapshot& snapshot) {
+        _state = snapshot;
+        if (!(_state.meanMs > 0) || !(_state.varianceMs2 >= 0)) {
+            _state = {};
+        }
+        _slowStreak = 0;
+        _timeoutStreak = 0;
+    }
+
+    bool isWarm() const { return _state.samples >= MIN_SAMPLES; }
+
+    unsigned long timeoutMs() const {
+        float timeout = static_cast<float>(_fallbackTimeoutMs);
+        if (isWarm()) {
+            float margin = TIMEOUT_SIGMAS * sigmaMs();
+            if (margin < MIN_MARGIN_MS) margin = MIN_MARGIN_MS;
+            timeout = _state.meanMs + margin;
+        }
+        timeout *= 1 + TIMEOUT_WIDEN_FRACTION * _timeoutStreak;
+        return timeout > MAX_TIMEOUT_MS ? MAX_TIMEOUT_MS : static_cast<unsigned long>(timeout);
+    }
+
+    // a rotation the sensor saw finish. Returns true when rotations have been
+    // slow enough, for long enough, to warn about.
+    bool addSample(const unsigned long durationMs) {
+        const float x = static_cast<float>(durationMs);
+        const bool slow = isWarm() && x > _state.meanMs + SLOW_SIGMAS * sigmaMs();
+
+        if (_state.samples == 0) {
+            _state.meanMs = x;
+            _state.varianceMs2 = (PRIOR_SIGMA_FRACTION * x) * (PRIOR_SIGMA_FRACTION * x);
+        } else {
+            // West's incremental form of the weighted mean and variance
+            const float diff = x - _state.meanMs;
+            const float increment = ALPHA * diff;
+            _state.meanMs += increment;
+            _state.varianceMs2 = (1 - ALPHA) * (_state.varianceMs2 + diff * increment);
+        }
+        _state.samples++;
+        _timeoutStreak = 0;
+
+        return noteSlow(slow);
+    }
+
+    // a rotation that had to be forced to a stop. Always a warning.
+    bool addTimeout() {
+        _timedOutRotations++;
+        _timeoutStreak++;
+        noteSlow(true);
+        return true;
+    }
+
+    // best guess at a whole rotation, for stopping part way through one
+    float expectedMs() const { return _state.samples > 0 ? _state.meanMs : static_cast<float>(_fallbackTimeoutMs); }
+
+    float getMeanMs() const { return _state.meanMs; }
+    float getSigmaMs() const { return std::sqrt(_state.varianceMs2); }
+    const RotationTimingSnapshot& snapshot() const { return _state; }
+    unsigned long getSlowRotations() const { return _slowRotations; }
+    unsigned long getTimedOutRotations() const { return _timedOutRotations; }
+};
+
+}  // namespace feeder
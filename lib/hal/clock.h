@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+namespace hal {
+
+/************************
+ * Clock
+ *
+ * On device this is just millis()/micros(). Off device time only moves when
+ * the simulator advances it, which is what makes runs deterministic.
+ ************************/
+#ifdef ARDUINO
+inline unsigned long millis() { return ::millis(); }
+inline unsigned long micros() { return ::micros(); }
+
+// the CPU's cycle counter, for timing short stretches of code. Wraps every
+// ~18s at 240MHz, fine for anything shorter.
+inline uint32_t cycleCount() { return ESP.getCycleCount(); }
+inline uint32_t cyclesPerMicro() { return getCpuFrequencyMhz(); }
+#else
+namespace native {
+inline unsigned long long clockMicros = 0;
+
+inline void setClockMicros(unsigned long long us) { clockMicros = us; }
+inline void advanceClockMicros(unsigned long long us) { clockMicros += us; }
+inline void advanceClockMillis(unsigned long ms) { clockMicros += static_cast<unsigned long long>(ms) * 1000; }
+}  // namespace native
+
+inline unsigned long millis() { return static_cast<unsigned long>(native::clockMicros / 1000); }
+inline unsigned long micros() { return static_cast<unsigned long>(native::clockMicros); }
+
+// real time, not the virtual clock: this is for measuring how long the host
+// takes to run the code. A "cycle" is a nanosecond.
+inline uint32_t cycleCount() {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+inline uint32_t cyclesPerMicro() { return 1000; }
+#endif
+
+}  // namespace hal
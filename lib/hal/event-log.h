@@ -0,0 +1,327 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+#include "clock.h"
+#include "log.h"
+#include "spsc-ring.h"
+
+// events below this level compile away: 0 debug, 1 info, 2 warn, 3 error
+#ifndef FEEDER_LOG_LEVEL
+#define FEEDER_LOG_LEVEL 1
+#endif
+
+namespace hal {
+
+/************************
+ * Event log
+ *
+ * Logging for the hot paths (the feeder task, MQTT callbacks). A log call
+ * only copies a small binary record (timestamp, which event, a few numbers)
+ * into a lock free ring. Formatting and the slow part, writing to Serial at
+ * 115200 baud, happen later on a low priority drain task, so a log line
+ * never holds up a motor stop.
+ *
+ * Each event is a constexpr EventInfo naming its level and printf format.
+ * The format only sees the numeric args (all as unsigned long), the short
+ * text, if any, goes straight after it, so formats that take one end in
+ * "name=".
+ ************************/
+enum class LogLevel : uint8_t {
+    Debug = 0,
+    Info = 1,
+    Warn = 2,
+    Error = 3,
+};
+
+constexpr LogLevel MIN_LOG_LEVEL = static_cast<LogLevel>(FEEDER_LOG_LEVEL);
+
+struct EventInfo {
+    LogLevel level;
+    const char* format;
+    // at most one of these per interval, the rest are counted and reported
+    // on the next one that gets through. 0 for no limit.
+    uint16_t minIntervalMs = 0;
+};
+
+const size_t LOG_ARGS = 3;
+const size_t LOG_TEXT_SIZE = 24;
+
+struct LogRecord {
+    uint32_t atMs;
+    const EventInfo* event;
+    uint32_t args[LOG_ARGS];
+    uint16_t suppressed;
+    char text[LOG_TEXT_SIZE];
+};
+
+const char* describe(const LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug:
+            return "D";
+        case LogLevel::Info:
+            return "I";
+        case LogLevel::Warn:
+            return "W";
+        default:
+            return "E";
+    }
+}
+
+const size_t LOG_LINE_SIZE = 128;
+
+// "12345 W <formatted args><text> (suppressed=N)"
+size_t formatLogRecord(char (&out)[LOG_LINE_SIZE], const LogRecord& record) {
+    int length = snprintf(out, LOG_LINE_SIZE, "%lu %s ", static_cast<unsigned long>(record.atMs), describe(record.event->level));
+    length += snprintf(out + length, LOG_LINE_SIZE - length, record.event->format, static_cast<unsigned long>(record.args[0]),
+                       static_cast<unsigned long>(record.args[1]), static_cast<unsigned long>(record.args[2]));
+    if (record.text[0] != '\0' && length < static_cast<int>(LOG_LINE_SIZE)) {
+        length += snprintf(out + length, LOG_LINE_SIZE - length, "%s", record.text);
+    }
+    if (record.suppressed > 0 && length < static_cast<int>(LOG_LINE_SIZE)) {
+        length += snprintf(out + length, LOG_LINE_SIZE - length, " (suppressed=%u)", record.suppressed);
+    }
+    return length < static_cast<int>(LOG_LINE_SIZE) ? length : LOG_LINE_SIZE - 1;
+}
+
+/************************
+ * Rings
+ *
+ * The feeder task has a ring to itself, claimed as it starts, so a log call
+ * on the motor's path only ever copies a record in. Everything else (the
+ * network task, setup() on the Arduino loop task, which shares a core with
+ * the feeder) shares the other ring, a push at a time under a lock, so it
+ * still has a single producer. Not for ISRs. Full rings drop, and the drops
+ * are reported.
+ ************************/
+const size_t LOG_RINGS = 2;
+const size_t LOG_RING_SIZE = 64;
+const size_t OWNED_RING = 0;
+const size_t SHARED_RING = 1;
+
+class EventLog {
+   private:
+    richiev::SpscRing<LogRecord, LOG_RING_SIZE> _rings[LOG_RINGS];
+    std::atomic<uint32_t> _dropped[LOG_RINGS] = {};
+    std::atomic<uint32_t> _written{0};
+
+#ifdef ARDUINO
+    std::atomic<TaskHandle_t> _owner{nullptr};
+    portMUX_TYPE _sharedLock = portMUX_INITIALIZER_UNLOCKED;
+
+    static TaskHandle_t currentTask() { return xTaskGetCurrentTaskHandle(); }
+#else
+    std::atomic<std::thread::id> _owner{};
+    std::mutex _sharedLock;
+
+    static std::thread::id currentTask() { return std::this_thread::get_id(); }
+#endif
+
+    bool pushShared(const LogRecord& record) {
+#ifdef ARDUINO
+        portENTER_CRITICAL(&_sharedLock);
+        const bool pushed = _rings[SHARED_RING].push(record);
+        portEXIT_CRITICAL(&_sharedLock);
+        return pushed;
+#else
+        std::lock_guard<std::mutex> lock(_sharedLock);
+        return _rings[SHARED_RING].push(record);
+#endif
+    }
+
+   public:
+    // gives the calling task the lock free ring, see above
+    void claimOwnRing() { _owner = currentTask(); }
+
+    void push(const LogRecord& record) {
+        if (currentTask() == _owner.load()) {
+            if (!_rings[OWNED_RING].push(record)) _dropped[OWNED_RING]++;
+        } else if (!pushShared(record)) {
+            _dropped[SHARED_RING]++;
+        }
+    }
+
+    // drain side: every record waiting, one ring at a time. Returns how many.
+    template <typename Fn>
+    size_t drain(Fn&& fn) {
+        size_t drained = 0;
+        LogRecord record;
+        for (size_t ring = 0; ring < LOG_RINGS; ring++) {
+            while (_rings[ring].pop(record)) {
+                fn(record);
+                drained++;
+            }
+        }
+        _written += drained;
+        return drained;
+    }
+
+    // dropped since last asked
+    uint32_t takeDropped() {
+        uint32_t dropped = 0;
+        for (auto& count : _dropped) dropped += count.exchange(0);
+        return dropped;
+    }
+
+    uint32_t getWritten() const { return _written.load(); }
+};
+
+inline EventLog eventLog;
+
+template <const EventInfo& E>
+constexpr bool logEnabled() {
+    return E.level >= MIN_LOG_LEVEL;
+}
+
+template <const EventInfo& E>
+void pushEvent(const uint32_t args[LOG_ARGS], const std::string_view text) {
+    // per event, shared by whichever core logs it. A race only miscounts.
+    static std::atomic<uint32_t> lastAtMs{0};
+    static std::atomic<uint16_t> suppressed{0};
+
+    const uint32_t nowMs = millis();
+    if (E.minIntervalMs != 0) {
+        const uint32_t last = lastAtMs.load(std::memory_order_relaxed);
+        if (last != 0 && nowMs - last < E.minIntervalMs) {
+            suppressed++;
+            return;
+        }
+        lastAtMs.store(nowMs == 0 ? 1 : nowMs, std::memory_order_relaxed);
+    }
+
+    LogRecord record;
+    record.atMs = nowMs;
+    record.event = &E;
+    memcpy(record.args, args, sizeof(record.args));
+    record.suppressed = suppressed.exchange(0);
+    const size_t textLength = text.size() < LOG_TEXT_SIZE - 1 ? text.size() : LOG_TEXT_SIZE - 1;
+    memcpy(record.text, text.data(), textLength);
+    record.text[textLength] = '\0';
+    eventLog.push(record);
+}
+
+// hal::log<FEED_BEGAN>(rotations, sixteenths). Events under MIN_LOG_LEVEL
+// are compiled out, but the args are still evaluated, wrap anything costly
+// to work out in `if (hal::logEnabled<E>())`.
+template <const EventInfo& E, typename... Args>
+void log(const Args... args) {
+    static_assert(sizeof...(Args) <= LOG_ARGS, "too many log args");
+    if constexpr (logEnabled<E>()) {
+        const uint32_t values[LOG_ARGS] = {static_cast<uint32_t>(args)...};
+        pushEvent<E>(values, {});
+    }
+}
+
+// same, with a short string (truncated to LOG_TEXT_SIZE - 1) on the end
+template <const EventInfo& E, typename... Args>
+void logText(const std::string_view text, const Args... args) {
+    static_assert(sizeof...(Args) <= LOG_ARGS, "too many log args");
+    if constexpr (logEnabled<E>()) {
+        const uint32_t values[LOG_ARGS] = {static_cast<uint32_t>(args)...};
+        pushEvent<E>(values, text);
+    }
+}
+
+/************************
+ * Log tail
+ *
+ * The last few formatted lines, numbered, for the sinks that can't be
+ * written from the drain task: MQTT (the client belongs to the network
+ * task) and the web server's /logs.
+ ************************/
+const size_t LOG_TAIL_LINES = 32;
+
+struct LogLine {
+    uint32_t seq;
+    LogLevel level;
+    char text[LOG_LINE_SIZE];
+};
+
+class LogTail {
+   private:
+    LogLine _lines[LOG_TAIL_LINES] = {};
+    uint32_t _nextSeq = 1;
+    mutable std::mutex _mutex;
+
+   public:
+    void append(const LogLevel level, const char* text) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        LogLine& line = _lines[_nextSeq % LOG_TAIL_LINES];
+        line.seq = _nextSeq++;
+        line.level = level;
+        snprintf(line.text, LOG_LINE_SIZE, "%s", text);
+    }
+
+    // lines after seq at or above level, oldest first. Returns the last seq
+    // seen, to pass back next time. Stops early when fn returns false.
+    template <typename Fn>
+    uint32_t forEachSince(const uint32_t seq, const LogLevel level, Fn&& fn) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const uint32_t oldest = _nextSeq > LOG_TAIL_LINES ? _nextSeq - LOG_TAIL_LINES : 1;
+        uint32_t at = seq + 1 > oldest ? seq + 1 : oldest;
+        for (; at < _nextSeq; at++) {
+            const LogLine& line = _lines[at % LOG_TAIL_LINES];
+            if (line.level >= level && !fn(line)) break;
+        }
+        return at - 1;
+    }
+
+    uint32_t lastSeq() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _nextSeq - 1;
+    }
+};
+
+inline LogTail logTail;
+
+// format everything waiting, write it to logSink (Serial on device) and the
+// tail. The drain task's body, and called directly off device.
+size_t drainEventLog() {
+    char line[LOG_LINE_SIZE];
+    const size_t drained = eventLog.drain([&](const LogRecord& record) {
+        formatLogRecord(line, record);
+        logSink.println(line);
+        logTail.append(record.event->level, line);
+    });
+
+    const uint32_t dropped = eventLog.takeDropped();
+    if (dropped > 0) {
+        snprintf(line, sizeof(line), "%lu W log ring full, dropped=%lu", static_cast<unsigned long>(millis()), static_cast<unsigned long>(dropped));
+        logSink.println(line);
+        logTail.append(LogLevel::Warn, line);
+    }
+    return drained;
+}
+
+#ifdef ARDUINO
+// below the network task, on its core, so it only gets the idle time
+const int LOG_DRAIN_TASK_CORE = 0;
+const int LOG_DRAIN_TASK_STACK_SIZE = 3072;
+const int LOG_DRAIN_TASK_PRIORITY = 0;
+const unsigned long LOG_DRAIN_PERIOD_MS = 50;
+
+void logDrainTask(void*) {
+    for (;;) {
+        drainEventLog();
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_PERIOD_MS));
+    }
+}
+
+void startLogDrainTask() {
+    xTaskCreatePinnedToCore(logDrainTask, "logDrain", LOG_DRAIN_TASK_STACK_SIZE, nullptr, LOG_DRAIN_TASK_PRIORITY, nullptr, LOG_DRAIN_TASK_CORE);
+}
+#endif
+
+}  // namespace hal
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+namespace hal {
+
+/************************
+ * GPIO
+ *
+ * Arduino's HIGH/LOW/OUTPUT are macros, so the HAL has its own names for them.
+ ************************/
+const int PIN_LOW = 0;
+const int PIN_HIGH = 1;
+
+// marks an interrupt handler, they need to live in IRAM on the ESP32
+#ifdef ARDUINO
+#define HAL_ISR_ATTR IRAM_ATTR
+#else
+#define HAL_ISR_ATTR
+#endif
+
+using EdgeHandler = void (*)();
+
+enum class PinMode {
+    Input,
+    InputPullup,
+    Output
+};
+
+#ifdef ARDUINO
+inline void pinMode(const int pin, const PinMode mode) {
+    switch (mode) {
+        case PinMode::Input:
+            ::pinMode(pin, INPUT);
+            break;
+        case PinMode::InputPullup:
+            ::pinMode(pin, INPUT_PULLUP);
+            break;
+        case PinMode::Output:
+            ::pinMode(pin, OUTPUT);
+            break;
+    }
+}
+
+inline void digitalWrite(const int pin, const int level) { ::digitalWrite(pin, level == PIN_LOW ? LOW : HIGH); }
+inline int digitalRead(const int pin) { return ::digitalRead(pin) == LOW ? PIN_LOW : PIN_HIGH; }
+
+// calls handler on both rising and falling edges
+inline void attachEdgeInterrupt(const int pin, const EdgeHandler handler) { ::attachInterrupt(digitalPinToInterrupt(pin), handler, CHANGE); }
+inline void detachEdgeInterrupt(const int pin) { ::detachInterrupt(digitalPinToInterrupt(pin)); }
+#else
+namespace native {
+const int PIN_COUNT = 40;
+
+inline PinMode pinModes[PIN_COUNT] = {};
+inline int pinLevels[PIN_COUNT] = {};
+inline unsigned long pinWriteCounts[PIN_COUNT] = {};
+inline EdgeHandler pinEdgeHandlers[PIN_COUNT] = {};
+
+// the simulator's side of an input pin. Fires the edge interrupt, if one is
+// attached, at the current virtual time.
+inline void setInputLevel(const int pin, const int level) {
+    const bool changed = pinLevels[pin] != level;
+    pinLevels[pin] = level;
+    if (changed && pinEdgeHandlers[pin] != nullptr) {
+        pinEdgeHandlers[pin]();
+    }
+}
+inline int outputLevel(const int pin) { return pinLevels[pin]; }
+
+inline void resetPins() {
+    for (int i = 0; i < PIN_COUNT; i++) {
+        pinModes[i] = PinMode::Input;
+        pinLevels[i] = PIN_LOW;
+        pinWriteCounts[i] = 0;
+        pinEdgeHandlers[i] = nullptr;
+    }
+}
+}  // namespace native
+
+inline void pinMode(const int pin, const PinMode mode) {
+    native::pinModes[pin] = mode;
+    if (mode == PinMode::InputPullup) {
+        native::pinLevels[pin] = PIN_HIGH;
+    }
+}
+
+inline void digitalWrite(const int pin, const int level) {
+    native::pinLevels[pin] = level == PIN_LOW ? PIN_LOW : PIN_HIGH;
+    native::pinWriteCounts[pin]++;
+}
+
+inline int digitalRead(const int pin) { return native::pinLevels[pin]; }
+
+inline void attachEdgeInterrupt(const int pin, const EdgeHandler handler) { native::pinEdgeHandlers[pin] = handler; }
+inline void detachEdgeInterrupt(const int pin) { native::pinEdgeHandlers[pin] = nullptr; }
+#endif
+
+}  // namespace hal
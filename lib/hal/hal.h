@@ -0,0 +1,8 @@
+#pragma once
+
+// Everything the feeder logic needs from the board. Only main.cpp and the
+// network glue should talk to Arduino directly.
+#include "clock.h"
+#include "gpio.h"
+#include "kv-store.h"
+#include "log.h"
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef ARDUINO
+#include <Preferences.h>
+#endif
+
+namespace hal {
+
+/************************
+ * Key value store
+ *
+ * The subset of Preferences the feeder actually uses, so that anything
+ * persisting to NVS can be driven by a host side fake.
+ ************************/
+class KeyValueStore {
+   public:
+    virtual ~KeyValueStore() = default;
+
+    virtual bool begin(const char* ns, bool readOnly) = 0;
+    virtual void end() = 0;
+
+    virtual bool isKey(const char* key) = 0;
+    virtual bool remove(const char* key) = 0;
+
+    virtual size_t putUInt(const char* key, uint32_t value) = 0;
+    virtual uint32_t getUInt(const char* key, uint32_t defaultValue = 0) = 0;
+
+    virtual size_t putULong64(const char* key, uint64_t value) = 0;
+    virtual uint64_t getULong64(const char* key, uint64_t defaultValue = 0) = 0;
+
+    virtual uint8_t getUChar(const char* key, uint8_t defaultValue = 0) = 0;
+
+    virtual size_t putBytes(const char* key, const void* value, size_t len) = 0;
+    // 0 if the key is missing or doesn't fit in maxLen
+    virtual size_t getBytes(const char* key, void* buf, size_t maxLen) = 0;
+    virtual size_t getBytesLength(const char* key) = 0;
+};
+
+#ifdef ARDUINO
+class PreferencesKeyValueStore : public KeyValueStore {
+   private:
+    Preferences _preferences;
+
+   public:
+    bool begin(const char* ns, bool readOnly) override { return _preferences.begin(ns, readOnly); }
+    void end() override { _preferences.end(); }
+
+    bool isKey(const char* key) override { return _preferences.isKey(key); }
+    bool remove(const char* key) override { return _preferences.remove(key); }
+
+    size_t putUInt(const char* key, uint32_t value) override { return _preferences.putUInt(key, value); }
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0) override { return _preferences.getUInt(key, defaultValue); }
+
+    size_t putULong64(const char* key, uint64_t value) override { return _preferences.putULong64(key, value); }
+    uint64_t getULong64(const char* key, uint64_t defaultValue = 0) override { return _preferences.getULong64(key, defaultValue); }
+
+    uint8_t getUChar(const char* key, uint8_t defaultValue = 0) override { return _preferences.getUChar(key, defaultValue); }
+
+    size_t putBytes(const char* key, const void* value, size_t len) override { return _preferences.putBytes(key, value, len); }
+    size_t getBytes(const char* key, void* buf, size_t maxLen) override { return _preferences.getBytes(key, buf, maxLen); }
+    size_t getBytesLength(const char* key) override { return _preferences.getBytesLength(key); }
+};
+#endif
+
+}  // namespace hal
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "clock.h"
+
+namespace hal {
+
+/************************
+ * Latency histograms
+ *
+ * Fixed power of two buckets in microseconds (≤1us, ≤2us, ... ≤~1s, and
+ * anything over), so recording is a few instructions and never allocates.
+ * Each histogram has one writer, the task whose code it times. Readers on
+ * another task can see a count a sample ahead of the sum, nothing worse.
+ ************************/
+const size_t LATENCY_BUCKETS = 21;
+
+class LatencyHistogram {
+   private:
+    // _buckets[i] counts samples in (2^(i-1), 2^i] us, the last one is +Inf
+    uint32_t _buckets[LATENCY_BUCKETS + 1] = {};
+    uint32_t _count = 0;
+    uint64_t _sumUs = 0;
+    uint32_t _maxUs = 0;
+
+   public:
+    const char* const name;
+    const char* const help;
+
+    constexpr LatencyHistogram(const char* name, const char* help) : name(name), help(help) {}
+
+    static size_t bucketFor(const uint32_t us) {
+        size_t bucket = 0;
+        while (bucket < LATENCY_BUCKETS && (1UL << bucket) < us) bucket++;
+        return bucket;
+    }
+
+    // upper bound of a bucket in us, 0 for the +Inf one
+    static uint32_t bucketBoundUs(const size_t bucket) { return bucket < LATENCY_BUCKETS ? 1UL << bucket : 0; }
+
+    void record(const uint32_t us) {
+        _buckets[bucketFor(us)]++;
+        _count++;
+        _sumUs += us;
+        if (us > _maxUs) _maxUs = us;
+    }
+
+    // the samples only, name and help stay
+    void copyCounts(const LatencyHistogram& other) {
+        for (size_t i = 0; i <= LATENCY_BUCKETS; i++) _buckets[i] = other._buckets[i];
+        _count = other._count;
+        _sumUs = other._sumUs;
+        _maxUs = other._maxUs;
+    }
+
+    uint32_t getBucket(const size_t bucket) const { return _buckets[bucket]; }
+    uint32_t getCount() const { return _count; }
+    uint64_t getSumUs() const { return _sumUs; }
+    uint32_t getMaxUs() const { return _maxUs; }
+    uint32_t getMeanUs() const { return _count == 0 ? 0 : static_cast<uint32_t>(_sumUs / _count); }
+
+    // the bucket bound that quantile of samples are at or under (or the
+    // max, once it's in the +Inf bucket)
+    uint32_t quantileUs(const float q) const {
+        if (_count == 0) return 0;
+        const uint32_t rank = static_cast<uint32_t>(q * _count + 0.5f);
+        uint32_t seen = 0;
+        for (size_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+            seen += _buckets[bucket];
+            if (seen >= rank) {
+                const uint32_t bound = bucketBoundUs(bucket);
+                return bound < _maxUs ? bound : _maxUs;
+            }
+        }
+        return _maxUs;
+    }
+};
+
+// times its scope off the cycle counter into a histogram
+class ScopedTimer {
+   private:
+    LatencyHistogram& _histogram;
+    const uint32_t _startedAt;
+
+   public:
+    explicit ScopedTimer(LatencyHistogram& histogram) : _histogram(histogram), _startedAt(cycleCount()) {}
+    ~ScopedTimer() { _histogram.record((cycleCount() - _startedAt) / cyclesPerMicro()); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+}  // namespace hal
@@ -0,0 +1,50 @@
+#pragma once
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <iostream>
+#include <string>
+#endif
+
+namespace hal {
+
+/************************
+ * Log sink
+ *
+ * Serial on device. Off device it has the same print/println surface and
+ * writes to stdout, or nowhere when the simulator is replaying a long run.
+ ************************/
+#ifdef ARDUINO
+inline Print& logSink = Serial;
+#else
+class LogSink {
+   private:
+    bool _enabled = true;
+
+   public:
+    void setEnabled(const bool enabled) { _enabled = enabled; }
+    bool isEnabled() const { return _enabled; }
+
+    template <typename T>
+    size_t print(const T& value) {
+        if (_enabled) std::cout << value;
+        return 0;
+    }
+
+    // Print prints bytes as numbers, not characters
+    size_t print(const unsigned char value) { return print(static_cast<unsigned int>(value)); }
+
+    size_t println() { return print('\n'); }
+
+    template <typename T>
+    size_t println(const T& value) {
+        print(value);
+        return println();
+    }
+};
+
+inline LogSink logSink;
+#endif
+
+}  // namespace hal
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "kv-store.h"
+
+namespace hal {
+
+/************************
+ * In memory KeyValueStore for running off device. Counts writes so callers
+ * can check how much flash wear an operation would cost, and can be told to
+ * drop writes to simulate losing power part way through a sequence.
+ *
+ * Wear is also counted the way ESP-IDF's NVS spends it, in 32 byte entries:
+ * a number takes one, a blob an index entry, a header and its data rounded
+ * up to whole entries.
+ ************************/
+const size_t NVS_ENTRY_BYTES = 32;
+
+class MemoryKeyValueStore : public KeyValueStore {
+   private:
+    std::map<std::string, std::vector<uint8_t>> _values;
+    std::string _namespace;
+    bool _readOnly = true;
+    bool _open = false;
+
+    size_t _writeCount = 0;
+    size_t _entriesWritten = 0;
+    long _writesUntilPowerLoss = -1;
+
+    std::string fullKey(const char* key) const { return _namespace + '\x1f' + key; }
+
+    size_t write(const char* key, const void* value, size_t len, const bool blob = false) {
+        if (!_open || _readOnly) return 0;
+        if (_writesUntilPowerLoss == 0) return 0;
+        if (_writesUntilPowerLoss > 0) _writesUntilPowerLoss--;
+
+        auto bytes = static_cast<const uint8_t*>(value);
+        _values[fullKey(key)] = std::vector<uint8_t>(bytes, bytes + len);
+        _writeCount++;
+        _entriesWritten += blob ? 2 + (len + NVS_ENTRY_BYTES - 1) / NVS_ENTRY_BYTES : 1;
+        return len;
+    }
+
+    bool read(const char* key, void* out, size_t len) {
+        if (!_open) return false;
+        auto found = _values.find(fullKey(key));
+        if (found == _values.end() || found->second.size() != len) return false;
+        memcpy(out, found->second.data(), len);
+        return true;
+    }
+
+    template <typename T>
+    T readOr(const char* key, T defaultValue) {
+        T value;
+        return read(key, &value, sizeof(T)) ? value : defaultValue;
+    }
+
+   public:
+    bool begin(const char* ns, bool readOnly) override {
+        _namespace = ns;
+        _readOnly = readOnly;
+        _open = true;
+        return true;
+    }
+
+    void end() override { _open = false; }
+
+    bool isKey(const char* key) override { return _open && _values.count(fullKey(key)) > 0; }
+
+    bool remove(const char* key) override {
+        if (!_open || _readOnly) return false;
+        _writeCount++;
+        return _values.erase(fullKey(key)) > 0;
+    }
+
+    size_t putUInt(const char* key, uint32_t value) override { return write(key, &value, sizeof(value)); }
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0) override { return readOr(key, defaultValue); }
+
+    size_t putULong64(const char* key, uint64_t value) override { return write(key, &value, sizeof(value)); }
+    uint64_t getULong64(const char* key, uint64_t defaultValue = 0) override { return readOr(key, defaultValue); }
+
+    uint8_t getUChar(const char* key, uint8_t defaultValue = 0) override { return readOr(key, defaultValue); }
+
+    size_t putBytes(const char* key, const void* value, size_t len) override { return write(key, value, len, true); }
+
+    size_t getBytes(const char* key, void* buf, size_t maxLen) override {
+        const size_t len = getBytesLength(key);
+        if (len == 0 || len > maxLen) return 0;
+        return read(key, buf, len) ? len : 0;
+    }
+
+    size_t getBytesLength(const char* key) override {
+        if (!_open) return 0;
+        auto found = _values.find(fullKey(key));
+        return found == _values.end() ? 0 : found->second.size();
+    }
+
+    // Test helpers
+    size_t putUChar(const char* key, uint8_t value) { return write(key, &value, sizeof(value)); }
+
+    size_t getWriteCount() const { return _writeCount; }
+    size_t getEntriesWritten() const { return _entriesWritten; }
+
+    // bytes of values held, across every namespace
+    size_t getStoredBytes() const {
+        size_t bytes = 0;
+        for (const auto& entry : _values) bytes += entry.second.size();
+        return bytes;
+    }
+    void resetWriteCount() {
+        _writeCount = 0;
+        _entriesWritten = 0;
+    }
+
+    // Silently drop every write after the next `writes` succeed, like the
+    // power being cut mid-persist.
+    void losePowerAfter(long writes) { _writesUntilPowerLoss = writes; }
+    void restorePower() { _writesUntilPowerLoss = -1; }
+};
+
+}  // namespace hal
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+namespace richiev {
+
+/************************
+ * Backoff
+ *
+ * Exponential, with jitter: the nth wait is somewhere between half and all
+ * of base * 2^n (up to cap), so a room full of devices that lost the same
+ * access point don't all come back at once. The caller supplies the
+ * randomness.
+ ************************/
+class Backoff {
+   private:
+    const uint32_t _baseMs;
+    const uint32_t _capMs;
+    uint32_t _attempts = 0;
+
+   public:
+    Backoff(const uint32_t baseMs, const uint32_t capMs) : _baseMs(baseMs), _capMs(capMs) {}
+
+    // how long to wait before the next attempt
+    uint32_t next(const uint32_t random) {
+        const uint32_t doublings = std::min<uint32_t>(_attempts, 16);
+        const uint32_t ceiling = static_cast<uint32_t>(std::min<uint64_t>(_capMs, static_cast<uint64_t>(_baseMs) << doublings));
+        _attempts++;
+        return ceiling / 2 + random % (ceiling / 2 + 1);
+    }
+
+    // after a success, back to waiting base
+    void reset() { _attempts = 0; }
+
+    uint32_t getAttempts() const { return _attempts; }
+};
+
+}  // namespace richiev
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace richiev {
+
+/************************
+ * Single writer, many reader ring
+ *
+ * Each item is stored once however many readers there are. A reader is just
+ * a cursor (the sequence number of the next item it wants), so adding one
+ * costs nothing. The writer never waits: it overwrites the oldest item, and
+ * a reader that has fallen more than N behind skips ahead and is told how
+ * many it missed. Not thread safe, the writer and readers have to be on the
+ * same task.
+ ************************/
+template <typename T, size_t N>
+class FanoutRing {
+    static_assert(N >= 1, "FanoutRing needs at least 1 slot");
+
+   private:
+    T _items[N];
+    // sequence number of the next item written
+    uint32_t _head = 0;
+
+   public:
+    // the sequence number it went out as
+    uint32_t push(const T& item) {
+        _items[_head % N] = item;
+        return _head++;
+    }
+
+    // where a reader that only wants what comes next starts
+    uint32_t head() const { return _head; }
+
+    // sequence number of the oldest item still held
+    uint32_t oldest() const { return _head > N ? _head - N : 0; }
+
+    bool contains(const uint32_t sequence) const { return sequence >= oldest() && sequence < _head; }
+
+    // the item at cursor and advances it, nullptr if the reader is caught
+    // up. skipped is how many were overwritten before this reader got to them.
+    const T* read(uint32_t& cursor, uint32_t& skipped) {
+        skipped = 0;
+        if (cursor == _head) return nullptr;
+        if (_head - cursor > N) {
+            skipped = _head - cursor - N;
+            cursor = _head - N;
+        }
+        return &_items[cursor++ % N];
+    }
+};
+
+}  // namespace richiev
@@ -0,0 +1,870 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string_view>
+#include <type_traits>
+
+#ifdef ARDUINO
+#include <lwip/sockets.h>
+#include <unistd.h>
+#else
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace richiev {
+namespace http {
+
+/************************
+ * Event driven HTTP server
+ *
+ * One poll() per pass of the network loop does whatever every socket is
+ * ready for (accept, read, write) without ever waiting on one, so a slow or
+ * stalled browser only holds up its own connection. Everything is fixed
+ * size: a few connection slots, each with its own request buffer, sharing a
+ * small pool of output buffers.
+ *
+ * Handlers don't write a body, they hand over a function that renders it.
+ * The server renders once to learn the length (and, if a buffer is free,
+ * keep the first window of it), then again for each further window as the
+ * socket takes it. A page is never in memory in one piece, and every
+ * response has a Content-Length, so keep-alive works throughout. If a
+ * re-render comes out different (a feeding landed part way through) the
+ * connection is dropped rather than sending a mix.
+ *
+ * A handler can instead turn its connection into a Server-Sent Events
+ * stream, which stays open pulling frames from a function until the
+ * browser goes away. Streams only ever take half the slots, so pages still
+ * load with the maximum open.
+ ************************/
+enum class Method : uint8_t {
+    Any,
+    Get,
+    Post,
+    Other,
+};
+
+const size_t REQUEST_BUFFER_SIZE = 1024;
+const size_t RESPONSE_HEAD_SIZE = 384;
+const size_t RESPONSE_HEADERS_SIZE = 192;
+// what a render function can capture
+const size_t BODY_CONTEXT_SIZE = 96;
+// for printf in a render, one template's worth
+const size_t FORMAT_SCRATCH_SIZE = 2048;
+const size_t MAX_ROUTES = 16;
+// a keep-alive connection is closed after this many so waiting clients get a turn
+const unsigned int MAX_REQUESTS_PER_CONNECTION = 100;
+// lwIP's own limit on open PCBs caps this on device
+const int LISTEN_BACKLOG = 64;
+const unsigned long IDLE_TIMEOUT_MS = 5000;
+const unsigned long STALL_TIMEOUT_MS = 10000;
+// an SSE comment this often on a quiet stream, so a browser that went
+// away without closing is noticed
+const unsigned long STREAM_HEARTBEAT_MS = 15000;
+// how long a browser waits to reconnect a dropped stream
+const unsigned long STREAM_RETRY_MS = 3000;
+
+const char *statusText(const int status) {
+    switch (status) {
+        case 200:
+            return "OK";
+        case 302:
+            return "Found";
+        case 304:
+            return "Not Modified";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 413:
+            return "Payload Too Large";
+        case 503:
+            return "Service Unavailable";
+        default:
+            return "Error";
+    }
+}
+
+/************************
+ * Requests
+ ************************/
+struct Request {
+    Method method = Method::Other;
+    std::string_view path;
+    std::string_view query;
+    std::string_view body;
+    std::string_view ifNoneMatch;
+    std::string_view lastEventId;
+    bool keepAlive = false;
+    bool formBody = false;
+
+    // name's value from the query string or a form body, url decoded into
+    // out. "" (and false) when it isn't there.
+    bool arg(const std::string_view name, char *out, const size_t size) const {
+        if (findArg(query, name, out, size)) return true;
+        return formBody && findArg(body, name, out, size);
+    }
+
+    template <size_t Size>
+    bool arg(const std::string_view name, char (&out)[Size]) const {
+        return arg(name, out, Size);
+    }
+
+   private:
+    static int hexValue(const char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    static bool findArg(std::string_view params, const std::string_view name, char *out, const size_t size) {
+        out[0] = '\0';
+        while (!params.empty()) {
+            const size_t end = params.find('&');
+            const std::string_view pair = params.substr(0, end);
+            params = end == std::string_view::npos ? std::string_view() : params.substr(end + 1);
+
+            const size_t equals = pair.find('=');
+            if (pair.substr(0, equals) != name) continue;
+
+            const std::string_view value = equals == std::string_view::npos ? std::string_view() : pair.substr(equals + 1);
+            size_t length = 0;
+            for (size_t i = 0; i < value.size() && length + 1 < size; i++) {
+                if (value[i] == '+') {
+                    out[length++] = ' ';
+                } else if (value[i] == '%' && i + 2 < value.size() && hexValue(value[i + 1]) >= 0 && hexValue(value[i + 2]) >= 0) {
+                    out[length++] = static_cast<char>(hexValue(value[i + 1]) * 16 + hexValue(value[i + 2]));
+                    i += 2;
+                } else {
+                    out[length++] = value[i];
+                }
+            }
+            out[length] = '\0';
+            return true;
+        }
+        return false;
+    }
+};
+
+enum class ParseResult {
+    Incomplete,
+    Complete,
+    Bad,
+    TooLarge,
+};
+
+bool equalsIgnoreCase(const std::string_view a, const std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if ((a[i] | 0x20) != (b[i] | 0x20)) return false;
+    }
+    return true;
+}
+
+// one request off the front of data, pointing into it. consumed is how many
+// bytes it took, body included.
+ParseResult parseRequest(const char *data, const size_t length, const size_t capacity, Request &request, size_t &consumed) {
+    const std::string_view received(data, length);
+    const size_t headEnd = received.find("\r\n\r\n");
+    if (headEnd == std::string_view::npos) {
+        return length >= capacity ? ParseResult::TooLarge : ParseResult::Incomplete;
+    }
+
+    std::string_view lines = received.substr(0, headEnd);
+    size_t lineEnd = lines.find("\r\n");
+    const std::string_view requestLine = lines.substr(0, lineEnd);
+    lines = lineEnd == std::string_view::npos ? std::string_view() : lines.substr(lineEnd + 2);
+
+    const size_t methodEnd = requestLine.find(' ');
+    const size_t targetEnd = methodEnd == std::string_view::npos ? std::string_view::npos : requestLine.find(' ', methodEnd + 1);
+    if (targetEnd == std::string_view::npos) return ParseResult::Bad;
+
+    const std::string_view method = requestLine.substr(0, methodEnd);
+    const std::string_view target = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+    const std::string_view version = requestLine.substr(targetEnd + 1);
+
+    request = Request();
+    request.method = method == "GET" ? Method::Get : (method == "POST" ? Method::Post : Method::Other);
+    const size_t queryStart = target.find('?');
+    request.path = target.substr(0, queryStart);
+    request.query = queryStart == std::string_view::npos ? std::string_view() : target.substr(queryStart + 1);
+    request.keepAlive = version == "HTTP/1.1";
+
+    size_t contentLength = 0;
+    while (!lines.empty()) {
+        lineEnd = lines.find("\r\n");
+        const std::string_view line = lines.substr(0, lineEnd);
+        lines = lineEnd == std::string_view::npos ? std::string_view() : lines.substr(lineEnd + 2);
+
+        const size_t colon = line.find(':');
+        if (colon == std::string_view::npos) continue;
+        const std::string_view name = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+
+        if (equalsIgnoreCase(name, "Content-Length")) {
+            contentLength = 0;
+            for (const char c : value) {
+                if (c < '0' || c > '9' || contentLength > capacity) return ParseResult::Bad;
+                contentLength = contentLength * 10 + (c - '0');
+            }
+        } else if (equalsIgnoreCase(name, "Connection")) {
+            if (equalsIgnoreCase(value, "close")) request.keepAlive = false;
+            if (equalsIgnoreCase(value, "keep-alive")) request.keepAlive = true;
+        } else if (equalsIgnoreCase(name, "If-None-Match")) {
+            request.ifNoneMatch = value;
+        } else if (equalsIgnoreCase(name, "Last-Event-ID")) {
+            request.lastEventId = value;
+        } else if (equalsIgnoreCase(name, "Content-Type")) {
+            request.formBody = value.substr(0, 33) == "application/x-www-form-urlencoded";
+        } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+            // nothing sent here needs a chunked body
+            return ParseResult::Bad;
+        }
+    }
+
+    const size_t bodyStart = headEnd + 4;
+    if (bodyStart + contentLength > capacity) return ParseResult::TooLarge;
+    if (bodyStart + contentLength > length) return ParseResult::Incomplete;
+
+    request.body = received.substr(bodyStart, contentLength);
+    consumed = bodyStart + contentLength;
+    return ParseResult::Complete;
+}
+
+/************************
+ * Rendering
+ *
+ * The Writer a render function gets. It sees the whole body every time but
+ * only keeps the window [windowStart, windowStart + windowSize), and hashes
+ * everything so a re-render can be checked against the first.
+ ************************/
+class BodyWriter {
+   private:
+    char *_window;
+    const size_t _windowStart;
+    const size_t _windowSize;
+    char *_scratch;
+    size_t _position = 0;
+    size_t _captured = 0;
+    // FNV-1a
+    uint32_t _hash = 2166136261u;
+
+   public:
+    BodyWriter(char *window, const size_t windowStart, const size_t windowSize, char *scratch)
+        : _window(window), _windowStart(windowStart), _windowSize(windowSize), _scratch(scratch) {}
+
+    void write(const char *data, const size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            _hash ^= static_cast<uint8_t>(data[i]);
+            _hash *= 16777619u;
+        }
+
+        const size_t windowEnd = _windowStart + _windowSize;
+        const size_t from = _position > _windowStart ? _position : _windowStart;
+        const size_t to = _position + length < windowEnd ? _position + length : windowEnd;
+        if (from < to) {
+            memcpy(_window + (from - _windowStart), data + (from - _position), to - from);
+            _captured += to - from;
+        }
+        _position += length;
+    }
+
+    void write(const char *str) { write(str, strlen(str)); }
+
+    void printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, format);
+        const int length = vsnprintf(_scratch, FORMAT_SCRATCH_SIZE, format, args);
+        va_end(args);
+        if (length > 0) write(_scratch, length < static_cast<int>(FORMAT_SCRATCH_SIZE) ? length : FORMAT_SCRATCH_SIZE - 1);
+    }
+
+    size_t getLength() const { return _position; }
+    size_t getCaptured() const { return _captured; }
+    uint32_t getHash() const { return _hash; }
+};
+
+using RenderFn = void (*)(BodyWriter &out, const void *context);
+// the next chunk of a stream into out and how long it is, 0 for nothing yet
+using StreamFn = size_t (*)(const void *context, uint32_t &cursor, char *out, size_t size);
+
+template <size_t MaxConnections, size_t OutputBuffers, size_t OutputBufferSize>
+class HttpServer;
+
+/************************
+ * Responses
+ ************************/
+class Response {
+   private:
+    int _status = 200;
+    const char *_contentType = "text/plain";
+    char *_headers;
+    size_t _headersLength = 0;
+    void *_context;
+    RenderFn _render = nullptr;
+    const uint8_t *_staticBody = nullptr;
+    size_t _staticLength = 0;
+    StreamFn _stream = nullptr;
+    uint32_t _streamCursor = 0;
+
+    // copies fn into the connection's context
+    template <typename Fn>
+    void keep(const Fn &fn) {
+        static_assert(sizeof(Fn) <= BODY_CONTEXT_SIZE, "function captures too much");
+        static_assert(alignof(Fn) <= alignof(std::max_align_t), "function is over aligned");
+        static_assert(std::is_trivially_destructible<Fn>::value, "function has to capture plain values");
+        new (_context) Fn(fn);
+    }
+
+    template <size_t MaxConnections, size_t OutputBuffers, size_t OutputBufferSize>
+    friend class HttpServer;
+
+   public:
+    Response(char *headers, void *context) : _headers(headers), _context(context) { _headers[0] = '\0'; }
+
+    // false if it didn't fit
+    bool header(const char *name, const char *value) {
+        const int length = snprintf(_headers + _headersLength, RESPONSE_HEADERS_SIZE - _headersLength, "%s: %s\r\n", name, value);
+        if (length < 0 || _headersLength + length >= RESPONSE_HEADERS_SIZE) {
+            _headers[_headersLength] = '\0';
+            return false;
+        }
+        _headersLength += length;
+        return true;
+    }
+
+    void status(const int status) {
+        _status = status;
+        _render = nullptr;
+        _staticBody = nullptr;
+        _staticLength = 0;
+        _stream = nullptr;
+    }
+
+    // fn(BodyWriter&) renders the body, possibly several times. It's copied
+    // into the connection, so it has to capture by value and be small.
+    template <typename Fn>
+    void render(const int status, const char *contentType, const Fn &fn) {
+        _status = status;
+        _contentType = contentType;
+        keep(fn);
+        _render = [](BodyWriter &out, const void *context) { (*static_cast<const Fn *>(context))(out); };
+        _staticBody = nullptr;
+        _stream = nullptr;
+    }
+
+    // keeps the connection open as a text/event-stream. fn(cursor, out,
+    // size) copies the next frame after cursor into out, advancing it, and
+    // returns its length or 0 when there's nothing new. Copied like render's.
+    template <typename Fn>
+    void eventStream(const uint32_t cursor, const Fn &fn) {
+        _status = 200;
+        _contentType = "text/event-stream";
+        keep(fn);
+        _stream = [](const void *context, uint32_t &at, char *out, size_t size) -> size_t {
+            return (*static_cast<const Fn *>(context))(at, out, size);
+        };
+        _streamCursor = cursor;
+        _render = nullptr;
+        _staticBody = nullptr;
+    }
+
+    // sent straight from where it is (eg flash), which has to outlive the response
+    void staticBody(const int status, const char *contentType, const uint8_t *data, const size_t length) {
+        _status = status;
+        _contentType = contentType;
+        _staticBody = data;
+        _staticLength = length;
+        _render = nullptr;
+        _stream = nullptr;
+    }
+
+    // a short body, formatted now
+    void text(const int status, const char *format, ...) __attribute__((format(printf, 3, 4))) {
+        _status = status;
+        _contentType = "text/plain";
+        va_list args;
+        va_start(args, format);
+        vsnprintf(static_cast<char *>(_context), BODY_CONTEXT_SIZE, format, args);
+        va_end(args);
+        _render = [](BodyWriter &out, const void *context) { out.write(static_cast<const char *>(context)); };
+        _staticBody = nullptr;
+        _stream = nullptr;
+    }
+
+    void redirect(const char *location) {
+        header("Location", location);
+        text(302, "%s", location);
+    }
+};
+
+/************************
+ * Connections
+ ************************/
+struct HttpStats {
+    unsigned long accepted = 0;
+    unsigned long requests = 0;
+    unsigned long badRequests = 0;
+    unsigned long notFound = 0;
+    unsigned long timedOut = 0;
+    // re-rendered body came out different, connection dropped
+    unsigned long torn = 0;
+    // renders beyond the first, one per window
+    unsigned long rerenders = 0;
+    size_t maxOpen = 0;
+    // event streams open now
+    size_t streams = 0;
+    // turned away with every stream slot taken
+    unsigned long streamsRefused = 0;
+};
+
+using Handler = std::function<void(const Request &, Response &)>;
+
+struct Route {
+    const char *path;
+    Method method;
+    Handler handler;
+};
+
+enum class ConnectionState : uint8_t {
+    Free,
+    Reading,
+    Writing,
+    Streaming,
+};
+
+struct Connection {
+    int fd = -1;
+    ConnectionState state = ConnectionState::Free;
+    bool keepAlive = false;
+    unsigned int served = 0;
+    unsigned long lastActiveMs = 0;
+
+    char request[REQUEST_BUFFER_SIZE];
+    size_t received = 0;
+    size_t requestLength = 0;
+
+    char head[RESPONSE_HEAD_SIZE];
+    size_t headLength = 0;
+    size_t headSent = 0;
+    char headers[RESPONSE_HEADERS_SIZE];
+
+    alignas(std::max_align_t) unsigned char context[BODY_CONTEXT_SIZE];
+    RenderFn render = nullptr;
+    const uint8_t *staticBody = nullptr;
+    size_t bodyLength = 0;
+    size_t bodySent = 0;
+    uint32_t bodyHash = 0;
+
+    // an output buffer from the pool while rendering, -1 for none
+    int window = -1;
+    size_t windowStart = 0;
+    size_t windowLength = 0;
+
+    // while Streaming, frames go out through head
+    StreamFn stream = nullptr;
+    uint32_t streamCursor = 0;
+};
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+bool wouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/************************
+ * Server
+ *
+ * MaxConnections slots; further clients wait in the listen backlog until
+ * one frees up. OutputBuffers of OutputBufferSize are shared between them,
+ * a connection only holds one while a rendered body is going out.
+ ************************/
+template <size_t MaxConnections, size_t OutputBuffers, size_t OutputBufferSize>
+class HttpServer {
+   private:
+    static constexpr size_t MAX_STREAMS = MaxConnections / 2 > 0 ? MaxConnections / 2 : 1;
+
+    uint16_t _port;
+    int _listenFd = -1;
+    Connection _connections[MaxConnections];
+    char _buffers[OutputBuffers][OutputBufferSize];
+    bool _bufferInUse[OutputBuffers] = {};
+    char _scratch[FORMAT_SCRATCH_SIZE];
+
+    Route _routes[MAX_ROUTES];
+    size_t _routeCount = 0;
+    Handler _notFound;
+    HttpStats _stats;
+
+    static void setNonBlocking(const int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    size_t openConnections() const {
+        size_t open = 0;
+        for (const auto &connection : _connections) open += connection.state != ConnectionState::Free;
+        return open;
+    }
+
+    int takeBuffer() {
+        for (size_t i = 0; i < OutputBuffers; i++) {
+            if (!_bufferInUse[i]) {
+                _bufferInUse[i] = true;
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    void releaseBuffer(Connection &connection) {
+        if (connection.window >= 0) _bufferInUse[connection.window] = false;
+        connection.window = -1;
+        connection.windowStart = 0;
+        connection.windowLength = 0;
+    }
+
+    void closeConnection(Connection &connection) {
+        if (connection.state == ConnectionState::Streaming) _stats.streams--;
+        releaseBuffer(connection);
+        ::close(connection.fd);
+        connection.fd = -1;
+        connection.state = ConnectionState::Free;
+    }
+
+    void acceptAll(const unsigned long nowMs) {
+        for (auto &connection : _connections) {
+            if (connection.state != ConnectionState::Free) continue;
+            const int fd = accept(_listenFd, nullptr, nullptr);
+            if (fd < 0) return;
+
+            setNonBlocking(fd);
+            const int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            connection.fd = fd;
+            connection.state = ConnectionState::Reading;
+            connection.received = 0;
+            connection.served = 0;
+            connection.lastActiveMs = nowMs;
+            _stats.accepted++;
+        }
+        const size_t open = openConnections();
+        if (open > _stats.maxOpen) _stats.maxOpen = open;
+    }
+
+    // renders the window starting at bodySent. False if it came out
+    // different from the first render.
+    bool fillWindow(Connection &connection) {
+        BodyWriter writer(_buffers[connection.window], connection.bodySent, OutputBufferSize, _scratch);
+        connection.render(writer, connection.context);
+        _stats.rerenders++;
+        connection.windowStart = connection.bodySent;
+        connection.windowLength = writer.getCaptured();
+        return writer.getLength() == connection.bodyLength && writer.getHash() == connection.bodyHash;
+    }
+
+    void respond(Connection &connection, const Request &request) {
+        Response response(connection.headers, connection.context);
+        const Route *route = nullptr;
+        for (size_t i = 0; i < _routeCount && route == nullptr; i++) {
+            if (request.path == _routes[i].path && (_routes[i].method == Method::Any || _routes[i].method == request.method)) {
+                route = &_routes[i];
+            }
+        }
+        if (route != nullptr) {
+            route->handler(request, response);
+        } else {
+            _stats.notFound++;
+            if (_notFound) {
+                _notFound(request, response);
+            } else {
+                response.text(404, "Not found");
+            }
+        }
+
+        if (response._stream == nullptr) {
+            startResponse(connection, response);
+        } else if (_stats.streams >= MAX_STREAMS) {
+            _stats.streamsRefused++;
+            response.text(503, "Too many event streams open\n");
+            startResponse(connection, response);
+        } else {
+            startStream(connection, response);
+        }
+    }
+
+    void startStream(Connection &connection, Response &response) {
+        connection.served++;
+        connection.keepAlive = false;
+        connection.stream = response._stream;
+        connection.streamCursor = response._streamCursor;
+        const int length = snprintf(connection.head, RESPONSE_HEAD_SIZE,
+                                    "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nCache-Control: no-cache\r\n%s\r\nretry: %lu\n\n",
+                                    response._contentType, connection.headers, STREAM_RETRY_MS);
+        connection.headLength = length > 0 && length < static_cast<int>(RESPONSE_HEAD_SIZE) ? length : 0;
+        connection.headSent = 0;
+        connection.state = ConnectionState::Streaming;
+        _stats.requests++;
+        _stats.streams++;
+    }
+
+    void startResponse(Connection &connection, Response &response) {
+        connection.served++;
+        connection.keepAlive = connection.keepAlive && connection.served < MAX_REQUESTS_PER_CONNECTION;
+        connection.render = response._render;
+        connection.staticBody = response._staticBody;
+        connection.bodyLength = response._staticLength;
+        connection.bodySent = 0;
+
+        // one pass for the length and hash, keeping the first window if
+        // there's a buffer for it
+        if (connection.render != nullptr) {
+            connection.window = takeBuffer();
+            BodyWriter writer(connection.window >= 0 ? _buffers[connection.window] : nullptr, 0,
+                              connection.window >= 0 ? OutputBufferSize : 0, _scratch);
+            connection.render(writer, connection.context);
+            connection.bodyLength = writer.getLength();
+            connection.bodyHash = writer.getHash();
+            connection.windowStart = 0;
+            connection.windowLength = writer.getCaptured();
+        }
+
+        const int length = snprintf(connection.head, RESPONSE_HEAD_SIZE,
+                                    "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: %s\r\n%s\r\n",
+                                    response._status, statusText(response._status), response._contentType,
+                                    static_cast<unsigned long>(connection.bodyLength), connection.keepAlive ? "keep-alive" : "close",
+                                    connection.headers);
+        connection.headLength = length > 0 && length < static_cast<int>(RESPONSE_HEAD_SIZE) ? length : 0;
+        connection.headSent = 0;
+        connection.state = ConnectionState::Writing;
+        _stats.requests++;
+    }
+
+    void readRequest(Connection &connection, const unsigned long nowMs) {
+        if (connection.received < REQUEST_BUFFER_SIZE) {
+            const ssize_t got = recv(connection.fd, connection.request + connection.received, REQUEST_BUFFER_SIZE - connection.received, 0);
+            if (got == 0 || (got < 0 && !wouldBlock())) {
+                closeConnection(connection);
+                return;
+            }
+            if (got > 0) {
+                connection.received += got;
+                connection.lastActiveMs = nowMs;
+            }
+        }
+        if (connection.received == 0) return;
+
+        Request request;
+        switch (parseRequest(connection.request, connection.received, REQUEST_BUFFER_SIZE, request, connection.requestLength)) {
+            case ParseResult::Incomplete:
+                return;
+            case ParseResult::Complete:
+                connection.keepAlive = request.keepAlive;
+                respond(connection, request);
+                return;
+            case ParseResult::Bad:
+            case ParseResult::TooLarge: {
+                const int status = connection.received == REQUEST_BUFFER_SIZE ? 413 : 400;
+                _stats.badRequests++;
+                connection.keepAlive = false;
+                connection.requestLength = connection.received;
+                Response response(connection.headers, connection.context);
+                response.text(status, "%s\n", statusText(status));
+                startResponse(connection, response);
+                return;
+            }
+        }
+    }
+
+    // false when the socket won't take more for now
+    bool sendSome(Connection &connection, const char *data, const size_t length, size_t &sent, const unsigned long nowMs) {
+        const ssize_t wrote = ::send(connection.fd, data, length, SEND_FLAGS);
+        if (wrote < 0) {
+            if (!wouldBlock()) closeConnection(connection);
+            return false;
+        }
+        sent += wrote;
+        connection.lastActiveMs = nowMs;
+        return true;
+    }
+
+    void writeResponse(Connection &connection, const unsigned long nowMs) {
+        while (connection.headSent < connection.headLength) {
+            if (!sendSome(connection, connection.head + connection.headSent, connection.headLength - connection.headSent, connection.headSent, nowMs)) return;
+        }
+
+        while (connection.bodySent < connection.bodyLength) {
+            const char *from;
+            size_t length;
+            if (connection.staticBody != nullptr) {
+                from = reinterpret_cast<const char *>(connection.staticBody) + connection.bodySent;
+                length = connection.bodyLength - connection.bodySent;
+            } else {
+                if (connection.window < 0 && (connection.window = takeBuffer()) < 0) return;
+                if (connection.bodySent >= connection.windowStart + connection.windowLength && !fillWindow(connection)) {
+                    _stats.torn++;
+                    closeConnection(connection);
+                    return;
+                }
+                from = _buffers[connection.window] + (connection.bodySent - connection.windowStart);
+                length = connection.windowStart + connection.windowLength - connection.bodySent;
+            }
+            if (!sendSome(connection, from, length, connection.bodySent, nowMs)) return;
+        }
+
+        releaseBuffer(connection);
+        if (!connection.keepAlive) {
+            closeConnection(connection);
+            return;
+        }
+        // anything pipelined behind it stays for the next read
+        memmove(connection.request, connection.request + connection.requestLength, connection.received - connection.requestLength);
+        connection.received -= connection.requestLength;
+        connection.requestLength = 0;
+        connection.state = ConnectionState::Reading;
+    }
+
+    // sends what's pending, then frames until the stream is caught up or
+    // the socket is full. head holds one frame at a time.
+    void writeStream(Connection &connection, const unsigned long nowMs) {
+        // nothing more is expected from the browser, a read only notices it going
+        const ssize_t got = recv(connection.fd, connection.request, REQUEST_BUFFER_SIZE, 0);
+        if (got == 0 || (got < 0 && !wouldBlock())) {
+            closeConnection(connection);
+            return;
+        }
+
+        for (;;) {
+            while (connection.headSent < connection.headLength) {
+                if (!sendSome(connection, connection.head + connection.headSent, connection.headLength - connection.headSent, connection.headSent, nowMs)) return;
+            }
+            size_t length = connection.stream(connection.context, connection.streamCursor, connection.head, RESPONSE_HEAD_SIZE);
+            if (length == 0 && nowMs - connection.lastActiveMs >= STREAM_HEARTBEAT_MS) {
+                memcpy(connection.head, ":\n\n", 3);
+                length = 3;
+            }
+            if (length == 0) return;
+            connection.headLength = length;
+            connection.headSent = 0;
+        }
+    }
+
+    // blocks for up to waitMs for any socket to be ready. Only for hosts
+    // that have nothing else to do.
+    void waitForActivity(const unsigned long waitMs) {
+        fd_set readable;
+        fd_set writable;
+        FD_ZERO(&readable);
+        FD_ZERO(&writable);
+        FD_SET(_listenFd, &readable);
+        int maxFd = _listenFd;
+        for (const auto &connection : _connections) {
+            if (connection.state == ConnectionState::Free) continue;
+            if (connection.state == ConnectionState::Streaming) {
+                FD_SET(connection.fd, &readable);
+                if (connection.headSent < connection.headLength) FD_SET(connection.fd, &writable);
+            } else {
+                FD_SET(connection.fd, connection.state == ConnectionState::Reading ? &readable : &writable);
+            }
+            if (connection.fd > maxFd) maxFd = connection.fd;
+        }
+        timeval timeout = {.tv_sec = static_cast<long>(waitMs / 1000), .tv_usec = static_cast<long>((waitMs % 1000) * 1000)};
+        select(maxFd + 1, &readable, &writable, nullptr, &timeout);
+    }
+
+   public:
+    // port 0 picks a free one, see getPort()
+    explicit HttpServer(const uint16_t port) : _port(port) {}
+
+    ~HttpServer() { stop(); }
+
+    bool on(const char *path, const Method method, Handler handler) {
+        if (_routeCount == MAX_ROUTES) return false;
+        _routes[_routeCount++] = {path, method, std::move(handler)};
+        return true;
+    }
+
+    void onNotFound(Handler handler) { _notFound = std::move(handler); }
+
+    bool begin() {
+        _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (_listenFd < 0) return false;
+
+        const int reuse = 1;
+        setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(_port);
+        if (bind(_listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(_listenFd, LISTEN_BACKLOG) < 0) {
+            ::close(_listenFd);
+            _listenFd = -1;
+            return false;
+        }
+        setNonBlocking(_listenFd);
+
+        socklen_t addressLength = sizeof(address);
+        if (getsockname(_listenFd, reinterpret_cast<sockaddr *>(&address), &addressLength) == 0) {
+            _port = ntohs(address.sin_port);
+        }
+        return true;
+    }
+
+    void stop() {
+        for (auto &connection : _connections) {
+            if (connection.state != ConnectionState::Free) closeConnection(connection);
+        }
+        if (_listenFd >= 0) ::close(_listenFd);
+        _listenFd = -1;
+    }
+
+    // one pass over every socket, never waits on one unless waitMs says to
+    void poll(const unsigned long nowMs, const unsigned long waitMs = 0) {
+        if (_listenFd < 0) return;
+        if (waitMs > 0) waitForActivity(waitMs);
+
+        acceptAll(nowMs);
+        for (auto &connection : _connections) {
+            if (connection.state == ConnectionState::Reading) {
+                readRequest(connection, nowMs);
+            }
+            if (connection.state == ConnectionState::Writing) {
+                writeResponse(connection, nowMs);
+            }
+            if (connection.state == ConnectionState::Streaming) {
+                writeStream(connection, nowMs);
+            }
+
+            // a quiet stream is fine, one that can't get a frame out isn't
+            const unsigned long idleMs = nowMs - connection.lastActiveMs;
+            const bool stalled = connection.state == ConnectionState::Writing ||
+                                 (connection.state == ConnectionState::Streaming && connection.headSent < connection.headLength);
+            if ((connection.state == ConnectionState::Reading && idleMs > IDLE_TIMEOUT_MS) || (stalled && idleMs > STALL_TIMEOUT_MS)) {
+                _stats.timedOut++;
+                closeConnection(connection);
+            }
+        }
+    }
+
+    uint16_t getPort() const { return _port; }
+    const HttpStats &getStats() const { return _stats; }
+};
+
+}  // namespace http
+}  // namespace richiev
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+// Arduino Libraries
+#include <ArduinoJson.h>
+
+#include "event-log.h"
+
+// The MQTT side that doesn't need a broker: handlers and dispatching a
+// message to them. Kept apart from mqtt.h so it builds off device.
+namespace richiev {
+namespace mqtt {
+
+// topics are cut to hal::LOG_TEXT_SIZE, plenty to tell them apart
+inline constexpr hal::EventInfo MQTT_RECEIVED{hal::LogLevel::Info, "Received msg payload_bytes=%lu on topic="};
+inline constexpr hal::EventInfo MQTT_UNHANDLED{hal::LogLevel::Warn, "Not handled topic, ignoring topic=", 1000};
+inline constexpr hal::EventInfo MQTT_BAD_JSON{hal::LogLevel::Warn, "deserializeJson() failed: error=%lu"};
+inline constexpr hal::EventInfo MQTT_TOO_MANY_TOPICS{hal::LogLevel::Error, "Too many MQTT topics, not handling topic="};
+
+/*******************************
+ * Handlers
+ *
+ * Topic to handler, sorted once when it's built and binary searched per
+ * message. Topics are string literals and handlers plain function pointers,
+ * so a lookup compares string_views and allocates nothing. The payload is
+ * handed over as it came off the wire, not NUL terminated.
+ *******************************/
+using TopicProcessor = void (*)(std::string_view payload);
+
+const size_t MAX_TOPICS = 16;
+
+class TopicProcessorMap {
+   public:
+    struct Entry {
+        // a literal, so it's also NUL terminated for subscribing
+        const char* topic;
+        std::string_view key;
+        TopicProcessor processor;
+    };
+
+   private:
+    Entry _entries[MAX_TOPICS] = {};
+    size_t _size = 0;
+    bool _sorted = true;
+
+   public:
+    bool add(const char* topic, TopicProcessor processor) {
+        if (_size == MAX_TOPICS) {
+            hal::logText<MQTT_TOO_MANY_TOPICS>(topic);
+            return false;
+        }
+        _entries[_size++] = {topic, std::string_view(topic), processor};
+        _sorted = false;
+        return true;
+    }
+
+    // after the last add(), before the first find()
+    void finalize() {
+        std::sort(_entries, _entries + _size, [](const Entry& a, const Entry& b) { return a.key < b.key; });
+        _sorted = true;
+    }
+
+    TopicProcessor find(const std::string_view topic) const {
+        if (!_sorted) return nullptr;
+        const Entry* end = _entries + _size;
+        const Entry* found = std::lower_bound(_entries, end, topic, [](const Entry& entry, const std::string_view key) { return entry.key < key; });
+        return found != end && found->key == topic ? found->processor : nullptr;
+    }
+
+    size_t size() const { return _size; }
+    const Entry* begin() const { return _entries; }
+    const Entry* end() const { return _entries + _size; }
+};
+
+TopicProcessorMap* topicsToProcessor = nullptr;
+
+/*******************************
+ * Payloads
+ *******************************/
+const size_t INPUT_DOCUMENT_SIZE = 200;
+using InputDocument = StaticJsonDocument<INPUT_DOCUMENT_SIZE>;
+
+// straight off the payload bytes into the caller's document. False (and the
+// document left empty) if it isn't JSON.
+bool parseInput(const std::string_view payload, JsonDocument& doc) {
+    const DeserializationError error = deserializeJson(doc, payload.data(), payload.size());
+    if (error) {
+        hal::log<MQTT_BAD_JSON>(error.code());
+        return false;
+    }
+    return true;
+}
+
+// onPublish's body
+bool dispatch(const TopicProcessorMap& handlers, const std::string_view topic, const std::string_view payload) {
+    hal::logText<MQTT_RECEIVED>(topic, payload.size());
+
+    const TopicProcessor processor = handlers.find(topic);
+    if (processor == nullptr) {
+        hal::logText<MQTT_UNHANDLED>(topic);
+        return false;
+    }
+    processor(payload);
+    return true;
+}
+
+}  // namespace mqtt
+}  // namespace richiev
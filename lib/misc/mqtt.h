@@ -1,43 +1,25 @@
 #pragma once
 
-#include <map>
 #include <memory>
 // Arduino Libraries
-#include <ArduinoJson.h>
 #include <TinyMqtt.h>
 
+#include "mqtt-dispatch.h"
+
 namespace richiev {
 namespace mqtt {
-/*******************************
- * Handlers
- *******************************/
-using TopicProcessorMap = std::map<std::string,
-                                   std::function<void(const std::string& payload)>>;
-std::shared_ptr<TopicProcessorMap> topicsToProcessor = nullptr;
-
-StaticJsonDocument<200> parseInput(const std::string payload) {
-    StaticJsonDocument<200> doc;
-    DeserializationError error = deserializeJson(doc, payload);
-
-    if (error) {
-        Serial.print(F("deserializeJson() failed: "));
-        Serial.println(error.f_str());
-    }
-    return doc;
-}
-
 void onPublish(const MqttClient* /* srce */, const Topic& topic, const char* payloadC, size_t payloadLength) {
-    std::string payload = payloadC;
-    Serial << "Received msg on topic=" << topic.c_str() << ", payload=" << payload << "\n";
+    dispatch(*topicsToProcessor, topic.c_str(), std::string_view(payloadC, payloadLength));
+}
 
-    if (topicsToProcessor->count(topic.c_str())) {
-        (*topicsToProcessor)[topic.c_str()](payload);
-    } else {
-        Serial << "Not handled topic, ignoring" << endl;
+void subscribeAll(MqttClient& mqttClient) {
+    for (const auto& topicAndProcessor : *topicsToProcessor) {
+        mqttClient.subscribe(topicAndProcessor.topic);
     }
 }
 
-void setupMQTT(MqttBroker& mqttBroker, MqttClient& mqttClient, const std::shared_ptr<TopicProcessorMap> topProcessor) {
+// topProcessor has to outlive the client, and be finalized
+void setupMQTT(MqttBroker& mqttBroker, MqttClient& mqttClient, TopicProcessorMap& topProcessor) {
     Serial.print("Starting MQTT broker");
     Serial.print("...");
 
@@ -46,13 +28,18 @@ void setupMQTT(MqttBroker& mqttBroker, MqttClient& mqttClient, const std::shared
     Serial.println(" done");
 
     Serial.print("Starting MQTT client on topic_count=");
-    topicsToProcessor = topProcessor;
+    topicsToProcessor = &topProcessor;
     Serial.println(topicsToProcessor->size());
 
     mqttClient.setCallback(onPublish);
-    for (const auto& topicAndProcessor : *topicsToProcessor) {
-        mqttClient.subscribe(topicAndProcessor.first);
-    }
+    subscribeAll(mqttClient);
+}
+
+// after the network comes back, setupMQTT's subscriptions again, in case
+// the client lost them with the link. Subscribing twice is harmless.
+void resubscribeMQTT(MqttClient& mqttClient) {
+    if (topicsToProcessor == nullptr) return;
+    subscribeAll(mqttClient);
 }
 
 void loopMQTT(MqttBroker& mqttBroker, MqttClient& mqttClient) {
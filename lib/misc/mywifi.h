@@ -3,29 +3,331 @@
 #include <WiFi.h>
 #include <ESPmDNS.h>
 
+#include <cstring>
 #include <string>
 
+#include "backoff.h"
+#include "event-log.h"
+#include "kv-store.h"
+
 namespace richiev {
 
-void connectWifi(const std::string hostname, const std::string wifiSSID, const std::string wifiPassword) {
-    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
-    WiFi.setHostname(hostname.c_str());
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(wifiSSID.c_str(), wifiPassword.c_str());
+/************************
+ * Wi-Fi
+ *
+ * Connecting doesn't block: begin() starts associating and returns, poll()
+ * from a loop moves it along and says whether it's up. The BSSID, channel
+ * and DHCP lease of the last connection are kept in NVS and tried first.
+ * Joining a known access point on a known channel with the address it
+ * handed out last time skips the scan and DHCP, which is most of what a
+ * connect costs. If that hasn't connected within FAST_CONNECT_TIMEOUT_MS
+ * it's forgotten and an ordinary connect takes over. Every
+ * FAST_CONNECTS_BEFORE_DHCP fast connects an ordinary one scans again, in
+ * case the access point moved.
+ *
+ * The cached address is only borrowed. A feeder that was off longer than
+ * the lease may find the router has given it to someone else, and until
+ * DHCP is asked the two would clash. So LEASE_RENEW_DELAY_MS after each
+ * fast connect (once the boot's own traffic is done) the DHCP client is
+ * started and the lease taken again. That drops the address for the
+ * exchange, which ends any open connection (MQTT clients reconnect), and
+ * whatever DHCP hands out is what the next fast connect uses. If DHCP
+ * doesn't answer within LEASE_RENEW_TIMEOUT_MS the cached address is put
+ * back, there being no server to have given it away.
+ *
+ * Once up it's watched: a dropped link (the router rebooting, say) is
+ * reconnected with the ordinary path, backing off between attempts that
+ * don't connect within CONNECT_TIMEOUT_MS. The SDK's own auto reconnect is
+ * off so the two don't fight. Every poll() is a status check plus at most
+ * one non-blocking SDK call; nothing waits on the radio.
+ ************************/
+const char* WIFI_PREFERENCE_NS = "wifi";
+const char* WIFI_LINK_KEY = "link";
+const unsigned long FAST_CONNECT_TIMEOUT_MS = 3000;
+const unsigned long CONNECT_TIMEOUT_MS = 15000;
+const uint8_t FAST_CONNECTS_BEFORE_DHCP = 16;
+const unsigned long LEASE_RENEW_DELAY_MS = 5000;
+const unsigned long LEASE_RENEW_TIMEOUT_MS = 10000;
+const uint32_t RECONNECT_BACKOFF_BASE_MS = 1000;
+const uint32_t RECONNECT_BACKOFF_CAP_MS = 5 * 60 * 1000;
+
+inline constexpr hal::EventInfo WIFI_CONNECTED{hal::LogLevel::Info, "WiFi connected down_ms=%lu, channel=%lu, fast=%lu, ip="};
+inline constexpr hal::EventInfo WIFI_FAST_CONNECT_FAILED{hal::LogLevel::Warn, "WiFi fast connect failed after took_ms=%lu, scanning instead"};
+inline constexpr hal::EventInfo WIFI_LINK_LOST{hal::LogLevel::Warn, "WiFi link lost after up_ms=%lu, status=%lu"};
+inline constexpr hal::EventInfo WIFI_RETRYING{hal::LogLevel::Warn, "WiFi not connected, retrying in_ms=%lu, attempt=%lu"};
+inline constexpr hal::EventInfo WIFI_MDNS_STARTED{hal::LogLevel::Info, "MDNS responder started with hostname="};
+inline constexpr hal::EventInfo WIFI_LEASE_RENEWED{hal::LogLevel::Info, "WiFi DHCP lease renewed took_ms=%lu, changed=%lu, ip="};
+inline constexpr hal::EventInfo WIFI_LEASE_RENEW_FAILED{hal::LogLevel::Warn, "WiFi DHCP didn't answer in took_ms=%lu, keeping the cached address"};
+
+// what a fast connect needs, as of the last ordinary one
+struct WifiLink {
+    uint32_t ssidHash = 0;
+    uint8_t bssid[6] = {};
+    uint8_t channel = 0;
+    // since the last ordinary connect
+    uint8_t fastConnects = 0;
+    uint32_t ip = 0;
+    uint32_t gateway = 0;
+    uint32_t subnet = 0;
+    uint32_t dns = 0;
+};
+
+struct WifiStats {
+    unsigned long linkLosses = 0;
+    // connects after a loss, not the first one
+    unsigned long reconnects = 0;
+    // attempts that timed out and backed off
+    unsigned long failedAttempts = 0;
+};
+
+class WifiConnection {
+   public:
+    enum class State : uint8_t {
+        Idle,
+        FastConnecting,
+        Connecting,
+        Connected,
+        // backing off before the next attempt
+        Waiting,
+    };
 
-    Serial.print("Connecting to WiFi ..");
-    while (WiFi.status() != WL_CONNECTED) {
-        Serial.print('.');
-        delay(1000);
+    static const char* describe(const State state) {
+        switch (state) {
+            case State::Idle:
+                return "idle";
+            case State::FastConnecting:
+                return "fast_connecting";
+            case State::Connecting:
+                return "connecting";
+            case State::Connected:
+                return "connected";
+            case State::Waiting:
+                return "waiting";
+        }
+        return "unknown";
     }
 
-    Serial.print("Connected ip=");
-    Serial.print(WiFi.localIP());
-    Serial.println();
+   private:
+    // the address a fast connect borrowed, see above
+    enum class Lease : uint8_t {
+        Cached,
+        Renewing,
+        Renewed,
+    };
 
-    if (MDNS.begin(hostname.c_str())) {
-        Serial.print("MDNS responder started with hostname=");
-        Serial.println(hostname.c_str());
+    const std::string _hostname;
+    const std::string _ssid;
+    const std::string _password;
+    hal::KeyValueStore& _kv;
+
+    State _state = State::Idle;
+    WifiLink _link;
+    Backoff _backoff{RECONNECT_BACKOFF_BASE_MS, RECONNECT_BACKOFF_CAP_MS};
+    // when the current state began, and how long to wait in it
+    unsigned long _stateAtMs = 0;
+    unsigned long _waitMs = 0;
+    // since boot or since the link was lost
+    unsigned long _downSinceMs = 0;
+    bool _fastConnected = false;
+    bool _everConnected = false;
+    bool _restored = false;
+    Lease _lease = Lease::Renewed;
+    unsigned long _leaseAtMs = 0;
+    WifiStats _stats;
+
+    // FNV-1a, so a changed SSID doesn't try the old network's link
+    static uint32_t hashOf(const std::string& text) {
+        uint32_t hash = 2166136261u;
+        for (const char c : text) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 16777619u;
+        }
+        return hash;
     }
-}
+
+    bool loadLink() {
+        _kv.begin(WIFI_PREFERENCE_NS, true);
+        const size_t read = _kv.getBytes(WIFI_LINK_KEY, &_link, sizeof(_link));
+        _kv.end();
+        return read == sizeof(_link) && _link.ssidHash == hashOf(_ssid) && _link.channel != 0 && _link.ip != 0 &&
+               _link.fastConnects < FAST_CONNECTS_BEFORE_DHCP;
+    }
+
+    void saveLink() {
+        _kv.begin(WIFI_PREFERENCE_NS, false);
+        _kv.putBytes(WIFI_LINK_KEY, &_link, sizeof(_link));
+        _kv.end();
+    }
+
+    void enter(const State state, const unsigned long nowMs) {
+        _state = state;
+        _stateAtMs = nowMs;
+    }
+
+    void beginOrdinary(const unsigned long nowMs) {
+        WiFi.disconnect();
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+        WiFi.begin(_ssid.c_str(), _password.c_str());
+        enter(State::Connecting, nowMs);
+    }
+
+    void backOff(const unsigned long nowMs) {
+        WiFi.disconnect();
+        _waitMs = _backoff.next(esp_random());
+        hal::log<WIFI_RETRYING>(_waitMs, _backoff.getAttempts());
+        enter(State::Waiting, nowMs);
+    }
+
+    void connected(const unsigned long nowMs) {
+        _fastConnected = _state == State::FastConnecting;
+        _lease = _fastConnected ? Lease::Cached : Lease::Renewed;
+        enter(State::Connected, nowMs);
+        _backoff.reset();
+        if (_everConnected) {
+            _stats.reconnects++;
+            _restored = true;
+        }
+        _everConnected = true;
+
+        if (_fastConnected) {
+            _link.fastConnects++;
+        } else {
+            _link.ssidHash = hashOf(_ssid);
+            const uint8_t* bssid = WiFi.BSSID();
+            if (bssid != nullptr) memcpy(_link.bssid, bssid, sizeof(_link.bssid));
+            // without a BSSID there's nothing to connect fast to
+            _link.channel = bssid != nullptr ? WiFi.channel() : 0;
+            _link.fastConnects = 0;
+            _link.ip = WiFi.localIP();
+            _link.gateway = WiFi.gatewayIP();
+            _link.subnet = WiFi.subnetMask();
+            _link.dns = WiFi.dnsIP();
+        }
+        saveLink();
+
+        hal::logText<WIFI_CONNECTED>(WiFi.localIP().toString().c_str(), nowMs - _downSinceMs, WiFi.channel(), _fastConnected);
+        if (MDNS.begin(_hostname.c_str())) {
+            hal::logText<WIFI_MDNS_STARTED>(_hostname.c_str());
+        }
+    }
+
+    // one step of taking the borrowed address back through DHCP
+    void renewLease(const unsigned long nowMs) {
+        switch (_lease) {
+            case Lease::Cached:
+                if (nowMs - _stateAtMs < LEASE_RENEW_DELAY_MS) return;
+                // no address starts the DHCP client
+                WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+                _lease = Lease::Renewing;
+                _leaseAtMs = nowMs;
+                return;
+            case Lease::Renewing:
+                break;
+            case Lease::Renewed:
+                return;
+        }
+
+        const uint32_t ip = WiFi.localIP();
+        if (ip != 0) {
+            const bool changed = ip != _link.ip || static_cast<uint32_t>(WiFi.gatewayIP()) != _link.gateway ||
+                                 static_cast<uint32_t>(WiFi.subnetMask()) != _link.subnet || static_cast<uint32_t>(WiFi.dnsIP()) != _link.dns;
+            if (changed) {
+                _link.ip = ip;
+                _link.gateway = WiFi.gatewayIP();
+                _link.subnet = WiFi.subnetMask();
+                _link.dns = WiFi.dnsIP();
+                saveLink();
+            }
+            hal::logText<WIFI_LEASE_RENEWED>(WiFi.localIP().toString().c_str(), nowMs - _leaseAtMs, changed);
+            _lease = Lease::Renewed;
+        } else if (nowMs - _leaseAtMs >= LEASE_RENEW_TIMEOUT_MS) {
+            hal::log<WIFI_LEASE_RENEW_FAILED>(nowMs - _leaseAtMs);
+            WiFi.config(IPAddress(_link.ip), IPAddress(_link.gateway), IPAddress(_link.subnet), IPAddress(_link.dns));
+            _lease = Lease::Renewed;
+        }
+    }
+
+    void linkLost(const wl_status_t status, const unsigned long nowMs) {
+        _stats.linkLosses++;
+        hal::log<WIFI_LINK_LOST>(nowMs - _stateAtMs, status);
+        _downSinceMs = nowMs;
+        MDNS.end();
+        // straight back in, the backoff is for attempts that fail
+        beginOrdinary(nowMs);
+    }
+
+   public:
+    WifiConnection(const std::string hostname, const std::string ssid, const std::string password, hal::KeyValueStore& kv)
+        : _hostname(hostname), _ssid(ssid), _password(password), _kv(kv) {}
+
+    // starts associating, poll() does the rest
+    void begin(const unsigned long nowMs) {
+        _downSinceMs = nowMs;
+        // the link is kept here, the SDK doesn't need to write its own copy
+        WiFi.persistent(false);
+        WiFi.setAutoReconnect(false);
+        // only takes before the interface is up
+        WiFi.setHostname(_hostname.c_str());
+        WiFi.mode(WIFI_STA);
+        if (!loadLink()) {
+            _link = WifiLink();
+            beginOrdinary(nowMs);
+            return;
+        }
+
+        WiFi.config(IPAddress(_link.ip), IPAddress(_link.gateway), IPAddress(_link.subnet), IPAddress(_link.dns));
+        WiFi.begin(_ssid.c_str(), _password.c_str(), _link.channel, _link.bssid);
+        enter(State::FastConnecting, nowMs);
+    }
+
+    // true while connected, never blocks
+    bool poll(const unsigned long nowMs) {
+        const wl_status_t status = WiFi.status();
+        switch (_state) {
+            case State::Idle:
+                return false;
+            case State::Connected:
+                if (status != WL_CONNECTED) {
+                    linkLost(status, nowMs);
+                    return false;
+                }
+                renewLease(nowMs);
+                return true;
+            case State::Waiting:
+                if (nowMs - _stateAtMs >= _waitMs) beginOrdinary(nowMs);
+                return false;
+            case State::FastConnecting:
+            case State::Connecting:
+                break;
+        }
+
+        if (status == WL_CONNECTED) {
+            connected(nowMs);
+            return true;
+        }
+        if (_state == State::FastConnecting && nowMs - _stateAtMs >= FAST_CONNECT_TIMEOUT_MS) {
+            hal::log<WIFI_FAST_CONNECT_FAILED>(nowMs - _stateAtMs);
+            _link = WifiLink();
+            beginOrdinary(nowMs);
+        } else if (_state == State::Connecting && nowMs - _stateAtMs >= CONNECT_TIMEOUT_MS) {
+            _stats.failedAttempts++;
+            backOff(nowMs);
+        }
+        return false;
+    }
+
+    // true once after each reconnect, for whatever needs redoing then
+    bool takeRestored() {
+        const bool restored = _restored;
+        _restored = false;
+        return restored;
+    }
+
+    State getState() const { return _state; }
+    bool isConnected() const { return _state == State::Connected; }
+    // whether it connected off the saved link
+    bool wasFastConnect() const { return _fastConnected; }
+    const WifiStats& getStats() const { return _stats; }
+};
+
 }  // namespace richiev
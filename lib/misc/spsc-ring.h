@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace richiev {
+
+/************************
+ * Bounded single producer/single consumer ring
+ *
+ * Lock free and allocation free, so the producer side is safe to call from
+ * an ISR or another core. One slot is kept empty to tell full from empty,
+ * so it holds N - 1 items.
+ ************************/
+template <typename T, size_t N>
+class SpscRing {
+    static_assert(N >= 2, "SpscRing needs at least 2 slots");
+
+   private:
+    T _items[N];
+    std::atomic<size_t> _head{0};  // next slot to write, owned by the producer
+    std::atomic<size_t> _tail{0};  // next slot to read, owned by the consumer
+
+   public:
+    // producer side. Returns false (and drops the item) when full.
+    bool push(const T& item) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        const size_t next = (head + 1) % N;
+        if (next == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        _items[head] = item;
+        _head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool pop(T& item) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = _items[tail];
+        _tail.store((tail + 1) % N, std::memory_order_release);
+        return true;
+    }
+
+    bool isEmpty() const {
+        return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire);
+    }
+
+    size_t size() const {
+        const size_t head = _head.load(std::memory_order_acquire);
+        const size_t tail = _tail.load(std::memory_order_acquire);
+        return (head + N - tail) % N;
+    }
+
+    static constexpr size_t capacity() { return N - 1; }
+};
+
+}  // namespace richiev
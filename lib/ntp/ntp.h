@@ -1,38 +1,253 @@
-// based on https://github.com/PaulStoffregen/Time/blob/master/examples/TimeNTP_ESP8266WiFi/TimeNTP_ESP8266WiFi.ino
+// SNTP (RFC 4330) client that never blocks: a request goes out on one tick,
+// the reply is picked up on a later one. Between syncs time is derived from
+// millis(), corrected for how fast the local clock has been drifting.
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <memory>
 
-#include <NTPClient.h>
+#include "hal.h"
+
+#ifdef ARDUINO
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <lwip/dns.h>
+#endif
 
 namespace ntp {
 
-WiFiUDP ntpUDP;
+/************************
+ * Transport
+ ************************/
+class UdpTransport {
+   public:
+    virtual ~UdpTransport() = default;
+
+    // queue a datagram, false if it can't be sent right now (eg the server
+    // name hasn't resolved yet)
+    virtual bool send(const uint8_t* data, size_t length) = 0;
+    // non-blocking, returns the size of a waiting datagram or 0
+    virtual size_t receive(uint8_t* buffer, size_t length) = 0;
+};
+
+#ifdef ARDUINO
+class WiFiUdpTransport : public UdpTransport {
+   private:
+    WiFiUDP _udp;
+    const char* _server;
+    const uint16_t _port;
+
+    ip_addr_t _serverAddress;
+    volatile bool _resolved = false;
+    volatile bool _resolving = false;
+
+    static void onResolved(const char*, const ip_addr_t* address, void* arg) {
+        auto self = static_cast<WiFiUdpTransport*>(arg);
+        if (address != nullptr) {
+            self->_serverAddress = *address;
+            self->_resolved = true;
+        }
+        self->_resolving = false;
+    }
+
+    // lwIP's async lookup, WiFiUDP::beginPacket(host) would block on DNS
+    bool resolve() {
+        if (_resolved) return true;
+        if (_resolving) return false;
+
+        const err_t err = dns_gethostbyname(_server, &_serverAddress, &WiFiUdpTransport::onResolved, this);
+        if (err == ERR_OK) {
+            _resolved = true;
+        } else if (err == ERR_INPROGRESS) {
+            _resolving = true;
+        }
+        return _resolved;
+    }
+
+   public:
+    WiFiUdpTransport(const char* server, const uint16_t port = 123) : _server(server), _port(port) {}
+
+    void begin(const uint16_t localPort = 2390) { _udp.begin(localPort); }
 
-std::unique_ptr<NTPClient> setupNTP() {
-    auto timeClient = std::make_unique<NTPClient>(ntpUDP);
+    bool send(const uint8_t* data, size_t length) override {
+        if (!resolve()) return false;
 
-    Serial.println("Setting up ntp client");
-    timeClient->setUpdateInterval(1000 * 60 * 30);
-    timeClient->begin();
-    timeClient->setTimeOffset(0);
+        _udp.beginPacket(IPAddress(ip_addr_get_ip4_u32(&_serverAddress)), _port);
+        _udp.write(data, length);
+        return _udp.endPacket() == 1;
+    }
+
+    size_t receive(uint8_t* buffer, size_t length) override {
+        const int size = _udp.parsePacket();
+        if (size <= 0) return 0;
+        return _udp.read(buffer, length);
+    }
+};
+#endif
+
+/************************
+ * Time service
+ ************************/
+const size_t NTP_PACKET_SIZE = 48;
+// 1900-01-01 to 1970-01-01
+const uint32_t SEVENTY_YEARS_SEC = 2208988800UL;
+
+const unsigned long SYNC_INTERVAL_MS = 1000UL * 60 * 30;
+const unsigned long UNSYNCED_RETRY_MS = 2000;
+const unsigned long REPLY_TIMEOUT_MS = 1500;
+// don't trust a drift estimate from syncs closer together than this
+const unsigned long MIN_DRIFT_WINDOW_MS = 1000UL * 60;
+const double MAX_DRIFT = 500e-6;
+
+class TimeService {
+   private:
+    UdpTransport& _udp;
+    const unsigned long _syncIntervalMs;
+
+    bool _synced = false;
+    uint64_t _baseEpochMs = 0;
+    unsigned long _baseMillis = 0;
+    // local clock rate error, seconds gained per second. Positive means
+    // millis() runs slow.
+    double _drift = 0;
+    uint64_t _lastReturnedEpochMs = 0;
+
+    bool _awaitingReply = false;
+    unsigned long _requestSentAt = 0;
+    unsigned long _nextRequestAt = 0;
+    uint32_t _requestNonce = 0;
+
+    unsigned long _syncCount = 0;
+    unsigned long _timeoutCount = 0;
+
+    static uint32_t readUInt32(const uint8_t* bytes) {
+        return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+               (static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]);
+    }
 
-    const int num_tries = 5;
-    for (int i = 0; i < num_tries && !timeClient->update(); i++) {
-        timeClient->forceUpdate();
-        delay(1000);
+    static void writeUInt32(uint8_t* bytes, const uint32_t value) {
+        bytes[0] = value >> 24;
+        bytes[1] = value >> 16;
+        bytes[2] = value >> 8;
+        bytes[3] = value;
     }
 
-    Serial.println("Current time: ");
-    Serial.println(timeClient->getFormattedTime());
+    uint64_t derivedEpochMs(const unsigned long nowMs) const {
+        const unsigned long elapsed = nowMs - _baseMillis;
+        return _baseEpochMs + static_cast<uint64_t>(elapsed + elapsed * _drift);
+    }
+
+    void sendRequest(const unsigned long nowMs) {
+        uint8_t packet[NTP_PACKET_SIZE] = {};
+        // LI 0 (no warning), version 3, mode 3 (client)
+        packet[0] = 0b00011011;
+        // the server echoes our transmit timestamp back as the originate
+        // timestamp, which ties a reply to this request
+        _requestNonce = nowMs ^ (_syncCount << 16) ^ 0x5eed;
+        writeUInt32(packet + 40, _requestNonce);
+
+        if (_udp.send(packet, NTP_PACKET_SIZE)) {
+            _awaitingReply = true;
+            _requestSentAt = nowMs;
+        } else {
+            _nextRequestAt = nowMs + UNSYNCED_RETRY_MS;
+        }
+    }
+
+    bool handleReply(const uint8_t* packet, const unsigned long nowMs) {
+        const uint8_t mode = packet[0] & 0x7;
+        const uint8_t stratum = packet[1];
+        if (mode != 4 || stratum == 0 || readUInt32(packet + 24) != _requestNonce) {
+            // not a server reply, a kiss-o'-death, or a late reply to an old request
+            return false;
+        }
+
+        const uint32_t transmitSec = readUInt32(packet + 40);
+        const uint32_t transmitFraction = readUInt32(packet + 44);
+        const unsigned long roundTripMs = nowMs - _requestSentAt;
+        const uint64_t serverEpochMs = static_cast<uint64_t>(transmitSec - SEVENTY_YEARS_SEC) * 1000 +
+                                       ((static_cast<uint64_t>(transmitFraction) * 1000) >> 32) +
+                                       roundTripMs / 2;
+
+        if (_synced && nowMs - _baseMillis >= MIN_DRIFT_WINDOW_MS) {
+            const double elapsed = static_cast<double>(nowMs - _baseMillis);
+            const double error = static_cast<double>(static_cast<int64_t>(serverEpochMs - derivedEpochMs(nowMs)));
+            _drift += error / elapsed;
+            if (_drift > MAX_DRIFT) _drift = MAX_DRIFT;
+            if (_drift < -MAX_DRIFT) _drift = -MAX_DRIFT;
+        }
+
+        _baseEpochMs = serverEpochMs;
+        _baseMillis = nowMs;
+        _synced = true;
+        _syncCount++;
+        return true;
+    }
+
+   public:
+    TimeService(UdpTransport& udp, const unsigned long syncIntervalMs = SYNC_INTERVAL_MS) : _udp(udp), _syncIntervalMs(syncIntervalMs) {}
+
+    // Never blocks: sends a request when one is due, picks up a reply if one
+    // has arrived.
+    void tick(const unsigned long nowMs) {
+        if (_awaitingReply) {
+            uint8_t packet[NTP_PACKET_SIZE];
+            if (_udp.receive(packet, NTP_PACKET_SIZE) == NTP_PACKET_SIZE && handleReply(packet, nowMs)) {
+                _awaitingReply = false;
+                _nextRequestAt = nowMs + _syncIntervalMs;
+            } else if (nowMs - _requestSentAt > REPLY_TIMEOUT_MS) {
+                _awaitingReply = false;
+                _timeoutCount++;
+                _nextRequestAt = nowMs + (_synced ? UNSYNCED_RETRY_MS * 4 : UNSYNCED_RETRY_MS);
+            }
+            return;
+        }
+
+        if (static_cast<long>(nowMs - _nextRequestAt) >= 0) {
+            sendRequest(nowMs);
+        }
+    }
+
+    // O(1), no network. Never goes backwards, even when a sync pulls the
+    // clock back.
+    uint64_t epochMs(const unsigned long nowMs) {
+        if (!_synced) return 0;
+
+        uint64_t epoch = derivedEpochMs(nowMs);
+        if (epoch < _lastReturnedEpochMs) {
+            epoch = _lastReturnedEpochMs;
+        }
+        _lastReturnedEpochMs = epoch;
+        return epoch;
+    }
+
+    unsigned long getEpochTime() { return static_cast<unsigned long>(epochMs(hal::millis()) / 1000); }
+
+    bool isSynced() const { return _synced; }
+    bool isAwaitingReply() const { return _awaitingReply; }
+    double getDrift() const { return _drift; }
+    unsigned long getSyncCount() const { return _syncCount; }
+    unsigned long getTimeoutCount() const { return _timeoutCount; }
+};
+
+#ifdef ARDUINO
+WiFiUdpTransport ntpUDP("pool.ntp.org");
+
+std::unique_ptr<TimeService> setupNTP() {
+    hal::logSink.println("Setting up ntp client");
+    ntpUDP.begin();
+
+    auto timeService = std::make_unique<TimeService>(ntpUDP);
+    // fires off the first request, the reply shows up on a later loopNTP
+    timeService->tick(hal::millis());
 
-    return std::move(timeClient);
+    return std::move(timeService);
 }
 
-void loopNTP(std::shared_ptr<NTPClient> timeClient) {
-    // this will trigger a time refresh if needed
-    // WARNING: this is sync and blocking
-    timeClient->update();
+void loopNTP(std::shared_ptr<TimeService> timeService) {
+    timeService->tick(hal::millis());
 }
+#endif
 
 }  // namespace ntp
@@ -0,0 +1,100 @@
+"""Gzips everything in assets/ into src/generated/static-assets-data.h.
+
+Runs before every PlatformIO build (extra_scripts), or by hand:
+    python scripts/embed_assets.py
+
+Each asset is served from a content addressed path (app.<hash>.css) with the
+same hash as its strong ETag, so browsers can cache it as immutable.
+"""
+import gzip
+import hashlib
+import os
+import re
+
+CONTENT_TYPES = {
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".svg": "image/svg+xml",
+    ".ico": "image/x-icon",
+}
+
+
+def project_dir():
+    try:
+        Import("env")  # noqa: F821 (provided by PlatformIO/SCons)
+        return env.subst("$PROJECT_DIR")  # noqa: F821
+    except NameError:
+        return os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def identifier(name):
+    return re.sub(r"[^A-Za-z0-9]", "_", name).upper()
+
+
+def render(assets):
+    lines = [
+        "// Generated by scripts/embed_assets.py from assets/, do not edit.",
+        "// Included from static-assets.h, which defines StaticAsset.",
+        "#pragma once",
+        "",
+        "namespace feeder {",
+        "namespace web_server {",
+        "namespace static_assets {",
+        "",
+    ]
+    for asset in assets:
+        data = ", ".join("0x%02x" % b for b in asset["gzipped"])
+        lines.append("// %s: %d bytes, %d gzipped" % (asset["name"], asset["size"], len(asset["gzipped"])))
+        lines.append("static const uint8_t %s_GZ[] PROGMEM = {%s};" % (asset["id"], data))
+        lines.append("")
+
+    lines.append("static const StaticAsset ASSETS[] = {")
+    for asset in assets:
+        lines.append('    {"%s", "%s", "%s", "\\"%s\\"", %s_GZ, sizeof(%s_GZ)},' % (
+            asset["name"], asset["path"], asset["content_type"], asset["hash"], asset["id"], asset["id"]))
+    lines.append("};")
+    lines.append("static const size_t ASSET_COUNT = sizeof(ASSETS) / sizeof(ASSETS[0]);")
+    lines.append("")
+    lines.append("}  // namespace static_assets")
+    lines.append("}  // namespace web_server")
+    lines.append("}  // namespace feeder")
+    lines.append("")
+    return "\n".join(lines)
+
+
+def main():
+    root = project_dir()
+    assets_dir = os.path.join(root, "assets")
+    out_path = os.path.join(root, "src", "generated", "static-assets-data.h")
+
+    assets = []
+    for name in sorted(os.listdir(assets_dir)):
+        stem, ext = os.path.splitext(name)
+        if ext not in CONTENT_TYPES:
+            continue
+        with open(os.path.join(assets_dir, name), "rb") as f:
+            raw = f.read()
+        # mtime=0 keeps the output (and so the hash) stable between builds
+        gzipped = gzip.compress(raw, compresslevel=9, mtime=0)
+        digest = hashlib.sha256(raw).hexdigest()[:16]
+        assets.append({
+            "name": name,
+            "id": identifier(name),
+            "path": "/static/%s.%s%s" % (stem, digest, ext),
+            "content_type": CONTENT_TYPES[ext],
+            "hash": digest,
+            "size": len(raw),
+            "gzipped": gzipped,
+        })
+
+    rendered = render(assets)
+    os.makedirs(os.path.dirname(out_path), exist_ok=True)
+    if os.path.exists(out_path):
+        with open(out_path) as f:
+            if f.read() == rendered:
+                return
+    with open(out_path, "w") as f:
+        f.write(rendered)
+
+
+main()
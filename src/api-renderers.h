@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "event-log.h"
+#include "feeder-common.h"
+#include "web-server-renderers.h"
+
+namespace feeder {
+namespace web_server {
+
+/************************
+ * GET /api/feedings
+ *
+ *   ?since=<epoch sec>   only feedings after this
+ *   ?cursor=<next>       continue from a previous page's "next"
+ *   ?limit=<n>           page size, default 50, at most 200
+ *
+ * {"feedings":[{"asOf":1767225600,"rotations":1},{"asOf":1767312000,"rotations":0.25},...],"next":"1767225600-1"}
+ * "next" is null on the last page. Feedings come out oldest first, straight
+ * off the journal's pages, starting from the page `since` is in rather than
+ * the oldest, so a query costs the pages it returns and not the history.
+ ************************/
+const unsigned int FEEDINGS_PAGE_DEFAULT_LIMIT = 50;
+// small enough that a whole page fits the response cache, so it's read out
+// of flash once rather than again for every window it goes out in
+const unsigned int FEEDINGS_PAGE_MAX_LIMIT = 200;
+// the most one feeding adds: ,{"asOf":4294967295,"rotations":7.94}
+const size_t FEEDINGS_JSON_BYTES_PER_FEEDING = 40;
+// {"feedings":[ and ],"next":"4294967295-4294967295"}
+const size_t FEEDINGS_JSON_OVERHEAD_BYTES = 48;
+
+struct FeedingsQuery {
+    // feedings after this (or, from a cursor, at it too, see skipAtSince)
+    unsigned long since = 0;
+    bool fromCursor = false;
+    // feedings at exactly `since` an earlier page already returned
+    unsigned int skipAtSince = 0;
+    unsigned int limit = FEEDINGS_PAGE_DEFAULT_LIMIT;
+};
+
+// cursor is "<asOf of the last feeding returned>-<how many at that asOf were returned>"
+FeedingsQuery parseFeedingsQuery(const char *since, const char *cursor, const char *limit) {
+    FeedingsQuery query;
+
+    if (cursor != nullptr && *cursor != 0) {
+        char *end = nullptr;
+        query.since = strtoul(cursor, &end, 10);
+        query.fromCursor = true;
+        if (end != nullptr && *end == '-') {
+            query.skipAtSince = strtoul(end + 1, nullptr, 10);
+        }
+    } else if (since != nullptr && *since != 0) {
+        query.since = strtoul(since, nullptr, 10);
+    }
+
+    if (limit != nullptr && *limit != 0) {
+        const unsigned long requested = strtoul(limit, nullptr, 10);
+        query.limit = requested == 0 ? FEEDINGS_PAGE_DEFAULT_LIMIT : (requested > FEEDINGS_PAGE_MAX_LIMIT ? FEEDINGS_PAGE_MAX_LIMIT : requested);
+    }
+    return query;
+}
+
+template <typename Writer, typename Store>
+void renderFeedingsJson(Writer &out, Store &store, const FeedingsQuery &query) {
+    unsigned int written = 0;
+    unsigned int skippedAtSince = 0;
+    bool hasMore = false;
+    unsigned long lastAsOf = 0;
+    unsigned int returnedAtLastAsOf = 0;
+    char dose[feeder::DOSE_BUFFER_SIZE];
+
+    out.write("{\"feedings\":[");
+    store.forEachSince(static_cast<uint32_t>(query.since), [&](const feeder::Feeding &feeding) {
+        const unsigned long asOf = feeding.asOfAdjustedSec;
+        if (asOf < query.since) return true;
+        if (asOf == query.since) {
+            if (!query.fromCursor) return true;
+            if (skippedAtSince < query.skipAtSince) {
+                skippedAtSince++;
+                return true;
+            }
+        }
+        if (written >= query.limit) {
+            hasMore = true;
+            return false;
+        }
+
+        feeder::formatDose(dose, feeding.dose());
+        out.printf("%s{\"asOf\":%lu,\"rotations\":%s}", written == 0 ? "" : ",", asOf, dose);
+
+        if (written > 0 && asOf == lastAsOf) {
+            returnedAtLastAsOf++;
+        } else {
+            // ties at the cursor carry over from the earlier pages
+            returnedAtLastAsOf = (query.fromCursor && asOf == query.since) ? query.skipAtSince + 1 : 1;
+        }
+        lastAsOf = asOf;
+        written++;
+        return true;
+    });
+
+    if (hasMore) {
+        out.printf("],\"next\":\"%lu-%u\"}", lastAsOf, returnedAtLastAsOf);
+    } else {
+        out.write("],\"next\":null}");
+    }
+}
+
+/************************
+ * GET /logs
+ *
+ *   ?since=<seq>   only lines after this, from a previous X-Log-Seq
+ *
+ * The event log's tail as plain text, a line per event, oldest first. Only
+ * lines up to `until` (what the X-Log-Seq header said) go out, so polling
+ * with since=<X-Log-Seq> never skips or repeats one.
+ ************************/
+template <typename Writer>
+void renderLogTail(Writer &out, const hal::LogTail &tail, const uint32_t since, const uint32_t until) {
+    tail.forEachSince(since, hal::LogLevel::Debug, [&](const hal::LogLine &line) {
+        if (line.seq > until) return false;
+        out.write(line.text);
+        out.write("\n");
+        return true;
+    });
+}
+
+}  // namespace web_server
+}  // namespace feeder
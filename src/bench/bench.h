@@ -0,0 +1,142 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench {
+
+/************************
+ * Allocation tracking
+ *
+ * main.cpp replaces the global operator new/delete with ones that report
+ * here, so each benchmark can say how much heap it needed.
+ ************************/
+struct HeapCounters {
+    size_t liveBytes = 0;
+    size_t peakBytes = 0;
+    size_t allocations = 0;
+};
+
+inline HeapCounters heap;
+
+inline void* trackedAlloc(const size_t size) {
+    // remember the size in front of the block so delete can account for it
+    auto block = static_cast<size_t*>(std::malloc(size + sizeof(size_t)));
+    if (block == nullptr) throw std::bad_alloc();
+    *block = size;
+
+    heap.liveBytes += size;
+    heap.allocations++;
+    if (heap.liveBytes > heap.peakBytes) heap.peakBytes = heap.liveBytes;
+    return block + 1;
+}
+
+inline void trackedFree(void* ptr) {
+    if (ptr == nullptr) return;
+    auto block = static_cast<size_t*>(ptr) - 1;
+    heap.liveBytes -= *block;
+    std::free(block);
+}
+
+/************************
+ * Runner
+ ************************/
+struct Result {
+    std::string name;
+    unsigned long iterations;
+    double nsPerOp;
+    // above what was live when the benchmark started
+    size_t peakHeapBytes;
+    double allocationsPerOp;
+};
+
+template <typename Fn>
+Result run(const char* name, const unsigned long iterations, Fn fn) {
+    // warm up, and let anything lazily allocated happen outside the measurement
+    fn();
+
+    const size_t liveAtStart = heap.liveBytes;
+    heap.peakBytes = heap.liveBytes;
+    const size_t allocationsAtStart = heap.allocations;
+
+    const auto startedAt = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++) {
+        fn();
+    }
+    const auto tookNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startedAt).count();
+
+    return {
+        .name = name,
+        .iterations = iterations,
+        .nsPerOp = static_cast<double>(tookNs) / iterations,
+        .peakHeapBytes = heap.peakBytes - liveAtStart,
+        .allocationsPerOp = static_cast<double>(heap.allocations - allocationsAtStart) / iterations};
+}
+
+// anything that isn't a timing: sizes, counts, bytes on the wire
+struct Measurement {
+    std::string name;
+    std::vector<std::pair<const char*, double>> values;
+};
+
+/************************
+ * Reporting
+ *
+ * A line per result as they come, or with --json one document at the end
+ * for tracking run over run:
+ * {"benchmarks":[{"name":..,"iterations":..,"ns_per_op":..,"peak_heap_bytes":..,"allocations_per_op":..}],
+ *  "measurements":[{"name":..,"<value>":..}]}
+ * Names are plain ASCII without quotes, so nothing is escaped.
+ ************************/
+class Reporter {
+   private:
+    const bool _json;
+    std::vector<Result> _results;
+    std::vector<Measurement> _measurements;
+
+   public:
+    explicit Reporter(const bool json) : _json(json) {}
+
+    void add(Result result) {
+        if (!_json) {
+            printf("%-40s iterations=%-8lu ns_per_op=%-12.0f peak_heap_bytes=%-8zu allocations_per_op=%.1f\n",
+                   result.name.c_str(), result.iterations, result.nsPerOp, result.peakHeapBytes, result.allocationsPerOp);
+        }
+        _results.push_back(std::move(result));
+    }
+
+    void add(Measurement measurement) {
+        if (!_json) {
+            printf("%-40s", measurement.name.c_str());
+            for (const auto& value : measurement.values) printf(" %s=%g", value.first, value.second);
+            printf("\n");
+        }
+        _measurements.push_back(std::move(measurement));
+    }
+
+    void finish() const {
+        if (!_json) return;
+
+        printf("{\"benchmarks\":[");
+        for (size_t i = 0; i < _results.size(); i++) {
+            const auto& result = _results[i];
+            printf("%s\n  {\"name\":\"%s\",\"iterations\":%lu,\"ns_per_op\":%.1f,\"peak_heap_bytes\":%zu,\"allocations_per_op\":%.2f}",
+                   i == 0 ? "" : ",", result.name.c_str(), result.iterations, result.nsPerOp, result.peakHeapBytes, result.allocationsPerOp);
+        }
+        printf("\n],\"measurements\":[");
+        for (size_t i = 0; i < _measurements.size(); i++) {
+            const auto& measurement = _measurements[i];
+            printf("%s\n  {\"name\":\"%s\"", i == 0 ? "" : ",", measurement.name.c_str());
+            for (const auto& value : measurement.values) printf(",\"%s\":%.6g", value.first, value.second);
+            printf("}");
+        }
+        printf("\n]}\n");
+    }
+};
+
+}  // namespace bench
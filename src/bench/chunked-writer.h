@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include "web-server-renderers.h"
+
+// What the root page looked like on the old WebServer, kept so the bench can
+// compare it against the streaming http::Response the firmware uses now.
+namespace bench {
+
+/************************
+ * ChunkedWriter
+ *
+ * Buffers small writes into a fixed scratch buffer and hands it to flush()
+ * whenever it fills up. Large fragments skip the buffer and go straight out.
+ * Nothing here touches the heap.
+ ************************/
+template <typename Flush, size_t BufferSize = 1024>
+class ChunkedWriter {
+   private:
+    Flush _flush;
+    char _buffer[BufferSize];
+    size_t _used = 0;
+    size_t _bytesWritten = 0;
+
+   public:
+    ChunkedWriter(Flush flush) : _flush(flush) {}
+
+    void flush() {
+        if (_used > 0) {
+            _flush(_buffer, _used);
+            _used = 0;
+        }
+    }
+
+    void write(const char* data, const size_t length) {
+        _bytesWritten += length;
+        if (length >= BufferSize) {
+            flush();
+            _flush(data, length);
+            return;
+        }
+        if (_used + length > BufferSize) {
+            flush();
+        }
+        memcpy(_buffer + _used, data, length);
+        _used += length;
+    }
+
+    void write(const char* str) { write(str, strlen(str)); }
+
+    // formats straight into the scratch buffer
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        // flushing a nearly full buffer up front is cheaper than formatting twice
+        if (BufferSize - _used < BufferSize / 4) {
+            flush();
+        }
+        for (int attempt = 0; attempt < 2; attempt++) {
+            va_list args;
+            va_start(args, format);
+            const int length = vsnprintf(_buffer + _used, BufferSize - _used, format, args);
+            va_end(args);
+
+            if (length < 0) return;
+            if (_used + length < BufferSize) {
+                _used += length;
+                _bytesWritten += length;
+                return;
+            }
+            // didn't fit, make room and try again
+            flush();
+        }
+        // bigger than the whole buffer, send what fit
+        _used = BufferSize - 1;
+        _bytesWritten += _used;
+        flush();
+    }
+
+    size_t getBytesWritten() const { return _bytesWritten; }
+};
+
+template <typename Writer, typename Feedings>
+void renderRoot(Writer &out, const char *triggered, const char *requestId, const Feedings &mostRecentFeedings, const unsigned long uptimeMs,
+                const unsigned long eventsSince) {
+    using namespace feeder::web_server;
+    renderRootPage(out, triggered, requestId, [&](Writer &table) { renderMeasurementList(table, mostRecentFeedings); }, uptimeMs, eventsSince);
+}
+
+}  // namespace bench
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace bench {
+
+/************************
+ * HTTP load
+ *
+ * Clients on their own threads hammering the server over loopback, each on
+ * a keep-alive connection (reconnecting when the server closes it), timing
+ * every request from sending it to having the whole body.
+ ************************/
+struct LoadResult {
+    unsigned int clients = 0;
+    unsigned long requests = 0;
+    unsigned long errors = 0;
+    unsigned long reconnects = 0;
+    double seconds = 0;
+    double p50Us = 0;
+    double p99Us = 0;
+    double maxUs = 0;
+};
+
+namespace http_load {
+
+int connectTo(const uint16_t port) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    const int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    // a client left waiting in the backlog shouldn't hang the run
+    const timeval timeout = {.tv_sec = 5, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// one request and its whole response. False on any error, keepAlive says
+// whether the connection can be used again.
+bool exchange(const int fd, const char* request, const size_t requestLength, char* buffer, const size_t bufferSize, bool& keepAlive) {
+    if (send(fd, request, requestLength, MSG_NOSIGNAL) != static_cast<ssize_t>(requestLength)) return false;
+
+    size_t received = 0;
+    size_t headEnd = 0;
+    size_t contentLength = 0;
+    while (headEnd == 0) {
+        const ssize_t got = recv(fd, buffer + received, bufferSize - received - 1, 0);
+        if (got <= 0) return false;
+        received += got;
+        buffer[received] = '\0';
+        const char* end = strstr(buffer, "\r\n\r\n");
+        if (end == nullptr) continue;
+
+        headEnd = end - buffer + 4;
+        const char* length = strstr(buffer, "Content-Length: ");
+        if (length == nullptr || length > end) return false;
+        contentLength = strtoul(length + 16, nullptr, 10);
+        const char* connection = strstr(buffer, "Connection: close");
+        keepAlive = connection == nullptr || connection > end;
+        if (strncmp(buffer, "HTTP/1.1 200", 12) != 0) return false;
+    }
+
+    // the body only needs counting
+    size_t bodyReceived = received - headEnd;
+    while (bodyReceived < contentLength) {
+        const ssize_t got = recv(fd, buffer, bufferSize, 0);
+        if (got <= 0) return false;
+        bodyReceived += got;
+    }
+    return bodyReceived == contentLength;
+}
+
+}  // namespace http_load
+
+// poll(waitMs) runs the server until the clients are done
+template <typename Poll>
+LoadResult runHttpLoad(Poll poll, const uint16_t port, const char* path, const unsigned int clients, const unsigned long durationMs) {
+    char request[128];
+    const int requestLength = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: feeder\r\n\r\n", path);
+
+    std::atomic<bool> clientsDone{false};
+    std::thread server([&]() {
+        while (!clientsDone.load()) poll(1);
+    });
+
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<unsigned long> errors(clients, 0);
+    std::vector<unsigned long> reconnects(clients, 0);
+    const auto startedAt = std::chrono::steady_clock::now();
+    const auto stopAt = startedAt + std::chrono::milliseconds(durationMs);
+
+    std::vector<std::thread> threads;
+    for (unsigned int client = 0; client < clients; client++) {
+        threads.emplace_back([&, client]() {
+            std::vector<char> buffer(16384);
+            auto& samples = latencies[client];
+            samples.reserve(200000);
+            int fd = -1;
+            while (std::chrono::steady_clock::now() < stopAt) {
+                if (fd < 0) {
+                    fd = http_load::connectTo(port);
+                    if (fd < 0) {
+                        errors[client]++;
+                        continue;
+                    }
+                }
+                bool keepAlive = false;
+                const auto sentAt = std::chrono::steady_clock::now();
+                if (!http_load::exchange(fd, request, requestLength, buffer.data(), buffer.size(), keepAlive)) {
+                    errors[client]++;
+                    keepAlive = false;
+                } else {
+                    samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sentAt).count());
+                }
+                if (!keepAlive) {
+                    close(fd);
+                    fd = -1;
+                    reconnects[client]++;
+                }
+            }
+            if (fd >= 0) close(fd);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startedAt).count();
+    clientsDone = true;
+    server.join();
+
+    std::vector<double> all;
+    LoadResult result;
+    for (unsigned int client = 0; client < clients; client++) {
+        all.insert(all.end(), latencies[client].begin(), latencies[client].end());
+        result.errors += errors[client];
+        result.reconnects += reconnects[client];
+    }
+    std::sort(all.begin(), all.end());
+    result.clients = clients;
+    result.requests = all.size();
+    result.seconds = seconds;
+    if (!all.empty()) {
+        result.p50Us = all[all.size() / 2];
+        result.p99Us = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+        result.maxUs = all.back();
+    }
+    return result;
+}
+
+}  // namespace bench
@@ -0,0 +1,392 @@
+// Host benchmarks for the feeder's hot paths.
+#include <algorithm>
+#include <cstdarg>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "chunked-writer.h"
+#include "http-load.h"
+#include "feeder-common.h"
+#include "feeder-task.h"
+#include "feeding-journal.h"
+#include "feeding-store.h"
+#include "memory-kv-store.h"
+#include "mqtt-dispatch.h"
+#include "response-cache.h"
+#include "static-assets.h"
+#include "web-server-renderers.h"
+#include "web-server.h"
+
+void* operator new(size_t size) { return bench::trackedAlloc(size); }
+void* operator new[](size_t size) { return bench::trackedAlloc(size); }
+void operator delete(void* ptr) noexcept { bench::trackedFree(ptr); }
+void operator delete[](void* ptr) noexcept { bench::trackedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { bench::trackedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { bench::trackedFree(ptr); }
+
+namespace {
+
+std::vector<feeder::Feeding> buildFeedings(const size_t count) {
+    std::vector<feeder::Feeding> feedings;
+    feedings.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        feedings.push_back({.asOfAdjustedSec = 1767225600UL + i * 3600, .rotations = static_cast<unsigned int>(1 + i % 3)});
+    }
+    return feedings;
+}
+
+// The page as handleRoot used to build it: all of it in one std::string
+// before anything went out.
+struct StringWriter {
+    std::string out;
+
+    void write(const char* data, size_t length) { out.append(data, length); }
+    void write(const char* str) { out += str; }
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char temp[1024];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(temp, sizeof(temp), format, args);
+        va_end(args);
+        out += temp;
+    }
+};
+
+size_t bytesOnWire = 0;
+unsigned long checksum = 0;
+bench::Reporter* reporter = nullptr;
+
+// What FeedingStore::getFeedingsSortedByAsOf did before the store could be
+// walked newest first: copy references out and sort them.
+template <size_t N>
+std::vector<std::reference_wrapper<const feeder::Feeding>> sortedByAsOf(const feeding_store::FeedingStore<N>& store) {
+    const auto& feedings = store.getFeedings();
+    std::vector<std::reference_wrapper<const feeder::Feeding>> sorted{feedings.begin(), feedings.end()};
+    std::sort(sorted.begin(), sorted.end(),
+              [](const feeder::Feeding& a, const feeder::Feeding& b) { return a.asOfAdjustedSec > b.asOfAdjustedSec; });
+    return sorted;
+}
+
+// A full store that has wrapped, so the newest feeding sits mid array.
+template <size_t N>
+void benchFeedingOrder() {
+    auto store = std::make_unique<feeding_store::FeedingStore<N>>();
+    for (const auto& feeding : buildFeedings(N + N / 3)) {
+        store->addFeeding(feeding);
+    }
+    const unsigned long iterations = N >= 4096 ? 2000 : 100000;
+
+    char name[64];
+    snprintf(name, sizeof(name), "feedingOrder/sortedByAsOf/N=%zu", N);
+    reporter->add(bench::run(name, iterations, [&]() {
+        for (const feeder::Feeding& feeding : sortedByAsOf(*store)) {
+            checksum += feeding.asOfAdjustedSec;
+        }
+    }));
+
+    snprintf(name, sizeof(name), "feedingOrder/newestFirst/N=%zu", N);
+    reporter->add(bench::run(name, iterations, [&]() {
+        for (const feeder::Feeding& feeding : store->newestFirst()) {
+            checksum += feeding.asOfAdjustedSec;
+        }
+    }));
+}
+
+// Body bytes for loading the root page plus its assets, either with an
+// empty cache or revalidating everything the browser already has.
+void reportPageLoadBytes() {
+    using namespace feeder::web_server;
+
+    const auto feedings = buildFeedings(50);
+    bench::ChunkedWriter writer([](const char*, size_t) {});
+    bench::renderRoot(writer, "", "0123456789abcdef", feedings, 0, 0);
+    writer.flush();
+    const size_t htmlBytes = writer.getBytesWritten();
+
+    size_t coldBytes = htmlBytes;
+    size_t warmBytes = htmlBytes;
+    unsigned int notModified = 0;
+    for (size_t i = 0; i < static_assets::ASSET_COUNT; i++) {
+        const auto& asset = static_assets::ASSETS[i];
+        coldBytes += static_assets::respond(asset, "").bodyLength;
+
+        const auto revalidated = static_assets::respond(asset, asset.etag);
+        warmBytes += revalidated.bodyLength;
+        notModified += revalidated.status == 304;
+    }
+
+    reporter->add({"pageLoad/rows=50",
+                   {{"html_bytes", htmlBytes},
+                    {"cold_bytes", coldBytes},
+                    {"warm_bytes", warmBytes},
+                    {"assets", static_assets::ASSET_COUNT},
+                    {"not_modified", notModified}}});
+}
+
+// Journal with history N filled past capacity (so the ring has wrapped),
+// then the cost of what boot does with it.
+template <size_t N>
+void benchJournal() {
+    hal::MemoryKeyValueStore kv;
+    auto feedings = buildFeedings(N + N / 4);
+    // a few feeds a day, not evenly spaced
+    for (size_t i = 0; i < feedings.size(); i++) {
+        feedings[i].asOfAdjustedSec = 1767225600UL + i * 21600 + (i * 7919) % 3600;
+    }
+
+    auto journal = std::make_unique<feeding_store::FeedingJournal<N>>(kv);
+    {
+        feeding_store::FeedingStore<feeding_store::FEEDINGS_IN_MEMORY> store;
+        journal->load(store);
+    }
+    size_t next = 0;
+    char name[64];
+    snprintf(name, sizeof(name), "journal/append/N=%zu", N);
+    reporter->add(bench::run(name, feedings.size() - 1, [&]() { journal->append(feedings[next++]); }));
+
+    size_t kept = 0;
+    journal->forEachOldestFirst([&](const feeder::Feeding&) {
+        kept++;
+        return true;
+    });
+
+    snprintf(name, sizeof(name), "journal/load/N=%zu", N);
+    reporter->add(bench::run(name, 200, [&]() {
+        feeding_store::FeedingJournal<N> reloaded(kv);
+        auto store = std::make_unique<feeding_store::FeedingStore<feeding_store::FEEDINGS_IN_MEMORY>>();
+        reloaded.load(*store);
+        checksum += reloaded.getLoadStats().feedingsRestored;
+    }));
+
+    feeding_store::FeedingJournal<N> reloaded(kv);
+    feeding_store::FeedingStore<feeding_store::FEEDINGS_IN_MEMORY> store;
+    reloaded.load(store);
+    snprintf(name, sizeof(name), "journal/boot/N=%zu", N);
+    reporter->add({name,
+                   {{"pages", feeding_store::FeedingJournal<N>::PAGE_COUNT},
+                    {"kept", kept},
+                    {"stored_bytes", kv.getStoredBytes()},
+                    {"bytes_per_feeding", static_cast<double>(kv.getStoredBytes()) / kept},
+                    {"boot_pages_read", reloaded.getLoadStats().pagesRead},
+                    {"boot_restored", reloaded.getLoadStats().feedingsRestored}}});
+}
+
+// What triggerFeed does with a new feeding: into the in-memory store, then
+// appended to the journal in NVS.
+void benchPersist() {
+    hal::MemoryKeyValueStore kv;
+    auto journal = std::make_shared<feeding_store::FeedingJournal<feeding_store::FEEDINGS_TO_KEEP>>(kv);
+    auto store = std::make_shared<feeding_store::FeedingStore<feeding_store::FEEDINGS_IN_MEMORY>>();
+    journal->load(*store);
+
+    const auto feedings = buildFeedings(20000);
+    size_t next = 0;
+    reporter->add(bench::run("persist/latestFeeding", feedings.size() - 1, [&]() {
+        store->addFeeding(feedings[next++]);
+        feeding_store::persistLatestFeeding(journal, store);
+    }));
+    reporter->add({"persist/latestFeeding/nvs",
+                   {{"writes_per_feeding", static_cast<double>(kv.getWriteCount()) / feedings.size()},
+                    {"entries_per_feeding", static_cast<double>(kv.getEntriesWritten()) / feedings.size()}}});
+}
+
+// An MQTT message from arriving to its handler running, against the topics
+// the controller registers.
+const std::string_view TRIGGER_FEED = R"({"requestId":"2f9c1a7e44d0b3a1","rotations":1.25})";
+
+void benchMqtt() {
+    reporter->add(bench::run("mqtt/parseInput", 100000, [&]() {
+        richiev::mqtt::InputDocument doc;
+        richiev::mqtt::parseInput(TRIGGER_FEED, doc);
+        checksum += doc["rotations"].as<float>() > 0;
+    }));
+
+    richiev::mqtt::TopicProcessorMap handlers;
+    for (const char* topic : {"debug/restart", "debug/clear", "execute/calibrate", "config/calibration",
+                              "config/logLevel", "config/schedule", "config/utcOffset"}) {
+        handlers.add(topic, [](std::string_view payload) { checksum += payload.size(); });
+    }
+    handlers.add("execute/triggerFeed", [](std::string_view payload) {
+        if (payload.size() == 0) return;
+        richiev::mqtt::InputDocument doc;
+        richiev::mqtt::parseInput(payload, doc);
+        checksum += doc["rotations"].as<float>() > 0;
+    });
+    handlers.finalize();
+
+    // an empty payload stops the handler short of parsing
+    reporter->add(bench::run("mqtt/dispatch", 100000, [&]() {
+        richiev::mqtt::dispatch(handlers, "execute/triggerFeed", {});
+        hal::eventLog.drain([](const hal::LogRecord&) {});
+    }));
+    reporter->add(bench::run("mqtt/dispatch/unhandled", 100000, [&]() {
+        richiev::mqtt::dispatch(handlers, "execute/unknown", {});
+        hal::eventLog.drain([](const hal::LogRecord&) {});
+    }));
+    reporter->add(bench::run("mqtt/dispatch+parseInput", 100000, [&]() {
+        richiev::mqtt::dispatch(handlers, "execute/triggerFeed", TRIGGER_FEED);
+        hal::eventLog.drain([](const hal::LogRecord&) {});
+    }));
+}
+
+// One feeder task pass, idle and part way through a rotation. The clock
+// stands still so the rotation never finishes or times out.
+void benchFeederTick() {
+    const feeder::RotationSensorPins sensorPins = {.input = 23};
+    const feeder::MotorPins motorPins = {.powerOutput = 22};
+    hal::native::resetPins();
+    hal::native::setClockMicros(1000000);
+    feeder::setupFeeder(sensorPins, motorPins);
+    hal::native::setInputLevel(sensorPins.input, hal::PIN_HIGH);
+
+    reporter->add(bench::run("feederTick/idle", 1000000, [&]() { feeder::serviceFeeder(hal::millis()); }));
+
+    feeder::enqueueFeed(1767225600UL, feeder::Dose::ofRotations(16));
+    feeder::serviceFeeder(hal::millis());
+    reporter->add(bench::run("feederTick/rotating", 1000000, [&]() { feeder::serviceFeeder(hal::millis()); }));
+    hal::eventLog.drain([](const hal::LogRecord&) {});
+}
+
+// The root page's table and a page of history near the end of a full
+// journal, rendered afresh and then out of the response cache. A hit costs
+// the same however much history there is.
+void benchResponseCache() {
+    using Cache = feeder::response_cache::ResponseCache<feeder::web_server::WEB_CACHE_SIZE, feeder::web_server::WEB_CACHE_ENTRIES>;
+    auto cache = std::make_unique<Cache>();
+    uint32_t generation = 0;
+
+    feeding_store::FeedingStore<feeding_store::FEEDINGS_IN_MEMORY> store;
+    for (const auto& feeding : buildFeedings(feeding_store::FEEDINGS_IN_MEMORY)) store.addFeeding(feeding);
+    const auto renderTable = [&](feeder::response_cache::ArenaWriter& out) { feeder::web_server::renderMeasurementList(out, store.newestFirst()); };
+    reporter->add(bench::run("responseCache/measurementList/miss", 5000, [&]() {
+        checksum += cache->fetch(feeder::web_server::MEASUREMENT_LIST_KEY, ++generation, renderTable).size();
+    }));
+    reporter->add(bench::run("responseCache/measurementList/hit", 100000, [&]() {
+        checksum += cache->fetch(feeder::web_server::MEASUREMENT_LIST_KEY, generation, renderTable).size();
+    }));
+
+    hal::MemoryKeyValueStore kv;
+    auto journal = std::make_unique<feeding_store::FeedingJournal<32768>>(kv);
+    {
+        feeding_store::FeedingStore<feeding_store::FEEDINGS_IN_MEMORY> loaded;
+        journal->load(loaded);
+    }
+    const auto feedings = buildFeedings(32768);
+    for (const auto& feeding : feedings) journal->append(feeding);
+    // the newest 50, a few page headers in from the tip
+    const auto query = feeder::web_server::parseFeedingsQuery(std::to_string(feedings[feedings.size() - 51].asOfAdjustedSec).c_str(), "", "");
+    const auto renderPage = [&](feeder::response_cache::ArenaWriter& out) { feeder::web_server::renderFeedingsJson(out, *journal, query); };
+    reporter->add(bench::run("responseCache/feedingsJson/miss/N=32768", 50, [&]() {
+        checksum += cache->fetch(feeder::web_server::feedingsJsonKey(query), ++generation, renderPage).size();
+    }));
+    reporter->add(bench::run("responseCache/feedingsJson/hit/N=32768", 100000, [&]() {
+        checksum += cache->fetch(feeder::web_server::feedingsJsonKey(query), generation, renderPage).size();
+    }));
+
+    const auto& stats = cache->getStats();
+    reporter->add({"responseCache", {{"hits", stats.hits}, {"misses", stats.misses}, {"flushes", stats.flushes}, {"uncacheable", stats.uncacheable}}});
+}
+
+// The web server over loopback with clients holding keep-alive connections,
+// more of them than it has connection slots, against the root page and the
+// JSON history.
+void benchHttp() {
+    hal::MemoryKeyValueStore kv;
+    auto journal = std::make_shared<feeding_store::FeedingJournal<feeding_store::FEEDINGS_TO_KEEP>>(kv);
+    auto store = std::make_shared<feeding_store::FeedingStore<feeding_store::FEEDINGS_IN_MEMORY>>();
+    journal->load(*store);
+    for (const auto& feeding : buildFeedings(50)) {
+        store->addFeeding(feeding);
+        feeding_store::persistLatestFeeding(journal, store);
+    }
+    auto ledger = std::make_shared<feeder::idempotency::IdempotencyLedger>(kv);
+    auto queue = std::make_shared<feeder::feed_queue::FeedQueue>();
+    auto calibration = std::make_shared<feeder::dosing::DoseCalibration>(kv);
+    auto liveEvents = std::make_shared<feeder::live_events::LiveEvents>();
+
+    feeder::web_server::FeederWebServer<feeding_store::FEEDINGS_IN_MEMORY, feeding_store::FEEDINGS_TO_KEEP> server(
+        store, journal, ledger, queue, calibration, liveEvents, [](feeder::metrics::Snapshot&) {}, 0);
+    if (!server.setupWebServer()) {
+        printf("http: couldn't listen\n");
+        return;
+    }
+
+    for (const char* path : {"/", "/api/feedings"}) {
+        for (const unsigned int clients : {10, 25, 50}) {
+            const auto result = bench::runHttpLoad([&](const unsigned long waitMs) { server.loopWebServer(hal::millis(), waitMs); },
+                                                   server.getPort(), path, clients, 1000);
+            char name[64];
+            snprintf(name, sizeof(name), "http%s/clients=%u", strcmp(path, "/") == 0 ? "/root" : path + 4, clients);
+            reporter->add({name,
+                           {{"requests_per_sec", result.requests / result.seconds},
+                            {"p50_us", result.p50Us},
+                            {"p99_us", result.p99Us},
+                            {"max_us", result.maxUs},
+                            {"reconnects", result.reconnects},
+                            {"errors", result.errors}}});
+        }
+    }
+    const auto& stats = server.getStats();
+    reporter->add({"http/server",
+                   {{"accepted", stats.accepted},
+                    {"requests", stats.requests},
+                    {"max_open", stats.maxOpen},
+                    {"rerenders", stats.rerenders},
+                    {"torn", stats.torn},
+                    {"timed_out", stats.timedOut},
+                    {"cache_hits", server.getCacheStats().hits},
+                    {"cache_misses", server.getCacheStats().misses}}});
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const bool json = argc > 1 && strcmp(argv[1], "--json") == 0;
+    bench::Reporter jsonOrText(json);
+    reporter = &jsonOrText;
+    hal::logSink.setEnabled(!json);
+
+    for (const size_t rows : {50, 500, 5000}) {
+        const auto feedings = buildFeedings(rows);
+        const unsigned long iterations = rows >= 5000 ? 50 : 500;
+
+        char name[64];
+        snprintf(name, sizeof(name), "renderRoot/streamed/rows=%zu", rows);
+        reporter->add(bench::run(name, iterations, [&]() {
+            bench::ChunkedWriter writer([](const char*, size_t length) { bytesOnWire += length; });
+            bench::renderRoot(writer, "", "0123456789abcdef", feedings, 0, 0);
+            writer.flush();
+        }));
+
+        snprintf(name, sizeof(name), "renderRoot/buffered/rows=%zu", rows);
+        reporter->add(bench::run(name, iterations, [&]() {
+            StringWriter writer;
+            bench::renderRoot(writer, "", "0123456789abcdef", feedings, 0, 0);
+            bytesOnWire += writer.out.size();
+        }));
+    }
+    reportPageLoadBytes();
+
+    benchFeedingOrder<50>();
+    benchFeedingOrder<4096>();
+
+    benchJournal<50>();
+    benchJournal<1024>();
+    benchJournal<32768>();
+
+    benchPersist();
+    benchMqtt();
+    benchFeederTick();
+    benchResponseCache();
+    benchHttp();
+
+    reporter->finish();
+
+    // keeps the loops above from being optimised away
+    if (checksum == 0) printf("checksum=0\n");
+    return 0;
+}
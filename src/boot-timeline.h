@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+#include "event-log.h"
+#include "hal.h"
+
+namespace feeder {
+namespace boot {
+
+/************************
+ * Boot timeline
+ *
+ * When each startup phase began and ended, in ms since power on, logged as
+ * each one ends and summed up once the network is ready. Phases overlap:
+ * the store loads and the feeder starts while Wi-Fi is still associating.
+ * Each phase is begun and ended by one task, never two at once.
+ ************************/
+enum class Phase : uint8_t {
+    WifiAssociate,
+    LoadState,
+    StartFeeder,
+    StartNetwork,
+};
+
+const size_t PHASE_COUNT = 4;
+
+const char* describe(const Phase phase) {
+    switch (phase) {
+        case Phase::WifiAssociate:
+            return "wifi_associate";
+        case Phase::LoadState:
+            return "load_state";
+        case Phase::StartFeeder:
+            return "start_feeder";
+        case Phase::StartNetwork:
+            return "start_network";
+    }
+    return "unknown";
+}
+
+inline constexpr hal::EventInfo BOOT_PHASE{hal::LogLevel::Info, "Boot phase started_ms=%lu, took_ms=%lu, phase="};
+inline constexpr hal::EventInfo BOOT_READY{hal::LogLevel::Info, "Boot done feeder_ready_ms=%lu, network_ready_ms=%lu, wifi_fast_connect=%lu"};
+
+struct PhaseTiming {
+    uint32_t beganMs = 0;
+    uint32_t endedMs = 0;
+};
+
+class Timeline {
+   private:
+    PhaseTiming _phases[PHASE_COUNT];
+    uint32_t _feederReadyMs = 0;
+    uint32_t _networkReadyMs = 0;
+
+   public:
+    void begin(const Phase phase) { _phases[static_cast<size_t>(phase)].beganMs = hal::millis(); }
+
+    void end(const Phase phase) {
+        auto& timing = _phases[static_cast<size_t>(phase)];
+        timing.endedMs = hal::millis();
+        hal::logText<BOOT_PHASE>(describe(phase), timing.beganMs, timing.endedMs - timing.beganMs);
+        if (phase == Phase::StartFeeder) _feederReadyMs = timing.endedMs;
+    }
+
+    // the last phase, after which it's all running
+    void networkReady(const bool fastConnect) {
+        _networkReadyMs = hal::millis();
+        hal::log<BOOT_READY>(_feederReadyMs, _networkReadyMs, fastConnect);
+    }
+
+    const PhaseTiming& get(const Phase phase) const { return _phases[static_cast<size_t>(phase)]; }
+    uint32_t getFeederReadyMs() const { return _feederReadyMs; }
+    // 0 until it is
+    uint32_t getNetworkReadyMs() const { return _networkReadyMs; }
+};
+
+Timeline timeline;
+
+}  // namespace boot
+}  // namespace feeder
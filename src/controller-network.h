@@ -0,0 +1,268 @@
+#pragma once
+
+#include <esp_heap_caps.h>
+#include <nvs_flash.h>
+
+#include <cmath>
+#include <memory>
+
+#include "boot-timeline.h"
+#include "controller.h"
+#include "kv-store.h"
+#include "metrics.h"
+#include "mqtt.h"
+#include "mywifi.h"
+#include "ntp.h"
+#include "web-server.h"
+
+namespace feeder {
+
+namespace controller {
+
+std::shared_ptr<ntp::TimeService> timeService = nullptr;
+hal::PreferencesKeyValueStore preferencesStore;
+std::unique_ptr<feeder::web_server::FeederWebServer<feeding_store::FEEDINGS_IN_MEMORY, feeding_store::FEEDINGS_TO_KEEP>> feedWebServer = nullptr;
+MqttClient* ackClient = nullptr;
+const richiev::WifiConnection* wifiConnection = nullptr;
+
+// {"requestId":"...","status":"queued|coalesced|duplicate|busy|invalid"} on
+// event/feedAck, so a client retrying a request can tell it already went
+// through, or that it should try again later
+void publishFeedAck(const char* requestId, const feed_queue::RequestResult result) {
+    char payload[128];
+    const int length = snprintf(payload, sizeof(payload), "{\"requestId\":\"%s\",\"status\":\"%s\"}", requestId, feed_queue::describe(result));
+    if (ackClient != nullptr && length > 0 && length < static_cast<int>(sizeof(payload))) {
+        ackClient->publish("event/feedAck", payload, length);
+    }
+}
+
+// the event log's tail, at or above mqttLogLevel, on event/log. A few lines
+// per loop at most so a burst doesn't hold up MQTT itself.
+hal::LogLevel mqttLogLevel = hal::LogLevel::Warn;
+uint32_t mqttLogSeq = 0;
+const unsigned int MQTT_LOG_LINES_PER_LOOP = 4;
+
+void publishLogs() {
+    if (ackClient == nullptr) return;
+    unsigned int published = 0;
+    mqttLogSeq = hal::logTail.forEachSince(mqttLogSeq, mqttLogLevel, [&](const hal::LogLine& line) {
+        if (published == MQTT_LOG_LINES_PER_LOOP) return false;
+        ackClient->publish("event/log", line.text, strlen(line.text));
+        published++;
+        return true;
+    });
+}
+
+// the outbox's status and feed events, a few per loop like the logs
+const size_t MQTT_EVENTS_PER_LOOP = 4;
+
+void publishOutbox() {
+    if (ackClient == nullptr) return;
+    outbox.flush([](const char* topic, const char* payload, const size_t length) { ackClient->publish(topic, payload, length); }, MQTT_EVENTS_PER_LOOP);
+}
+
+void collectDeviceMetrics(metrics::Snapshot& snapshot) {
+    collectMetrics(snapshot);
+    snapshot.freeHeapBytes = ESP.getFreeHeap();
+    snapshot.largestFreeBlockBytes = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    snapshot.bootFeederReadyMs = boot::timeline.getFeederReadyMs();
+    snapshot.bootNetworkReadyMs = boot::timeline.getNetworkReadyMs();
+    if (wifiConnection != nullptr) {
+        const auto& wifi = wifiConnection->getStats();
+        snapshot.wifiConnected = wifiConnection->isConnected();
+        snapshot.wifiLinkLosses = wifi.linkLosses;
+        snapshot.wifiReconnects = wifi.reconnects;
+        snapshot.wifiFailedAttempts = wifi.failedAttempts;
+    }
+    if (feedWebServer != nullptr) {
+        const auto& http = feedWebServer->getStats();
+        snapshot.httpRequests = http.requests;
+        snapshot.httpDropped = http.timedOut + http.torn;
+        snapshot.eventStreams = http.streams;
+        snapshot.responseCacheHits = feedWebServer->getCacheStats().hits;
+        snapshot.responseCacheMisses = feedWebServer->getCacheStats().misses;
+    }
+}
+
+// the metrics summary on state/metrics, for dashboards that don't scrape
+const unsigned long METRICS_PUBLISH_PERIOD_MS = 60 * 1000;
+unsigned long metricsPublishedAt = 0;
+
+void publishMetrics() {
+    if (ackClient == nullptr || hal::millis() - metricsPublishedAt < METRICS_PUBLISH_PERIOD_MS) return;
+    metricsPublishedAt = hal::millis();
+
+    metrics::Snapshot snapshot;
+    collectDeviceMetrics(snapshot);
+    char payload[metrics::SUMMARY_BUFFER_SIZE];
+    const size_t length = metrics::renderSummaryJson(payload, snapshot);
+    if (length > 0) {
+        ackClient->publish("state/metrics", payload, length);
+    }
+}
+
+// built once at setup, and lives as long as the MQTT client
+richiev::mqtt::TopicProcessorMap topicsToProcessor;
+
+inline constexpr hal::EventInfo MQTT_FEED_WITHOUT_ID{hal::LogLevel::Warn, "MQTT feed without a requestId, retries of this can double feed"};
+inline constexpr hal::EventInfo CALIBRATION_REJECTED{hal::LogLevel::Warn, "Rejected calibration milligrams=%lu, rotations=%lu, pending_rotations=%lu"};
+inline constexpr hal::EventInfo SCHEDULE_REJECTED{hal::LogLevel::Warn, "Rejected schedule index=%lu, at=%lu, rotations=%lu"};
+inline constexpr hal::EventInfo SETTINGS_CLEARED{hal::LogLevel::Warn, "Clearing settings out"};
+
+void buildHandlers() {
+    topicsToProcessor.add("debug/restart", [](std::string_view payload) {
+        // straight out, the log drain wouldn't get to it before the restart
+        Serial.println("Restarting");
+        ESP.restart();
+    });
+
+    topicsToProcessor.add("debug/clear", [](std::string_view payload) {
+        hal::log<SETTINGS_CLEARED>();
+        nvs_flash_erase();
+        nvs_flash_init();
+    });
+
+    topicsToProcessor.add("execute/triggerFeed", [](std::string_view payload) {
+        richiev::mqtt::InputDocument doc;
+        richiev::mqtt::parseInput(payload, doc);
+        if (!doc.containsKey("rotations") && !doc.containsKey("fraction") && !doc.containsKey("grams")) {
+            return;
+        }
+
+        // rotations can be fractional, or given as "fraction" (of a
+        // rotation) or "grams" instead
+        dosing::DoseRequest doseRequest;
+        doseRequest.rotations = doc["rotations"] | 0.0f;
+        doseRequest.fraction = doc["fraction"] | 0.0f;
+        doseRequest.grams = doc["grams"] | 0.0f;
+
+        // {"requestId":"<anything unique per feed>","rotations":1}. Older
+        // clients send a numeric asOf instead, which works as an ID too.
+        char asOfId[24];
+        const char* requestId = doc["requestId"].as<const char*>();
+        if (requestId == nullptr && doc.containsKey("asOf")) {
+            snprintf(asOfId, sizeof(asOfId), "asOf:%lu", doc["asOf"].as<unsigned long>());
+            requestId = asOfId;
+        }
+        if (requestId == nullptr) {
+            hal::log<MQTT_FEED_WITHOUT_ID>();
+        }
+
+        Dose dose;
+        const auto result = dosing::resolveDose(doseRequest, *doseCalibration, dose)
+                                ? requestFeed(requestId, feed_queue::Source::Mqtt, dose)
+                                : feed_queue::RequestResult::Invalid;
+        if (requestId != nullptr) {
+            publishFeedAck(requestId, result);
+        }
+    });
+
+    // {"rotations":5}: feeds that many whole rotations to weigh, then
+    // config/calibration {"grams":7.4} with what they weighed
+    topicsToProcessor.add("execute/calibrate", [](std::string_view payload) {
+        richiev::mqtt::InputDocument doc;
+        richiev::mqtt::parseInput(payload, doc);
+        const unsigned int rotations = doc["rotations"] | 0u;
+        if (rotations == 0) {
+            return;
+        }
+        startCalibration(rotations);
+    });
+
+    // {"grams":7.4}, or {"grams":7.4,"rotations":5} for rotations fed some
+    // other way
+    topicsToProcessor.add("config/calibration", [](std::string_view payload) {
+        richiev::mqtt::InputDocument doc;
+        richiev::mqtt::parseInput(payload, doc);
+        const float grams = doc["grams"] | 0.0f;
+        const unsigned int rotations = doc["rotations"] | 0u;
+        if (!doseCalibration->record(grams, rotations)) {
+            hal::log<CALIBRATION_REJECTED>(grams > 0 ? std::lround(grams * 1000) : 0, rotations, doseCalibration->getPendingRotations());
+        }
+    });
+
+    // {"level":0..3}, debug/info/warn/error. Only what FEEDER_LOG_LEVEL
+    // compiled in is there to send.
+    topicsToProcessor.add("config/logLevel", [](std::string_view payload) {
+        richiev::mqtt::InputDocument doc;
+        richiev::mqtt::parseInput(payload, doc);
+        const unsigned int level = doc["level"] | static_cast<unsigned int>(hal::LogLevel::Warn);
+        mqttLogLevel = static_cast<hal::LogLevel>(level > 3 ? 3 : level);
+    });
+
+    // {"index":0,"at":25200,"weekdays":127,"rotations":1}, at is seconds
+    // into the local day, weekdays a mask with bit 0 Sunday. rotations 0
+    // turns the schedule off.
+    topicsToProcessor.add("config/schedule", [](std::string_view payload) {
+        richiev::mqtt::InputDocument doc;
+        richiev::mqtt::parseInput(payload, doc);
+        if (!doc.containsKey("index") || !doc.containsKey("at")) {
+            return;
+        }
+
+        scheduler::Schedule schedule;
+        schedule.secOfDay = doc["at"].as<uint32_t>();
+        schedule.weekdays = doc.containsKey("weekdays") ? doc["weekdays"].as<uint8_t>() : scheduler::EVERY_DAY;
+        schedule.rotations = doc.containsKey("rotations") ? doc["rotations"].as<uint8_t>() : 0;
+        const uint32_t now = timeService->isSynced() ? timeService->getEpochTime() : 0;
+        const size_t index = doc["index"].as<size_t>();
+        if (!feedScheduler->setSchedule(index, schedule, now)) {
+            hal::log<SCHEDULE_REJECTED>(index, schedule.secOfDay, schedule.rotations);
+        }
+    });
+
+    // {"minutes":-300}
+    topicsToProcessor.add("config/utcOffset", [](std::string_view payload) {
+        richiev::mqtt::InputDocument doc;
+        richiev::mqtt::parseInput(payload, doc);
+        if (!doc.containsKey("minutes")) {
+            return;
+        }
+        const uint32_t now = timeService->isSynced() ? timeService->getEpochTime() : 0;
+        feedScheduler->setUtcOffset(doc["minutes"].as<int32_t>() * 60, now);
+    });
+
+    topicsToProcessor.finalize();
+    Serial << "Initialized topic_processor_count=" << topicsToProcessor.size() << endl;
+}
+
+// what the feeder needs before it starts: the feedings, calibration and
+// schedule out of NVS. Doesn't touch the network.
+void setupControllerState() {
+    buildHandlers();
+    setupFeedingState(preferencesStore);
+    setupScheduler(preferencesStore);
+}
+
+// the rest, once Wi-Fi is up
+void setupController(MqttBroker& mqttBroker, MqttClient& mqttClient, std::shared_ptr<ntp::TimeService> ts, const richiev::WifiConnection& wifi) {
+    timeService = ts;
+    ackClient = &mqttClient;
+    wifiConnection = &wifi;
+
+    feedWebServer = std::make_unique<feeder::web_server::FeederWebServer<feeding_store::FEEDINGS_IN_MEMORY, feeding_store::FEEDINGS_TO_KEEP>>(feedingStore, feedingJournal, feedLedger, feedQueue, doseCalibration, liveEvents, collectDeviceMetrics);
+    feedWebServer->setupWebServer();
+    richiev::mqtt::setupMQTT(mqttBroker, mqttClient, topicsToProcessor);
+}
+
+void loopController() {
+    processFeedCompletions();
+    if (timeService->isSynced()) {
+        loopScheduler(timeService->getEpochTime());
+    }
+    {
+        hal::ScopedTimer timer(metrics::webTime);
+        feedWebServer->loopWebServer(hal::millis());
+    }
+    // a feeding is journaled as of when it starts, so feeds asked for before
+    // NTP has answered wait in the queue rather than go down as 1970
+    if (timeService->isSynced()) {
+        dispatchQueuedFeed(timeService->getEpochTime());
+    }
+    updateStatus(hal::millis());
+    publishOutbox();
+    publishLogs();
+    publishMetrics();
+}
+}  // namespace controller
+}  // namespace feeder
@@ -1,89 +1,243 @@
 #pragma once
 
-#include <NTPClient.h>
-#include <nvs_flash.h>
-
 #include <memory>
 
+#include "dosing.h"
+#include "event-log.h"
+#include "feed-events.h"
+#include "feed-queue.h"
+#include "feeder-task.h"
 #include "feeder.h"
+#include "feeding-journal.h"
 #include "feeding-store.h"
-#include "mqtt.h"
-#include "web-server.h"
+#include "hal.h"
+#include "idempotency-ledger.h"
+#include "live-events.h"
+#include "metrics.h"
+#include "scheduler.h"
 
 namespace feeder {
 
 namespace controller {
 
-unsigned long lastFeedAsOf = 0;
-std::shared_ptr<NTPClient> timeClient = nullptr;
-std::shared_ptr<feeding_store::FeedingStore<feeding_store::FEEDINGS_TO_KEEP>> feedingStore = nullptr;
-std::unique_ptr<feeder::web_server::FeederWebServer<feeding_store::FEEDINGS_TO_KEEP>> feedWebServer = nullptr;
-
-void triggerFeed(const unsigned long asOf, const unsigned long adjustedTimeSec, const unsigned int rotations) {
-    if (asOf <= lastFeedAsOf) {
-        Serial.print("Refusing to feed because of time mismatch (idempotence check). asOf=");
-        Serial.print(asOf);
-        Serial.print("<= lastFeedAsOf=");
-        Serial.print(lastFeedAsOf);
-        Serial.println();
-    } else {
-        const feeder::Feeding feeding = {
-            .asOfAdjustedSec = adjustedTimeSec,
-            .rotations = rotations};
-        feeder::beginFeed(asOf, adjustedTimeSec, rotations);
-        feedingStore->addFeeding(feeding);
-        feeding_store::persistFeedingStore(feedingStore);
+std::shared_ptr<feeding_store::FeedingJournal<feeding_store::FEEDINGS_TO_KEEP>> feedingJournal = nullptr;
+std::shared_ptr<feeding_store::FeedingStore<feeding_store::FEEDINGS_IN_MEMORY>> feedingStore = nullptr;
+std::shared_ptr<idempotency::IdempotencyLedger> feedLedger = nullptr;
+std::shared_ptr<feed_queue::FeedQueue> feedQueue = std::make_shared<feed_queue::FeedQueue>();
+std::unique_ptr<scheduler::Scheduler> feedScheduler = nullptr;
+std::shared_ptr<dosing::DoseCalibration> doseCalibration = nullptr;
+// what the feeder task reports back that has to survive a reboot
+hal::KeyValueStore* feederStateStore = nullptr;
+uint32_t rotationTimingPersistedSamples = 0;
+uint8_t persistedDrumOffset = 0;
+unsigned long feedsCompleted = 0;
+// what goes out over MQTT, published by the network loop
+feed_events::Outbox outbox;
+feed_events::StatusPublisher statusPublisher;
+// what goes out to open pages on GET /events, served by the web server
+std::shared_ptr<live_events::LiveEvents> liveEvents = std::make_shared<live_events::LiveEvents>();
+// the last feed handed to the feeder task, the running one while it's busy
+Dose dispatchedDose;
+
+const char* ROTATION_TIMING_KEY = "rotTiming";
+const char* DRUM_OFFSET_KEY = "drumPos";
+// a reboot loses at most this many rotations of learning, the model only
+// remembers about 8 anyway
+const uint32_t ROTATION_TIMING_PERSIST_EVERY = 8;
+
+// straight to the feeder task, skipping the queue
+bool triggerFeed(const unsigned long adjustedTimeSec, const Dose dose) {
+    const feeder::Feeding feeding = {
+        .asOfAdjustedSec = adjustedTimeSec,
+        .rotations = dose.rotations,
+        .sixteenths = dose.sixteenths};
+    if (!feeder::enqueueFeed(adjustedTimeSec, dose)) {
+        return false;
     }
+    dispatchedDose = dose;
+    feedingStore->addFeeding(feeding);
+    {
+        hal::ScopedTimer timer(metrics::persistTime);
+        feeding_store::persistLatestFeeding(feedingJournal, feedingStore);
+    }
+    feed_events::pushFeedStarted(outbox, feeding);
+    feed_events::pushFeedStarted(*liveEvents, feeding);
+    return true;
 }
 
-std::unique_ptr<richiev::mqtt::TopicProcessorMap> buildHandlers() {
-    auto topicsToProcessorPtr = std::make_unique<richiev::mqtt::TopicProcessorMap>();
-    auto& topicsToProcessor = *topicsToProcessorPtr;
-
-    topicsToProcessor["debug/restart"] = [&](const std::string& payload) {
-        Serial.println("Restarting");
-        ESP.restart();
-    };
-
-    topicsToProcessor["debug/clear"] = [&](const std::string& payload) {
-        Serial.println("Clearing settings out");
-        nvs_flash_erase();
-        nvs_flash_init();
-    };
-
-    topicsToProcessor["execute/triggerFeed"] = [&](const std::string& payload) {
-        auto doc = richiev::mqtt::parseInput(payload);
-        if (!doc.containsKey("rotations")) {
-            return;
-        }
+feed_queue::RequestResult queueFeed(const feed_queue::Source source, const Dose dose) {
+    return feed_queue::toRequestResult(feedQueue->push(source, dose, hal::millis()));
+}
 
-        auto rotations = doc["rotations"].as<unsigned int>();
-        auto asOf = doc.containsKey("asOf") ? doc["asOf"].as<unsigned long>() : millis();
+// keyed by the slot, so two slots due together (after an outage, say)
+// are two feeds rather than coalescing into one
+feed_queue::RequestResult queueScheduledFeed(const scheduler::Slot& slot, const unsigned int rotations) {
+    return feed_queue::toRequestResult(feedQueue->push(feed_queue::Source::Scheduler, Dose::ofRotations(rotations), hal::millis(), slot.key()));
+}
 
-        triggerFeed(asOf, timeClient->getEpochTime(), rotations);
-    };
+feed_queue::RequestResult requestFeed(const char* requestId, const feed_queue::Source source, const Dose dose) {
+    return feed_queue::requestFeed(*feedQueue, *feedLedger, requestId, source, dose, hal::millis());
+}
 
-    Serial << "Initialized topic_processor_count=" << topicsToProcessor.size() << endl;
-    return std::move(topicsToProcessorPtr);
+// feeds whole rotations to weigh, see DoseCalibration
+feed_queue::RequestResult startCalibration(const unsigned int rotations) {
+    const auto result = queueFeed(feed_queue::Source::Mqtt, Dose::ofRotations(rotations));
+    if (result != feed_queue::RequestResult::Busy) {
+        doseCalibration->begin(rotations);
+    }
+    return result;
 }
 
-void setupController(MqttBroker& mqttBroker, MqttClient& mqttClient, std::shared_ptr<NTPClient> tc) {
-    std::shared_ptr<richiev::mqtt::TopicProcessorMap> handlers = std::move(buildHandlers());
-    timeClient = tc;
+inline constexpr hal::EventInfo FEED_DISPATCHED{hal::LogLevel::Info, "Dispatching a queued feed rotations=%lu, sixteenths=%lu, waited_ms=%lu, source="};
+inline constexpr hal::EventInfo FEED_COMPLETED{hal::LogLevel::Info, "Feed completed adjustedStartedAtSec=%lu, sixteenths=%lu, duration=%lu"};
 
-    feedingStore = std::move(feeding_store::setupFeedingStore<feeding_store::FEEDINGS_TO_KEEP>());
+// Hands the next queued feed to the feeder task once it's idle. Feedings are
+// recorded as of when they start, not when they were asked for.
+bool dispatchQueuedFeed(const unsigned long adjustedTimeSec) {
+    if (feeder::isFeedPending()) return false;
 
-    feedWebServer = std::make_unique<feeder::web_server::FeederWebServer<feeding_store::FEEDINGS_TO_KEEP>>(feedingStore);
-    feedWebServer->setupWebServer();
-    richiev::mqtt::setupMQTT(mqttBroker, mqttClient, handlers);
+    feed_queue::FeedCommand command;
+    if (!feedQueue->pop(command, hal::millis())) return false;
+
+    hal::logText<FEED_DISPATCHED>(feed_queue::describe(command.source), command.dose.rotations, command.dose.sixteenths, hal::millis() - command.queuedAtMs);
+    if (!triggerFeed(adjustedTimeSec, command.dose)) return false;
+    feed_queue::recordDispatched(*feedLedger, command);
+    return true;
 }
 
-void loopController() {
-    feedWebServer->loopWebServer();
-    auto pendingFeed = feedWebServer->retrievePendingFeedRequest();
-    if (pendingFeed) {
-        triggerFeed(millis(), timeClient->getEpochTime(), pendingFeed->rotations);
+// rotations the feeder task finished, out to open pages. Before the
+// completions so a feed's last rotation is never reported after it finished.
+void processFeedProgress() {
+    feeder::FeedProgress progress;
+    while (feeder::feedProgress.pop(progress)) {
+        if (progress.forced) {
+            feed_events::pushRotationForced(*liveEvents, progress.adjustedStartedAtSec, progress.rotationsDone);
+        }
+        feed_events::pushFeedProgress(*liveEvents, progress.adjustedStartedAtSec, progress.rotationsDone, progress.dispensedSixteenths, progress.forced);
     }
 }
+
+// drains what the feeder task reports back, returns how many feeds finished
+unsigned int processFeedCompletions() {
+    processFeedProgress();
+
+    unsigned int finished = 0;
+    feeder::FeedCompletion completion;
+    while (feeder::feedCompletions.pop(completion)) {
+        hal::log<FEED_COMPLETED>(completion.adjustedStartedAtSec, completion.dose.totalSixteenths(), completion.durationMs);
+        const feeder::Feeding feeding = {
+            .asOfAdjustedSec = completion.adjustedStartedAtSec,
+            .rotations = completion.dose.rotations,
+            .sixteenths = completion.dose.sixteenths};
+        feed_events::pushFeedFinished(outbox, feeding, completion.durationMs);
+        feed_events::pushFeedFinished(*liveEvents, feeding, completion.durationMs);
+
+        const auto& timing = completion.rotationTiming;
+        if (timing.samples <= feeder::RotationTimingModel::MIN_SAMPLES ||
+            timing.samples >= rotationTimingPersistedSamples + ROTATION_TIMING_PERSIST_EVERY) {
+            feederStateStore->begin(feeding_store::PREFERENCE_NS, false);
+            feederStateStore->putBytes(ROTATION_TIMING_KEY, &timing, sizeof(timing));
+            feederStateStore->end();
+            rotationTimingPersistedSamples = timing.samples;
+        }
+        // only sub-rotation doses move it
+        if (completion.drumOffsetSixteenths != persistedDrumOffset) {
+            feederStateStore->begin(feeding_store::PREFERENCE_NS, false);
+            feederStateStore->putUInt(DRUM_OFFSET_KEY, completion.drumOffsetSixteenths);
+            feederStateStore->end();
+            persistedDrumOffset = completion.drumOffsetSixteenths;
+        }
+        finished++;
+    }
+    feedsCompleted += finished;
+    return finished;
+}
+
+// state/status into the outbox, if it's changed or due a refresh
+void updateStatus(const unsigned long nowMs) {
+    feed_events::Status status;
+    status.feeding = feeder::feedInProgress.load();
+    if (status.feeding) {
+        status.dose = dispatchedDose;
+        status.doneSixteenths = feeder::feedProgressSixteenths.load();
+    }
+    status.nextFeedEpochSec = feedScheduler ? feedScheduler->getNextSlot().epochSec : 0;
+    statusPublisher.update(outbox, status, nowMs);
+}
+
+// everything but the heap, which only the device side can see
+void collectMetrics(metrics::Snapshot& snapshot) {
+    const auto& queueStats = feedQueue->getStats();
+    snapshot.uptimeMs = hal::millis();
+    snapshot.feedsQueued = queueStats.queued;
+    snapshot.feedsDispatched = queueStats.dispatched;
+    snapshot.feedsCompleted = feedsCompleted;
+    snapshot.feedsRejectedBusy = queueStats.rejected;
+    snapshot.duplicateRequests = feedLedger ? feedLedger->getStats().duplicates : 0;
+    snapshot.scheduledFeedsRefused = feedScheduler ? feedScheduler->getStats().refused : 0;
+    // the feeder task's, a read of a word it's writing is at worst one behind
+    snapshot.forcedRotations = feeder::rotationTiming.getTimedOutRotations();
+    snapshot.slowRotations = feeder::rotationTiming.getSlowRotations();
+    snapshot.logLines = hal::eventLog.getWritten();
+    snapshot.eventsPublished = outbox.getStats().published;
+    snapshot.eventsDropped = outbox.getStats().dropped;
+    snapshot.liveEventsLagged = liveEvents->getStats().lagged;
+}
+
+void setupFeedingState(hal::KeyValueStore& kv) {
+    feedingJournal = std::make_shared<feeding_store::FeedingJournal<feeding_store::FEEDINGS_TO_KEEP>>(kv);
+    feedingStore = std::move(feeding_store::setupFeedingStore<feeding_store::FEEDINGS_IN_MEMORY>(feedingJournal));
+
+    const auto& stats = feedingJournal->getLoadStats();
+    hal::logSink.print("Loaded feedings=");
+    hal::logSink.print(stats.feedingsRestored);
+    hal::logSink.print(", pages_read=");
+    hal::logSink.print(stats.pagesRead);
+    hal::logSink.print(", took_us=");
+    hal::logSink.print(stats.tookUs);
+    if (stats.migrated) {
+        hal::logSink.print(", migrated from the old format");
+    }
+    hal::logSink.println();
+
+    // what the feeder learnt about its rotation time and where it left the
+    // drum, before the feeder task starts using them
+    feeder::RotationTimingSnapshot timing;
+    kv.begin(feeding_store::PREFERENCE_NS, true);
+    kv.getBytes(ROTATION_TIMING_KEY, &timing, sizeof(timing));
+    persistedDrumOffset = static_cast<uint8_t>(kv.getUInt(DRUM_OFFSET_KEY, 0) % SIXTEENTHS_PER_ROTATION);
+    kv.end();
+    feeder::rotationTiming.restore(timing);
+    feeder::drumOffsetSixteenths = persistedDrumOffset;
+    feederStateStore = &kv;
+    rotationTimingPersistedSamples = feeder::rotationTiming.snapshot().samples;
+    hal::logSink.print("Loaded rotation timing samples=");
+    hal::logSink.print(static_cast<unsigned long>(timing.samples));
+    hal::logSink.print(", timeout_ms=");
+    hal::logSink.print(feeder::rotationTiming.timeoutMs());
+    hal::logSink.println();
+
+    feedLedger = std::make_shared<idempotency::IdempotencyLedger>(kv);
+    feedLedger->load();
+    hal::logSink.print("Loaded feed request ids=");
+    hal::logSink.print(feedLedger->size());
+    hal::logSink.println();
+
+    doseCalibration = std::make_shared<dosing::DoseCalibration>(kv);
+    doseCalibration->load();
+}
+
+void setupScheduler(hal::KeyValueStore& kv) {
+    // a full queue leaves the slot due, the scheduler offers it again
+    feedScheduler = std::make_unique<scheduler::Scheduler>(kv, [](const scheduler::Slot& slot, const unsigned int rotations, const uint32_t) {
+        return queueScheduledFeed(slot, rotations) != feed_queue::RequestResult::Busy;
+    });
+    feedScheduler->load();
+}
+
+// nowEpochSec has to be from a synced clock
+void loopScheduler(const unsigned long nowEpochSec) {
+    feedScheduler->tick(nowEpochSec);
+}
 }  // namespace controller
 }  // namespace feeder
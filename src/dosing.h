@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "event-log.h"
+#include "feeder-common.h"
+#include "feeding-store.h"
+#include "hal.h"
+
+namespace feeder {
+namespace dosing {
+
+/************************
+ * Dose requests
+ *
+ * What MQTT and the web page can ask for: rotations (which can have a
+ * fractional part), plus a fraction of a rotation, or grams. Grams need the
+ * feeder calibrated first. Everything comes out in sixteenths of a rotation,
+ * rounded to the nearest.
+ ************************/
+struct DoseRequest {
+    float rotations = 0;
+    float fraction = 0;
+    float grams = 0;
+};
+
+// one feed shouldn't empty the drum because of a typo
+const float MAX_DOSE_ROTATIONS = 16;
+
+inline constexpr hal::EventInfo DOSE_CALIBRATED{hal::LogLevel::Info, "Calibrated milligrams_per_rotation=%lu"};
+inline constexpr hal::EventInfo GRAMS_BEFORE_CALIBRATION{hal::LogLevel::Warn, "Refusing a dose in grams, the feeder isn't calibrated"};
+
+/************************
+ * Calibration
+ *
+ * Grams per rotation, measured by feeding a few whole rotations into
+ * something on a scale and reporting back what it weighed. Kept in NVS.
+ ************************/
+class DoseCalibration {
+   private:
+    hal::KeyValueStore& _kv;
+    float _gramsPerRotation = 0;
+    // rotations of the calibration feed waiting on its weight
+    unsigned int _pendingRotations = 0;
+
+    static constexpr const char* GRAMS_PER_ROTATION_KEY = "gPerRot";
+
+   public:
+    DoseCalibration(hal::KeyValueStore& kv) : _kv(kv) {}
+
+    void load() {
+        float gramsPerRotation = 0;
+        _kv.begin(feeding_store::PREFERENCE_NS, true);
+        _kv.getBytes(GRAMS_PER_ROTATION_KEY, &gramsPerRotation, sizeof(gramsPerRotation));
+        _kv.end();
+        _gramsPerRotation = gramsPerRotation > 0 ? gramsPerRotation : 0;
+    }
+
+    // the calibration feed itself is queued by the caller
+    void begin(const unsigned int rotations) { _pendingRotations = rotations; }
+
+    // grams is what the rotations from begin() weighed. rotations can be
+    // given instead if the feed was done some other way.
+    bool record(const float grams, const unsigned int rotations = 0) {
+        const unsigned int fed = rotations != 0 ? rotations : _pendingRotations;
+        if (fed == 0 || !(grams > 0)) return false;
+
+        _gramsPerRotation = grams / fed;
+        _pendingRotations = 0;
+        _kv.begin(feeding_store::PREFERENCE_NS, false);
+        _kv.putBytes(GRAMS_PER_ROTATION_KEY, &_gramsPerRotation, sizeof(_gramsPerRotation));
+        _kv.end();
+
+        hal::log<DOSE_CALIBRATED>(std::lround(_gramsPerRotation * 1000));
+        return true;
+    }
+
+    bool isCalibrated() const { return _gramsPerRotation > 0; }
+    float getGramsPerRotation() const { return _gramsPerRotation; }
+    unsigned int getPendingRotations() const { return _pendingRotations; }
+};
+
+// false (and dose left alone) if it's nothing, too much, or grams without a
+// calibration
+bool resolveDose(const DoseRequest& request, const DoseCalibration& calibration, Dose& dose) {
+    float rotations = request.rotations + request.fraction;
+    if (request.grams > 0) {
+        if (!calibration.isCalibrated()) {
+            hal::log<GRAMS_BEFORE_CALIBRATION>();
+            return false;
+        }
+        rotations = request.grams / calibration.getGramsPerRotation();
+    }
+    if (!(rotations > 0) || rotations > MAX_DOSE_ROTATIONS) return false;
+
+    const long sixteenths = std::lround(rotations * SIXTEENTHS_PER_ROTATION);
+    // anything asked for feeds at least something
+    dose = Dose::ofSixteenths(sixteenths < 1 ? 1 : sixteenths);
+    return true;
+}
+
+}  // namespace dosing
+}  // namespace feeder
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include "feeder-common.h"
+#include "spsc-ring.h"
+
+namespace feeder {
+namespace feed_events {
+
+/************************
+ * Outbox
+ *
+ * What the device has to say over MQTT, rendered when it happens and held
+ * here until the network loop gets to it. Pushing is a snprintf into a
+ * fixed slot, publishing happens a few messages per loop, so neither a
+ * burst of events nor a slow broker connection holds anything else up. A
+ * full outbox drops the newest message and counts it.
+ ************************/
+const size_t OUTBOX_PAYLOAD_SIZE = 160;
+const size_t OUTBOX_SLOTS = 8;
+
+struct OutboxMessage {
+    const char* topic;
+    uint16_t length;
+    char payload[OUTBOX_PAYLOAD_SIZE];
+};
+
+struct OutboxStats {
+    unsigned long published = 0;
+    unsigned long dropped = 0;
+};
+
+class Outbox {
+   private:
+    // only the network task touches it, the ring is for the fixed slots
+    richiev::SpscRing<OutboxMessage, OUTBOX_SLOTS + 1> _messages;
+    OutboxStats _stats;
+
+   public:
+    // format as for printf. False if it didn't fit or the outbox is full.
+    template <typename... Args>
+    bool push(const char* topic, const char* format, const Args... args) {
+        OutboxMessage message;
+        message.topic = topic;
+        const int length = snprintf(message.payload, OUTBOX_PAYLOAD_SIZE, format, args...);
+        message.length = static_cast<uint16_t>(length > 0 ? length : 0);
+        if (length <= 0 || length >= static_cast<int>(OUTBOX_PAYLOAD_SIZE) || !_messages.push(message)) {
+            _stats.dropped++;
+            return false;
+        }
+        return true;
+    }
+
+    // hands at most maxMessages to publish(topic, payload, length), oldest
+    // first. Returns how many.
+    template <typename Publish>
+    size_t flush(Publish&& publish, const size_t maxMessages) {
+        size_t flushed = 0;
+        OutboxMessage message;
+        while (flushed < maxMessages && _messages.pop(message)) {
+            publish(message.topic, message.payload, message.length);
+            flushed++;
+        }
+        _stats.published += flushed;
+        return flushed;
+    }
+
+    size_t size() const { return _messages.size(); }
+    const OutboxStats& getStats() const { return _stats; }
+};
+
+/************************
+ * Feed events
+ *
+ * event/feedStarted {"asOf":..,"rotations":1,"sixteenths":4,"dose":1.25}
+ * event/feedFinished, the same plus "durationMs"
+ * event/feedProgress {"asOf":..,"rotationsDone":1,"dispensed":1,"forced":false}
+ *   after each rotation
+ * event/rotationForced {"asOf":..,"rotation":2}
+ *   the sensor never saw home, the rotation was finished on time instead
+ *
+ * asOf is the Feeding's, seconds in adjusted (local) time. Sink is an
+ * Outbox (MQTT) or LiveEvents (/events), anything with push(topic, format,
+ * args...).
+ ************************/
+const char* FEED_STARTED_TOPIC = "event/feedStarted";
+const char* FEED_FINISHED_TOPIC = "event/feedFinished";
+const char* FEED_PROGRESS_TOPIC = "event/feedProgress";
+const char* ROTATION_FORCED_TOPIC = "event/rotationForced";
+
+template <typename Sink>
+bool pushFeedStarted(Sink& sink, const Feeding& feeding) {
+    char dose[DOSE_BUFFER_SIZE];
+    formatDose(dose, feeding.dose());
+    return sink.push(FEED_STARTED_TOPIC, "{\"asOf\":%lu,\"rotations\":%u,\"sixteenths\":%u,\"dose\":%s}",
+                     feeding.asOfAdjustedSec, feeding.rotations, static_cast<unsigned int>(feeding.sixteenths), dose);
+}
+
+template <typename Sink>
+bool pushFeedFinished(Sink& sink, const Feeding& feeding, const unsigned long durationMs) {
+    char dose[DOSE_BUFFER_SIZE];
+    formatDose(dose, feeding.dose());
+    return sink.push(FEED_FINISHED_TOPIC, "{\"asOf\":%lu,\"rotations\":%u,\"sixteenths\":%u,\"dose\":%s,\"durationMs\":%lu}",
+                     feeding.asOfAdjustedSec, feeding.rotations, static_cast<unsigned int>(feeding.sixteenths), dose, durationMs);
+}
+
+template <typename Sink>
+bool pushFeedProgress(Sink& sink, const unsigned long asOfAdjustedSec, const unsigned int rotationsDone, const unsigned long dispensedSixteenths, const bool forced) {
+    char dispensed[DOSE_BUFFER_SIZE];
+    formatDose(dispensed, Dose::ofSixteenths(dispensedSixteenths));
+    return sink.push(FEED_PROGRESS_TOPIC, "{\"asOf\":%lu,\"rotationsDone\":%u,\"dispensed\":%s,\"forced\":%s}",
+                     asOfAdjustedSec, rotationsDone, dispensed, forced ? "true" : "false");
+}
+
+template <typename Sink>
+bool pushRotationForced(Sink& sink, const unsigned long asOfAdjustedSec, const unsigned int rotation) {
+    return sink.push(ROTATION_FORCED_TOPIC, "{\"asOf\":%lu,\"rotation\":%u}", asOfAdjustedSec, rotation);
+}
+
+/************************
+ * Status
+ *
+ * state/status {"state":"idle|feeding","dose":1.25,"rotationsDone":0.5,"nextFeedAt":..}
+ *
+ * dose and rotationsDone are the running feed's (0 when idle), nextFeedAt
+ * the next scheduled slot in epoch seconds, 0 for none. Sent when it
+ * changes, no more than once a STATUS_MIN_INTERVAL_MS while a feed runs, and
+ * every STATUS_REFRESH_MS regardless so a dashboard that just subscribed
+ * doesn't wait long for it.
+ ************************/
+const char* STATUS_TOPIC = "state/status";
+const unsigned long STATUS_MIN_INTERVAL_MS = 1000;
+const unsigned long STATUS_REFRESH_MS = 30 * 1000;
+
+struct Status {
+    bool feeding = false;
+    Dose dose;
+    unsigned long doneSixteenths = 0;
+    uint32_t nextFeedEpochSec = 0;
+
+    bool operator==(const Status& other) const {
+        return feeding == other.feeding && dose == other.dose && doneSixteenths == other.doneSixteenths && nextFeedEpochSec == other.nextFeedEpochSec;
+    }
+    bool operator!=(const Status& other) const { return !(*this == other); }
+};
+
+class StatusPublisher {
+   private:
+    Status _last;
+    unsigned long _lastAtMs = 0;
+    bool _sent = false;
+
+   public:
+    // pushes status if it's due, returns whether it did
+    bool update(Outbox& outbox, const Status& status, const unsigned long nowMs) {
+        const unsigned long sinceMs = nowMs - _lastAtMs;
+        const bool changed = status != _last;
+        // starting and finishing go out straight away, progress is throttled
+        const bool throttled = status.feeding && _last.feeding && sinceMs < STATUS_MIN_INTERVAL_MS;
+        if (_sent && !(changed && !throttled) && sinceMs < STATUS_REFRESH_MS) return false;
+
+        char dose[DOSE_BUFFER_SIZE];
+        char done[DOSE_BUFFER_SIZE];
+        formatDose(dose, status.dose);
+        formatDose(done, Dose::ofSixteenths(status.doneSixteenths));
+        if (!outbox.push(STATUS_TOPIC, "{\"state\":\"%s\",\"dose\":%s,\"rotationsDone\":%s,\"nextFeedAt\":%lu}",
+                         status.feeding ? "feeding" : "idle", dose, done, static_cast<unsigned long>(status.nextFeedEpochSec))) {
+            return false;
+        }
+        _last = status;
+        _lastAtMs = nowMs;
+        _sent = true;
+        return true;
+    }
+};
+
+}  // namespace feed_events
+}  // namespace feeder
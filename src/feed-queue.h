@@ -0,0 +1,249 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include "event-log.h"
+#include "feeder-common.h"
+#include "hal.h"
+#include "idempotency-ledger.h"
+
+namespace feeder {
+namespace feed_queue {
+
+/************************
+ * Feed command queue
+ *
+ * Feeds asked for by MQTT, the web page and the scheduler wait here until
+ * the feeder is idle, then go to the feeder task one at a time. Fixed size,
+ * nothing allocated.
+ *
+ * - The highest priority source goes first, oldest first within a source.
+ * - A feed with no request ID (a client that doesn't send one) asked for
+ *   again from the same source with the same dose, while one is still
+ *   waiting, is coalesced into it rather than queued twice. Requests with
+ *   IDs are only coalesced with the same ID, different IDs are different
+ *   feeds even when they look alike. Schedules go in keyed by their slot,
+ *   so two slots due at once are two feeds.
+ * - When it's full the request is refused and the caller told, nothing
+ *   waiting is ever dropped.
+ *
+ * Everything here runs on the network side (one task), it isn't thread safe.
+ ************************/
+const size_t FEED_QUEUE_DEPTH = 8;
+
+enum class Source : uint8_t {
+    Scheduler,
+    Mqtt,
+    Http,
+};
+const size_t SOURCE_COUNT = 3;
+
+inline constexpr hal::EventInfo FEED_QUEUE_FULL{hal::LogLevel::Warn, "Refusing to queue a feed, the feed queue is full source=", 1000};
+inline constexpr hal::EventInfo DUPLICATE_FEED_REQUEST{hal::LogLevel::Info, "Ignoring duplicate feed request requestId="};
+
+const char* describe(const Source source) {
+    switch (source) {
+        case Source::Scheduler:
+            return "scheduler";
+        case Source::Mqtt:
+            return "mqtt";
+        default:
+            return "http";
+    }
+}
+
+enum class PushResult {
+    Queued,
+    Coalesced,
+    Full,
+};
+
+// what a feed was asked for with, see idempotency::hashRequestId, or for a
+// schedule its slot's key. 0 for none.
+const uint64_t NO_REQUEST_ID = 0;
+
+struct FeedCommand {
+    Source source = Source::Mqtt;
+    Dose dose;
+    unsigned long queuedAtMs = 0;
+    uint64_t requestHash = NO_REQUEST_ID;
+};
+
+struct FeedQueueStats {
+    unsigned long queued = 0;
+    unsigned long coalesced = 0;
+    unsigned long rejected = 0;
+    unsigned long dispatched = 0;
+    size_t maxDepth = 0;
+    // time between being queued and going to the feeder
+    unsigned long totalWaitMs = 0;
+    unsigned long maxWaitMs = 0;
+
+    unsigned long meanWaitMs() const { return dispatched == 0 ? 0 : totalWaitMs / dispatched; }
+};
+
+class FeedQueue {
+   private:
+    struct Entry {
+        FeedCommand command;
+        // arrival order, for FIFO within a priority
+        uint32_t sequence = 0;
+        bool used = false;
+    };
+
+    std::array<Entry, FEED_QUEUE_DEPTH> _entries{};
+    // someone at the web page is waiting on it, a schedule can start a bit late
+    std::array<uint8_t, SOURCE_COUNT> _priorities{{0, 1, 2}};
+    size_t _depth = 0;
+    uint32_t _nextSequence = 0;
+    FeedQueueStats _stats;
+
+    bool isCoalescable(const Source source, const Dose& dose, const uint64_t requestHash) const {
+        for (const auto& entry : _entries) {
+            if (entry.used && entry.command.source == source && entry.command.dose == dose && entry.command.requestHash == requestHash) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+   public:
+    // whether a feed asked for with this request ID is waiting
+    bool isWaiting(const uint64_t requestHash) const {
+        for (const auto& entry : _entries) {
+            if (entry.used && entry.command.requestHash == requestHash) return true;
+        }
+        return false;
+    }
+
+    PushResult push(const Source source, const Dose& dose, const unsigned long nowMs, const uint64_t requestHash = NO_REQUEST_ID) {
+        if (isCoalescable(source, dose, requestHash)) {
+            _stats.coalesced++;
+            return PushResult::Coalesced;
+        }
+        if (_depth >= FEED_QUEUE_DEPTH) {
+            _stats.rejected++;
+            hal::logText<FEED_QUEUE_FULL>(describe(source));
+            return PushResult::Full;
+        }
+
+        for (auto& entry : _entries) {
+            if (entry.used) continue;
+            entry.command = {source, dose, nowMs, requestHash};
+            entry.sequence = _nextSequence++;
+            entry.used = true;
+            break;
+        }
+        _depth++;
+        if (_depth > _stats.maxDepth) _stats.maxDepth = _depth;
+        _stats.queued++;
+        return PushResult::Queued;
+    }
+
+    bool pop(FeedCommand& command, const unsigned long nowMs) {
+        Entry* next = nullptr;
+        for (auto& entry : _entries) {
+            if (!entry.used) continue;
+            if (next == nullptr) {
+                next = &entry;
+                continue;
+            }
+            const uint8_t priority = _priorities[static_cast<size_t>(entry.command.source)];
+            const uint8_t nextPriority = _priorities[static_cast<size_t>(next->command.source)];
+            if (priority > nextPriority ||
+                (priority == nextPriority && static_cast<int32_t>(entry.sequence - next->sequence) < 0)) {
+                next = &entry;
+            }
+        }
+        if (next == nullptr) return false;
+
+        command = next->command;
+        next->used = false;
+        _depth--;
+
+        const unsigned long waitedMs = nowMs - command.queuedAtMs;
+        _stats.dispatched++;
+        _stats.totalWaitMs += waitedMs;
+        if (waitedMs > _stats.maxWaitMs) _stats.maxWaitMs = waitedMs;
+        return true;
+    }
+
+    void setPriority(const Source source, const uint8_t priority) { _priorities[static_cast<size_t>(source)] = priority; }
+
+    size_t size() const { return _depth; }
+    bool isEmpty() const { return _depth == 0; }
+    static constexpr size_t capacity() { return FEED_QUEUE_DEPTH; }
+    const FeedQueueStats& getStats() const { return _stats; }
+};
+
+/************************
+ * Feed requests
+ *
+ * What MQTT and the web page go through: a request ID already waiting in the
+ * queue, or in the idempotency ledger, is a duplicate. Otherwise the feed is
+ * queued, and its ID recorded in the ledger when it's dispatched (see
+ * recordDispatched), so a client told "busy", or whose feed was lost from
+ * the queue to a reboot, can retry with the same ID.
+ ************************/
+enum class RequestResult {
+    Queued,
+    Coalesced,
+    Duplicate,
+    Busy,
+    // not a dose the feeder can do (eg grams before it's calibrated)
+    Invalid,
+};
+
+const char* describe(const RequestResult result) {
+    switch (result) {
+        case RequestResult::Queued:
+            return "queued";
+        case RequestResult::Coalesced:
+            return "coalesced";
+        case RequestResult::Duplicate:
+            return "duplicate";
+        case RequestResult::Busy:
+            return "busy";
+        case RequestResult::Invalid:
+        default:
+            return "invalid";
+    }
+}
+
+RequestResult toRequestResult(const PushResult result) {
+    switch (result) {
+        case PushResult::Queued:
+            return RequestResult::Queued;
+        case PushResult::Coalesced:
+            return RequestResult::Coalesced;
+        default:
+            return RequestResult::Busy;
+    }
+}
+
+// requestId can be null for clients that don't send one, those aren't
+// protected against retries
+RequestResult requestFeed(FeedQueue& queue, idempotency::IdempotencyLedger& ledger, const char* requestId, const Source source,
+                          const Dose& dose, const unsigned long nowMs) {
+    const uint64_t requestHash = requestId == nullptr ? NO_REQUEST_ID : idempotency::hashRequestId(requestId, strlen(requestId));
+    if (requestHash != NO_REQUEST_ID) {
+        const bool waiting = queue.isWaiting(requestHash);
+        if (waiting) ledger.countDuplicate();
+        if (waiting || ledger.check(requestHash) == idempotency::Outcome::Duplicate) {
+            hal::logText<DUPLICATE_FEED_REQUEST>(requestId);
+            return RequestResult::Duplicate;
+        }
+    }
+    return toRequestResult(queue.push(source, dose, nowMs, requestHash));
+}
+
+// once a popped command has gone to the feeder. A schedule's slot key isn't
+// a request ID, the scheduler keeps its own record of what fired.
+void recordDispatched(idempotency::IdempotencyLedger& ledger, const FeedCommand& command) {
+    if (command.requestHash != NO_REQUEST_ID && command.source != Source::Scheduler) ledger.record(command.requestHash);
+}
+
+}  // namespace feed_queue
+}  // namespace feeder
@@ -0,0 +1,628 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "feeder-common.h"
+#include "feeding-store.h"
+#include "hal.h"
+
+namespace feeding_store {
+
+uint8_t crc8(const uint8_t* data, const size_t length, uint8_t crc = 0) {
+    for (size_t b = 0; b < length; b++) {
+        crc ^= data[b];
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/************
+ * History page format
+ *
+ * Feedings are kept in fixed size NVS blobs ("h0", "h1", ...) used as a
+ * ring of pages. A page is an 8 byte header:
+ *   bytes 0-3  asOfAdjustedSec of its first feeding
+ *   bytes 4-5  sequence number (wraps)
+ *   byte  6    number of feedings in the page
+ *   byte  7    crc8 of everything else in the page
+ * followed by a record per feeding: the zigzag varint delta from the
+ * previous feeding's asOf (the first one's is from the header's) and a
+ * dose byte. A few feeds a day is 4 bytes per feeding, where each one
+ * used to take its own 32 byte NVS entry.
+ *
+ * The dose byte is whole rotations (up to 127) with the top bit clear, or
+ * with it set the dose in sixteenths of a rotation (up to 7 15/16), for
+ * feedings that weren't whole rotations. Pages from before sub-rotation
+ * doses read back the same (nobody fed 128+ rotations at once).
+ ***********/
+const size_t PAGE_BYTES = 256;
+const size_t PAGE_HEADER_BYTES = 8;
+// 5 varint bytes covers any 32 bit delta, plus the dose byte
+const size_t MAX_RECORD_BYTES = 6;
+const size_t MIN_FEEDINGS_PER_PAGE = (PAGE_BYTES - PAGE_HEADER_BYTES) / MAX_RECORD_BYTES;
+
+// pages needed to always hold the newest `feedings`, whatever is in them and
+// however empty the newest page is
+constexpr size_t pagesFor(const size_t feedings) {
+    return (feedings + MIN_FEEDINGS_PER_PAGE - 1) / MIN_FEEDINGS_PER_PAGE + 1;
+}
+
+const uint8_t DOSE_IN_SIXTEENTHS = 0x80;
+
+uint8_t encodeDose(const feeder::Feeding& feeding) {
+    if (feeding.sixteenths == 0) {
+        return static_cast<uint8_t>(std::min(feeding.rotations, 127u));
+    }
+    const unsigned long sixteenths = std::min(feeding.dose().totalSixteenths(), 127ul);
+    return DOSE_IN_SIXTEENTHS | static_cast<uint8_t>(sixteenths);
+}
+
+void decodeDose(const uint8_t encoded, feeder::Feeding& feeding) {
+    const feeder::Dose dose = (encoded & DOSE_IN_SIXTEENTHS) ? feeder::Dose::ofSixteenths(encoded & 0x7F) : feeder::Dose::ofRotations(encoded);
+    feeding.rotations = dose.rotations;
+    feeding.sixteenths = dose.sixteenths;
+}
+
+class HistoryPage {
+   private:
+    uint8_t _bytes[PAGE_BYTES] = {};
+    size_t _used = 0;
+    uint32_t _lastAsOf = 0;
+
+    static uint32_t readUInt32(const uint8_t* bytes) {
+        return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+               (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+
+    uint8_t computeCrc() const {
+        const uint8_t crc = crc8(_bytes, PAGE_HEADER_BYTES - 1);
+        return crc8(_bytes + PAGE_HEADER_BYTES, _used - PAGE_HEADER_BYTES, crc);
+    }
+
+    // decodes the record at `at`, returns where the next one starts or 0
+    // if it runs off the end
+    size_t decode(size_t at, const size_t end, uint32_t& asOf, uint8_t& dose) const {
+        uint32_t zigzag = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (at >= end) return 0;
+            const uint8_t byte = _bytes[at++];
+            zigzag |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                if (at >= end) return 0;
+                const int32_t delta = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+                asOf += static_cast<uint32_t>(delta);
+                dose = _bytes[at++];
+                return at;
+            }
+        }
+        return 0;
+    }
+
+   public:
+    void reset(const uint16_t sequence, const uint32_t baseAsOf) {
+        memset(_bytes, 0, sizeof(_bytes));
+        for (int i = 0; i < 4; i++) _bytes[i] = static_cast<uint8_t>(baseAsOf >> (8 * i));
+        _bytes[4] = static_cast<uint8_t>(sequence);
+        _bytes[5] = static_cast<uint8_t>(sequence >> 8);
+        _used = PAGE_HEADER_BYTES;
+        _lastAsOf = baseAsOf;
+        _bytes[7] = computeCrc();
+    }
+
+    // false if the page is full
+    bool append(const feeder::Feeding& feeding) {
+        if (getCount() == 0xFF) return false;
+
+        const int32_t delta = static_cast<int32_t>(static_cast<uint32_t>(feeding.asOfAdjustedSec) - _lastAsOf);
+        uint32_t zigzag = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+
+        uint8_t record[MAX_RECORD_BYTES];
+        size_t length = 0;
+        do {
+            record[length] = zigzag & 0x7f;
+            zigzag >>= 7;
+            if (zigzag != 0) record[length] |= 0x80;
+            length++;
+        } while (zigzag != 0);
+        record[length++] = encodeDose(feeding);
+
+        if (_used + length > PAGE_BYTES) return false;
+
+        memcpy(_bytes + _used, record, length);
+        _used += length;
+        _bytes[6]++;
+        _lastAsOf = feeding.asOfAdjustedSec;
+        _bytes[7] = computeCrc();
+        return true;
+    }
+
+    // takes a page as read back from flash, false if it's damaged
+    bool load(const size_t length) {
+        if (length < PAGE_HEADER_BYTES || length > PAGE_BYTES) return false;
+        _used = length;
+        if (_bytes[7] != computeCrc()) return false;
+
+        // walk the records to find where the next append continues from, and
+        // that the count matches what's there
+        uint32_t asOf = getBaseAsOf();
+        uint8_t dose = 0;
+        size_t at = PAGE_HEADER_BYTES;
+        for (unsigned int i = 0; i < getCount(); i++) {
+            at = decode(at, _used, asOf, dose);
+            if (at == 0) return false;
+        }
+        _lastAsOf = asOf;
+        return at == _used;
+    }
+
+    // fn returns false to stop early, which this passes on
+    template <typename Fn>
+    bool forEach(Fn fn) const {
+        uint32_t asOf = getBaseAsOf();
+        uint8_t dose = 0;
+        size_t at = PAGE_HEADER_BYTES;
+        for (unsigned int i = 0; i < getCount(); i++) {
+            at = decode(at, _used, asOf, dose);
+            feeder::Feeding feeding = {.asOfAdjustedSec = asOf, .rotations = 0};
+            decodeDose(dose, feeding);
+            if (at == 0 || !fn(feeding)) return false;
+        }
+        return true;
+    }
+
+    uint32_t getBaseAsOf() const { return readUInt32(_bytes); }
+    uint16_t getSequence() const { return static_cast<uint16_t>(_bytes[4] | (_bytes[5] << 8)); }
+    uint8_t getCount() const { return _bytes[6]; }
+
+    uint8_t* data() { return _bytes; }
+    const uint8_t* data() const { return _bytes; }
+    size_t size() const { return _used; }
+};
+
+/************
+ * FeedingJournal
+ *
+ * Append only persistence of the last N feedings, at least N and up to a
+ * page's worth more. Rewriting a whole page blob costs ~10 NVS entries, so
+ * an append doesn't: the feeding goes in its own u64 entry ("hp0".."hp15"),
+ * one entry of wear, and only every PENDING_FEEDINGS appends (or when the
+ * page fills) are they folded into the page blob. A pending entry is
+ * tagged with the page's sequence and how many feedings its blob held when
+ * it was written, so once they're folded in (or the page moves on) the old
+ * entries no longer match and are just overwritten later.
+ *
+ * A full page is written, then the tip moves to the next. If power is lost
+ * in between the full page is still the tip and the new feeding is lost,
+ * as it would be had power gone before it was written at all.
+ *
+ * Loading only reads the newest pages, enough to fill the in memory window,
+ * so boot time doesn't grow with how much history is kept.
+ ***********/
+struct JournalLoadStats {
+    size_t pagesRead = 0;
+    size_t feedingsRestored = 0;
+    unsigned long tookUs = 0;
+    bool migrated = false;
+};
+
+// feedings an append keeps out of the page blob, see above
+const size_t PENDING_FEEDINGS = 16;
+
+// A pending feeding:
+//   bits  0-31  asOfAdjustedSec
+//   bits 32-39  dose byte, as in a page
+//   bits 40-47  low byte of the page's sequence
+//   bits 48-55  feedings in the page's blob when it was written
+//   bits 56-63  crc8 of the lower 7 bytes
+uint64_t encodePending(const feeder::Feeding& feeding, const uint16_t sequence, const uint8_t flushed) {
+    uint8_t bytes[7];
+    const uint32_t asOf = static_cast<uint32_t>(feeding.asOfAdjustedSec);
+    for (int b = 0; b < 4; b++) bytes[b] = static_cast<uint8_t>(asOf >> (8 * b));
+    bytes[4] = encodeDose(feeding);
+    bytes[5] = static_cast<uint8_t>(sequence);
+    bytes[6] = flushed;
+    uint64_t record = static_cast<uint64_t>(crc8(bytes, sizeof(bytes))) << 56;
+    for (int b = 0; b < 7; b++) record |= static_cast<uint64_t>(bytes[b]) << (8 * b);
+    return record;
+}
+
+// false for a stale, damaged or missing entry
+bool decodePending(const uint64_t record, const uint16_t sequence, const uint8_t flushed, feeder::Feeding& feeding) {
+    uint8_t bytes[7];
+    for (int b = 0; b < 7; b++) bytes[b] = static_cast<uint8_t>(record >> (8 * b));
+    if (static_cast<uint8_t>(record >> 56) != crc8(bytes, sizeof(bytes)) || bytes[5] != static_cast<uint8_t>(sequence) || bytes[6] != flushed) {
+        return false;
+    }
+    feeding.asOfAdjustedSec = static_cast<uint32_t>(record);
+    decodeDose(bytes[4], feeding);
+    return true;
+}
+
+template <size_t N>
+class FeedingJournal {
+   public:
+    static constexpr size_t PAGE_COUNT = pagesFor(N);
+    // the tip only has 16 bits for the page
+    static_assert(PAGE_COUNT <= 0xFFFF, "FeedingJournal can't address more than 65535 pages");
+
+   private:
+    hal::KeyValueStore& _kv;
+
+    HistoryPage _open;
+    size_t _openIndex = 0;
+    bool _hasOpen = false;
+    // feedings of the open page in its blob, the rest are pending
+    uint8_t _flushed = 0;
+    size_t _pagesRead = 0;
+    JournalLoadStats _loadStats;
+    // goes up with every change, see FeedingStore
+    uint32_t _generation = 0;
+
+    static constexpr const char* TIP_KEY = "hTip";
+
+    static void pageKey(char* key, size_t keySize, const size_t page) {
+        snprintf(key, keySize, "h%u", static_cast<unsigned int>(page));
+    }
+
+    bool readPage(const size_t page, HistoryPage& out) {
+        char key[8];
+        pageKey(key, sizeof(key), page);
+        _pagesRead++;
+        return out.load(_kv.getBytes(key, out.data(), PAGE_BYTES));
+    }
+
+    void writePage(const size_t page, const HistoryPage& contents) {
+        char key[8];
+        pageKey(key, sizeof(key), page);
+        _kv.putBytes(key, contents.data(), contents.size());
+    }
+
+    static void pendingKey(char* key, size_t keySize, const size_t slot) {
+        snprintf(key, keySize, "hp%u", static_cast<unsigned int>(slot));
+    }
+
+    void writePending(const feeder::Feeding& feeding) {
+        char key[8];
+        pendingKey(key, sizeof(key), _open.getCount() - 1 - _flushed);
+        _kv.putULong64(key, encodePending(feeding, _open.getSequence(), _flushed));
+    }
+
+    // the open page's pending feedings, after its blob
+    void readPending() {
+        for (size_t slot = 0; slot < PENDING_FEEDINGS; slot++) {
+            char key[8];
+            pendingKey(key, sizeof(key), slot);
+            feeder::Feeding feeding = {.asOfAdjustedSec = 0, .rotations = 0};
+            if (!decodePending(_kv.getULong64(key, 0), _open.getSequence(), _flushed, feeding)) return;
+            if (_open.getCount() == 0) _open.reset(_open.getSequence(), feeding.asOfAdjustedSec);
+            if (!_open.append(feeding)) return;
+        }
+    }
+
+    void flushOpen() {
+        writePage(_openIndex, _open);
+        _flushed = _open.getCount();
+    }
+
+    void writeTip() {
+        _kv.putUInt(TIP_KEY, (static_cast<uint32_t>(_open.getSequence()) << 16) | static_cast<uint32_t>(_openIndex));
+    }
+
+    // puts the feeding in the open page, starting a new one if it's full.
+    // Returns true if it started a new page.
+    bool place(const feeder::Feeding& feeding, const bool writeFullPage) {
+        // a page the tip moved to before anything was written to it
+        if (_hasOpen && _open.getCount() == 0) {
+            _open.reset(_open.getSequence(), feeding.asOfAdjustedSec);
+        }
+        if (_hasOpen && _open.append(feeding)) {
+            return false;
+        }
+
+        if (_hasOpen && writeFullPage && _flushed != _open.getCount()) {
+            writePage(_openIndex, _open);
+        }
+        _flushed = 0;
+        const uint16_t sequence = _hasOpen ? _open.getSequence() + 1 : 1;
+        _openIndex = _hasOpen ? (_openIndex + 1) % PAGE_COUNT : 0;
+        _open.reset(sequence, feeding.asOfAdjustedSec);
+        _open.append(feeding);
+        _hasOpen = true;
+        return true;
+    }
+
+    // Walks back from the open page to the oldest page still part of the
+    // ring. Calls fn(index, page) oldest first, fn returns false to stop.
+    template <typename Fn>
+    void forEachPageOldestFirst(const size_t maxPages, Fn fn) {
+        const size_t pages = std::min(maxPages, PAGE_COUNT);
+        HistoryPage page;
+        for (size_t back = pages - 1; back > 0; back--) {
+            const size_t index = (_openIndex + PAGE_COUNT - back) % PAGE_COUNT;
+            // before the ring has wrapped there's nothing (or a stale page) here
+            if (!readPage(index, page) || page.getSequence() != static_cast<uint16_t>(_open.getSequence() - back)) {
+                continue;
+            }
+            if (!fn(page)) return;
+        }
+        fn(_open);
+    }
+
+    // The newest page that starts before `since`, as how many pages back
+    // forEachPageOldestFirst has to go for it: feedings are journaled in time
+    // order (the clock never steps back, see ntp), so nothing in an older
+    // page is at or after `since`. Bisects the ring on the pages' headers.
+    size_t pagesToCover(const uint32_t since) {
+        if (_open.getCount() > 0 && _open.getBaseAsOf() < since) return 1;
+
+        HistoryPage page;
+        size_t lo = 1;
+        size_t hi = PAGE_COUNT - 1;
+        while (lo < hi) {
+            const size_t back = (lo + hi) / 2;
+            if (pageStartsBefore(back, since, page)) {
+                hi = back;
+            } else {
+                lo = back + 1;
+            }
+        }
+        return lo + 1;
+    }
+
+    bool pageStartsBefore(const size_t back, const uint32_t since, HistoryPage& page) {
+        char key[8];
+        pageKey(key, sizeof(key), (_openIndex + PAGE_COUNT - back) % PAGE_COUNT);
+        _pagesRead++;
+        const size_t length = _kv.getBytes(key, page.data(), PAGE_BYTES);
+        // not written yet, the ring hasn't got this far round
+        if (length == 0) return true;
+        // damaged or stale, so can't say: look further back, which only costs reads
+        if (!page.load(length) || page.getSequence() != static_cast<uint16_t>(_open.getSequence() - back)) return false;
+        return page.getBaseAsOf() < since;
+    }
+
+    /************
+     * Older formats, migrated on first boot
+     ***********/
+    // every build before the paged format kept 50
+    static constexpr size_t LEGACY_SLOTS = 50;
+
+    // One u64 NVS entry per slot ("j<slot>"), plus a tip ("jTip"):
+    //   bits  0-31  asOfAdjustedSec
+    //   bits 32-47  sequence number (wraps)
+    //   bits 48-55  rotations (0 = empty slot)
+    //   bits 56-63  crc8 of the lower 7 bytes
+    static bool decodeSlotRecord(const uint64_t record, feeder::Feeding& feeding, uint16_t& sequence) {
+        uint8_t bytes[7];
+        for (int b = 0; b < 7; b++) bytes[b] = static_cast<uint8_t>(record >> (8 * b));
+        if (static_cast<uint8_t>(record >> 56) != crc8(bytes, sizeof(bytes))) {
+            return false;
+        }
+
+        feeding.asOfAdjustedSec = static_cast<uint32_t>(record);
+        sequence = static_cast<uint16_t>(record >> 32);
+        feeding.rotations = static_cast<uint8_t>(record >> 48);
+        return feeding.rotations != 0;
+    }
+
+    bool readSlotFormat(std::vector<feeder::Feeding>& feedings) {
+        const char* slotTipKey = "jTip";
+        if (!_kv.isKey(slotTipKey)) {
+            return false;
+        }
+
+        const uint32_t tip = _kv.getUInt(slotTipKey, 0);
+        uint16_t lastSequence = static_cast<uint16_t>(tip >> 16);
+        size_t nextSlot = tip & 0xFFFF;
+        if (nextSlot >= LEGACY_SLOTS) {
+            nextSlot = 0;
+        }
+
+        feeder::Feeding records[LEGACY_SLOTS] = {};
+        uint16_t sequences[LEGACY_SLOTS] = {};
+        bool valid[LEGACY_SLOTS] = {};
+        for (size_t i = 0; i < LEGACY_SLOTS; i++) {
+            char key[8];
+            snprintf(key, sizeof(key), "j%u", static_cast<unsigned int>(i));
+            valid[i] = decodeSlotRecord(_kv.getULong64(key, 0), records[i], sequences[i]);
+            _kv.remove(key);
+        }
+        _kv.remove(slotTipKey);
+
+        // a record landed but the tip didn't: roll forward
+        while (valid[nextSlot] && sequences[nextSlot] == static_cast<uint16_t>(lastSequence + 1)) {
+            lastSequence++;
+            nextSlot = (nextSlot + 1) % LEGACY_SLOTS;
+        }
+
+        // oldest first. Anything claiming to be newer than the tip is from a
+        // write that never completed.
+        for (size_t k = 0; k < LEGACY_SLOTS; k++) {
+            const size_t i = (nextSlot + k) % LEGACY_SLOTS;
+            if (valid[i] && static_cast<int16_t>(sequences[i] - lastSequence) <= 0) {
+                feedings.push_back(records[i]);
+            }
+        }
+        return true;
+    }
+
+    // The original format: two keys per slot, {slot + 1, 'D'|'A', 0}, plus
+    // an index key {'I', 0}
+    bool readLegacyFormat(std::vector<feeder::Feeding>& feedings) {
+        const auto KEY_I_OFFSET = static_cast<unsigned char>(1);
+        const char indexKey[] = {'I', 0};
+        if (!_kv.isKey(indexKey)) {
+            return false;
+        }
+
+        const unsigned char index = _kv.getUChar(indexKey, 0);
+        const size_t nextSlot = index < LEGACY_SLOTS ? index : 0;
+        feeder::Feeding records[LEGACY_SLOTS] = {};
+        for (size_t i = 0; i < LEGACY_SLOTS; i++) {
+            const char rotationsKey[] = {static_cast<char>(KEY_I_OFFSET + i), 'D', 0};
+            const char asOfKey[] = {static_cast<char>(KEY_I_OFFSET + i), 'A', 0};
+
+            records[i].rotations = _kv.getUInt(rotationsKey, 0);
+            records[i].asOfAdjustedSec = _kv.getUInt(asOfKey, 0);
+            _kv.remove(rotationsKey);
+            _kv.remove(asOfKey);
+        }
+        _kv.remove(indexKey);
+
+        for (size_t k = 0; k < LEGACY_SLOTS; k++) {
+            const auto& feeding = records[(nextSlot + k) % LEGACY_SLOTS];
+            if (feeding.rotations != 0) {
+                feedings.push_back(feeding);
+            }
+        }
+        return true;
+    }
+
+    bool migrateOlderFormats() {
+        std::vector<feeder::Feeding> feedings;
+        if (!readSlotFormat(feedings) && !readLegacyFormat(feedings)) {
+            return false;
+        }
+
+        for (const auto& feeding : feedings) {
+            place(feeding, true);
+        }
+        if (_hasOpen) {
+            flushOpen();
+            writeTip();
+        }
+        return true;
+    }
+
+   public:
+    FeedingJournal(hal::KeyValueStore& kv) : _kv(kv) {}
+
+    void append(const feeder::Feeding& feeding) {
+        _kv.begin(PREFERENCE_NS, false);
+        if (place(feeding, true)) {
+            writeTip();
+        }
+        if (_open.getCount() - _flushed == PENDING_FEEDINGS) {
+            flushOpen();
+        } else {
+            writePending(feeding);
+        }
+        _kv.end();
+        _generation++;
+    }
+
+    // restores the newest feedings, as many as the store holds
+    template <size_t W>
+    void load(FeedingStore<W>& feedingStore) {
+        const unsigned long startedAt = hal::micros();
+        const size_t pagesReadBefore = _pagesRead;
+        _loadStats = {};
+        _hasOpen = false;
+        _kv.begin(PREFERENCE_NS, false);
+
+        if (!_kv.isKey(TIP_KEY)) {
+            _loadStats.migrated = migrateOlderFormats();
+        } else {
+            const uint32_t tip = _kv.getUInt(TIP_KEY, 0);
+            _openIndex = tip & 0xFFFF;
+            const uint16_t sequence = static_cast<uint16_t>(tip >> 16);
+            _hasOpen = _openIndex < PAGE_COUNT;
+            // the tip's page has no blob until its first PENDING_FEEDINGS are
+            // folded in (or it's damaged): it starts out empty, and what's
+            // pending still counts
+            if (_hasOpen && (!readPage(_openIndex, _open) || _open.getSequence() != sequence)) {
+                _open.reset(sequence, 0);
+            }
+
+            // a page got written but the tip didn't follow (journals from
+            // before pending feedings wrote a new page first): roll forward,
+            // and fix the tip before the ring wraps onto the page it points at
+            HistoryPage next;
+            size_t rolled = 0;
+            while (_hasOpen && rolled < PAGE_COUNT) {
+                const size_t nextIndex = (_openIndex + 1) % PAGE_COUNT;
+                if (!readPage(nextIndex, next) || next.getSequence() != static_cast<uint16_t>(_open.getSequence() + 1)) {
+                    break;
+                }
+                _open = next;
+                _openIndex = nextIndex;
+                rolled++;
+            }
+            if (rolled > 0) {
+                writeTip();
+            }
+
+            if (_hasOpen) {
+                _flushed = _open.getCount();
+                readPending();
+            }
+        }
+
+        if (_hasOpen) {
+            // the store is a ring, so overfilling it just leaves the newest W
+            forEachPageOldestFirst(pagesFor(W), [&](const HistoryPage& page) {
+                return page.forEach([&](const feeder::Feeding& feeding) {
+                    feedingStore.addFeeding(feeding);
+                    _loadStats.feedingsRestored++;
+                    return true;
+                });
+            });
+            _loadStats.feedingsRestored = std::min(_loadStats.feedingsRestored, W);
+        }
+
+        _kv.end();
+        _generation++;
+        _loadStats.pagesRead = _pagesRead - pagesReadBefore;
+        _loadStats.tookUs = hal::micros() - startedAt;
+    }
+
+    // Every feeding kept, oldest first, read a page at a time. fn returns
+    // false to stop early.
+    template <typename Fn>
+    void forEachOldestFirst(Fn fn) {
+        if (!_hasOpen) return;
+
+        _kv.begin(PREFERENCE_NS, true);
+        forEachPageOldestFirst(PAGE_COUNT, [&](const HistoryPage& page) { return page.forEach(fn); });
+        _kv.end();
+    }
+
+    // The feedings at or after sinceAdjustedSec, oldest first, reading only
+    // the pages they're in (and a few headers to find them). fn returns
+    // false to stop early.
+    template <typename Fn>
+    void forEachSince(const uint32_t sinceAdjustedSec, Fn fn) {
+        if (!_hasOpen) return;
+
+        _kv.begin(PREFERENCE_NS, true);
+        forEachPageOldestFirst(pagesToCover(sinceAdjustedSec), [&](const HistoryPage& page) {
+            return page.forEach([&](const feeder::Feeding& feeding) { return feeding.asOfAdjustedSec < sinceAdjustedSec || fn(feeding); });
+        });
+        _kv.end();
+    }
+
+    const JournalLoadStats& getLoadStats() const { return _loadStats; }
+    size_t getPagesRead() const { return _pagesRead; }
+    uint32_t getGeneration() const { return _generation; }
+};
+
+template <size_t W, size_t N>
+void persistLatestFeeding(std::shared_ptr<FeedingJournal<N>> journal, std::shared_ptr<FeedingStore<W>> feedingStore) {
+    journal->append(feedingStore->getFeedings()[feedingStore->getNewestIndex()]);
+}
+
+template <size_t W, size_t N>
+std::unique_ptr<FeedingStore<W>> setupFeedingStore(std::shared_ptr<FeedingJournal<N>> journal) {
+    auto feedingStore = std::make_unique<FeedingStore<W>>();
+    journal->load(*feedingStore);
+    return feedingStore;
+}
+
+}  // namespace feeding_store
@@ -1,10 +1,8 @@
 #pragma once
 
-#include <Preferences.h>
-
-#include <functional>
-#include <memory>
-#include <vector>
+#include <array>
+#include <cstdint>
+#include <type_traits>
 
 #include "feeder-common.h"
 
@@ -14,123 +12,120 @@ namespace feeding_store {
 
 const char* PREFERENCE_NS = "feeder";
 
-/************
- * I/O
- ***********/
-Preferences preferences;
-
-const size_t FEEDINGS_TO_KEEP = 50;
-
-// +1 to avoid inserting a null pointer at the beginning of the string
-const auto KEY_I_OFFSET = static_cast<unsigned char>(1);
-#define ROTATIONS_KEY(i) \
-    { static_cast<unsigned char>(KEY_I_OFFSET + i), 'D', 0 }
-#define AS_OF_KEY(i) \
-    { static_cast<unsigned char>(KEY_I_OFFSET + i), 'A', 0 }
-#define INDEX_KEY \
-    { 'I', 0 }
-
-void persistFeeding(const unsigned char i, const feeder::Feeding& feeding) {
-    char rotationsKey[] = ROTATIONS_KEY(i);
-    char asOfKey[] = AS_OF_KEY(i);
-    ;
-
-    preferences.putUInt(rotationsKey, feeding.rotations);
-    preferences.putULong(asOfKey, feeding.asOfAdjustedSec);
-}
-
-feeder::Feeding readFeeding(const unsigned char i) {
-    feeder::Feeding feeding;
+// How many feedings the journal keeps in flash. Override with
+// -DFEEDER_FEEDINGS_TO_KEEP=<n>, see partitions-history.csv for room to keep
+// tens of thousands.
+#ifndef FEEDER_FEEDINGS_TO_KEEP
+#define FEEDER_FEEDINGS_TO_KEEP 1024
+#endif
+const size_t FEEDINGS_TO_KEEP = FEEDER_FEEDINGS_TO_KEEP;
 
-    char rotationsKey[] = ROTATIONS_KEY(i);
-    char asOfKey[] = AS_OF_KEY(i);
-    ;
+// The newest of those, held in RAM for the root page
+const size_t FEEDINGS_IN_MEMORY = 50;
 
-    feeding.rotations = preferences.getUInt(rotationsKey, 0);
-    feeding.asOfAdjustedSec = preferences.getULong(asOfKey, 0);
-
-    return feeding;
-}
-
-void persistIndex(const unsigned char i) {
-    char indexKey[] = INDEX_KEY;
-    preferences.putUChar(indexKey, i);
-}
-
-unsigned char readIndex() {
-    char indexKey[] = INDEX_KEY;
-    return preferences.getUChar(indexKey);
-}
+// smallest unsigned type that can index N slots
+template <size_t N>
+using SlotIndex = typename std::conditional<(N <= 0xFF), uint8_t, typename std::conditional<(N <= 0xFFFF), uint16_t, uint32_t>::type>::type;
 
 /************
  * FeedingStore
+ *
+ * Fixed capacity ring. Slots fill in feeding order, so walking back from the
+ * tip gives the feedings newest first without sorting anything. The
+ * generation goes up with every change, for caching what's rendered from it.
  ***********/
 template <size_t N>
 class FeedingStore {
+   public:
+    using Slot = SlotIndex<N>;
+
+    // newest first, skipping empty slots. Holds nothing but a couple of
+    // indexes, so iterating it doesn't allocate.
+    class NewestFirst {
+       public:
+        class iterator {
+           private:
+            const FeedingStore* _store;
+            // how many slots back from the newest
+            size_t _back;
+
+            void skipEmpty() {
+                while (_back < N && _store->slotFromNewest(_back).isEmpty()) {
+                    _back++;
+                }
+            }
+
+           public:
+            iterator(const FeedingStore* store, const size_t back) : _store(store), _back(back) { skipEmpty(); }
+
+            const feeder::Feeding& operator*() const { return _store->slotFromNewest(_back); }
+            const feeder::Feeding* operator->() const { return &_store->slotFromNewest(_back); }
+
+            iterator& operator++() {
+                _back++;
+                skipEmpty();
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const { return _back == other._back; }
+            bool operator!=(const iterator& other) const { return _back != other._back; }
+        };
+
+       private:
+        const FeedingStore* _store;
+
+       public:
+        NewestFirst(const FeedingStore* store) : _store(store) {}
+
+        iterator begin() const { return iterator(_store, 0); }
+        iterator end() const { return iterator(_store, N); }
+    };
+
    private:
-    std::vector<feeder::Feeding> _mostRecentFeedings;
-    unsigned char _tipIndex = 0;
+    std::array<feeder::Feeding, N> _mostRecentFeedings{};
+    Slot _tipIndex = 0;
+    uint32_t _generation = 0;
 
-   public:
-    FeedingStore() : _mostRecentFeedings(N) {}
+    const feeder::Feeding& slotFromNewest(const size_t back) const {
+        return _mostRecentFeedings[(_tipIndex + N - 1 - back) % N];
+    }
 
-    void addFeeding(const feeder::Feeding feeding, bool persist = false) {
-        _mostRecentFeedings[_tipIndex] = feeding;
+   public:
+    // returns the slot the feeding was written to
+    Slot addFeeding(const feeder::Feeding feeding) {
+        const Slot slot = _tipIndex;
+        _mostRecentFeedings[slot] = feeding;
         _tipIndex++;
         if (_tipIndex >= N) {
             _tipIndex = 0;
         }
+        _generation++;
+        return slot;
     };
 
-    const std::vector<feeder::Feeding>& getFeedings() {
+    const std::array<feeder::Feeding, N>& getFeedings() const {
         return _mostRecentFeedings;
     }
 
-    const std::vector<std::reference_wrapper<feeder::Feeding>> getFeedingsSortedByAsOf() {
-        std::vector<std::reference_wrapper<feeder::Feeding>> sorted{_mostRecentFeedings.begin(), _mostRecentFeedings.end()};
-        std::sort(sorted.begin(), sorted.end(),
-                  [](std::reference_wrapper<feeder::Feeding>& a, std::reference_wrapper<feeder::Feeding>& b) { return a.get().asOfAdjustedSec > b.get().asOfAdjustedSec; });
-        return sorted;
-    }
-
-    void
-    updateTipIndex(const unsigned char tipIndex) {
-        _tipIndex = tipIndex;
-    }
-
-    const unsigned char getTipIndex() { return _tipIndex; }
-};
-
-template <size_t N>
-void persistFeedingStore(std::shared_ptr<FeedingStore<N>> feedingStore) {
-    preferences.begin(PREFERENCE_NS, false);
-    auto& feedings = feedingStore->getFeedings();
-    for (unsigned char i = 0; i < feedings.size(); i++) {
-        persistFeeding(i, feedings[i]);
+    // walks the ring from the oldest slot to the newest, skipping empty ones.
+    // fn returns false to stop early.
+    template <typename Fn>
+    void forEachOldestFirst(Fn fn) const {
+        for (size_t k = 0; k < N; k++) {
+            const auto& feeding = _mostRecentFeedings[(_tipIndex + k) % N];
+            if (!feeding.isEmpty() && !fn(feeding)) {
+                return;
+            }
+        }
     }
 
-    persistIndex(feedingStore->getTipIndex());
-    preferences.end();
-}
+    NewestFirst newestFirst() const { return NewestFirst(this); }
 
-#include "Arduino.h"
-template <size_t N>
-std::unique_ptr<FeedingStore<N>> setupFeedingStore() {
-    auto feedingStore = std::make_unique<FeedingStore<N>>();
-
-    preferences.begin(PREFERENCE_NS, true);
-    for (unsigned char i = 0; i < N; i++) {
-        feeder::Feeding feeding = readFeeding(i);
-        if (feeding.rotations != 0) {
-            feedingStore->addFeeding(feeding);
-        }
-    }
+    Slot getTipIndex() const { return _tipIndex; }
 
-    auto index = readIndex();
-    feedingStore->updateTipIndex(index);
-    preferences.end();
+    uint32_t getGeneration() const { return _generation; }
 
-    return std::move(feedingStore);
-}
+    Slot getNewestIndex() const { return _tipIndex == 0 ? N - 1 : _tipIndex - 1; }
+};
 
 }  // namespace feeding_store
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "feeding-store.h"
+#include "hal.h"
+
+namespace feeder {
+namespace idempotency {
+
+/************************
+ * Idempotency ledger
+ *
+ * Remembers the request IDs of the last WINDOW feeds so a retried MQTT
+ * message or a resubmitted form doesn't feed twice, reboots included.
+ *
+ * An ID is recorded when its feed goes to the feeder (and is journaled),
+ * not when it's queued: the queue is only in RAM, so a reboot loses what's
+ * waiting in it, and the client's retry has to be let through then. While
+ * the feed waits the queue itself spots the retry, see feed_queue.
+ *
+ * IDs are kept as 48 bit hashes in a small open addressing table (O(1)
+ * lookups) threaded onto an LRU list, so the least recently seen ID is the
+ * one that falls out when the window is full.
+ *
+ * Each new ID is persisted as a single u64 NVS entry, 48 bit hash | 16 bit
+ * sequence, into slot sequence % WINDOW. No tip to keep in step: the
+ * sequence numbers say which entry is newest. After a reboot the window is
+ * the last WINDOW IDs recorded (recency from duplicates isn't persisted).
+ ************************/
+const uint8_t WINDOW = 64;
+static_assert((WINDOW & (WINDOW - 1)) == 0, "WINDOW has to divide the 16 bit sequence space");
+
+enum class Outcome {
+    New,
+    Duplicate,
+};
+
+const uint64_t HASH_MASK = 0xFFFFFFFFFFFFULL;
+
+// FNV-1a, cut down to 48 bits. 0 marks an empty NVS slot so it's never used.
+uint64_t hashRequestId(const char* requestId, const size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<uint8_t>(requestId[i]);
+        hash *= 1099511628211ULL;
+    }
+    hash = (hash ^ (hash >> 48)) & HASH_MASK;
+    return hash == 0 ? 1 : hash;
+}
+
+struct LedgerStats {
+    unsigned long recorded = 0;
+    unsigned long duplicates = 0;
+    unsigned long evicted = 0;
+};
+
+class IdempotencyLedger {
+   private:
+    static const uint8_t NONE = 0xFF;
+    static const size_t TABLE_SIZE = WINDOW * 2;
+
+    struct Entry {
+        uint64_t hash;
+        // LRU list, head is the most recently seen
+        uint8_t newer;
+        uint8_t older;
+    };
+
+    hal::KeyValueStore& _kv;
+
+    Entry _entries[WINDOW];
+    uint8_t _size = 0;
+    uint8_t _newest = NONE;
+    uint8_t _oldest = NONE;
+    // entry indexes, NONE when empty. Kept at most half full.
+    uint8_t _table[TABLE_SIZE];
+
+    uint16_t _sequence = 0;
+    LedgerStats _stats;
+
+    static size_t homeOf(const uint64_t hash) { return hash & (TABLE_SIZE - 1); }
+
+    static void slotKey(char* key, size_t keySize, const size_t slot) {
+        snprintf(key, keySize, "id%u", static_cast<unsigned int>(slot));
+    }
+
+    // table position holding hash, or the empty one it would go in
+    size_t probe(const uint64_t hash) const {
+        size_t at = homeOf(hash);
+        while (_table[at] != NONE && _entries[_table[at]].hash != hash) {
+            at = (at + 1) & (TABLE_SIZE - 1);
+        }
+        return at;
+    }
+
+    // backward shift delete, keeps every probe chain unbroken without
+    // tombstones
+    void removeFromTable(size_t hole) {
+        _table[hole] = NONE;
+        size_t at = hole;
+        for (;;) {
+            at = (at + 1) & (TABLE_SIZE - 1);
+            if (_table[at] == NONE) return;
+
+            const size_t home = homeOf(_entries[_table[at]].hash);
+            const bool homeBetween = hole <= at ? (hole < home && home <= at) : (hole < home || home <= at);
+            if (!homeBetween) {
+                _table[hole] = _table[at];
+                _table[at] = NONE;
+                hole = at;
+            }
+        }
+    }
+
+    void unlink(const uint8_t index) {
+        auto& entry = _entries[index];
+        if (entry.newer != NONE) _entries[entry.newer].older = entry.older;
+        else _newest = entry.older;
+        if (entry.older != NONE) _entries[entry.older].newer = entry.newer;
+        else _oldest = entry.newer;
+    }
+
+    void linkNewest(const uint8_t index) {
+        auto& entry = _entries[index];
+        entry.newer = NONE;
+        entry.older = _newest;
+        if (_newest != NONE) _entries[_newest].newer = index;
+        _newest = index;
+        if (_oldest == NONE) _oldest = index;
+    }
+
+    // into RAM only, returns false if it was already there
+    bool insert(const uint64_t hash) {
+        const size_t at = probe(hash);
+        if (_table[at] != NONE) {
+            const uint8_t index = _table[at];
+            unlink(index);
+            linkNewest(index);
+            return false;
+        }
+
+        uint8_t index;
+        if (_size < WINDOW) {
+            index = _size++;
+        } else {
+            index = _oldest;
+            unlink(index);
+            removeFromTable(probe(_entries[index].hash));
+            _stats.evicted++;
+        }
+
+        _entries[index].hash = hash;
+        linkNewest(index);
+        // the eviction may have shifted the chain, look again
+        _table[probe(hash)] = index;
+        return true;
+    }
+
+   public:
+    IdempotencyLedger(hal::KeyValueStore& kv) : _kv(kv) { memset(_table, NONE, sizeof(_table)); }
+
+    void load() {
+        uint64_t records[WINDOW];
+        bool anyValid = false;
+        uint16_t newest = 0;
+
+        _kv.begin(feeding_store::PREFERENCE_NS, true);
+        for (size_t slot = 0; slot < WINDOW; slot++) {
+            char key[8];
+            slotKey(key, sizeof(key), slot);
+            records[slot] = _kv.getULong64(key, 0);
+
+            const uint16_t sequence = records[slot] >> 48;
+            // a slot only ever holds sequences that land on it
+            if ((records[slot] & HASH_MASK) == 0 || sequence % WINDOW != slot) {
+                records[slot] = 0;
+                continue;
+            }
+            if (!anyValid || static_cast<int16_t>(sequence - newest) > 0) {
+                newest = sequence;
+            }
+            anyValid = true;
+        }
+        _kv.end();
+
+        // oldest first, so the LRU order comes back as it was recorded
+        for (uint16_t back = WINDOW; anyValid && back > 0; back--) {
+            const uint16_t sequence = newest - (back - 1);
+            const uint64_t record = records[sequence % WINDOW];
+            if (record != 0 && static_cast<uint16_t>(record >> 48) == sequence) {
+                insert(record & HASH_MASK);
+            }
+        }
+        _sequence = anyValid ? newest : 0;
+        _stats = {};
+    }
+
+    // O(1), whether the ID was recorded. Doesn't record it.
+    Outcome check(const uint64_t hash) {
+        const size_t at = probe(hash);
+        if (_table[at] == NONE) return Outcome::New;
+
+        unlink(_table[at]);
+        linkNewest(_table[at]);
+        _stats.duplicates++;
+        return Outcome::Duplicate;
+    }
+
+    // a retry spotted somewhere else (the feed is still queued)
+    void countDuplicate() { _stats.duplicates++; }
+
+    // O(1). Records the ID (in RAM and NVS) as its feed starts.
+    void record(const uint64_t hash) {
+        if (!insert(hash)) return;
+
+        _sequence++;
+        char key[8];
+        slotKey(key, sizeof(key), _sequence % WINDOW);
+        _kv.begin(feeding_store::PREFERENCE_NS, false);
+        _kv.putULong64(key, (static_cast<uint64_t>(_sequence) << 48) | hash);
+        _kv.end();
+
+        _stats.recorded++;
+    }
+
+    size_t size() const { return _size; }
+    const LedgerStats& getStats() const { return _stats; }
+};
+
+const char* describe(const Outcome outcome) {
+    return outcome == Outcome::New ? "new" : "duplicate";
+}
+
+}  // namespace idempotency
+}  // namespace feeder
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include "fanout-ring.h"
+
+namespace feeder {
+namespace live_events {
+
+/************************
+ * Live events
+ *
+ * The feed events for GET /events, kept as ready to send Server-Sent Events
+ * frames:
+ *
+ *   id: 12
+ *   event: feedStarted
+ *   data: {"asOf":..,"rotations":1,"sixteenths":4,"dose":1.25}
+ *
+ * Each is rendered once when it happens and every open page reads the same
+ * copy out of a fan-out ring. The id is the ring's sequence number, so a
+ * browser that reconnects with Last-Event-ID picks up where it left off if
+ * the ring still has it. A page that falls more than LIVE_EVENT_SLOTS
+ * behind loses the oldest and carries on, counted as lagged.
+ ************************/
+const size_t LIVE_EVENT_SIZE = 224;
+const size_t LIVE_EVENT_SLOTS = 16;
+
+struct LiveEvent {
+    uint16_t length;
+    char frame[LIVE_EVENT_SIZE];
+};
+
+struct LiveEventStats {
+    unsigned long published = 0;
+    // didn't fit a frame
+    unsigned long dropped = 0;
+    // overwritten before a page read them, once per page
+    unsigned long lagged = 0;
+};
+
+class LiveEvents {
+   private:
+    richiev::FanoutRing<LiveEvent, LIVE_EVENT_SLOTS> _ring;
+    LiveEventStats _stats;
+
+    static bool parseSequence(const std::string_view text, uint32_t& sequence) {
+        if (text.empty() || text.size() > 9) return false;
+        sequence = 0;
+        for (const char c : text) {
+            if (c < '0' || c > '9') return false;
+            sequence = sequence * 10 + (c - '0');
+        }
+        return true;
+    }
+
+   public:
+    // the same shape as Outbox::push so the feed_events renderers take
+    // either. The event is named for the part of the topic after its '/'.
+    template <typename... Args>
+    bool push(const char* topic, const char* format, const Args... args) {
+        const char* slash = strchr(topic, '/');
+        const char* name = slash != nullptr ? slash + 1 : topic;
+
+        LiveEvent event;
+        const int head = snprintf(event.frame, LIVE_EVENT_SIZE, "id: %lu\nevent: %s\ndata: ", static_cast<unsigned long>(_ring.head()), name);
+        if (head <= 0 || head >= static_cast<int>(LIVE_EVENT_SIZE)) {
+            _stats.dropped++;
+            return false;
+        }
+        const int data = snprintf(event.frame + head, LIVE_EVENT_SIZE - head, format, args...);
+        // room for the blank line that ends it
+        if (data <= 0 || head + data + 2 >= static_cast<int>(LIVE_EVENT_SIZE)) {
+            _stats.dropped++;
+            return false;
+        }
+        memcpy(event.frame + head + data, "\n\n", 2);
+        event.length = static_cast<uint16_t>(head + data + 2);
+        _ring.push(event);
+        _stats.published++;
+        return true;
+    }
+
+    // where a new page starts reading: just after lastEventId if it
+    // reconnected, or at since (the head when it was rendered) for a page
+    // that just loaded, if the ring still has what it missed. Otherwise
+    // with whatever comes next.
+    uint32_t startFor(const std::string_view lastEventId, const std::string_view since) const {
+        uint32_t sequence = 0;
+        if (parseSequence(lastEventId, sequence) && _ring.contains(sequence)) return sequence + 1;
+        if (parseSequence(since, sequence) && (sequence == _ring.head() || _ring.contains(sequence))) return sequence;
+        return _ring.head();
+    }
+
+    // for a page to hand back as since
+    uint32_t head() const { return _ring.head(); }
+
+    // copies the next frame for the page at cursor into out, 0 if it's
+    // caught up
+    size_t next(uint32_t& cursor, char* out, const size_t size) {
+        uint32_t skipped = 0;
+        const LiveEvent* event = _ring.read(cursor, skipped);
+        if (skipped > 0) _stats.lagged += skipped;
+        if (event == nullptr || event->length > size) return 0;
+        memcpy(out, event->frame, event->length);
+        return event->length;
+    }
+
+    const LiveEventStats& getStats() const { return _stats; }
+};
+
+}  // namespace live_events
+}  // namespace feeder
@@ -1,12 +1,15 @@
 #include <Arduino.h>
-#include <NTPClient.h>
 
+#include "boot-timeline.h"
+#include "event-log.h"
+#include "feeder-task.h"
 #include "feeder.h"
+#include "metrics.h"
 #include "mqtt.h"
 #include "mywifi.h"
 #include "ntp.h"
 #include "ota.h"
-#include "controller.h"
+#include "controller-network.h"
 
 // pull in all the inputs last to make sure they're only being referenced from here
 #include "inputs.h"
@@ -18,7 +21,8 @@ namespace feeder {
 MqttBroker mqttBroker(MQTT_BROKER_PORT);
 MqttClient mqttClient(&mqttBroker);
 
-std::shared_ptr<NTPClient> timeClient;
+std::shared_ptr<ntp::TimeService> timeService;
+std::unique_ptr<richiev::WifiConnection> wifi;
 
 RotationSensorPins rotationSensorPins = {
     .input = 23};
@@ -26,34 +30,97 @@ RotationSensorPins rotationSensorPins = {
 MotorPins motorPins = {
     .powerOutput = 22};
 
+// Networking gets core 0 (alongside the WiFi stack), the feeder task has core 1
+const int NETWORK_TASK_CORE = 0;
+const int NETWORK_TASK_STACK_SIZE = 8192;
+const int NETWORK_TASK_PRIORITY = 1;
+
+void loop();
+
+// the network half of startup, once Wi-Fi has associated: NTP's first
+// request, OTA, the web server and MQTT
+void startNetwork() {
+    boot::timeline.end(boot::Phase::WifiAssociate);
+    boot::timeline.begin(boot::Phase::StartNetwork);
+    richiev::ota::setupOTA(hostname);
+    // sends the first NTP request, the reply is handled from loop()
+    timeService = std::move(ntp::setupNTP());
+    controller::setupController(mqttBroker, mqttClient, timeService, *wifi);
+    boot::timeline.end(boot::Phase::StartNetwork);
+    boot::timeline.networkReady(wifi->wasFastConnect());
+}
+
+void networkTask(void*) {
+    while (!wifi->poll(hal::millis())) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    startNetwork();
+
+    for (;;) {
+        loop();
+        // let the idle task (and its watchdog) run
+        vTaskDelay(1);
+    }
+}
+
+// Wi-Fi associates while the feedings load and the feeder task starts, so
+// the feeder is ready well before the network is. Nothing can ask for a feed
+// until the network is up anyway: requests come in over it, and the
+// scheduler waits on NTP.
 void setup() {
     Serial.begin(115200);
+    // anything logged from here on is written out by this, not the logger
+    hal::startLogDrainTask();
 
-    richiev::connectWifi(hostname, wifiSSID, wifiPassword);
-    richiev::ota::setupOTA(hostname);
+    boot::timeline.begin(boot::Phase::WifiAssociate);
+    wifi = std::make_unique<richiev::WifiConnection>(hostname, wifiSSID, wifiPassword, controller::preferencesStore);
+    wifi->begin(hal::millis());
 
-    // trigger a NTP refresh
-    timeClient = std::move(ntp::setupNTP());
+    boot::timeline.begin(boot::Phase::LoadState);
+    controller::setupControllerState();
+    boot::timeline.end(boot::Phase::LoadState);
 
-    controller::setupController(mqttBroker, mqttClient, timeClient);
+    boot::timeline.begin(boot::Phase::StartFeeder);
     setupFeeder(rotationSensorPins, motorPins);
+    startFeederTask();
+    boot::timeline.end(boot::Phase::StartFeeder);
+
+    xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK_SIZE, nullptr, NETWORK_TASK_PRIORITY, nullptr, NETWORK_TASK_CORE);
 }
 
+// Runs on the network task once Wi-Fi has associated the first time. The
+// feeder has its own task, so this keeps running through feeds, and through
+// later Wi-Fi outages: the clock carries on from the last NTP sync, so
+// schedules still fire, and everything else picks up again once it's back.
+//
+// Before that first association there's nothing for it to do. The feeder has
+// no clock until NTP answers, so no schedule can fire, and nothing else can
+// ask for a feed. If the access point is down at power on the feeder waits,
+// retrying, until it's back.
 void loop() {
-    const unsigned long loopStartedAt = timeClient->getEpochTime();
-    loopFeeder(loopStartedAt);
-
-    // Don't run this when the feeder is going, because this blocks and I
-    // don't want networking to affect food being dumped in
-    if (!isInFeed()) {
+    hal::ScopedTimer loopTimer(metrics::loopTime);
+    {
+        hal::ScopedTimer timer(metrics::wifiTime);
+        wifi->poll(hal::millis());
+        if (wifi->takeRestored()) richiev::mqtt::resubscribeMQTT(mqttClient);
+    }
+    {
+        hal::ScopedTimer timer(metrics::mqttTime);
         richiev::mqtt::loopMQTT(mqttBroker, feeder::mqttClient);
-        controller::loopController();
+    }
+    controller::loopController();
 
-        ntp::loopNTP(timeClient);
+    {
+        hal::ScopedTimer timer(metrics::ntpTime);
+        ntp::loopNTP(timeService);
+    }
+    {
+        hal::ScopedTimer timer(metrics::otaTime);
         richiev::ota::loopOTA();
     }
 }
 }  // namespace feeder
 
 void setup() { feeder::setup(); }
-void loop() { feeder::loop(); }
+// everything runs on the feeder and network tasks, Arduino's loopTask isn't needed
+void loop() { vTaskDelete(nullptr); }
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include "feeder-task.h"
+#include "latency-histogram.h"
+
+namespace feeder {
+namespace metrics {
+
+/************************
+ * Timers
+ *
+ * One per subsystem loop() calls, plus the feeder task's pass (which
+ * feeder-task.h keeps).
+ ************************/
+hal::LatencyHistogram loopTime("feeder_loop_duration_microseconds", "One pass of the network task's loop()");
+hal::LatencyHistogram mqttTime("feeder_mqtt_loop_duration_microseconds", "MQTT broker and client loop");
+hal::LatencyHistogram webTime("feeder_web_loop_duration_microseconds", "HTTP server poll, including any requests it served");
+hal::LatencyHistogram persistTime("feeder_persist_duration_microseconds", "Writing a finished feeding to NVS");
+hal::LatencyHistogram ntpTime("feeder_ntp_loop_duration_microseconds", "NTP client loop");
+hal::LatencyHistogram otaTime("feeder_ota_loop_duration_microseconds", "OTA handler loop");
+hal::LatencyHistogram wifiTime("feeder_wifi_loop_duration_microseconds", "Wi-Fi supervisor poll, including any reconnect it started");
+
+hal::LatencyHistogram* const HISTOGRAMS[] = {&loopTime, &mqttTime, &webTime, &persistTime, &ntpTime, &otaTime, &wifiTime, &feederPassTime};
+
+/************************
+ * Counters and gauges
+ *
+ * Filled in when asked for, from the stats the modules already keep.
+ ************************/
+struct Snapshot {
+    unsigned long uptimeMs = 0;
+    unsigned long feedsQueued = 0;
+    unsigned long feedsDispatched = 0;
+    unsigned long feedsCompleted = 0;
+    unsigned long feedsRejectedBusy = 0;
+    unsigned long duplicateRequests = 0;
+    unsigned long scheduledFeedsRefused = 0;
+    unsigned long forcedRotations = 0;
+    unsigned long slowRotations = 0;
+    unsigned long logLines = 0;
+    unsigned long eventsPublished = 0;
+    unsigned long eventsDropped = 0;
+    unsigned long httpRequests = 0;
+    unsigned long httpDropped = 0;
+    unsigned long eventStreams = 0;
+    unsigned long liveEventsLagged = 0;
+    unsigned long responseCacheHits = 0;
+    unsigned long responseCacheMisses = 0;
+    // 0 off device
+    unsigned long freeHeapBytes = 0;
+    unsigned long largestFreeBlockBytes = 0;
+    unsigned long bootFeederReadyMs = 0;
+    unsigned long bootNetworkReadyMs = 0;
+    unsigned long wifiConnected = 0;
+    unsigned long wifiLinkLosses = 0;
+    unsigned long wifiReconnects = 0;
+    unsigned long wifiFailedAttempts = 0;
+};
+
+struct MetricDescription {
+    const char* name;
+    const char* type;
+    const char* help;
+    unsigned long Snapshot::*field;
+};
+
+const MetricDescription SNAPSHOT_METRICS[] = {
+    {"feeder_uptime_milliseconds", "gauge", "Time since boot", &Snapshot::uptimeMs},
+    {"feeder_feeds_queued_total", "counter", "Feeds put on the queue", &Snapshot::feedsQueued},
+    {"feeder_feeds_dispatched_total", "counter", "Feeds handed to the feeder task", &Snapshot::feedsDispatched},
+    {"feeder_feeds_completed_total", "counter", "Feeds the feeder task finished", &Snapshot::feedsCompleted},
+    {"feeder_feeds_rejected_busy_total", "counter", "Feeds refused because the queue was full", &Snapshot::feedsRejectedBusy},
+    {"feeder_duplicate_requests_total", "counter", "Feed requests dropped as repeats of an earlier request ID", &Snapshot::duplicateRequests},
+    {"feeder_scheduled_feeds_refused_total", "counter", "Scheduled slots the full queue turned away, each retried until fed or too late", &Snapshot::scheduledFeedsRefused},
+    {"feeder_forced_rotations_total", "counter", "Rotations forced to a stop by the timeout", &Snapshot::forcedRotations},
+    {"feeder_slow_rotations_total", "counter", "Rotations well over the learnt mean", &Snapshot::slowRotations},
+    {"feeder_log_lines_total", "counter", "Event log records written out", &Snapshot::logLines},
+    {"feeder_mqtt_events_published_total", "counter", "Status and feed event messages published", &Snapshot::eventsPublished},
+    {"feeder_mqtt_events_dropped_total", "counter", "Status and feed event messages dropped with the outbox full", &Snapshot::eventsDropped},
+    {"feeder_http_requests_total", "counter", "HTTP requests answered", &Snapshot::httpRequests},
+    {"feeder_http_dropped_total", "counter", "HTTP connections dropped part way, stalled or with the page changing under them", &Snapshot::httpDropped},
+    {"feeder_http_event_streams", "gauge", "Pages open on /events", &Snapshot::eventStreams},
+    {"feeder_live_events_lagged_total", "counter", "Live events a page fell too far behind to get", &Snapshot::liveEventsLagged},
+    {"feeder_response_cache_hits_total", "counter", "Root page tables and history pages served from the response cache", &Snapshot::responseCacheHits},
+    {"feeder_response_cache_misses_total", "counter", "Root page tables and history pages rendered afresh", &Snapshot::responseCacheMisses},
+    {"feeder_free_heap_bytes", "gauge", "Free heap", &Snapshot::freeHeapBytes},
+    {"feeder_largest_free_block_bytes", "gauge", "Largest allocatable heap block", &Snapshot::largestFreeBlockBytes},
+    {"feeder_boot_feeder_ready_milliseconds", "gauge", "Time from power on until the feeder task could feed", &Snapshot::bootFeederReadyMs},
+    {"feeder_boot_network_ready_milliseconds", "gauge", "Time from power on until Wi-Fi, the web server and MQTT were up", &Snapshot::bootNetworkReadyMs},
+    {"feeder_wifi_connected", "gauge", "1 while Wi-Fi is connected", &Snapshot::wifiConnected},
+    {"feeder_wifi_link_losses_total", "counter", "Times the Wi-Fi link dropped", &Snapshot::wifiLinkLosses},
+    {"feeder_wifi_reconnects_total", "counter", "Times Wi-Fi came back after dropping", &Snapshot::wifiReconnects},
+    {"feeder_wifi_failed_attempts_total", "counter", "Wi-Fi connect attempts that timed out and backed off", &Snapshot::wifiFailedAttempts},
+};
+
+const size_t HISTOGRAM_COUNT = sizeof(HISTOGRAMS) / sizeof(HISTOGRAMS[0]);
+
+// the counters and a copy of every timer, taken at once, so a response can
+// be rendered more than once and come out the same each time
+struct Capture {
+    Snapshot snapshot;
+    hal::LatencyHistogram histograms[HISTOGRAM_COUNT] = {loopTime, mqttTime, webTime, persistTime, ntpTime, otaTime, wifiTime, feederPassTime};
+
+    void take(const Snapshot& current) {
+        snapshot = current;
+        for (size_t i = 0; i < HISTOGRAM_COUNT; i++) {
+            histograms[i].copyCounts(*HISTOGRAMS[i]);
+        }
+    }
+};
+
+/************************
+ * GET /metrics
+ *
+ * Prometheus text format. Counters reset on reboot, which Prometheus
+ * handles.
+ ************************/
+template <typename Writer>
+void renderPrometheus(Writer& out, const Capture& capture) {
+    const Snapshot& snapshot = capture.snapshot;
+    for (const auto& metric : SNAPSHOT_METRICS) {
+        out.printf("# HELP %s %s\n# TYPE %s %s\n%s %lu\n", metric.name, metric.help, metric.name, metric.type, metric.name, snapshot.*metric.field);
+    }
+
+    for (const auto& captured : capture.histograms) {
+        const auto* histogram = &captured;
+        out.printf("# HELP %s %s\n# TYPE %s histogram\n", histogram->name, histogram->help, histogram->name);
+        unsigned long cumulative = 0;
+        for (size_t bucket = 0; bucket < hal::LATENCY_BUCKETS; bucket++) {
+            cumulative += histogram->getBucket(bucket);
+            out.printf("%s_bucket{le=\"%lu\"} %lu\n", histogram->name, static_cast<unsigned long>(hal::LatencyHistogram::bucketBoundUs(bucket)), cumulative);
+        }
+        out.printf("%s_bucket{le=\"+Inf\"} %lu\n", histogram->name, static_cast<unsigned long>(histogram->getCount()));
+        out.printf("%s_sum %llu\n%s_count %lu\n", histogram->name, static_cast<unsigned long long>(histogram->getSumUs()),
+                   histogram->name, static_cast<unsigned long>(histogram->getCount()));
+    }
+}
+
+/************************
+ * MQTT summary
+ *
+ * The same, cut down to fit a message: the counters, and count/mean/p99/max
+ * per timer. {"uptimeMs":..,...,"timers":{"loop":{"n":..,"mean":..,"p99":..,"max":..},...}}
+ ************************/
+const size_t SUMMARY_BUFFER_SIZE = 1024;
+
+// short names for the summary, same order as HISTOGRAMS
+const char* const SUMMARY_TIMER_NAMES[] = {"loop", "mqtt", "web", "persist", "ntp", "ota", "wifi", "feederTask"};
+
+// the length written, 0 if it didn't fit
+size_t renderSummaryJson(char (&out)[SUMMARY_BUFFER_SIZE], const Snapshot& snapshot) {
+    int length = snprintf(out, SUMMARY_BUFFER_SIZE,
+                          "{\"uptimeMs\":%lu,\"feedsQueued\":%lu,\"feedsDispatched\":%lu,\"feedsCompleted\":%lu,\"feedsRejectedBusy\":%lu,"
+                          "\"duplicateRequests\":%lu,\"forcedRotations\":%lu,\"slowRotations\":%lu,\"freeHeap\":%lu,\"largestFreeBlock\":%lu,\"timers\":{",
+                          snapshot.uptimeMs, snapshot.feedsQueued, snapshot.feedsDispatched, snapshot.feedsCompleted, snapshot.feedsRejectedBusy,
+                          snapshot.duplicateRequests, snapshot.forcedRotations, snapshot.slowRotations, snapshot.freeHeapBytes, snapshot.largestFreeBlockBytes);
+
+    for (size_t i = 0; i < HISTOGRAM_COUNT; i++) {
+        if (length <= 0 || length >= static_cast<int>(SUMMARY_BUFFER_SIZE)) return 0;
+        const auto& histogram = *HISTOGRAMS[i];
+        length += snprintf(out + length, SUMMARY_BUFFER_SIZE - length, "%s\"%s\":{\"n\":%lu,\"mean\":%lu,\"p99\":%lu,\"max\":%lu}",
+                           i == 0 ? "" : ",", SUMMARY_TIMER_NAMES[i], static_cast<unsigned long>(histogram.getCount()),
+                           static_cast<unsigned long>(histogram.getMeanUs()), static_cast<unsigned long>(histogram.quantileUs(0.99f)),
+                           static_cast<unsigned long>(histogram.getMaxUs()));
+    }
+    if (length <= 0 || length >= static_cast<int>(SUMMARY_BUFFER_SIZE)) return 0;
+    length += snprintf(out + length, SUMMARY_BUFFER_SIZE - length, "}}");
+    return length < static_cast<int>(SUMMARY_BUFFER_SIZE) ? length : 0;
+}
+
+}  // namespace metrics
+}  // namespace feeder
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+namespace feeder {
+namespace response_cache {
+
+/************************
+ * Response cache
+ *
+ * Rendered bodies (or parts of them) that only change when the data behind
+ * them does, kept in one fixed arena. An entry is keyed by what was
+ * rendered and the generation of the data it came from, so a change to the
+ * data makes its entries miss without anything having to invalidate them.
+ * When a new body doesn't fit (in the arena, or in the entry table) the
+ * whole cache is dropped and refilled from what's asked for next; stale
+ * generations are most of what's in it by then anyway. A body bigger than
+ * the arena is never cached, the caller renders it every time.
+ ************************/
+// what was rendered: a kind, then whatever tells variants of it apart (eg a
+// query's fields)
+using Key = std::array<uint32_t, 4>;
+
+struct CacheStats {
+    unsigned long hits = 0;
+    unsigned long misses = 0;
+    // bodies too big to cache at all
+    unsigned long uncacheable = 0;
+    // times the whole cache was dropped to make room
+    unsigned long flushes = 0;
+};
+
+// renders into the arena's free space, noting if it ran out
+class ArenaWriter {
+   private:
+    char* _out;
+    const size_t _capacity;
+    size_t _length = 0;
+    bool _overflowed = false;
+
+   public:
+    ArenaWriter(char* out, const size_t capacity) : _out(out), _capacity(capacity) {}
+
+    void write(const char* data, const size_t length) {
+        if (_overflowed || _length + length > _capacity) {
+            _overflowed = true;
+            return;
+        }
+        memcpy(_out + _length, data, length);
+        _length += length;
+    }
+
+    void write(const char* str) { write(str, strlen(str)); }
+
+    void printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        if (_overflowed) return;
+        // vsnprintf needs room for its terminator even though it isn't kept
+        const size_t room = _capacity - _length;
+        va_list args;
+        va_start(args, format);
+        const int length = vsnprintf(_out + _length, room, format, args);
+        va_end(args);
+        if (length < 0 || static_cast<size_t>(length) >= room) {
+            _overflowed = true;
+            return;
+        }
+        _length += length;
+    }
+
+    size_t getLength() const { return _length; }
+    bool overflowed() const { return _overflowed; }
+};
+
+template <size_t ArenaSize, size_t Entries>
+class ResponseCache {
+    static_assert(ArenaSize <= 0xFFFF, "ResponseCache offsets are 16 bit");
+
+   private:
+    struct Entry {
+        Key key;
+        uint32_t generation;
+        uint16_t offset;
+        uint16_t length;
+    };
+
+    char _arena[ArenaSize];
+    size_t _arenaUsed = 0;
+    Entry _entries[Entries];
+    size_t _entryCount = 0;
+    CacheStats _stats;
+
+    const Entry* find(const Key& key, const uint32_t generation) const {
+        for (size_t i = 0; i < _entryCount; i++) {
+            if (_entries[i].generation == generation && _entries[i].key == key) return &_entries[i];
+        }
+        return nullptr;
+    }
+
+    void flush() {
+        _arenaUsed = 0;
+        _entryCount = 0;
+        _stats.flushes++;
+    }
+
+    // renders into the free space, dropping everything once if it doesn't fit
+    template <typename Render>
+    const Entry* store(const Key& key, const uint32_t generation, Render& render) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (_entryCount < Entries) {
+                ArenaWriter writer(_arena + _arenaUsed, ArenaSize - _arenaUsed);
+                render(writer);
+                if (!writer.overflowed()) {
+                    Entry& entry = _entries[_entryCount++];
+                    entry = {key, generation, static_cast<uint16_t>(_arenaUsed), static_cast<uint16_t>(writer.getLength())};
+                    _arenaUsed += writer.getLength();
+                    return &entry;
+                }
+            }
+            if (_arenaUsed == 0) break;
+            flush();
+        }
+        _stats.uncacheable++;
+        return nullptr;
+    }
+
+   public:
+    // the body for key as of generation, rendering it with render(writer)
+    // into the cache if it isn't there. Empty if it's too big to cache;
+    // render it straight out instead. Only good until the next call.
+    template <typename Render>
+    std::string_view get(const Key& key, const uint32_t generation, Render render) {
+        const Entry* entry = find(key, generation);
+        if (entry == nullptr) entry = store(key, generation, render);
+        if (entry == nullptr) return {};
+        return std::string_view(_arena + entry->offset, entry->length);
+    }
+
+    // get() for a new request, counted as a hit or a miss. Re-renders of
+    // the same response use get() so they don't count twice.
+    template <typename Render>
+    std::string_view fetch(const Key& key, const uint32_t generation, Render render) {
+        if (find(key, generation) != nullptr) {
+            _stats.hits++;
+        } else {
+            _stats.misses++;
+        }
+        return get(key, generation, render);
+    }
+
+    size_t getArenaUsed() const { return _arenaUsed; }
+    const CacheStats& getStats() const { return _stats; }
+};
+
+}  // namespace response_cache
+}  // namespace feeder
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+#include "event-log.h"
+#include "feeding-store.h"
+#include "hal.h"
+
+namespace feeder {
+namespace scheduler {
+
+/************************
+ * Feed schedules
+ *
+ * Recurring feeds run on the device itself, so the fish still eat when the
+ * home automation host is down. A schedule is a time of day, the weekdays it
+ * runs on and how many rotations to feed.
+ *
+ * Times are local to a fixed UTC offset (no DST rules on the device, move
+ * the offset when the clocks change).
+ ************************/
+const size_t MAX_SCHEDULES = 8;
+const uint32_t SEC_PER_DAY = 86400;
+// bit 0 is Sunday
+const uint8_t EVERY_DAY = 0x7F;
+
+struct Schedule {
+    uint32_t secOfDay = 0;
+    uint8_t weekdays = 0;
+    uint8_t rotations = 0;
+
+    bool isEnabled() const { return weekdays != 0 && rotations != 0; }
+};
+
+// packed for NVS: secOfDay 17 bits | weekdays 7 bits | rotations 8 bits
+uint32_t encodeSchedule(const Schedule& schedule) {
+    return (schedule.secOfDay & 0x1FFFF) | (static_cast<uint32_t>(schedule.weekdays & EVERY_DAY) << 17) |
+           (static_cast<uint32_t>(schedule.rotations) << 24);
+}
+
+Schedule decodeSchedule(const uint32_t packed) {
+    Schedule schedule;
+    schedule.secOfDay = packed & 0x1FFFF;
+    schedule.weekdays = (packed >> 17) & EVERY_DAY;
+    schedule.rotations = packed >> 24;
+    if (schedule.secOfDay >= SEC_PER_DAY) {
+        schedule.weekdays = 0;
+    }
+    return schedule;
+}
+
+/************************
+ * Slots
+ *
+ * One firing of one schedule. Ordered by time, then schedule index for two
+ * schedules at the same time, which makes "the last slot fired" a single
+ * number: anything at or before it has already been handled.
+ ************************/
+struct Slot {
+    uint32_t epochSec = 0;
+    uint8_t schedule = 0;
+
+    uint64_t key() const { return (static_cast<uint64_t>(epochSec) << 8) | schedule; }
+    bool isValid() const { return epochSec != 0; }
+};
+
+enum class MissedFeedPolicy {
+    // anything missed while off (or while the clock was wrong) is dropped
+    Skip,
+    // the most recent missed slot is fed late, if it's within the catch up
+    // window. Never more than one, the fish shouldn't get a day's worth at once.
+    FeedLatest,
+};
+
+// how late a slot can be noticed and still count as on time
+const uint32_t ON_TIME_TOLERANCE_SEC = 5 * 60;
+const uint32_t DEFAULT_CATCH_UP_WINDOW_SEC = 2 * 60 * 60;
+// a slot the feed queue had no room for is offered again this much later
+const uint32_t REFUSED_RETRY_SEC = 10;
+
+inline constexpr hal::EventInfo SCHEDULED_FEED{hal::LogLevel::Info, "Scheduled feed slot=%lu, schedule=%lu"};
+inline constexpr hal::EventInfo SCHEDULED_FEED_REFUSED{hal::LogLevel::Warn, "Scheduled feed refused, retrying slot=%lu, schedule=%lu"};
+
+struct SchedulerStats {
+    unsigned long fired = 0;
+    unsigned long caughtUp = 0;
+    unsigned long skipped = 0;
+    // slots that came due again (eg the clock went backwards) but had
+    // already been fired
+    unsigned long alreadyFired = 0;
+    // times the trigger turned a slot away (the feed queue was full)
+    unsigned long refused = 0;
+    unsigned long replans = 0;
+};
+
+/************************
+ * Scheduler
+ *
+ * The next slot across every schedule is worked out ahead of time, so a
+ * tick is one comparison until it comes due. Replanning (O(schedules x
+ * days in a week)) only happens after a slot fires or the schedules change.
+ *
+ * The trigger only queues the feed, false if it couldn't. The slot then
+ * stays due and is offered again every REFUSED_RETRY_SEC, until it's fed or
+ * too late for the missed feed policy. Once queued the slot is persisted as
+ * fired before the feed can start: a reboot part way through can lose a
+ * feed, but never doubles one.
+ ************************/
+using FeedTrigger = std::function<bool(const Slot& slot, const unsigned int rotations, const uint32_t nowEpochSec)>;
+
+class Scheduler {
+   private:
+    hal::KeyValueStore& _kv;
+    const FeedTrigger _trigger;
+    MissedFeedPolicy _policy;
+    uint32_t _catchUpWindowSec;
+
+    std::array<Schedule, MAX_SCHEDULES> _schedules{};
+    int32_t _utcOffsetSec = 0;
+    uint64_t _lastFiredKey = 0;
+
+    Slot _next;
+    bool _planned = false;
+    uint32_t _lastTickSec = 0;
+    uint32_t _retryAtSec = 0;
+    SchedulerStats _stats;
+
+    static constexpr const char* SCHEDULES_KEY = "sched";
+    static constexpr const char* UTC_OFFSET_KEY = "schedTz";
+    static constexpr const char* LAST_FIRED_KEY = "schedLast";
+
+    static uint8_t weekdayOf(const int64_t localDay) {
+        // 1970-01-01 was a Thursday
+        return static_cast<uint8_t>(((localDay + 4) % 7 + 7) % 7);
+    }
+
+    static uint64_t keyAtEndOf(const uint32_t epochSec) { return (static_cast<uint64_t>(epochSec) << 8) | 0xFF; }
+
+    // A week either way covers every weekday mask
+    Slot firstSlotAfter(const uint64_t afterKey) const {
+        const int64_t afterLocal = static_cast<int64_t>(afterKey >> 8) + _utcOffsetSec;
+        const int64_t firstDay = afterLocal / SEC_PER_DAY;
+
+        Slot best;
+        for (int64_t day = firstDay; day <= firstDay + 7 && !best.isValid(); day++) {
+            for (uint8_t i = 0; i < MAX_SCHEDULES; i++) {
+                const auto& schedule = _schedules[i];
+                if (!schedule.isEnabled() || (schedule.weekdays & (1 << weekdayOf(day))) == 0) continue;
+
+                const Slot candidate = {static_cast<uint32_t>(day * SEC_PER_DAY + schedule.secOfDay - _utcOffsetSec), i};
+                if (candidate.key() > afterKey && (!best.isValid() || candidate.key() < best.key())) {
+                    best = candidate;
+                }
+            }
+        }
+        return best;
+    }
+
+    Slot lastSlotAtOrBefore(const uint32_t epochSec) const {
+        const uint64_t beforeKey = keyAtEndOf(epochSec);
+        const int64_t lastDay = (static_cast<int64_t>(epochSec) + _utcOffsetSec) / SEC_PER_DAY;
+
+        Slot best;
+        for (int64_t day = lastDay; day >= lastDay - 7 && !best.isValid(); day--) {
+            for (uint8_t i = 0; i < MAX_SCHEDULES; i++) {
+                const auto& schedule = _schedules[i];
+                if (!schedule.isEnabled() || (schedule.weekdays & (1 << weekdayOf(day))) == 0) continue;
+
+                const Slot candidate = {static_cast<uint32_t>(day * SEC_PER_DAY + schedule.secOfDay - _utcOffsetSec), i};
+                if (candidate.key() <= beforeKey && (!best.isValid() || candidate.key() > best.key())) {
+                    best = candidate;
+                }
+            }
+        }
+        return best;
+    }
+
+    // A clock that was days ahead leaves the last fired slot in the future,
+    // which would hold off every feed until real time caught up with it.
+    // Anything closer is kept: those slots may really have been fed.
+    void forgetLastFiredIfFarAhead(const uint32_t nowEpochSec) {
+        if ((_lastFiredKey >> 8) > static_cast<uint64_t>(nowEpochSec) + SEC_PER_DAY) {
+            _lastFiredKey = keyAtEndOf(nowEpochSec);
+        }
+    }
+
+    void planAfter(const uint64_t afterKey) {
+        _next = firstSlotAfter(afterKey);
+        _planned = true;
+        _stats.replans++;
+    }
+
+    enum class FireResult {
+        Fired,
+        AlreadyFired,
+        Refused,
+    };
+
+    FireResult fire(const Slot& slot, const uint32_t nowEpochSec) {
+        if (slot.key() <= _lastFiredKey) {
+            _stats.alreadyFired++;
+            return FireResult::AlreadyFired;
+        }
+
+        if (!_trigger(slot, _schedules[slot.schedule].rotations, nowEpochSec)) {
+            _stats.refused++;
+            _retryAtSec = nowEpochSec + REFUSED_RETRY_SEC;
+            hal::log<SCHEDULED_FEED_REFUSED>(slot.epochSec, slot.schedule);
+            return FireResult::Refused;
+        }
+
+        _lastFiredKey = slot.key();
+        _kv.begin(feeding_store::PREFERENCE_NS, false);
+        _kv.putULong64(LAST_FIRED_KEY, _lastFiredKey);
+        _kv.end();
+        hal::log<SCHEDULED_FEED>(slot.epochSec, slot.schedule);
+        return FireResult::Fired;
+    }
+
+    void save() {
+        uint32_t packed[MAX_SCHEDULES];
+        for (size_t i = 0; i < MAX_SCHEDULES; i++) {
+            packed[i] = encodeSchedule(_schedules[i]);
+        }
+
+        _kv.begin(feeding_store::PREFERENCE_NS, false);
+        _kv.putBytes(SCHEDULES_KEY, packed, sizeof(packed));
+        _kv.putUInt(UTC_OFFSET_KEY, static_cast<uint32_t>(_utcOffsetSec));
+        _kv.end();
+    }
+
+   public:
+    Scheduler(hal::KeyValueStore& kv, FeedTrigger trigger, const MissedFeedPolicy policy = MissedFeedPolicy::FeedLatest,
+              const uint32_t catchUpWindowSec = DEFAULT_CATCH_UP_WINDOW_SEC)
+        : _kv(kv), _trigger(trigger), _policy(policy), _catchUpWindowSec(catchUpWindowSec) {}
+
+    void load() {
+        _kv.begin(feeding_store::PREFERENCE_NS, true);
+        uint32_t packed[MAX_SCHEDULES] = {};
+        if (_kv.getBytes(SCHEDULES_KEY, packed, sizeof(packed)) == sizeof(packed)) {
+            for (size_t i = 0; i < MAX_SCHEDULES; i++) {
+                _schedules[i] = decodeSchedule(packed[i]);
+            }
+        }
+        _utcOffsetSec = static_cast<int32_t>(_kv.getUInt(UTC_OFFSET_KEY, 0));
+        _lastFiredKey = _kv.getULong64(LAST_FIRED_KEY, 0);
+        _kv.end();
+
+        // planned on the first tick with a real time, against the last slot
+        // fired so anything missed while off gets noticed
+        _planned = false;
+    }
+
+    // Changing schedules never fires anything from the past: the plan
+    // restarts from now. nowEpochSec is 0 if the clock isn't synced yet, the
+    // first tick plans instead.
+    bool setSchedule(const size_t index, const Schedule& schedule, const uint32_t nowEpochSec) {
+        if (index >= MAX_SCHEDULES || schedule.secOfDay >= SEC_PER_DAY) return false;
+
+        _schedules[index] = schedule;
+        save();
+        replanFromNow(nowEpochSec);
+        return true;
+    }
+
+    void setUtcOffset(const int32_t utcOffsetSec, const uint32_t nowEpochSec) {
+        _utcOffsetSec = utcOffsetSec;
+        save();
+        replanFromNow(nowEpochSec);
+    }
+
+    void replanFromNow(const uint32_t nowEpochSec) {
+        if (nowEpochSec == 0) {
+            _planned = false;
+            return;
+        }
+        const uint64_t nowKey = keyAtEndOf(nowEpochSec);
+        planAfter(nowKey > _lastFiredKey ? nowKey : _lastFiredKey);
+    }
+
+    // nowEpochSec must come from a synced clock
+    void tick(const uint32_t nowEpochSec) {
+        if (!_planned) {
+            forgetLastFiredIfFarAhead(nowEpochSec);
+            if (_lastFiredKey == 0) {
+                replanFromNow(nowEpochSec);
+            } else {
+                planAfter(_lastFiredKey);
+            }
+        } else if (nowEpochSec + ON_TIME_TOLERANCE_SEC < _lastTickSec) {
+            // the clock went back (an NTP correction), the plan was made
+            // against a time that hasn't happened yet
+            forgetLastFiredIfFarAhead(nowEpochSec);
+            replanFromNow(nowEpochSec);
+            _retryAtSec = 0;
+        }
+        _lastTickSec = nowEpochSec;
+
+        if (!_next.isValid() || nowEpochSec < _next.epochSec || nowEpochSec < _retryAtSec) {
+            return;
+        }
+
+        const Slot due = _next;
+        if (nowEpochSec - due.epochSec <= ON_TIME_TOLERANCE_SEC) {
+            const auto result = fire(due, nowEpochSec);
+            if (result == FireResult::Refused) return;
+            if (result == FireResult::Fired) _stats.fired++;
+            planAfter(due.key());
+            return;
+        }
+
+        // Off, or the clock just jumped forward, across one or more slots.
+        // Anything before the newest missed one is dropped whatever the policy.
+        const Slot latest = lastSlotAtOrBefore(nowEpochSec);
+        if (_policy == MissedFeedPolicy::FeedLatest && latest.isValid() && nowEpochSec - latest.epochSec <= _catchUpWindowSec &&
+            latest.key() > _lastFiredKey) {
+            const auto result = fire(latest, nowEpochSec);
+            if (result == FireResult::Refused) return;
+            if (result == FireResult::Fired) _stats.caughtUp++;
+        } else {
+            _stats.skipped++;
+        }
+        planAfter(keyAtEndOf(nowEpochSec));
+    }
+
+    const Schedule& getSchedule(const size_t index) const { return _schedules[index]; }
+    int32_t getUtcOffset() const { return _utcOffsetSec; }
+    const Slot& getNextSlot() const { return _next; }
+    uint64_t getLastFiredKey() const { return _lastFiredKey; }
+    const SchedulerStats& getStats() const { return _stats; }
+};
+
+}  // namespace scheduler
+}  // namespace feeder
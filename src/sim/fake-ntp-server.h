@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstring>
+
+#include "hal.h"
+#include "ntp.h"
+
+namespace feeder {
+namespace sim {
+
+/************************
+ * Fake NTP server
+ *
+ * Stands in for the UDP socket. Answers each request after a virtual round
+ * trip with the "true" time, which runs at a configurable rate relative to
+ * the virtual millis() to model a drifting local oscillator.
+ ************************/
+class FakeNtpServer : public ntp::UdpTransport {
+   private:
+    const unsigned long _epochAtStart;
+    // how fast true time runs relative to the local clock, in ppm
+    const double _localClockSlowPpm;
+    const unsigned long _roundTripMs;
+    // every nth request goes unanswered, 0 to answer them all
+    const unsigned int _dropEvery;
+
+    bool _pending = false;
+    unsigned long _replyAt = 0;
+    uint8_t _requestTransmit[8] = {};
+    unsigned long _requests = 0;
+
+    static void writeUInt32(uint8_t* bytes, const uint32_t value) {
+        bytes[0] = value >> 24;
+        bytes[1] = value >> 16;
+        bytes[2] = value >> 8;
+        bytes[3] = value;
+    }
+
+   public:
+    FakeNtpServer(const unsigned long epochAtStart, const double localClockSlowPpm, const unsigned long roundTripMs, const unsigned int dropEvery)
+        : _epochAtStart(epochAtStart), _localClockSlowPpm(localClockSlowPpm), _roundTripMs(roundTripMs), _dropEvery(dropEvery) {}
+
+    uint64_t trueEpochMs() const {
+        const double localMs = hal::native::clockMicros / 1000.0;
+        return static_cast<uint64_t>(_epochAtStart) * 1000 + static_cast<uint64_t>(localMs * (1 + _localClockSlowPpm * 1e-6));
+    }
+
+    bool send(const uint8_t* data, size_t length) override {
+        _requests++;
+        if (length != ntp::NTP_PACKET_SIZE || (_dropEvery != 0 && _requests % _dropEvery == 0)) {
+            return true;
+        }
+        memcpy(_requestTransmit, data + 40, sizeof(_requestTransmit));
+        _pending = true;
+        _replyAt = hal::millis() + _roundTripMs;
+        return true;
+    }
+
+    size_t receive(uint8_t* buffer, size_t length) override {
+        if (!_pending || hal::millis() < _replyAt || length < ntp::NTP_PACKET_SIZE) {
+            return 0;
+        }
+        _pending = false;
+
+        // stamped half way back
+        const uint64_t transmitMs = trueEpochMs() - _roundTripMs / 2;
+        memset(buffer, 0, ntp::NTP_PACKET_SIZE);
+        buffer[0] = 0b00011100;  // version 3, mode 4 (server)
+        buffer[1] = 2;           // stratum
+        memcpy(buffer + 24, _requestTransmit, sizeof(_requestTransmit));
+        writeUInt32(buffer + 40, static_cast<uint32_t>(transmitMs / 1000 + ntp::SEVENTY_YEARS_SEC));
+        writeUInt32(buffer + 44, static_cast<uint32_t>(((transmitMs % 1000) << 32) / 1000));
+        return ntp::NTP_PACKET_SIZE;
+    }
+
+    unsigned long getRequestCount() const { return _requests; }
+};
+
+}  // namespace sim
+}  // namespace feeder
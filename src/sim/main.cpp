@@ -0,0 +1,142 @@
+// Off device simulator: replays feeds against the real feeder state machine
+// with a virtual clock and a modelled motor + rotation sensor.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "hal.h"
+#include "memory-kv-store.h"
+#include "simulator.h"
+
+using feeder::RotationSensing;
+using feeder::sim::ScheduledFeed;
+using feeder::sim::SimulationStats;
+using feeder::sim::Simulator;
+using feeder::sim::SimulatorConfig;
+
+const char* sensingName(const RotationSensing sensing) {
+    return sensing == RotationSensing::Polled ? "polled" : "interrupt";
+}
+
+SimulationStats runScenario(const SimulatorConfig& config, const unsigned int days) {
+    const std::vector<ScheduledFeed> schedule = {
+        {.atSecOfDay = 7 * 3600, .rotations = 1},
+        {.atSecOfDay = 12 * 3600, .rotations = 2},
+        {.atSecOfDay = 17 * 3600 + 30 * 60, .rotations = 1},
+        {.atSecOfDay = 21 * 3600, .rotations = 3},
+    };
+
+    hal::MemoryKeyValueStore kv;
+    Simulator simulator(config, kv);
+    simulator.setup();
+    if (config.onDeviceSchedule) {
+        simulator.setupSchedule(schedule);
+    }
+
+    const auto startedAt = std::chrono::steady_clock::now();
+    simulator.runDays(days, schedule);
+    const auto wallMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startedAt).count();
+
+    const auto stats = simulator.getStats();
+    printf("[%s] simulated_days=%u wall_ms=%lld\n", sensingName(config.sensing), days, static_cast<long long>(wallMs));
+    printf("[%s] feeds_triggered=%lu feeds_finished=%lu rotations=%lu forced_stops=%lu part_way_stops=%lu\n", sensingName(config.sensing),
+           stats.feedsTriggered, stats.feedsFinished, stats.rotations, stats.forcedStops, stats.partWayStops);
+    const double requestedRotations = static_cast<double>(stats.requestedSixteenths) / feeder::SIXTEENTHS_PER_ROTATION;
+    printf("[%s] dose requested_rotations=%.2f turned_rotations=%.2f error_per_feed=%.3f\n", sensingName(config.sensing),
+           requestedRotations, stats.turnedRotations,
+           stats.feedsTriggered ? (stats.turnedRotations - requestedRotations) / stats.feedsTriggered : 0.0);
+    printf("[%s] store_writes=%zu writes_per_feed=%.2f\n", sensingName(config.sensing),
+           stats.storeWrites, stats.feedsTriggered ? static_cast<double>(stats.storeWrites) / stats.feedsTriggered : 0.0);
+    printf("[%s] stop_latency_ms min=%.1f mean=%.1f p99=%.1f max=%.1f stddev=%.1f\n", sensingName(config.sensing),
+           stats.stopLatencyMs.min(), stats.stopLatencyMs.mean(), stats.stopLatencyMs.percentile(0.99),
+           stats.stopLatencyMs.max(), stats.stopLatencyMs.stddev());
+    printf("[%s] ntp requests=%lu syncs=%lu drift_ppm=%.1f time_error_ms mean=%.1f max=%.1f\n", sensingName(config.sensing),
+           stats.ntpRequests, stats.ntpSyncs, stats.estimatedDriftPpm, stats.timeErrorMs.mean(), stats.timeErrorMs.max());
+    if (config.onDeviceSchedule) {
+        printf("[%s] scheduler fired=%lu caught_up=%lu skipped=%lu already_fired=%lu refused=%lu replans=%lu reboots=%lu\n", sensingName(config.sensing),
+               stats.scheduled.fired, stats.scheduled.caughtUp, stats.scheduled.skipped, stats.scheduled.alreadyFired,
+               stats.scheduled.refused, stats.scheduled.replans, stats.reboots);
+    }
+    printf("[%s] rotation_timing mean_ms=%.0f sigma_ms=%.0f timeout_ms=%lu fixed_timeout_ms=%lu slow=%lu timed_out=%lu\n", sensingName(config.sensing),
+           stats.rotationMeanMs, stats.rotationSigmaMs, stats.rotationTimeoutMs, feeder::APPROXIMATE_ROTATION_DURATION_MS,
+           stats.slowRotations, stats.timedOutRotations);
+    printf("[%s] feed_queue queued=%lu coalesced=%lu rejected=%lu max_depth=%zu wait_ms mean=%lu max=%lu\n", sensingName(config.sensing),
+           stats.feedQueue.queued, stats.feedQueue.coalesced, stats.feedQueue.rejected, stats.feedQueue.maxDepth,
+           stats.feedQueue.meanWaitMs(), stats.feedQueue.maxWaitMs);
+    printf("[%s] mqtt feed_started=%lu feed_finished=%lu status=%lu dropped=%lu\n", sensingName(config.sensing),
+           stats.feedStartedEvents, stats.feedFinishedEvents, stats.statusUpdates, stats.eventsDropped);
+    printf("[%s] live_events events=%lu progress=%lu forced=%lu lagged=%lu\n", sensingName(config.sensing),
+           stats.liveEvents, stats.liveProgressEvents, stats.liveForcedEvents, stats.liveEventsLagged);
+    printf("[%s] loop_feeder_ns passes=%lu mean=%.0f p99=%.0f max=%.0f\n", sensingName(config.sensing),
+           stats.loopPasses, stats.loopFeederNs.mean(), stats.loopFeederNs.percentile(0.99), stats.loopFeederNs.max());
+
+    return stats;
+}
+
+int main(int argc, char** argv) {
+    unsigned int days = 1;
+    bool compare = false;
+    SimulatorConfig config;
+
+    // quiet by default, a day of loop logging is a lot of output
+    hal::logSink.setEnabled(false);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--verbose") == 0) {
+            hal::logSink.setEnabled(true);
+        } else if (strcmp(argv[i], "--days") == 0 && i + 1 < argc) {
+            days = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            config.seed = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--loop-ms") == 0 && i + 1 < argc) {
+            config.loopPeriodMs = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--shared-loop") == 0) {
+            config.useSharedLoop();
+        } else if (strcmp(argv[i], "--slow-loop-ms") == 0 && i + 1 < argc) {
+            config.slowLoopMs = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--scheduler") == 0) {
+            config.onDeviceSchedule = true;
+        } else if (strcmp(argv[i], "--missed") == 0 && i + 1 < argc) {
+            const char* policy = argv[++i];
+            config.missedFeedPolicy = strcmp(policy, "skip") == 0 ? feeder::scheduler::MissedFeedPolicy::Skip : feeder::scheduler::MissedFeedPolicy::FeedLatest;
+        } else if (strcmp(argv[i], "--outage") == 0 && i + 2 < argc) {
+            // --outage <hours into the run> <minutes off>
+            config.outageAtMs = static_cast<unsigned long>(atof(argv[++i]) * 3600 * 1000);
+            config.outageMs = static_cast<unsigned long>(atof(argv[++i]) * 60 * 1000);
+        } else if (strcmp(argv[i], "--fraction") == 0 && i + 1 < argc) {
+            // --fraction 0.25 feeds 1.25, 2.25, ... instead of whole rotations
+            config.extraSixteenths = static_cast<uint8_t>(atof(argv[++i]) * feeder::SIXTEENTHS_PER_ROTATION + 0.5) % feeder::SIXTEENTHS_PER_ROTATION;
+        } else if (strcmp(argv[i], "--sensing") == 0 && i + 1 < argc) {
+            const char* sensing = argv[++i];
+            compare = strcmp(sensing, "compare") == 0;
+            config.sensing = strcmp(sensing, "polled") == 0 ? RotationSensing::Polled : RotationSensing::Interrupt;
+        } else {
+            fprintf(stderr, "usage: %s [--verbose] [--days N] [--seed N] [--loop-ms N] [--shared-loop] [--slow-loop-ms N] [--sensing polled|interrupt|compare] [--fraction F] "
+                    "[--scheduler [--missed skip|latest] [--outage HOURS MINUTES]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (config.outageMs > 0 && !config.onDeviceSchedule) {
+        fprintf(stderr, "--outage needs --scheduler\n");
+        return 2;
+    }
+
+    if (!compare) {
+        auto stats = runScenario(config, days);
+        return stats.feedsTriggered == stats.feedsFinished ? 0 : 1;
+    }
+
+    // same seed, same motor, only the sensing differs
+    config.sensing = RotationSensing::Polled;
+    auto polled = runScenario(config, days);
+    config.sensing = RotationSensing::Interrupt;
+    auto interrupt = runScenario(config, days);
+
+    printf("stop_latency_jitter_ms polled=%.1f interrupt=%.1f\n", polled.stopLatencyMs.stddev(), interrupt.stopLatencyMs.stddev());
+    printf("stop_latency_worst_ms polled=%.1f interrupt=%.1f\n", polled.stopLatencyMs.max(), interrupt.stopLatencyMs.max());
+
+    const bool allFinished = polled.feedsTriggered == polled.feedsFinished && interrupt.feedsTriggered == interrupt.feedsFinished;
+    return allFinished ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <random>
+#include <vector>
+
+#include "hal.h"
+
+namespace feeder {
+namespace sim {
+
+/************************
+ * Rotation sensor waveform
+ *
+ * What the sensor pin does over one rotation, as a function of how long the
+ * motor has been running in that rotation. The sensor is pulled up and reads
+ * HIGH while the feeder sits at home, then LOW for the rest of the rotation.
+ ************************/
+struct WaveformSegment {
+    // the level holds until this many ms of motor run time into the rotation
+    unsigned long untilMs;
+    int level;
+};
+
+struct RotationWaveform {
+    std::vector<WaveformSegment> segments;
+    // where the feeder rests at power up, past any bounce around home
+    unsigned long parkedAtMs = 0;
+
+    unsigned long durationMs() const { return segments.empty() ? 0 : segments.back().untilMs; }
+
+    int levelAt(const unsigned long positionMs) const {
+        for (auto& segment : segments) {
+            if (positionMs < segment.untilMs) return segment.level;
+        }
+        return hal::PIN_LOW;
+    }
+
+    // home for leaveHomeMs, then out of home for the rest of rotationMs. Each
+    // transition chatters bounceCount times over bounceMs.
+    static RotationWaveform withBounce(const unsigned long rotationMs, const unsigned long leaveHomeMs,
+                                       const unsigned long bounceMs, const unsigned int bounceCount) {
+        RotationWaveform waveform;
+        const unsigned long step = bounceCount == 0 ? 0 : bounceMs / (2 * bounceCount);
+
+        // arriving home at 0 (the end of the previous rotation)
+        unsigned long at = 0;
+        for (unsigned int i = 0; i < bounceCount; i++) {
+            waveform.segments.push_back({at += step, hal::PIN_HIGH});
+            waveform.segments.push_back({at += step, hal::PIN_LOW});
+        }
+        waveform.segments.push_back({leaveHomeMs, hal::PIN_HIGH});
+        waveform.parkedAtMs = at;
+
+        // leaving home
+        at = leaveHomeMs;
+        for (unsigned int i = 0; i < bounceCount; i++) {
+            waveform.segments.push_back({at += step, hal::PIN_LOW});
+            waveform.segments.push_back({at += step, hal::PIN_HIGH});
+        }
+        waveform.segments.push_back({rotationMs, hal::PIN_LOW});
+        return waveform;
+    }
+};
+
+/************************
+ * Motor model
+ *
+ * Integrates motor run time and tracks where in the rotation the feeder is.
+ * Rotation durations are jittered per rotation from a seeded generator so a
+ * run is repeatable.
+ ************************/
+class MotorModel {
+   private:
+    const RotationWaveform _waveform;
+    const unsigned long _jitterMs;
+    std::mt19937 _random;
+
+    unsigned long long _positionUs = 0;
+    unsigned long long _currentRotationUs;
+    unsigned long long _lastHomeAtMicros = 0;
+    bool _passedHomeThisRun = false;
+    unsigned long _rotationsCompleted = 0;
+
+    unsigned long long nextRotationUs() {
+        if (_jitterMs == 0) return static_cast<unsigned long long>(_waveform.durationMs()) * 1000;
+        std::uniform_int_distribution<long> jitter(-static_cast<long>(_jitterMs), static_cast<long>(_jitterMs));
+        return static_cast<unsigned long long>(_waveform.durationMs() + jitter(_random)) * 1000;
+    }
+
+   public:
+    MotorModel(const RotationWaveform waveform, const unsigned long jitterMs, const unsigned int seed)
+        : _waveform(waveform), _jitterMs(jitterMs), _random(seed) {
+        _currentRotationUs = nextRotationUs();
+        // start parked at home, past any bounce
+        _positionUs = static_cast<unsigned long long>(_waveform.parkedAtMs) * 1000;
+    }
+
+    // advance from startMicros by durationMicros with the motor in the given state
+    void advance(const unsigned long long startMicros, const unsigned long long durationMicros, const bool motorOn) {
+        if (!motorOn) return;
+
+        unsigned long long remainingUs = durationMicros;
+        unsigned long long atUs = startMicros;
+        while (remainingUs > 0) {
+            const unsigned long long untilHomeUs = _currentRotationUs - _positionUs;
+            if (remainingUs < untilHomeUs) {
+                _positionUs += remainingUs;
+                remainingUs = 0;
+            } else {
+                atUs += untilHomeUs;
+                remainingUs -= untilHomeUs;
+                _positionUs = 0;
+                _lastHomeAtMicros = atUs;
+                _passedHomeThisRun = true;
+                _rotationsCompleted++;
+                _currentRotationUs = nextRotationUs();
+            }
+        }
+    }
+
+    int sensorLevel() const {
+        // stretch/squash the waveform's tail to this rotation's duration
+        const unsigned long long scaledUs = _positionUs * _waveform.durationMs() * 1000 / _currentRotationUs;
+        return _waveform.levelAt(static_cast<unsigned long>(scaledUs / 1000));
+    }
+
+    void motorStarted() { _passedHomeThisRun = false; }
+
+    bool passedHomeThisRun() const { return _passedHomeThisRun; }
+    unsigned long long lastHomeAtMicros() const { return _lastHomeAtMicros; }
+    unsigned long positionMs() const { return static_cast<unsigned long>(_positionUs / 1000); }
+    unsigned long rotationsCompleted() const { return _rotationsCompleted; }
+    // how far the drum has turned in all, in rotations
+    double turnedRotations() const { return _rotationsCompleted + static_cast<double>(_positionUs) / _currentRotationUs; }
+};
+
+}  // namespace sim
+}  // namespace feeder
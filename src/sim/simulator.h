@@ -0,0 +1,434 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "controller.h"
+#include "feeder-task.h"
+#include "fake-ntp-server.h"
+#include "feeder.h"
+#include "hal.h"
+#include "memory-kv-store.h"
+#include "motor-model.h"
+#include "ntp.h"
+
+namespace feeder {
+namespace sim {
+
+/************************
+ * Stats
+ ************************/
+class Samples {
+   private:
+    std::vector<double> _values;
+
+   public:
+    void add(const double value) { _values.push_back(value); }
+
+    size_t count() const { return _values.size(); }
+
+    double min() const { return _values.empty() ? 0 : *std::min_element(_values.begin(), _values.end()); }
+    double max() const { return _values.empty() ? 0 : *std::max_element(_values.begin(), _values.end()); }
+
+    double mean() const {
+        if (_values.empty()) return 0;
+        double sum = 0;
+        for (auto v : _values) sum += v;
+        return sum / _values.size();
+    }
+
+    double stddev() const {
+        if (_values.size() < 2) return 0;
+        const double m = mean();
+        double sum = 0;
+        for (auto v : _values) sum += (v - m) * (v - m);
+        return std::sqrt(sum / (_values.size() - 1));
+    }
+
+    double percentile(const double p) const {
+        if (_values.empty()) return 0;
+        std::vector<double> sorted = _values;
+        std::sort(sorted.begin(), sorted.end());
+        const size_t i = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+        return sorted[i];
+    }
+};
+
+struct SimulationStats {
+    unsigned long feedsTriggered = 0;
+    unsigned long feedsFinished = 0;
+    unsigned long rotations = 0;
+    unsigned long forcedStops = 0;
+    // motor switched off short of home on purpose, ending a part rotation
+    unsigned long partWayStops = 0;
+    // what the feeds asked for against how far the motor model turned
+    unsigned long requestedSixteenths = 0;
+    double turnedRotations = 0;
+    unsigned long loopPasses = 0;
+    size_t storeWrites = 0;
+
+    // ms between the feeder arriving home and the motor being switched off
+    Samples stopLatencyMs;
+    // host wall time spent inside each feeder task pass
+    Samples loopFeederNs;
+
+    unsigned long ntpRequests = 0;
+    unsigned long ntpSyncs = 0;
+    // derived epoch minus true epoch, sampled at every feed
+    Samples timeErrorMs;
+    double estimatedDriftPpm = 0;
+
+    // on device schedules, summed across reboots
+    scheduler::SchedulerStats scheduled;
+    unsigned long reboots = 0;
+
+    feed_queue::FeedQueueStats feedQueue;
+
+    // what the rotation timing model ended up with
+    float rotationMeanMs = 0;
+    float rotationSigmaMs = 0;
+    unsigned long rotationTimeoutMs = 0;
+    unsigned long slowRotations = 0;
+    unsigned long timedOutRotations = 0;
+
+    // what went out over MQTT
+    unsigned long feedStartedEvents = 0;
+    unsigned long feedFinishedEvents = 0;
+    unsigned long statusUpdates = 0;
+    unsigned long eventsDropped = 0;
+
+    // what a page open on /events saw
+    unsigned long liveEvents = 0;
+    unsigned long liveProgressEvents = 0;
+    unsigned long liveForcedEvents = 0;
+    unsigned long liveEventsLagged = 0;
+};
+
+/************************
+ * Simulator
+ ************************/
+struct ScheduledFeed {
+    unsigned long atSecOfDay;
+    unsigned int rotations;
+    uint8_t sixteenths = 0;
+};
+
+struct SimulatorConfig {
+    RotationSensorPins rotationSensorPins = {.input = 23};
+    MotorPins motorPins = {.powerOutput = 22};
+    RotationSensing sensing = RotationSensing::Interrupt;
+
+    RotationWaveform waveform = RotationWaveform::withBounce(9650, 350, 24, 3);
+    unsigned long rotationJitterMs = 150;
+
+    // the feeder task's wake up period
+    unsigned long loopPeriodMs = FEEDER_TASK_PERIOD_MS;
+    // how often a pass runs late. The feeder task has a core to itself, but
+    // see useSharedLoop().
+    double slowLoopProbability = 0;
+    unsigned long slowLoopMs = 250;
+    // step size while nothing is feeding
+    unsigned long idleStepMs = 1000;
+
+    // 2026-01-01T00:00:00Z
+    unsigned long epochAtStart = 1767225600;
+    unsigned int seed = 1;
+
+    // the fake NTP server. True time runs this much faster than millis().
+    double localClockSlowPpm = 40;
+    unsigned long ntpRoundTripMs = 60;
+    unsigned int ntpDropEvery = 5;
+
+    // run the schedule with the on device scheduler rather than triggering
+    // each feed from outside (the home automation host)
+    bool onDeviceSchedule = false;
+    scheduler::MissedFeedPolicy missedFeedPolicy = scheduler::MissedFeedPolicy::FeedLatest;
+    // power off once, this far into the run and for this long. Only with the
+    // on device schedule, the outside host has no idea the feeder is off.
+    unsigned long outageAtMs = 0;
+    unsigned long outageMs = 0;
+    // added to each feed triggered from outside, to exercise part rotations
+    uint8_t extraSixteenths = 0;
+
+    // model the feeder sharing loop() with networking, where now and then a
+    // pass takes much longer (web render, MQTT, NTP)
+    void useSharedLoop() {
+        loopPeriodMs = 10;
+        slowLoopProbability = 0.02;
+    }
+};
+
+class Simulator {
+   private:
+    const SimulatorConfig _config;
+    hal::MemoryKeyValueStore& _kv;
+    MotorModel _motor;
+    FakeNtpServer _ntpServer;
+    // rebuilt on reboot, which loses sync
+    std::unique_ptr<ntp::TimeService> _timeService;
+    std::mt19937 _random;
+    SimulationStats _stats;
+    bool _motorWasOn = false;
+    unsigned long _timedOutSeen = 0;
+    unsigned long _eventsDroppedAtStart = 0;
+    // one page open on /events the whole run
+    uint32_t _liveCursor = 0;
+    unsigned long _liveLaggedAtStart = 0;
+    double _turnedAtStart = 0;
+
+    bool motorOn() const { return hal::native::outputLevel(_config.motorPins.powerOutput) == hal::PIN_HIGH; }
+
+    void observeMotor() {
+        const bool on = motorOn();
+        if (on && !_motorWasOn) {
+            _motor.motorStarted();
+        } else if (!on && _motorWasOn) {
+            if (_motor.passedHomeThisRun()) {
+                _stats.rotations++;
+                _stats.stopLatencyMs.add((hal::native::clockMicros - _motor.lastHomeAtMicros()) / 1000.0);
+            } else if (feeder::rotationTiming.getTimedOutRotations() != _timedOutSeen) {
+                _stats.forcedStops++;
+            } else {
+                _stats.partWayStops++;
+            }
+            _timedOutSeen = feeder::rotationTiming.getTimedOutRotations();
+        }
+        _motorWasOn = on;
+    }
+
+    unsigned long nextStepMs() {
+        if (!feeder::isFeedPending() && controller::feedQueue->isEmpty() && !_timeService->isAwaitingReply()) return _config.idleStepMs;
+
+        std::uniform_real_distribution<double> chance(0, 1);
+        return chance(_random) < _config.slowLoopProbability ? _config.slowLoopMs : _config.loopPeriodMs;
+    }
+
+    void step(const unsigned long stepMs) {
+        // 1ms at a time while the motor runs, so each sensor edge (and the
+        // interrupt it fires) lands at the right virtual time
+        const bool on = motorOn();
+        const unsigned long substepMs = on ? 1 : stepMs;
+        for (unsigned long elapsedMs = 0; elapsedMs < stepMs; elapsedMs += substepMs) {
+            const unsigned long long substepUs = static_cast<unsigned long long>(substepMs) * 1000;
+            _motor.advance(hal::native::clockMicros, substepUs, on);
+            hal::native::advanceClockMicros(substepUs);
+            hal::native::setInputLevel(_config.rotationSensorPins.input, _motor.sensorLevel());
+        }
+
+        // what the feeder task does each wake up
+        const auto startedAt = std::chrono::steady_clock::now();
+        feeder::serviceFeeder(hal::millis());
+        const auto tookNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startedAt).count();
+
+        _stats.loopPasses++;
+        _stats.loopFeederNs.add(static_cast<double>(tookNs));
+        observeMotor();
+
+        // and the network side picking up completions and NTP replies
+        _stats.feedsFinished += controller::processFeedCompletions();
+        _timeService->tick(hal::millis());
+        if (_timeService->isSynced()) {
+            const unsigned long nowEpochSec = static_cast<unsigned long>(_timeService->epochMs(hal::millis()) / 1000);
+            if (_config.onDeviceSchedule) controller::loopScheduler(nowEpochSec);
+            controller::dispatchQueuedFeed(nowEpochSec);
+        }
+        controller::updateStatus(hal::millis());
+        controller::outbox.flush([this](const char* topic, const char*, const size_t) { countPublished(topic); }, SIZE_MAX);
+        readLiveEvents();
+
+        // the drain task's job on device
+        hal::drainEventLog();
+    }
+
+    void setupScheduler() {
+        controller::feedScheduler = std::make_unique<scheduler::Scheduler>(
+            _kv,
+            [this](const scheduler::Slot& slot, const unsigned int rotations, const uint32_t) {
+                if (controller::queueScheduledFeed(slot, rotations) == feed_queue::RequestResult::Busy) {
+                    return false;
+                }
+                countTriggeredFeed(Dose::ofRotations(rotations));
+                return true;
+            },
+            _config.missedFeedPolicy);
+        controller::feedScheduler->load();
+    }
+
+    void countPublished(const char* topic) {
+        if (topic == feed_events::FEED_STARTED_TOPIC) {
+            _stats.feedStartedEvents++;
+        } else if (topic == feed_events::FEED_FINISHED_TOPIC) {
+            _stats.feedFinishedEvents++;
+        } else if (topic == feed_events::STATUS_TOPIC) {
+            _stats.statusUpdates++;
+        }
+    }
+
+    void readLiveEvents() {
+        char frame[live_events::LIVE_EVENT_SIZE + 1];
+        size_t length;
+        while ((length = controller::liveEvents->next(_liveCursor, frame, live_events::LIVE_EVENT_SIZE)) > 0) {
+            frame[length] = '\0';
+            _stats.liveEvents++;
+            if (strstr(frame, "\nevent: feedProgress\n") != nullptr) _stats.liveProgressEvents++;
+            if (strstr(frame, "\nevent: rotationForced\n") != nullptr) _stats.liveForcedEvents++;
+        }
+    }
+
+    void countTriggeredFeed(const Dose dose) {
+        _stats.feedsTriggered++;
+        _stats.requestedSixteenths += dose.totalSixteenths();
+        if (_timeService->isSynced()) {
+            const uint64_t epochMs = _timeService->epochMs(hal::millis());
+            _stats.timeErrorMs.add(static_cast<double>(static_cast<int64_t>(epochMs - _ntpServer.trueEpochMs())));
+        }
+    }
+
+    // the scheduler's own stats start over with it on reboot
+    void keepSchedulerStats() {
+        _stats = getStats();
+        controller::feedScheduler = nullptr;
+    }
+
+   public:
+    Simulator(const SimulatorConfig config, hal::MemoryKeyValueStore& kv)
+        : _config(config),
+          _kv(kv),
+          _motor(config.waveform, config.rotationJitterMs, config.seed),
+          _ntpServer(config.epochAtStart, config.localClockSlowPpm, config.ntpRoundTripMs, config.ntpDropEvery),
+          _timeService(std::make_unique<ntp::TimeService>(_ntpServer)),
+          _random(config.seed) {}
+
+    void setup() {
+        hal::native::resetPins();
+        hal::native::setClockMicros(0);
+        hal::native::setInputLevel(_config.rotationSensorPins.input, _motor.sensorLevel());
+
+        feeder::setupFeeder(_config.rotationSensorPins, _config.motorPins, _config.sensing);
+        controller::setupFeedingState(_kv);
+        controller::feedQueue = std::make_shared<feed_queue::FeedQueue>();
+        // setupFeeder's pinMode(INPUT_PULLUP) floats the pin high, put the sensor back
+        hal::native::setInputLevel(_config.rotationSensorPins.input, _motor.sensorLevel());
+        _kv.resetWriteCount();
+        _timedOutSeen = feeder::rotationTiming.getTimedOutRotations();
+        _eventsDroppedAtStart = controller::outbox.getStats().dropped;
+        _liveCursor = controller::liveEvents->head();
+        _liveLaggedAtStart = controller::liveEvents->getStats().lagged;
+        _turnedAtStart = _motor.turnedRotations();
+
+        // what setupNTP does: the first request goes out, nothing waits for it
+        _timeService->tick(hal::millis());
+    }
+
+    // the schedule goes into the scheduler (and so NVS) like it would over
+    // MQTT, before there's a synced clock
+    void setupSchedule(const std::vector<ScheduledFeed>& schedule) {
+        setupScheduler();
+        for (size_t i = 0; i < schedule.size() && i < scheduler::MAX_SCHEDULES; i++) {
+            scheduler::Schedule entry;
+            entry.secOfDay = schedule[i].atSecOfDay;
+            entry.weekdays = scheduler::EVERY_DAY;
+            entry.rotations = schedule[i].rotations;
+            controller::feedScheduler->setSchedule(i, entry, 0);
+        }
+        _kv.resetWriteCount();
+    }
+
+    // Power off for outageMs, then boot again: feeder, feeding state and
+    // schedules come back out of NVS and NTP starts over unsynced.
+    void reboot(const unsigned long outageMs) {
+        while (feeder::isFeedPending() || !controller::feedQueue->isEmpty()) {
+            step(_config.loopPeriodMs);
+        }
+        keepSchedulerStats();
+        _stats.reboots++;
+
+        hal::native::advanceClockMillis(outageMs);
+        hal::native::setInputLevel(_config.rotationSensorPins.input, _motor.sensorLevel());
+        feeder::setupFeeder(_config.rotationSensorPins, _config.motorPins, _config.sensing);
+        hal::native::setInputLevel(_config.rotationSensorPins.input, _motor.sensorLevel());
+        controller::setupFeedingState(_kv);
+        if (_config.onDeviceSchedule) {
+            setupScheduler();
+        }
+
+        _timeService = std::make_unique<ntp::TimeService>(_ntpServer);
+        _timeService->tick(hal::millis());
+    }
+
+    void triggerFeed(const Dose dose) {
+        countTriggeredFeed(dose);
+        const uint64_t epochMs = _timeService->epochMs(hal::millis());
+        controller::queueFeed(feed_queue::Source::Mqtt, dose);
+        if (_timeService->isSynced()) {
+            controller::dispatchQueuedFeed(static_cast<unsigned long>(epochMs / 1000));
+        }
+        observeMotor();
+    }
+
+    void runForMs(const unsigned long durationMs) {
+        const unsigned long until = hal::millis() + durationMs;
+        while (hal::millis() < until) {
+            step(std::min(nextStepMs(), until - hal::millis()));
+        }
+    }
+
+    // run whole days, triggering each scheduled feed at its time of day
+    // (or leaving it to the on device scheduler)
+    void runDays(const unsigned int days, std::vector<ScheduledFeed> schedule) {
+        if (_config.onDeviceSchedule) {
+            const unsigned long endMs = hal::millis() + days * 86400UL * 1000;
+            if (_config.outageMs > 0 && _config.outageAtMs < endMs) {
+                runForMs(_config.outageAtMs - hal::millis());
+                reboot(_config.outageMs);
+            }
+            runForMs(endMs - hal::millis());
+            return;
+        }
+
+        std::sort(schedule.begin(), schedule.end(), [](const ScheduledFeed& a, const ScheduledFeed& b) { return a.atSecOfDay < b.atSecOfDay; });
+
+        for (unsigned int day = 0; day < days; day++) {
+            const unsigned long dayStartMs = day * 86400UL * 1000;
+            for (auto& feed : schedule) {
+                runForMs(dayStartMs + feed.atSecOfDay * 1000 - hal::millis());
+                triggerFeed(Dose::ofSixteenths(feed.rotations * SIXTEENTHS_PER_ROTATION + feed.sixteenths + _config.extraSixteenths));
+            }
+            runForMs(dayStartMs + 86400UL * 1000 - hal::millis());
+        }
+    }
+
+    SimulationStats getStats() {
+        _stats.storeWrites = _kv.getWriteCount();
+        _stats.turnedRotations = _motor.turnedRotations() - _turnedAtStart;
+        _stats.ntpRequests = _ntpServer.getRequestCount();
+        _stats.ntpSyncs = _timeService->getSyncCount();
+        _stats.estimatedDriftPpm = _timeService->getDrift() * 1e6;
+        _stats.feedQueue = controller::feedQueue->getStats();
+        _stats.rotationMeanMs = feeder::rotationTiming.getMeanMs();
+        _stats.rotationSigmaMs = feeder::rotationTiming.getSigmaMs();
+        _stats.rotationTimeoutMs = feeder::rotationTiming.timeoutMs();
+        _stats.slowRotations = feeder::rotationTiming.getSlowRotations();
+        _stats.timedOutRotations = feeder::rotationTiming.getTimedOutRotations();
+        _stats.eventsDropped = controller::outbox.getStats().dropped - _eventsDroppedAtStart;
+        _stats.liveEventsLagged = controller::liveEvents->getStats().lagged - _liveLaggedAtStart;
+        SimulationStats stats = _stats;
+        if (controller::feedScheduler) {
+            const auto& scheduled = controller::feedScheduler->getStats();
+            stats.scheduled.fired += scheduled.fired;
+            stats.scheduled.caughtUp += scheduled.caughtUp;
+            stats.scheduled.skipped += scheduled.skipped;
+            stats.scheduled.alreadyFired += scheduled.alreadyFired;
+            stats.scheduled.refused += scheduled.refused;
+            stats.scheduled.replans += scheduled.replans;
+        }
+        return stats;
+    }
+};
+
+}  // namespace sim
+}  // namespace feeder
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+namespace feeder {
+namespace web_server {
+namespace static_assets {
+
+/************************
+ * Pre-gzipped assets baked into flash by scripts/embed_assets.py
+ ************************/
+struct StaticAsset {
+    // source file name in assets/, eg app.css
+    const char *name;
+    // content addressed, eg /static/app.0123456789abcdef.css
+    const char *path;
+    const char *contentType;
+    // quoted, ready to go in a header
+    const char *etag;
+    const uint8_t *gzipped;
+    size_t gzippedLength;
+};
+
+}  // namespace static_assets
+}  // namespace web_server
+}  // namespace feeder
+
+#include "generated/static-assets-data.h"
+
+namespace feeder {
+namespace web_server {
+namespace static_assets {
+
+// the path never changes for a given body, so it can be cached forever
+const char CACHE_CONTROL[] = "public, max-age=31536000, immutable";
+
+const StaticAsset *findByName(const char *name) {
+    for (size_t i = 0; i < ASSET_COUNT; i++) {
+        if (strcmp(ASSETS[i].name, name) == 0) return &ASSETS[i];
+    }
+    return nullptr;
+}
+
+const char *pathFor(const char *name) {
+    auto asset = findByName(name);
+    return asset == nullptr ? "" : asset->path;
+}
+
+// If-None-Match is a comma separated list of (possibly weak) tags, or *
+bool etagMatches(const char *ifNoneMatch, const char *etag) {
+    if (ifNoneMatch == nullptr || *ifNoneMatch == 0) return false;
+
+    const size_t etagLength = strlen(etag);
+    const char *at = ifNoneMatch;
+    while (*at != 0) {
+        while (*at == ' ' || *at == ',') at++;
+        if (*at == '*') return true;
+        if (strncmp(at, "W/", 2) == 0) at += 2;
+
+        if (strncmp(at, etag, etagLength) == 0 && (at[etagLength] == 0 || at[etagLength] == ',' || at[etagLength] == ' ')) {
+            return true;
+        }
+        while (*at != 0 && *at != ',') at++;
+    }
+    return false;
+}
+
+struct AssetResponse {
+    int status;
+    // gzipped bytes to send, 0 for a 304
+    size_t bodyLength;
+};
+
+AssetResponse respond(const StaticAsset &asset, const char *ifNoneMatch) {
+    if (etagMatches(ifNoneMatch, asset.etag)) {
+        return {304, 0};
+    }
+    return {200, asset.gzippedLength};
+}
+
+}  // namespace static_assets
+}  // namespace web_server
+}  // namespace feeder
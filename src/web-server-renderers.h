@@ -1,47 +1,60 @@
 #pragma once
 
+#include <cstdio>
+#include <cstring>
 #include <ctime>
-#include <list>
-#include <string>
 
-#include "Arduino.h"
+#include "feeder-common.h"
+#include "hal.h"
+#include "static-assets.h"
 
 namespace feeder {
 namespace web_server {
 
-std::string renderTime(char *temp, size_t bufferSize, const unsigned long timeInSec) {
-    // millis to time
-    const time_t rawtime = (time_t)timeInSec;
-    struct tm *dt = gmtime(&rawtime);
-
-    // format
-    strftime(temp, bufferSize, "%Y-%m-%d %H:%M:%S", dt);
-    return temp;
-}
-
-std::string renderFooter(char *temp, size_t bufferSize) {
-    unsigned long time = millis();
-    int sec = time / 1000;
-    int min = sec / 60;
-    int hr = min / 60;
+/************************
+ * Templates (flash)
+ ************************/
+static const char ROOT_HEAD_OPEN[] PROGMEM = R"(
+<!doctype html>
+<html lang="en">
+  <head>
+    <title>Feeder</title>
+    )";
+static const char STYLESHEET_TEMPLATE[] PROGMEM = R"(<link rel="stylesheet" href="%s" />)";
+static const char ROOT_HEAD[] PROGMEM = R"(
+    <meta name="viewport" content="width=device-width, initial-scale=1, maximum-scale=1, user-scalable=no">
+    <meta charset="utf-8">
+  </head>
+  <body>
+    <div class="container-fluid">
+      <header class="row">
+        <div class="col">
+          <h1 id="pageTitle">Feeder</h1>
+        </div>
+      </header>
+    )";
 
-    snprintf(temp, bufferSize,
-             "<footer>Uptime: %02d:%02d:%02d</footer>",
-             hr, min % 60, sec % 60);
-    return temp;
-}
+static const char TRIGGERED_SUCCESS[] PROGMEM = R"(<section class="alert alert-success">Successfully triggered a feed!</section>)";
+static const char TRIGGERED_COALESCED[] PROGMEM = R"(<section class="alert alert-info">That feed was already waiting, it'll only happen once.</section>)";
+static const char TRIGGERED_INVALID[] PROGMEM = R"(<section class="alert alert-warning">Not a dose the feeder can do (grams need a calibration first).</section>)";
+static const char TRIGGERED_BUSY[] PROGMEM = R"(<section class="alert alert-warning">Too many feeds waiting already, try again once they're done.</section>)";
+static const char TRIGGERED_DUPLICATE[] PROGMEM = R"(<section class="alert alert-info">Already fed for that request, not feeding again.</section>)";
 
-std::string renderForm(char *temp, size_t bufferSize, unsigned long asOf) {
-    std::string formTemplate = R"(
+static const char FORM_TEMPLATE[] PROGMEM = R"(
       <section class="row">
         <form class="form-inline row row-cols-lg-auto align-items-center" action="/trigger_feed" method="post">
-          <input type="hidden" name="asOf" id="asOf" value="%u"/>
+          <input type="hidden" name="requestId" id="requestId" value="%s"/>
 
           <div class="col-12 form-floating">
-            <input type="number" class="form-control" name="rotations" id="rotations" value="1" />
+            <input type="number" class="form-control" name="rotations" id="rotations" value="1" min="0" step="0.0625" />
             <label for="rotations">Rotations</label>
           </div>
 
+          <div class="col-12 form-floating">
+            <input type="number" class="form-control" name="grams" id="grams" min="0" step="any" placeholder="grams" />
+            <label for="grams">or grams</label>
+          </div>
+
           <div class="col-12">
             <button class="btn btn-primary" type="submit">Feed</button>
           </div>
@@ -49,84 +62,105 @@ std::string renderForm(char *temp, size_t bufferSize, unsigned long asOf) {
       </section>
     )";
 
-    snprintf(temp, bufferSize, formTemplate.c_str(), asOf);
-    return temp;
-}
+// filled in by app.js from /events while a feed runs
+static const char LIVE_STATUS_TEMPLATE[] PROGMEM = R"(<section class="alert alert-info mt-3" id="liveStatus" data-since="%lu" hidden></section>)";
 
-std::string renderMeasurementList(char *temp, size_t bufferSize, const std::vector<std::reference_wrapper<feeder::Feeding>> &mostRecentFeedings) {
-    std::string measurementString = R"(<section class="row mt-3"><div class="col"><table class="table table-striped">)";
-    const auto alkMeasureTemplate = R"(
+static const char MEASUREMENTS_OPEN[] PROGMEM = R"(<section class="row mt-3"><div class="col"><table class="table table-striped" id="feedings">)";
+static const char MEASUREMENT_TEMPLATE[] PROGMEM = R"(
       <tr class="measurement">
         <td class="asOfAdjustedSec converted-time" data-epoch-sec="%lu">%s</td>
-        <td class="rotations">%u</td>
+        <td class="rotations">%s</td>
       </tr>
     )";
+static const char MEASUREMENTS_CLOSE[] PROGMEM = "</table></div></section>";
+
+static const char FOOTER_TEMPLATE[] PROGMEM = "<footer>Uptime: %02d:%02d:%02d</footer>";
+
+static const char ROOT_TAIL_OPEN[] PROGMEM = R"(
+    </div>
+
+    )";
+static const char SCRIPT_TEMPLATE[] PROGMEM = R"(<script src="%s"></script>)";
+static const char ROOT_TAIL[] PROGMEM = R"(
+  </body>
+</html>
+    )";
+
+/************************
+ * Renderers
+ ************************/
+const size_t TIME_BUFFER_SIZE = 20;
+const size_t REQUEST_ID_BUFFER_SIZE = 17;
+
+void renderTime(char (&out)[TIME_BUFFER_SIZE], const unsigned long timeInSec) {
+    const time_t rawtime = (time_t)timeInSec;
+    struct tm dt;
+    gmtime_r(&rawtime, &dt);
+
+    strftime(out, TIME_BUFFER_SIZE, "%Y-%m-%d %H:%M:%S", &dt);
+}
+
+template <typename Writer>
+void renderFooter(Writer &out, const unsigned long uptimeMs) {
+    unsigned long time = uptimeMs;
+    int sec = time / 1000;
+    int min = sec / 60;
+    int hr = min / 60;
+
+    out.printf(FOOTER_TEMPLATE, hr, min % 60, sec % 60);
+}
+
+template <typename Writer>
+void renderForm(Writer &out, const char *requestId) {
+    out.printf(FORM_TEMPLATE, requestId);
+}
+
+template <typename Writer, typename Feedings>
+void renderMeasurementList(Writer &out, const Feedings &mostRecentFeedings) {
+    out.write(MEASUREMENTS_OPEN);
+    char time[TIME_BUFFER_SIZE];
+    char dose[feeder::DOSE_BUFFER_SIZE];
     for (auto &feedingRef : mostRecentFeedings) {
-        auto &feeding = feedingRef.get();
+        const feeder::Feeding &feeding = feedingRef;
         if (feeding.asOfAdjustedSec != 0) {
-            snprintf(temp, bufferSize, alkMeasureTemplate,
-                     feeding.asOfAdjustedSec,
-                     renderTime(temp, bufferSize, feeding.asOfAdjustedSec).c_str(),
-                     feeding.rotations);
-            measurementString += temp;
+            renderTime(time, feeding.asOfAdjustedSec);
+            feeder::formatDose(dose, feeding.dose());
+            out.printf(MEASUREMENT_TEMPLATE, feeding.asOfAdjustedSec, time, dose);
         }
     }
-    measurementString += "</table></div></section>";
-    return measurementString;
+    out.write(MEASUREMENTS_CLOSE);
 }
 
-void renderRoot(std::string &out, const std::string &triggered, const std::vector<std::reference_wrapper<feeder::Feeding>> &mostRecentFeedings) {
-    std::string triggeredContent = "";
-    if (triggered == "true") {
-        triggeredContent = R"(<section class="alert alert-success">Successfully triggered a feed!</section>)";
-    } else if (triggered == "false") {
-        triggeredContent = R"(<section class="alert alert-warning">Failed to trigger a feed!</section>)";
+// uptimeMs is passed in so rendering the page twice gives the same page.
+// eventsSince is where the page picks up /events from. renderTable(out)
+// writes the feedings, see renderMeasurementList.
+template <typename Writer, typename RenderTable>
+void renderRootPage(Writer &out, const char *triggered, const char *requestId, const RenderTable &renderTable, const unsigned long uptimeMs,
+                    const unsigned long eventsSince) {
+    out.write(ROOT_HEAD_OPEN);
+    out.printf(STYLESHEET_TEMPLATE, static_assets::pathFor("app.css"));
+    out.write(ROOT_HEAD);
+
+    // feed_queue::describe of how /trigger_feed went
+    if (strcmp(triggered, "queued") == 0) {
+        out.write(TRIGGERED_SUCCESS);
+    } else if (strcmp(triggered, "coalesced") == 0) {
+        out.write(TRIGGERED_COALESCED);
+    } else if (strcmp(triggered, "invalid") == 0) {
+        out.write(TRIGGERED_INVALID);
+    } else if (strcmp(triggered, "duplicate") == 0) {
+        out.write(TRIGGERED_DUPLICATE);
+    } else if (strcmp(triggered, "busy") == 0) {
+        out.write(TRIGGERED_BUSY);
     }
 
-    const int bufferSize = 1024;
-    char temp[bufferSize];
-    memset(temp, 0, bufferSize);
-
-    out += R"(
-<!doctype html>
-<html lang="en">
-  <head>
-    <title>Feeder</title>
-    <link rel="stylesheet" href="https://cdn.jsdelivr.net/npm/bootstrap@5.2.3/dist/css/bootstrap.min.css" />
-    <meta name="viewport" content="width=device-width, initial-scale=1, maximum-scale=1, user-scalable=no">
-    <meta charset="utf-8">
-  </head>
-  <body>
-    <div class="container-fluid">
-      <header class="row">
-        <div class="col">
-          <h1 id="pageTitle">Feeder</h1>
-        </div>
-      </header>
-    )";
-
-    out += triggeredContent;
-
-    out += renderForm(temp, bufferSize, millis());
-    out += renderMeasurementList(temp, bufferSize, mostRecentFeedings);
-    out += renderFooter(temp, bufferSize);
-    out += R"(
-    </div>
-
-    <script src="https://code.jquery.com/jquery-3.6.4.slim.min.js" integrity="sha256-a2yjHM4jnF9f54xUQakjZGaqYs/V1CYvWpoqZzC2/Bw=" crossorigin="anonymous"></script>
-    <script src="https://cdn.jsdelivr.net/npm/bootstrap@5.3.0-alpha3/dist/js/bootstrap.bundle.min.js" integrity="sha384-ENjdO4Dr2bkBIFxQpeoTz1HIcje39Wm4jDKdf19U8gI4ddQ3GYNS7NTKfAdVQSZe" crossorigin="anonymous"></script>
-    <script src="https://cdnjs.cloudflare.com/ajax/libs/luxon/3.3.0/luxon.min.js" integrity="sha512-KKbQg5o92MwtJKR9sfm/HkREzfyzNMiKPIQ7i7SZOxwEdiNCm4Svayn2DBq7MKEdrqPJUOSIpy1v6PpFlCQ0YA==" crossorigin="anonymous" referrerpolicy="no-referrer"></script>
-    <script>
-      $('.converted-time').each(function(index, item) {
-        const { DateTime } = luxon;
-        var epochSec = $(item).data("epoch-sec");
-        var timeString = DateTime.fromSeconds(epochSec).toFormat('yyyy-MM-dd HH:mm:ss');
-        $(item).text(timeString)
-      })
-    </script>
-  </body>
-</html>
-    )";
+    renderForm(out, requestId);
+    out.printf(LIVE_STATUS_TEMPLATE, eventsSince);
+    renderTable(out);
+    renderFooter(out, uptimeMs);
+    out.write(ROOT_TAIL_OPEN);
+    out.printf(SCRIPT_TEMPLATE, static_assets::pathFor("app.js"));
+    out.write(ROOT_TAIL);
 }
 
 }  // namespace web_server
@@ -1,104 +1,293 @@
 #pragma once
 
-#include <Arduino.h>
-#include <WebServer.h>  // Built into ESP32
+#ifdef ARDUINO
+#include <esp_system.h>
+#else
+#include <random>
+#endif
 
-#include <list>
+#include <functional>
 #include <memory>
-#include <string>
 
+#include "api-renderers.h"
+#include "dosing.h"
+#include "feed-queue.h"
+#include "feeding-journal.h"
 #include "feeding-store.h"
+#include "hal.h"
+#include "http-server.h"
+#include "idempotency-ledger.h"
+#include "live-events.h"
+#include "metrics.h"
+#include "response-cache.h"
+#include "static-assets.h"
 #include "web-server-renderers.h"
 
 namespace feeder {
 namespace web_server {
 
-struct FeedRequest {
-    unsigned long asOf;
-    unsigned int rotations;
-};
+namespace http = richiev::http;
+
+// a browser opens ~6 connections to a host, and the pages here are small
+const size_t WEB_CONNECTIONS = 6;
+const size_t WEB_OUTPUT_BUFFERS = 3;
+const size_t WEB_OUTPUT_BUFFER_SIZE = 2048;
+using WebHttpServer = http::HttpServer<WEB_CONNECTIONS, WEB_OUTPUT_BUFFERS, WEB_OUTPUT_BUFFER_SIZE>;
+
+// the root page's table for 50 feedings is ~7KB, an /api/feedings page of
+// 50 ~2KB
+const size_t WEB_CACHE_SIZE = 12 * 1024;
+const size_t WEB_CACHE_ENTRIES = 8;
+using WebResponseCache = response_cache::ResponseCache<WEB_CACHE_SIZE, WEB_CACHE_ENTRIES>;
+static_assert(FEEDINGS_PAGE_MAX_LIMIT * FEEDINGS_JSON_BYTES_PER_FEEDING + FEEDINGS_JSON_OVERHEAD_BYTES <= WEB_CACHE_SIZE,
+              "the biggest /api/feedings page has to fit the response cache");
+
+const response_cache::Key MEASUREMENT_LIST_KEY = {1, 0, 0, 0};
+
+response_cache::Key feedingsJsonKey(const FeedingsQuery &query) {
+    return {2, static_cast<uint32_t>(query.since), query.skipAtSince | (query.fromCursor ? 0x80000000u : 0), query.limit};
+}
+
+inline constexpr hal::EventInfo WEB_FEED_WITHOUT_ID{hal::LogLevel::Warn, "Feeding without a requestId, retries of this can double feed"};
+inline constexpr hal::EventInfo WEB_FEED_REQUESTED{hal::LogLevel::Info, "Feed requested from the web page sixteenths=%lu, result="};
+
+// requests within this of each other share one copy of the metrics
+const unsigned long METRICS_CAPTURE_MAX_AGE_MS = 1000;
+
+uint32_t randomWord() {
+#ifdef ARDUINO
+    return esp_random();
+#else
+    static std::minstd_rand random(std::random_device{}());
+    return static_cast<uint32_t>(random());
+#endif
+}
 
-template <size_t N>
+template <size_t N, size_t HistoryN>
 class FeederWebServer {
    private:
-    WebServer _server;
+    WebHttpServer _server;
     std::shared_ptr<feeding_store::FeedingStore<N>> _feedStore;
-    std::unique_ptr<FeedRequest> _pendingFeedRequest;
+    std::shared_ptr<feeding_store::FeedingJournal<HistoryN>> _journal;
+    std::shared_ptr<idempotency::IdempotencyLedger> _ledger;
+    std::shared_ptr<feed_queue::FeedQueue> _feedQueue;
+    std::shared_ptr<dosing::DoseCalibration> _calibration;
+    std::shared_ptr<live_events::LiveEvents> _liveEvents;
+    std::function<void(metrics::Snapshot &)> _collectMetrics;
+    // what's rendered from the store and journal, by their generation
+    WebResponseCache _cache;
+    // in ETags made from a generation, which starts again on boot
+    const uint32_t _bootId = randomWord();
+    metrics::Capture _metricsCapture;
+    unsigned long _metricsCapturedAtMs = 0;
+    bool _metricsCaptured = false;
 
    public:
-    FeederWebServer(std::shared_ptr<feeding_store::FeedingStore<N>> feedStore) : _feedStore(feedStore), _server(80) {}
+    FeederWebServer(std::shared_ptr<feeding_store::FeedingStore<N>> feedStore, std::shared_ptr<feeding_store::FeedingJournal<HistoryN>> journal,
+                    std::shared_ptr<idempotency::IdempotencyLedger> ledger, std::shared_ptr<feed_queue::FeedQueue> feedQueue,
+                    std::shared_ptr<dosing::DoseCalibration> calibration, std::shared_ptr<live_events::LiveEvents> liveEvents,
+                    std::function<void(metrics::Snapshot &)> collectMetrics, const uint16_t port = 80)
+        : _server(port), _feedStore(feedStore), _journal(journal), _ledger(ledger), _feedQueue(feedQueue), _calibration(calibration), _liveEvents(liveEvents), _collectMetrics(collectMetrics) {}
 
-    void handleRoot() {
-        std::string bodyText;
-        const String triggered = _server.arg("triggered");
-        const auto &mostRecentReadings = _feedStore->getFeedingsSortedByAsOf();
+    // the root page's table, rendered once per change to the store.
+    // newRequest counts it as a cache hit or miss, re-renders don't.
+    std::string_view cachedMeasurementList(const bool newRequest) {
+        const auto render = [this](response_cache::ArenaWriter &out) { renderMeasurementList(out, _feedStore->newestFirst()); };
+        return newRequest ? _cache.fetch(MEASUREMENT_LIST_KEY, _feedStore->getGeneration(), render)
+                          : _cache.get(MEASUREMENT_LIST_KEY, _feedStore->getGeneration(), render);
+    }
+
+    std::string_view cachedFeedingsJson(const FeedingsQuery &query, const bool newRequest) {
+        const auto render = [this, &query](response_cache::ArenaWriter &out) { renderFeedingsJson(out, *_journal, query); };
+        return newRequest ? _cache.fetch(feedingsJsonKey(query), _journal->getGeneration(), render)
+                          : _cache.get(feedingsJsonKey(query), _journal->getGeneration(), render);
+    }
 
-        renderRoot(bodyText, std::string(triggered.c_str()), mostRecentReadings);
+    void handleRoot(const http::Request &request, http::Response &response) {
+        char triggered[12];
+        request.arg("triggered", triggered);
+        // a fresh ID per page load, a resubmitted form reuses it
+        char requestId[REQUEST_ID_BUFFER_SIZE];
+        snprintf(requestId, sizeof(requestId), "%08lx%08lx", static_cast<unsigned long>(randomWord()), static_cast<unsigned long>(randomWord()));
+        const unsigned long uptimeMs = hal::millis();
+        // the page's own feedings are what's stored now, /events takes over from here
+        const unsigned long eventsSince = _liveEvents->head();
 
-        _server.send(200, "text/html", bodyText.c_str());
+        // rendered a window at a time as the socket takes it, the page never
+        // exists in one piece
+        cachedMeasurementList(true);
+        auto *self = this;
+        response.render(200, "text/html", [self, triggered, requestId, uptimeMs, eventsSince](http::BodyWriter &out) {
+            renderRootPage(out, triggered, requestId, [self](http::BodyWriter &table) {
+                const auto cached = self->cachedMeasurementList(false);
+                if (cached.empty()) {
+                    renderMeasurementList(table, self->_feedStore->newestFirst());
+                } else {
+                    table.write(cached.data(), cached.size());
+                }
+            }, uptimeMs, eventsSince);
+        });
     }
 
-    void handleNotFound() {
-        String message = "File Not Found\n\n";
-        message += "URI: ";
-        message += _server.uri();
-        message += "\nMethod: ";
-        message += (_server.method() == HTTP_GET) ? "GET" : "POST";
-        message += "\nArguments: ";
-        message += _server.args();
-        message += "\n";
-
-        for (uint8_t i = 0; i < _server.args(); i++) {
-            message += " " + _server.argName(i) + ": " + _server.arg(i) + "\n";
+    void handleAsset(const static_assets::StaticAsset &asset, const http::Request &request, http::Response &response) {
+        char ifNoneMatch[64];
+        snprintf(ifNoneMatch, sizeof(ifNoneMatch), "%.*s", static_cast<int>(request.ifNoneMatch.size()), request.ifNoneMatch.data());
+        const auto result = static_assets::respond(asset, ifNoneMatch);
+
+        response.header("ETag", asset.etag);
+        response.header("Cache-Control", static_assets::CACHE_CONTROL);
+        if (result.status == 304) {
+            response.status(304);
+            return;
         }
 
-        _server.send(404, "text/plain", message);
+        response.header("Content-Encoding", "gzip");
+        response.staticBody(200, asset.contentType, asset.gzipped, asset.gzippedLength);
     }
 
-    void handleFeed() {
-        String rotationsString = _server.arg("rotations");
-        if (rotationsString == "") {
-            Serial.println("Bad rotations!");
+    void handleFeedingsApi(const http::Request &request, http::Response &response) {
+        char since[16];
+        char cursor[32];
+        char limit[8];
+        request.arg("since", since);
+        request.arg("cursor", cursor);
+        request.arg("limit", limit);
+        const auto query = parseFeedingsQuery(since, cursor, limit);
+
+        // the journal's generation says whether anything changed, so a 304
+        // doesn't read the history at all
+        char etag[24];
+        snprintf(etag, sizeof(etag), "\"%08lx-%lu\"", static_cast<unsigned long>(_bootId), static_cast<unsigned long>(_journal->getGeneration()));
+        response.header("ETag", etag);
+        response.header("Cache-Control", "no-cache");
+        char ifNoneMatch[64];
+        snprintf(ifNoneMatch, sizeof(ifNoneMatch), "%.*s", static_cast<int>(request.ifNoneMatch.size()), request.ifNoneMatch.data());
+        if (static_assets::etagMatches(ifNoneMatch, etag)) {
+            response.status(304);
+            return;
         }
-        String asOfString = _server.arg("asOf");
-
-        const long asOf = atol(asOfString.c_str());
-        const int rotations = atoi(rotationsString.c_str());
-
-        if (asOf > 0 && rotations > 0) {
-            auto newFeedRequest = std::make_unique<FeedRequest>();
-            newFeedRequest->asOf = asOf;
-            newFeedRequest->rotations = rotations;
-            _pendingFeedRequest = std::move(newFeedRequest);
-
-            _server.sendHeader("Location", "/?triggered=true", true);
-            _server.send(302, "text/plain", "triggered=true");
-        } else {
-            _server.sendHeader("Location", "/?triggered=false", true);
-            _server.send(302, "text/plain", "triggered=false");
+
+        // out of the cache, or for a page too big for it, read out of flash
+        // for each window as it goes out
+        cachedFeedingsJson(query, true);
+        auto *self = this;
+        response.render(200, "application/json", [self, query](http::BodyWriter &out) {
+            const auto cached = self->cachedFeedingsJson(query, false);
+            if (cached.empty()) {
+                renderFeedingsJson(out, *self->_journal, query);
+            } else {
+                out.write(cached.data(), cached.size());
+            }
+        });
+    }
+
+    void handleLogs(const http::Request &request, http::Response &response) {
+        char sinceArg[12];
+        request.arg("since", sinceArg);
+        const uint32_t since = strtoul(sinceArg, nullptr, 10);
+        const uint32_t until = hal::logTail.lastSeq();
+
+        char seq[12];
+        snprintf(seq, sizeof(seq), "%lu", static_cast<unsigned long>(until));
+        response.header("X-Log-Seq", seq);
+        response.header("Cache-Control", "no-cache");
+        response.render(200, "text/plain", [since, until](http::BodyWriter &out) { renderLogTail(out, hal::logTail, since, until); });
+    }
+
+    // feed events as they happen, see LiveEvents. Every open page reads the
+    // same frames, each through its own cursor.
+    void handleEvents(const http::Request &request, http::Response &response) {
+        char since[12];
+        request.arg("since", since);
+        auto *events = _liveEvents.get();
+        response.eventStream(events->startFor(request.lastEventId, since), [events](uint32_t &cursor, char *out, const size_t size) {
+            return events->next(cursor, out, size);
+        });
+    }
+
+    void handleMetrics(const http::Request &, http::Response &response) {
+        const unsigned long nowMs = hal::millis();
+        if (!_metricsCaptured || nowMs - _metricsCapturedAtMs >= METRICS_CAPTURE_MAX_AGE_MS) {
+            metrics::Snapshot snapshot;
+            _collectMetrics(snapshot);
+            _metricsCapture.take(snapshot);
+            _metricsCapturedAtMs = nowMs;
+            _metricsCaptured = true;
         }
+
+        const auto *self = this;
+        response.render(200, "text/plain; version=0.0.4", [self](http::BodyWriter &out) { metrics::renderPrometheus(out, self->_metricsCapture); });
     }
 
-    void setupWebServer() {
-        _server.on("/", [&]() { handleRoot(); });
-        _server.on("/trigger_feed", HTTPMethod::HTTP_POST, [&]() { handleFeed(); });
-        _server.onNotFound([&]() { handleNotFound(); });
-        _server.begin();
-        Serial.println("HTTP server started");
+    void handleNotFound(const http::Request &request, http::Response &response) {
+        response.text(404, "File Not Found\n\nURI: %.*s\nMethod: %s\n", static_cast<int>(request.path.size()), request.path.data(),
+                      request.method == http::Method::Get ? "GET" : "POST");
     }
 
-    void loopWebServer() {
-        _server.handleClient();
+    void handleFeed(const http::Request &request, http::Response &response) {
+        // rotations (can be fractional), fraction or grams
+        char rotations[16];
+        char fraction[16];
+        char grams[16];
+        char requestId[40];
+        char asOf[16];
+        request.arg("rotations", rotations);
+        request.arg("fraction", fraction);
+        request.arg("grams", grams);
+        request.arg("requestId", requestId);
+        request.arg("asOf", asOf);
+
+        dosing::DoseRequest doseRequest;
+        doseRequest.rotations = atof(rotations);
+        doseRequest.fraction = atof(fraction);
+        doseRequest.grams = atof(grams);
+
+        // the page sends a requestId, older clients a numeric asOf, same as
+        // over MQTT. Anything else still feeds, without retry protection.
+        if (requestId[0] == '\0' && asOf[0] != '\0') {
+            snprintf(requestId, sizeof(requestId), "asOf:%lu", strtoul(asOf, nullptr, 10));
+        }
+        if (requestId[0] == '\0') {
+            hal::log<WEB_FEED_WITHOUT_ID>();
+        }
+
+        Dose dose;
+        const auto result = dosing::resolveDose(doseRequest, *_calibration, dose)
+                                ? feed_queue::requestFeed(*_feedQueue, *_ledger, requestId[0] == '\0' ? nullptr : requestId, feed_queue::Source::Http, dose, hal::millis())
+                                : feed_queue::RequestResult::Invalid;
+        hal::logText<WEB_FEED_REQUESTED>(feed_queue::describe(result), dose.totalSixteenths());
+
+        char location[32];
+        snprintf(location, sizeof(location), "/?triggered=%s", feed_queue::describe(result));
+        response.redirect(location);
     }
 
-    std::unique_ptr<FeedRequest> retrievePendingFeedRequest() {
-        if (_pendingFeedRequest) {
-            auto feedReq = std::move(_pendingFeedRequest);
-            _pendingFeedRequest = nullptr;
-            return feedReq;
+    bool setupWebServer() {
+        _server.on("/", http::Method::Any, [this](const http::Request &request, http::Response &response) { handleRoot(request, response); });
+        for (size_t i = 0; i < static_assets::ASSET_COUNT; i++) {
+            const auto *asset = &static_assets::ASSETS[i];
+            _server.on(asset->path, http::Method::Get, [this, asset](const http::Request &request, http::Response &response) { handleAsset(*asset, request, response); });
         }
-        return nullptr;
+        _server.on("/api/feedings", http::Method::Get, [this](const http::Request &request, http::Response &response) { handleFeedingsApi(request, response); });
+        _server.on("/trigger_feed", http::Method::Post, [this](const http::Request &request, http::Response &response) { handleFeed(request, response); });
+        _server.on("/events", http::Method::Get, [this](const http::Request &request, http::Response &response) { handleEvents(request, response); });
+        _server.on("/logs", http::Method::Get, [this](const http::Request &request, http::Response &response) { handleLogs(request, response); });
+        _server.on("/metrics", http::Method::Get, [this](const http::Request &request, http::Response &response) { handleMetrics(request, response); });
+        _server.onNotFound([this](const http::Request &request, http::Response &response) { handleNotFound(request, response); });
+
+        const bool started = _server.begin();
+        hal::logSink.println(started ? "HTTP server started" : "HTTP server failed to start");
+        return started;
+    }
+
+    // never blocks on a client, see HttpServer
+    void loopWebServer(const unsigned long nowMs, const unsigned long waitMs = 0) {
+        _server.poll(nowMs, waitMs);
     }
+
+    const http::HttpStats &getStats() const { return _server.getStats(); }
+    const response_cache::CacheStats &getCacheStats() const { return _cache.getStats(); }
+    uint16_t getPort() const { return _server.getPort(); }
 };
 
 }  // namespace web_server
@@ -0,0 +1,177 @@
+#include <unity.h>
+
+#include "feed-queue.h"
+#include "idempotency-ledger.h"
+#include "memory-kv-store.h"
+#include "scheduler.h"
+
+using feeder::Dose;
+using feeder::feed_queue::FeedCommand;
+using feeder::feed_queue::FeedQueue;
+using feeder::feed_queue::RequestResult;
+using feeder::feed_queue::Source;
+
+hal::MemoryKeyValueStore* kv;
+feeder::idempotency::IdempotencyLedger* ledger;
+FeedQueue* queue;
+
+void setUp() {
+    kv = new hal::MemoryKeyValueStore();
+    ledger = new feeder::idempotency::IdempotencyLedger(*kv);
+    ledger->load();
+    queue = new FeedQueue();
+}
+void tearDown() {
+    delete queue;
+    delete ledger;
+    delete kv;
+}
+
+RequestResult request(const char* requestId, const Source source, const Dose dose) {
+    return feeder::feed_queue::requestFeed(*queue, *ledger, requestId, source, dose, 0);
+}
+
+/************************
+ * Coalescing
+ ************************/
+void test_different_request_ids_are_different_feeds() {
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request("a", Source::Mqtt, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request("b", Source::Mqtt, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(2, queue->size());
+    TEST_ASSERT_EQUAL(0, queue->getStats().coalesced);
+}
+
+void test_the_same_request_id_is_a_duplicate() {
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request("a", Source::Http, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(RequestResult::Duplicate, request("a", Source::Http, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(1, queue->size());
+}
+
+void test_requests_without_ids_coalesce_with_each_other() {
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request(nullptr, Source::Mqtt, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(RequestResult::Coalesced, request(nullptr, Source::Mqtt, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(1, queue->size());
+
+    // but not across sources or doses
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request(nullptr, Source::Http, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request(nullptr, Source::Mqtt, Dose::ofRotations(2)));
+    TEST_ASSERT_EQUAL(3, queue->size());
+}
+
+void test_requests_with_and_without_ids_do_not_coalesce() {
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request(nullptr, Source::Mqtt, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request("a", Source::Mqtt, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request(nullptr, Source::Scheduler, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(RequestResult::Coalesced, request(nullptr, Source::Scheduler, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(3, queue->size());
+}
+
+void test_schedule_slots_with_the_same_dose_do_not_coalesce() {
+    // two slots come due behind a running feed, after an outage say
+    const feeder::scheduler::Slot morning = {.epochSec = 1767250800, .schedule = 0};
+    const feeder::scheduler::Slot noon = {.epochSec = 1767268800, .schedule = 1};
+    TEST_ASSERT_EQUAL(feeder::feed_queue::PushResult::Queued, queue->push(Source::Scheduler, Dose::ofRotations(1), 0, morning.key()));
+    TEST_ASSERT_EQUAL(feeder::feed_queue::PushResult::Queued, queue->push(Source::Scheduler, Dose::ofRotations(1), 0, noon.key()));
+    // the same slot offered again is still the one feed
+    TEST_ASSERT_EQUAL(feeder::feed_queue::PushResult::Coalesced, queue->push(Source::Scheduler, Dose::ofRotations(1), 0, noon.key()));
+    TEST_ASSERT_EQUAL(2, queue->size());
+
+    // and a slot's key isn't a request ID to remember
+    FeedCommand command;
+    TEST_ASSERT_TRUE(queue->pop(command, 0));
+    feeder::feed_queue::recordDispatched(*ledger, command);
+    TEST_ASSERT_EQUAL(0, ledger->getStats().recorded);
+}
+
+/************************
+ * Across reboots
+ ************************/
+// what a reboot keeps: the ledger's NVS, not the queue
+void reboot() {
+    delete queue;
+    delete ledger;
+    ledger = new feeder::idempotency::IdempotencyLedger(*kv);
+    ledger->load();
+    queue = new FeedQueue();
+}
+
+void test_dispatched_id_is_a_duplicate_after_a_reboot() {
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request("a", Source::Mqtt, Dose::ofRotations(1)));
+    FeedCommand command;
+    TEST_ASSERT_TRUE(queue->pop(command, 0));
+    feeder::feed_queue::recordDispatched(*ledger, command);
+    TEST_ASSERT_EQUAL(RequestResult::Duplicate, request("a", Source::Mqtt, Dose::ofRotations(1)));
+
+    reboot();
+    TEST_ASSERT_EQUAL(RequestResult::Duplicate, request("a", Source::Mqtt, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(1, ledger->getStats().duplicates);
+}
+
+void test_id_lost_from_the_queue_to_a_reboot_can_be_retried() {
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request("a", Source::Http, Dose::ofRotations(1)));
+    // nothing recorded while it waits
+    TEST_ASSERT_EQUAL(0, ledger->getStats().recorded);
+
+    reboot();
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request("a", Source::Http, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(1, queue->size());
+}
+
+/************************
+ * A full queue
+ ************************/
+void test_full_queue_is_busy_and_the_id_can_be_retried() {
+    char id[8];
+    for (size_t i = 0; i < FeedQueue::capacity(); i++) {
+        snprintf(id, sizeof(id), "f%u", static_cast<unsigned int>(i));
+        TEST_ASSERT_EQUAL(RequestResult::Queued, request(id, Source::Mqtt, Dose::ofRotations(1)));
+    }
+    TEST_ASSERT_EQUAL(RequestResult::Busy, request("late", Source::Mqtt, Dose::ofRotations(1)));
+    TEST_ASSERT_EQUAL(1, queue->getStats().rejected);
+
+    FeedCommand command;
+    TEST_ASSERT_TRUE(queue->pop(command, 0));
+    TEST_ASSERT_EQUAL(RequestResult::Queued, request("late", Source::Mqtt, Dose::ofRotations(1)));
+}
+
+void test_full_queue_still_spots_a_retry_of_a_waiting_id() {
+    char id[8];
+    for (size_t i = 0; i < FeedQueue::capacity(); i++) {
+        snprintf(id, sizeof(id), "f%u", static_cast<unsigned int>(i));
+        request(id, Source::Mqtt, Dose::ofRotations(1));
+    }
+    TEST_ASSERT_EQUAL(RequestResult::Duplicate, request("f3", Source::Mqtt, Dose::ofRotations(1)));
+}
+
+/************************
+ * Order
+ ************************/
+void test_pops_by_priority_then_oldest_first() {
+    queue->push(Source::Scheduler, Dose::ofRotations(1), 0);
+    queue->push(Source::Mqtt, Dose::ofRotations(2), 1);
+    queue->push(Source::Http, Dose::ofRotations(3), 2);
+    queue->push(Source::Mqtt, Dose::ofRotations(4), 3);
+
+    const unsigned int expected[] = {3, 2, 4, 1};
+    FeedCommand command;
+    for (const unsigned int rotations : expected) {
+        TEST_ASSERT_TRUE(queue->pop(command, 10));
+        TEST_ASSERT_EQUAL(rotations, command.dose.rotations);
+    }
+    TEST_ASSERT_FALSE(queue->pop(command, 10));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_different_request_ids_are_different_feeds);
+    RUN_TEST(test_the_same_request_id_is_a_duplicate);
+    RUN_TEST(test_requests_without_ids_coalesce_with_each_other);
+    RUN_TEST(test_requests_with_and_without_ids_do_not_coalesce);
+    RUN_TEST(test_schedule_slots_with_the_same_dose_do_not_coalesce);
+    RUN_TEST(test_dispatched_id_is_a_duplicate_after_a_reboot);
+    RUN_TEST(test_id_lost_from_the_queue_to_a_reboot_can_be_retried);
+    RUN_TEST(test_full_queue_is_busy_and_the_id_can_be_retried);
+    RUN_TEST(test_full_queue_still_spots_a_retry_of_a_waiting_id);
+    RUN_TEST(test_pops_by_priority_then_oldest_first);
+    return UNITY_END();
+}
@@ -0,0 +1,378 @@
+#include <unity.h>
+
+#include <vector>
+
+#include "feeding-journal.h"
+#include "memory-kv-store.h"
+
+using feeding_store::FeedingJournal;
+using feeding_store::FeedingStore;
+
+// small enough that a few hundred feedings wrap the ring
+const size_t HISTORY = 100;
+using Journal = FeedingJournal<HISTORY>;
+
+hal::MemoryKeyValueStore* kv;
+
+void setUp() { kv = new hal::MemoryKeyValueStore(); }
+void tearDown() { delete kv; }
+
+feeder::Feeding feedingAt(const size_t i) {
+    // a few feeds a day, not evenly spaced, some of them part rotations
+    feeder::Feeding feeding = {.asOfAdjustedSec = 1767225600UL + i * 21600 + (i * 7919) % 3600, .rotations = 1 + static_cast<unsigned int>(i % 3)};
+    if (i % 5 == 0) {
+        feeding.rotations = 0;
+        feeding.sixteenths = 4;
+    }
+    return feeding;
+}
+
+// every feeding the journal has, oldest first
+std::vector<feeder::Feeding> restore() {
+    Journal journal(*kv);
+    FeedingStore<HISTORY> store;
+    journal.load(store);
+    std::vector<feeder::Feeding> feedings;
+    journal.forEachOldestFirst([&](const feeder::Feeding& feeding) {
+        feedings.push_back(feeding);
+        return true;
+    });
+    return feedings;
+}
+
+// the newest of feedings 0..end-1, at least as many as it keeps
+void assertRestored(const std::vector<feeder::Feeding>& feedings, const size_t end) {
+    TEST_ASSERT_GREATER_OR_EQUAL(end < HISTORY ? end : HISTORY, feedings.size());
+    TEST_ASSERT_LESS_OR_EQUAL(end, feedings.size());
+    const size_t from = end - feedings.size();
+    for (size_t i = from; i < end; i++) {
+        const auto expected = feedingAt(i);
+        TEST_ASSERT_EQUAL(expected.asOfAdjustedSec, feedings[i - from].asOfAdjustedSec);
+        TEST_ASSERT_EQUAL(expected.rotations, feedings[i - from].rotations);
+        TEST_ASSERT_EQUAL(expected.sixteenths, feedings[i - from].sixteenths);
+    }
+}
+
+template <typename J>
+void appendAll(J& journal, const size_t from, const size_t to) {
+    for (size_t i = from; i < to; i++) journal.append(feedingAt(i));
+}
+
+/************************
+ * Writes per feed
+ ************************/
+void test_append_between_flushes_writes_one_entry() {
+    Journal journal(*kv);
+    FeedingStore<HISTORY> store;
+    journal.load(store);
+    // the first starts a page, which also writes the tip
+    journal.append(feedingAt(0));
+
+    for (size_t i = 1; i < feeding_store::PENDING_FEEDINGS - 1; i++) {
+        kv->resetWriteCount();
+        journal.append(feedingAt(i));
+        TEST_ASSERT_EQUAL(1, kv->getWriteCount());
+        TEST_ASSERT_EQUAL(1, kv->getEntriesWritten());
+    }
+}
+
+void test_append_folds_pending_into_the_page_once_per_batch() {
+    Journal journal(*kv);
+    FeedingStore<HISTORY> store;
+    journal.load(store);
+    appendAll(journal, 0, feeding_store::PENDING_FEEDINGS - 1);
+
+    kv->resetWriteCount();
+    journal.append(feedingAt(feeding_store::PENDING_FEEDINGS - 1));
+    // just the page blob, nothing pending
+    TEST_ASSERT_EQUAL(1, kv->getWriteCount());
+}
+
+void test_wear_per_feed_is_under_two_entries() {
+    Journal journal(*kv);
+    FeedingStore<HISTORY> store;
+    journal.load(store);
+    kv->resetWriteCount();
+
+    const size_t feedings = 1000;
+    appendAll(journal, 0, feedings);
+    // the per feeding slots this replaced cost 2 entries (record and tip)
+    TEST_ASSERT_LESS_THAN(2 * feedings, kv->getEntriesWritten());
+}
+
+/************************
+ * Reloading
+ ************************/
+void test_reload_restores_pending_and_paged_feedings() {
+    const size_t checkpoints[] = {1, 5, 15, 16, 17, 45, 90, 300};
+    Journal journal(*kv);
+    FeedingStore<HISTORY> store;
+    journal.load(store);
+
+    size_t appended = 0;
+    for (const size_t checkpoint : checkpoints) {
+        appendAll(journal, appended, checkpoint);
+        appended = checkpoint;
+        assertRestored(restore(), appended);
+    }
+}
+
+void test_reload_then_append_carries_on() {
+    {
+        Journal journal(*kv);
+        FeedingStore<HISTORY> store;
+        journal.load(store);
+        appendAll(journal, 0, 20);
+    }
+    {
+        Journal journal(*kv);
+        FeedingStore<HISTORY> store;
+        journal.load(store);
+        TEST_ASSERT_EQUAL(20, journal.getLoadStats().feedingsRestored);
+        appendAll(journal, 20, 70);
+    }
+    assertRestored(restore(), 70);
+}
+
+void test_load_fills_the_store_newest_last() {
+    {
+        Journal journal(*kv);
+        FeedingStore<HISTORY> store;
+        journal.load(store);
+        appendAll(journal, 0, 30);
+    }
+    Journal journal(*kv);
+    FeedingStore<10> store;
+    journal.load(store);
+    TEST_ASSERT_EQUAL(feedingAt(29).asOfAdjustedSec, store.getFeedings()[store.getNewestIndex()].asOfAdjustedSec);
+    TEST_ASSERT_EQUAL(10, journal.getLoadStats().feedingsRestored);
+}
+
+/************************
+ * From a point in time
+ ************************/
+// enough pages (50) that reading them all would show
+using LongJournal = FeedingJournal<2000>;
+
+std::vector<feeder::Feeding> feedingsSince(LongJournal& journal, const uint32_t since) {
+    std::vector<feeder::Feeding> feedings;
+    journal.forEachSince(since, [&](const feeder::Feeding& feeding) {
+        feedings.push_back(feeding);
+        return true;
+    });
+    return feedings;
+}
+
+void assertSinceMatchesFullWalk(LongJournal& journal) {
+    std::vector<feeder::Feeding> all;
+    journal.forEachOldestFirst([&](const feeder::Feeding& feeding) {
+        all.push_back(feeding);
+        return true;
+    });
+    TEST_ASSERT_GREATER_THAN(0, all.size());
+
+    for (const size_t from : {size_t(0), size_t(1), all.size() / 3, all.size() / 2, all.size() - 1}) {
+        const auto feedings = feedingsSince(journal, all[from].asOfAdjustedSec);
+        TEST_ASSERT_EQUAL(all.size() - from, feedings.size());
+        for (size_t i = 0; i < feedings.size(); i++) {
+            TEST_ASSERT_EQUAL(all[from + i].asOfAdjustedSec, feedings[i].asOfAdjustedSec);
+        }
+        // a second either side of a feeding
+        TEST_ASSERT_EQUAL(all.size() - from, feedingsSince(journal, all[from].asOfAdjustedSec - 1).size());
+        TEST_ASSERT_EQUAL(all.size() - from - 1, feedingsSince(journal, all[from].asOfAdjustedSec + 1).size());
+    }
+    TEST_ASSERT_EQUAL(all.size(), feedingsSince(journal, 0).size());
+    TEST_ASSERT_EQUAL(0, feedingsSince(journal, all.back().asOfAdjustedSec + 1).size());
+}
+
+void test_since_returns_what_a_full_walk_would() {
+    LongJournal journal(*kv);
+    FeedingStore<HISTORY> store;
+    journal.load(store);
+    // before the ring has gone round, then after
+    appendAll(journal, 0, 300);
+    assertSinceMatchesFullWalk(journal);
+    appendAll(journal, 300, 5000);
+    assertSinceMatchesFullWalk(journal);
+}
+
+void test_since_reads_only_the_pages_it_returns() {
+    LongJournal journal(*kv);
+    FeedingStore<HISTORY> store;
+    journal.load(store);
+    appendAll(journal, 0, 5000);
+
+    for (const size_t from : {size_t(3100), size_t(4000), size_t(4990)}) {
+        const size_t before = journal.getPagesRead();
+        unsigned int returned = 0;
+        journal.forEachSince(feedingAt(from).asOfAdjustedSec, [&](const feeder::Feeding&) { return ++returned < 50; });
+        TEST_ASSERT_GREATER_THAN(0, returned);
+        // log2(50) headers to find it, and the two pages 50 feedings can span
+        TEST_ASSERT_LESS_OR_EQUAL(8, journal.getPagesRead() - before);
+    }
+}
+
+/************************
+ * Damage and power loss
+ ************************/
+void test_torn_page_loses_only_its_feedings() {
+    {
+        Journal journal(*kv);
+        FeedingStore<HISTORY> store;
+        journal.load(store);
+        appendAll(journal, 0, 200);
+    }
+    const auto before = restore();
+
+    // the oldest page, cut short as if power went mid-write
+    kv->begin(feeding_store::PREFERENCE_NS, false);
+    const uint32_t tip = kv->getUInt("hTip", 0);
+    const size_t oldest = ((tip & 0xFFFF) + 1) % Journal::PAGE_COUNT;
+    char key[8];
+    snprintf(key, sizeof(key), "h%u", static_cast<unsigned int>(oldest));
+    uint8_t page[feeding_store::PAGE_BYTES];
+    const size_t length = kv->getBytes(key, page, sizeof(page));
+    TEST_ASSERT_GREATER_THAN(feeding_store::PAGE_HEADER_BYTES, length);
+    const uint8_t count = page[6];
+    kv->putBytes(key, page, length - 3);
+    kv->end();
+
+    const auto after = restore();
+    TEST_ASSERT_EQUAL(before.size() - count, after.size());
+    // what's left is still the newest, in order
+    for (size_t i = 0; i < after.size(); i++) {
+        TEST_ASSERT_EQUAL(before[i + count].asOfAdjustedSec, after[i].asOfAdjustedSec);
+    }
+}
+
+// power cut after each of the writes an append makes, at every point in a
+// few pages: the earlier feedings survive, and so does the new one if it
+// got far enough
+void test_power_loss_mid_append_keeps_earlier_feedings() {
+    for (size_t lost = 1; lost < 150; lost++) {
+        for (long writes = 0; writes < 3; writes++) {
+            delete kv;
+            kv = new hal::MemoryKeyValueStore();
+            {
+                Journal journal(*kv);
+                FeedingStore<HISTORY> feedingStore;
+                journal.load(feedingStore);
+                appendAll(journal, 0, lost);
+                kv->losePowerAfter(writes);
+                journal.append(feedingAt(lost));
+                kv->restorePower();
+            }
+            const auto restored = restore();
+            const bool keptNew = !restored.empty() && restored.back().asOfAdjustedSec == feedingAt(lost).asOfAdjustedSec;
+            assertRestored(restored, keptNew ? lost + 1 : lost);
+
+            // and the journal carries on from there
+            {
+                Journal journal(*kv);
+                FeedingStore<HISTORY> feedingStore;
+                journal.load(feedingStore);
+                appendAll(journal, lost + 1, lost + 3);
+            }
+            const auto carriedOn = restore();
+            TEST_ASSERT_EQUAL(feedingAt(lost + 2).asOfAdjustedSec, carriedOn.back().asOfAdjustedSec);
+        }
+    }
+}
+
+/************************
+ * Migration
+ ************************/
+void test_migrates_slot_format() {
+    // 50 u64 slots and a tip, the ring having wrapped to slot 7
+    const size_t slots = 50;
+    const size_t next = 7;
+    kv->begin(feeding_store::PREFERENCE_NS, false);
+    for (size_t i = 0; i < slots; i++) {
+        // slot next is the oldest
+        const size_t age = (i + slots - next) % slots;
+        const auto feeding = feedingAt(age);
+        uint8_t bytes[7];
+        const uint16_t sequence = static_cast<uint16_t>(100 + age);
+        for (int b = 0; b < 4; b++) bytes[b] = static_cast<uint8_t>(feeding.asOfAdjustedSec >> (8 * b));
+        bytes[4] = static_cast<uint8_t>(sequence);
+        bytes[5] = static_cast<uint8_t>(sequence >> 8);
+        bytes[6] = static_cast<uint8_t>(1 + age % 3);
+        uint64_t record = static_cast<uint64_t>(feeding_store::crc8(bytes, sizeof(bytes))) << 56;
+        for (int b = 0; b < 7; b++) record |= static_cast<uint64_t>(bytes[b]) << (8 * b);
+        char key[8];
+        snprintf(key, sizeof(key), "j%u", static_cast<unsigned int>(i));
+        kv->putULong64(key, record);
+    }
+    kv->putUInt("jTip", (static_cast<uint32_t>(100 + slots - 1) << 16) | next);
+    kv->end();
+
+    Journal journal(*kv);
+    FeedingStore<HISTORY> store;
+    journal.load(store);
+    TEST_ASSERT_TRUE(journal.getLoadStats().migrated);
+    TEST_ASSERT_EQUAL(slots, journal.getLoadStats().feedingsRestored);
+
+    const auto feedings = restore();
+    TEST_ASSERT_EQUAL(slots, feedings.size());
+    for (size_t age = 0; age < slots; age++) {
+        TEST_ASSERT_EQUAL(feedingAt(age).asOfAdjustedSec, feedings[age].asOfAdjustedSec);
+        TEST_ASSERT_EQUAL(1 + age % 3, feedings[age].rotations);
+    }
+
+    kv->begin(feeding_store::PREFERENCE_NS, true);
+    TEST_ASSERT_FALSE(kv->isKey("jTip"));
+    TEST_ASSERT_FALSE(kv->isKey("j0"));
+    kv->end();
+}
+
+void test_migrates_original_format() {
+    // two keys per slot and an index, 30 of the 50 slots used
+    const size_t used = 30;
+    kv->begin(feeding_store::PREFERENCE_NS, false);
+    for (size_t i = 0; i < used; i++) {
+        const char rotationsKey[] = {static_cast<char>(1 + i), 'D', 0};
+        const char asOfKey[] = {static_cast<char>(1 + i), 'A', 0};
+        kv->putUInt(rotationsKey, 2);
+        kv->putUInt(asOfKey, feedingAt(i).asOfAdjustedSec);
+    }
+    const char indexKey[] = {'I', 0};
+    kv->putUChar(indexKey, used);
+    kv->end();
+
+    {
+        Journal journal(*kv);
+        FeedingStore<HISTORY> store;
+        journal.load(store);
+        TEST_ASSERT_TRUE(journal.getLoadStats().migrated);
+    }
+
+    const auto feedings = restore();
+    TEST_ASSERT_EQUAL(used, feedings.size());
+    for (size_t i = 0; i < used; i++) {
+        TEST_ASSERT_EQUAL(feedingAt(i).asOfAdjustedSec, feedings[i].asOfAdjustedSec);
+        TEST_ASSERT_EQUAL(2, feedings[i].rotations);
+    }
+
+    // and only once
+    Journal journal(*kv);
+    FeedingStore<HISTORY> store;
+    journal.load(store);
+    TEST_ASSERT_FALSE(journal.getLoadStats().migrated);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_append_between_flushes_writes_one_entry);
+    RUN_TEST(test_append_folds_pending_into_the_page_once_per_batch);
+    RUN_TEST(test_wear_per_feed_is_under_two_entries);
+    RUN_TEST(test_reload_restores_pending_and_paged_feedings);
+    RUN_TEST(test_reload_then_append_carries_on);
+    RUN_TEST(test_load_fills_the_store_newest_last);
+    RUN_TEST(test_since_returns_what_a_full_walk_would);
+    RUN_TEST(test_since_reads_only_the_pages_it_returns);
+    RUN_TEST(test_torn_page_loses_only_its_feedings);
+    RUN_TEST(test_power_loss_mid_append_keeps_earlier_feedings);
+    RUN_TEST(test_migrates_slot_format);
+    RUN_TEST(test_migrates_original_format);
+    return UNITY_END();
+}
@@ -0,0 +1,222 @@
+#include <unity.h>
+
+#include <cstring>
+
+#include "ntp.h"
+
+// 2026-01-01, whole seconds so the NTP fraction round trips exactly
+const uint64_t EPOCH_MS = 1767225600000ULL;
+// long enough apart for the second sync to measure drift
+const unsigned long SYNC_INTERVAL_MS = 120000;
+
+/************************
+ * Scripted NTP server
+ *
+ * Stands in for the UDP socket. Keeps the last request, and answers it only
+ * when the test says so, with whatever time (and originate timestamp) the
+ * test wants.
+ ************************/
+class ScriptedNtpServer : public ntp::UdpTransport {
+   private:
+    uint8_t _request[ntp::NTP_PACKET_SIZE] = {};
+    uint8_t _reply[ntp::NTP_PACKET_SIZE] = {};
+    bool _replying = false;
+
+    static void writeUInt32(uint8_t* bytes, const uint32_t value) {
+        bytes[0] = value >> 24;
+        bytes[1] = value >> 16;
+        bytes[2] = value >> 8;
+        bytes[3] = value;
+    }
+
+   public:
+    unsigned long requests = 0;
+
+    bool send(const uint8_t* data, size_t length) override {
+        if (length != ntp::NTP_PACKET_SIZE) return false;
+        memcpy(_request, data, length);
+        requests++;
+        return true;
+    }
+
+    size_t receive(uint8_t* buffer, size_t length) override {
+        if (!_replying || length < ntp::NTP_PACKET_SIZE) return 0;
+        _replying = false;
+        memcpy(buffer, _reply, ntp::NTP_PACKET_SIZE);
+        return ntp::NTP_PACKET_SIZE;
+    }
+
+    // the last request sent, to answer later or tamper with
+    void copyRequest(uint8_t* request) const { memcpy(request, _request, ntp::NTP_PACKET_SIZE); }
+
+    // a server reply to request carrying epochMs
+    void answerTo(const uint8_t* request, const uint64_t epochMs) {
+        memset(_reply, 0, sizeof(_reply));
+        _reply[0] = 0b00011100;  // version 3, mode 4 (server)
+        _reply[1] = 2;           // stratum
+        memcpy(_reply + 24, request + 40, 8);
+        writeUInt32(_reply + 40, static_cast<uint32_t>(epochMs / 1000 + ntp::SEVENTY_YEARS_SEC));
+        writeUInt32(_reply + 44, static_cast<uint32_t>(((epochMs % 1000) << 32) / 1000));
+        _replying = true;
+    }
+
+    void answer(const uint64_t epochMs) { answerTo(_request, epochMs); }
+};
+
+ScriptedNtpServer* server;
+ntp::TimeService* timeService;
+
+void setUp() {
+    server = new ScriptedNtpServer();
+    timeService = new ntp::TimeService(*server, SYNC_INTERVAL_MS);
+}
+void tearDown() {
+    delete timeService;
+    delete server;
+}
+
+// request at nowMs, answered within the same tick (no round trip)
+void syncAt(const unsigned long nowMs, const uint64_t serverEpochMs) {
+    timeService->tick(nowMs);
+    TEST_ASSERT_TRUE(timeService->isAwaitingReply());
+    server->answer(serverEpochMs);
+    timeService->tick(nowMs);
+    TEST_ASSERT_FALSE(timeService->isAwaitingReply());
+}
+
+/************************
+ * Before the first sync
+ ************************/
+void test_epoch_is_zero_until_the_first_sync() {
+    TEST_ASSERT_EQUAL_UINT64(0, timeService->epochMs(0));
+
+    timeService->tick(1000);
+    TEST_ASSERT_EQUAL(1, server->requests);
+    TEST_ASSERT_FALSE(timeService->isSynced());
+    TEST_ASSERT_EQUAL_UINT64(0, timeService->epochMs(1500));
+
+    server->answer(EPOCH_MS);
+    timeService->tick(1000);
+    TEST_ASSERT_TRUE(timeService->isSynced());
+    TEST_ASSERT_EQUAL_UINT64(EPOCH_MS, timeService->epochMs(1000));
+    TEST_ASSERT_EQUAL_UINT64(EPOCH_MS + 500, timeService->epochMs(1500));
+}
+
+/************************
+ * Reply matching
+ ************************/
+void test_reply_with_the_wrong_originate_timestamp_is_rejected() {
+    timeService->tick(1000);
+    uint8_t request[ntp::NTP_PACKET_SIZE];
+    server->copyRequest(request);
+    request[43] ^= 0x01;
+    server->answerTo(request, EPOCH_MS);
+    timeService->tick(1100);
+    TEST_ASSERT_FALSE(timeService->isSynced());
+    TEST_ASSERT_TRUE(timeService->isAwaitingReply());
+    TEST_ASSERT_EQUAL_UINT64(0, timeService->epochMs(1100));
+
+    // nothing else comes, so it times out and asks again
+    const unsigned long timedOutAt = 1000 + ntp::REPLY_TIMEOUT_MS + 1;
+    timeService->tick(timedOutAt);
+    TEST_ASSERT_EQUAL(1, timeService->getTimeoutCount());
+    syncAt(timedOutAt + ntp::UNSYNCED_RETRY_MS, EPOCH_MS);
+    TEST_ASSERT_EQUAL(2, server->requests);
+    TEST_ASSERT_TRUE(timeService->isSynced());
+}
+
+void test_late_reply_to_an_earlier_request_is_rejected() {
+    timeService->tick(1000);
+    uint8_t first[ntp::NTP_PACKET_SIZE];
+    server->copyRequest(first);
+    const unsigned long timedOutAt = 1000 + ntp::REPLY_TIMEOUT_MS + 1;
+    timeService->tick(timedOutAt);
+
+    // the retry goes out, then the first request's reply turns up
+    timeService->tick(timedOutAt + ntp::UNSYNCED_RETRY_MS);
+    TEST_ASSERT_EQUAL(2, server->requests);
+    server->answerTo(first, EPOCH_MS);
+    timeService->tick(timedOutAt + ntp::UNSYNCED_RETRY_MS);
+    TEST_ASSERT_FALSE(timeService->isSynced());
+}
+
+/************************
+ * Drift
+ ************************/
+void test_drift_is_measured_between_syncs() {
+    syncAt(1000, EPOCH_MS);
+    // the server moved a second more than millis() over 10000s, 100ppm. A
+    // sync that comes that late is measured the same.
+    const unsigned long intervalMs = 10000000;
+    syncAt(1000 + intervalMs, EPOCH_MS + intervalMs + 1000);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 100e-6, timeService->getDrift());
+}
+
+void test_drift_is_clamped_to_500ppm() {
+    syncAt(1000, EPOCH_MS);
+    // 10s out over 120s is a stepped clock, not an oscillator
+    const uint64_t secondSyncMs = EPOCH_MS + SYNC_INTERVAL_MS + 10000;
+    syncAt(1000 + SYNC_INTERVAL_MS, secondSyncMs);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, ntp::MAX_DRIFT, timeService->getDrift());
+    // and time runs on at no more than that
+    TEST_ASSERT_EQUAL_UINT64(secondSyncMs + 1000500, timeService->epochMs(1000 + SYNC_INTERVAL_MS + 1000000));
+}
+
+void test_drift_is_clamped_to_minus_500ppm() {
+    syncAt(1000, EPOCH_MS);
+    syncAt(1000 + SYNC_INTERVAL_MS, EPOCH_MS + SYNC_INTERVAL_MS - 10000);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, -ntp::MAX_DRIFT, timeService->getDrift());
+}
+
+void test_syncs_too_close_together_leave_drift_alone() {
+    ntp::TimeService quick(*server, 10000);
+    quick.tick(1000);
+    server->answer(EPOCH_MS);
+    quick.tick(1000);
+    quick.tick(11000);
+    server->answer(EPOCH_MS + 10000 + 50);
+    quick.tick(11000);
+    TEST_ASSERT_EQUAL(2, quick.getSyncCount());
+    TEST_ASSERT_FLOAT_WITHIN(1e-12, 0, quick.getDrift());
+}
+
+/************************
+ * Monotonic epoch
+ ************************/
+void test_epoch_never_goes_backwards_when_the_clock_is_stepped_back() {
+    syncAt(1000, EPOCH_MS);
+    const unsigned long secondSyncAt = 1000 + SYNC_INTERVAL_MS;
+    const uint64_t beforeStep = timeService->epochMs(secondSyncAt);
+    TEST_ASSERT_EQUAL_UINT64(EPOCH_MS + SYNC_INTERVAL_MS, beforeStep);
+
+    // the server says it's 5s earlier than we thought
+    syncAt(secondSyncAt, EPOCH_MS + SYNC_INTERVAL_MS - 5000);
+    uint64_t previous = beforeStep;
+    for (unsigned long nowMs = secondSyncAt; nowMs < secondSyncAt + 10000; nowMs += 100) {
+        const uint64_t epochMs = timeService->epochMs(nowMs);
+        TEST_ASSERT_GREATER_OR_EQUAL(previous, epochMs);
+        previous = epochMs;
+    }
+    // held until the corrected clock caught up, then moving again
+    TEST_ASSERT_GREATER_THAN(beforeStep, previous);
+}
+
+void test_epoch_steps_forward_straight_away() {
+    syncAt(1000, EPOCH_MS);
+    syncAt(1000 + SYNC_INTERVAL_MS, EPOCH_MS + SYNC_INTERVAL_MS + 5000);
+    TEST_ASSERT_EQUAL_UINT64(EPOCH_MS + SYNC_INTERVAL_MS + 5000, timeService->epochMs(1000 + SYNC_INTERVAL_MS));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_epoch_is_zero_until_the_first_sync);
+    RUN_TEST(test_reply_with_the_wrong_originate_timestamp_is_rejected);
+    RUN_TEST(test_late_reply_to_an_earlier_request_is_rejected);
+    RUN_TEST(test_drift_is_measured_between_syncs);
+    RUN_TEST(test_drift_is_clamped_to_500ppm);
+    RUN_TEST(test_drift_is_clamped_to_minus_500ppm);
+    RUN_TEST(test_syncs_too_close_together_leave_drift_alone);
+    RUN_TEST(test_epoch_never_goes_backwards_when_the_clock_is_stepped_back);
+    RUN_TEST(test_epoch_steps_forward_straight_away);
+    return UNITY_END();
+}
@@ -0,0 +1,244 @@
+#include <unity.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "edge-debouncer.h"
+#include "feeder-task.h"
+#include "feeder.h"
+#include "hal.h"
+#include "motor-model.h"
+
+const feeder::RotationSensorPins SENSOR_PINS = {.input = 23};
+const feeder::MotorPins MOTOR_PINS = {.powerOutput = 22};
+
+// home chatters 3 times over 8ms on the way in and out
+const unsigned long ROTATION_MS = 9600;
+const unsigned long BOUNCE_MS = 8;
+
+void setUp() {
+    hal::native::setClockMicros(0);
+    hal::native::resetPins();
+    feeder::rotationTiming = feeder::RotationTimingModel(feeder::APPROXIMATE_ROTATION_DURATION_MS);
+    feeder::drumOffsetSixteenths = 0;
+    feeder::drumPositionKnown = true;
+}
+void tearDown() {}
+
+void edge(const unsigned long atMs, const bool inRotation) {
+    hal::native::setClockMicros(static_cast<unsigned long long>(atMs) * 1000);
+    // the sensor reads LOW away from home
+    hal::native::setInputLevel(SENSOR_PINS.input, inRotation ? hal::PIN_LOW : hal::PIN_HIGH);
+}
+
+/************************
+ * EdgeDebouncer
+ ************************/
+void test_burst_settles_after_quiet_period_dated_at_first_edge() {
+    feeder::EdgeDebouncer debouncer(40, true);
+    debouncer.onEdge({1000, false});
+    debouncer.onEdge({1002, true});
+    debouncer.onEdge({1004, false});
+
+    unsigned long endedAt = 0;
+    TEST_ASSERT_TRUE(debouncer.update(1043));
+    TEST_ASSERT_FALSE(debouncer.takeRotationEnd(endedAt));
+
+    TEST_ASSERT_FALSE(debouncer.update(1044));
+    TEST_ASSERT_TRUE(debouncer.takeRotationEnd(endedAt));
+    TEST_ASSERT_EQUAL(1000, endedAt);
+    // once only
+    TEST_ASSERT_FALSE(debouncer.takeRotationEnd(endedAt));
+}
+
+void test_bounce_back_to_the_same_level_is_not_a_transition() {
+    feeder::EdgeDebouncer debouncer(40, true);
+    debouncer.onEdge({1000, false});
+    debouncer.onEdge({1003, true});
+
+    unsigned long endedAt = 0;
+    TEST_ASSERT_TRUE(debouncer.update(2000));
+    TEST_ASSERT_FALSE(debouncer.takeRotationEnd(endedAt));
+    TEST_ASSERT_EQUAL(0, debouncer.getTransitionCount());
+}
+
+/************************
+ * pollRotationFinished
+ ************************/
+void test_interrupt_sensing_reports_the_edge_time_not_the_poll_time() {
+    feeder::setupFeeder(SENSOR_PINS, MOTOR_PINS, feeder::RotationSensing::Interrupt);
+    edge(100, true);
+    edge(9700, false);
+    edge(9702, true);
+    edge(9704, false);
+
+    // the loop only gets round to it 300ms later
+    bool inRotation = true;
+    unsigned long endedAt = 0;
+    TEST_ASSERT_TRUE(feeder::pollRotationFinished(10000, inRotation, endedAt));
+    TEST_ASSERT_FALSE(inRotation);
+    TEST_ASSERT_EQUAL(9700, endedAt);
+    TEST_ASSERT_FALSE(feeder::pollRotationFinished(10005, inRotation, endedAt));
+}
+
+void test_interrupt_sensing_resyncs_after_dropped_edges() {
+    feeder::setupFeeder(SENSOR_PINS, MOTOR_PINS, feeder::RotationSensing::Interrupt);
+    // more chatter than the ring holds, ending in rotation
+    for (unsigned long i = 0; i < 40; i++) edge(100 + i, i % 2 == 0);
+    edge(200, true);
+
+    bool inRotation = false;
+    unsigned long endedAt = 0;
+    feeder::pollRotationFinished(200, inRotation, endedAt);
+    feeder::pollRotationFinished(300, inRotation, endedAt);
+    TEST_ASSERT_TRUE(inRotation);
+}
+
+/************************
+ * Stop latency
+ *
+ * Feeds run against the simulator's motor, the feeder serviced every
+ * periodMs (and now and then a slow pass). Latency is from the drum
+ * reaching home to the motor going off.
+ ************************/
+struct Latencies {
+    std::vector<double> ms;
+
+    double min() const { return *std::min_element(ms.begin(), ms.end()); }
+    double max() const { return *std::max_element(ms.begin(), ms.end()); }
+    double mean() const {
+        double sum = 0;
+        for (const double value : ms) sum += value;
+        return sum / ms.size();
+    }
+};
+
+Latencies runFeeds(const feeder::RotationSensing sensing, const unsigned long periodMs, const double slowProbability) {
+    feeder::sim::MotorModel motor(feeder::sim::RotationWaveform::withBounce(ROTATION_MS, 500, BOUNCE_MS, 3), 50, 7);
+    std::mt19937 random(7);
+    std::uniform_real_distribution<double> chance(0, 1);
+
+    feeder::setupFeeder(SENSOR_PINS, MOTOR_PINS, sensing);
+    hal::native::setInputLevel(SENSOR_PINS.input, motor.sensorLevel());
+
+    Latencies latencies;
+    bool wasOn = false;
+    for (int feed = 0; feed < 10; feed++) {
+        feeder::beginFeed(hal::millis(), 0, feeder::Dose::ofRotations(3));
+        while (feeder::isInFeed()) {
+            const unsigned long stepMs = chance(random) < slowProbability ? 100 : periodMs;
+            const bool on = hal::native::outputLevel(MOTOR_PINS.powerOutput) == hal::PIN_HIGH;
+            for (unsigned long elapsed = 0; elapsed < stepMs; elapsed++) {
+                motor.advance(hal::native::clockMicros, 1000, on);
+                hal::native::advanceClockMillis(1);
+                hal::native::setInputLevel(SENSOR_PINS.input, motor.sensorLevel());
+            }
+            feeder::loopFeeder(hal::millis());
+
+            const bool nowOn = hal::native::outputLevel(MOTOR_PINS.powerOutput) == hal::PIN_HIGH;
+            if (nowOn && !wasOn) {
+                motor.motorStarted();
+            } else if (!nowOn && wasOn && motor.passedHomeThisRun()) {
+                latencies.ms.push_back((hal::native::clockMicros - motor.lastHomeAtMicros()) / 1000.0);
+            }
+            wasOn = nowOn;
+        }
+    }
+    return latencies;
+}
+
+void test_interrupt_stop_latency_is_bounded_and_steady() {
+    const auto latencies = runFeeds(feeder::RotationSensing::Interrupt, feeder::FEEDER_TASK_PERIOD_MS, 0);
+    TEST_ASSERT_EQUAL(30, latencies.ms.size());
+
+    // the chatter, the quiet period, then at most a pass to notice
+    const double bound = BOUNCE_MS + feeder::EDGE_QUIET_PERIOD_MS + feeder::FEEDER_TASK_PERIOD_MS + 1;
+    TEST_ASSERT_LESS_OR_EQUAL(bound, latencies.max());
+    TEST_ASSERT_LESS_OR_EQUAL(feeder::FEEDER_TASK_PERIOD_MS + 1, latencies.max() - latencies.min());
+}
+
+void test_interrupt_stops_sooner_than_polling() {
+    const auto interrupt = runFeeds(feeder::RotationSensing::Interrupt, feeder::FEEDER_TASK_PERIOD_MS, 0);
+    const auto polled = runFeeds(feeder::RotationSensing::Polled, feeder::FEEDER_TASK_PERIOD_MS, 0);
+    TEST_ASSERT_EQUAL(polled.ms.size(), interrupt.ms.size());
+    TEST_ASSERT_LESS_THAN(polled.mean(), interrupt.mean());
+    TEST_ASSERT_LESS_THAN(polled.max(), interrupt.max());
+}
+
+void test_slow_passes_only_delay_the_stop_by_their_length() {
+    // a shared loop, 10ms a pass and 2% of them 100ms
+    const auto latencies = runFeeds(feeder::RotationSensing::Interrupt, 10, 0.02);
+    TEST_ASSERT_LESS_OR_EQUAL(BOUNCE_MS + feeder::EDGE_QUIET_PERIOD_MS + 100 + 1, latencies.max());
+    TEST_ASSERT_GREATER_OR_EQUAL(BOUNCE_MS, latencies.min());
+}
+
+/************************
+ * Supply sags after warm-up
+ *
+ * The model learns a 9650ms rotation, then the motor slows to 10150ms,
+ * past the learnt timeout. The forced stops mustn't teach it the short run
+ * back to home as a rotation, or count it as one.
+ ************************/
+// runs a feed to the end against motor, returns how far the drum turned
+double feedAgainst(feeder::sim::MotorModel& motor, const unsigned int rotations) {
+    const double turnedBefore = motor.turnedRotations();
+    bool wasOn = false;
+    feeder::beginFeed(hal::millis(), 0, feeder::Dose::ofRotations(rotations));
+    while (feeder::isInFeed()) {
+        const bool on = hal::native::outputLevel(MOTOR_PINS.powerOutput) == hal::PIN_HIGH;
+        if (on && !wasOn) motor.motorStarted();
+        wasOn = on;
+        for (unsigned long elapsed = 0; elapsed < feeder::FEEDER_TASK_PERIOD_MS; elapsed++) {
+            motor.advance(hal::native::clockMicros, 1000, on);
+            hal::native::advanceClockMillis(1);
+            hal::native::setInputLevel(SENSOR_PINS.input, motor.sensorLevel());
+        }
+        feeder::loopFeeder(hal::millis());
+    }
+    return motor.turnedRotations() - turnedBefore;
+}
+
+void test_supply_sagging_after_warm_up_widens_the_timeout_not_sigma() {
+    feeder::setupFeeder(SENSOR_PINS, MOTOR_PINS, feeder::RotationSensing::Interrupt);
+    {
+        feeder::sim::MotorModel warm(feeder::sim::RotationWaveform::withBounce(9650, 500, BOUNCE_MS, 3), 50, 7);
+        hal::native::setInputLevel(SENSOR_PINS.input, warm.sensorLevel());
+        for (int feed = 0; feed < 4; feed++) feedAgainst(warm, 3);
+    }
+    TEST_ASSERT_TRUE(feeder::rotationTiming.isWarm());
+    const float warmSigmaMs = feeder::rotationTiming.getSigmaMs();
+    TEST_ASSERT_LESS_THAN(10150, feeder::rotationTiming.timeoutMs());
+
+    // parked at home, as the last feed left it
+    feeder::sim::MotorModel sagged(feeder::sim::RotationWaveform::withBounce(10150, 500, BOUNCE_MS, 3), 50, 11);
+    hal::native::setInputLevel(SENSOR_PINS.input, sagged.sensorLevel());
+    const double turned = feedAgainst(sagged, 21);
+
+    TEST_ASSERT_GREATER_THAN(0, feeder::rotationTiming.getTimedOutRotations());
+    // every rotation of the dose, and not one more
+    TEST_ASSERT_FLOAT_WITHIN(0.5, 21, turned);
+    // learnt the new speed rather than the run home after a forced stop
+    TEST_ASSERT_FLOAT_WITHIN(150, 10150, feeder::rotationTiming.getMeanMs());
+    TEST_ASSERT_LESS_THAN(4 * warmSigmaMs + 200, feeder::rotationTiming.getSigmaMs());
+    TEST_ASSERT_GREATER_THAN(10150, feeder::rotationTiming.timeoutMs());
+    TEST_ASSERT_LESS_THAN(11500, feeder::rotationTiming.timeoutMs());
+
+    // and the next feed runs without forcing a stop
+    const unsigned long forced = feeder::rotationTiming.getTimedOutRotations();
+    TEST_ASSERT_FLOAT_WITHIN(0.5, 3, feedAgainst(sagged, 3));
+    TEST_ASSERT_EQUAL(forced, feeder::rotationTiming.getTimedOutRotations());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_burst_settles_after_quiet_period_dated_at_first_edge);
+    RUN_TEST(test_bounce_back_to_the_same_level_is_not_a_transition);
+    RUN_TEST(test_interrupt_sensing_reports_the_edge_time_not_the_poll_time);
+    RUN_TEST(test_interrupt_sensing_resyncs_after_dropped_edges);
+    RUN_TEST(test_interrupt_stop_latency_is_bounded_and_steady);
+    RUN_TEST(test_interrupt_stops_sooner_than_polling);
+    RUN_TEST(test_slow_passes_only_delay_the_stop_by_their_length);
+    RUN_TEST(test_supply_sagging_after_warm_up_widens_the_timeout_not_sigma);
+    return UNITY_END();
+}
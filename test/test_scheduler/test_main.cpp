@@ -0,0 +1,251 @@
+#include <unity.h>
+
+#include <memory>
+#include <vector>
+
+#include "memory-kv-store.h"
+#include "scheduler.h"
+
+using feeder::scheduler::MissedFeedPolicy;
+using feeder::scheduler::Scheduler;
+
+// 2026-01-01 00:00 UTC
+const uint32_t DAY_0 = 1767225600UL;
+const uint32_t HOUR = 3600;
+const uint32_t MINUTE = 60;
+
+struct Fired {
+    uint32_t slotSec;
+    unsigned int rotations;
+    uint32_t atSec;
+};
+
+hal::MemoryKeyValueStore* kv;
+std::vector<Fired> fired;
+// what the feed queue says to the trigger
+bool accepting;
+
+void setUp() {
+    kv = new hal::MemoryKeyValueStore();
+    fired.clear();
+    accepting = true;
+}
+void tearDown() { delete kv; }
+
+// a scheduler on kv as it'd come up at boot
+std::unique_ptr<Scheduler> boot(const MissedFeedPolicy policy) {
+    auto scheduler = std::make_unique<Scheduler>(*kv, [](const feeder::scheduler::Slot& slot, const unsigned int rotations, const uint32_t nowEpochSec) {
+        if (!accepting) return false;
+        fired.push_back({slot.epochSec, rotations, nowEpochSec});
+        return true;
+    }, policy);
+    scheduler->load();
+    return scheduler;
+}
+
+// 07:00 for 1 rotation and 12:00 for 2, every day
+std::unique_ptr<Scheduler> bootWithSchedules(const MissedFeedPolicy policy) {
+    auto scheduler = boot(policy);
+    scheduler->setSchedule(0, {.secOfDay = 7 * HOUR, .weekdays = feeder::scheduler::EVERY_DAY, .rotations = 1}, 0);
+    scheduler->setSchedule(1, {.secOfDay = 12 * HOUR, .weekdays = feeder::scheduler::EVERY_DAY, .rotations = 2}, 0);
+    return scheduler;
+}
+
+// a tick a second, like the network loop gives it (only faster)
+void tickThrough(Scheduler& scheduler, const uint32_t fromSec, const uint32_t toSec) {
+    for (uint32_t now = fromSec; now <= toSec; now++) scheduler.tick(now);
+}
+
+// boots, feeds day 0's 07:00 so there's a last fired slot, then powers off
+// at offSec until onSec and boots again
+std::unique_ptr<Scheduler> outage(const MissedFeedPolicy policy, const uint32_t offSec, const uint32_t onSec) {
+    {
+        auto scheduler = bootWithSchedules(policy);
+        tickThrough(*scheduler, DAY_0 + 6 * HOUR + 59 * MINUTE, offSec);
+        TEST_ASSERT_EQUAL(1, fired.size());
+    }
+    fired.clear();
+    auto scheduler = boot(policy);
+    scheduler->tick(onSec);
+    return scheduler;
+}
+
+/************************
+ * On time
+ ************************/
+void test_fires_each_slot_once_on_time() {
+    auto scheduler = bootWithSchedules(MissedFeedPolicy::FeedLatest);
+    tickThrough(*scheduler, DAY_0 + 6 * HOUR, DAY_0 + 13 * HOUR);
+
+    TEST_ASSERT_EQUAL(2, fired.size());
+    TEST_ASSERT_EQUAL(DAY_0 + 7 * HOUR, fired[0].slotSec);
+    TEST_ASSERT_EQUAL(DAY_0 + 7 * HOUR, fired[0].atSec);
+    TEST_ASSERT_EQUAL(1, fired[0].rotations);
+    TEST_ASSERT_EQUAL(DAY_0 + 12 * HOUR, fired[1].slotSec);
+    TEST_ASSERT_EQUAL(2, fired[1].rotations);
+    TEST_ASSERT_EQUAL(2, scheduler->getStats().fired);
+}
+
+/************************
+ * Missed while off
+ ************************/
+void test_feed_latest_catches_up_inside_the_window() {
+    // off over 12:00, back an hour later
+    auto scheduler = outage(MissedFeedPolicy::FeedLatest, DAY_0 + 11 * HOUR, DAY_0 + 13 * HOUR);
+    TEST_ASSERT_EQUAL(1, fired.size());
+    TEST_ASSERT_EQUAL(DAY_0 + 12 * HOUR, fired[0].slotSec);
+    TEST_ASSERT_EQUAL(1, scheduler->getStats().caughtUp);
+
+    // and carries on with the next day
+    tickThrough(*scheduler, DAY_0 + 13 * HOUR, DAY_0 + 31 * HOUR);
+    TEST_ASSERT_EQUAL(2, fired.size());
+    TEST_ASSERT_EQUAL(DAY_0 + 31 * HOUR, fired[1].slotSec);
+}
+
+void test_feed_latest_skips_outside_the_window() {
+    // back 2h 1m after 12:00
+    auto scheduler = outage(MissedFeedPolicy::FeedLatest, DAY_0 + 11 * HOUR, DAY_0 + 14 * HOUR + MINUTE);
+    TEST_ASSERT_EQUAL(0, fired.size());
+    TEST_ASSERT_EQUAL(1, scheduler->getStats().skipped);
+    TEST_ASSERT_EQUAL(0, scheduler->getStats().caughtUp);
+}
+
+void test_feed_latest_feeds_only_the_newest_missed_slot() {
+    // off over day 0's 12:00 and day 1's 07:00, back 30 minutes after that
+    auto scheduler = outage(MissedFeedPolicy::FeedLatest, DAY_0 + 11 * HOUR, DAY_0 + 31 * HOUR + 30 * MINUTE);
+    TEST_ASSERT_EQUAL(1, fired.size());
+    TEST_ASSERT_EQUAL(DAY_0 + 31 * HOUR, fired[0].slotSec);
+    TEST_ASSERT_EQUAL(1, fired[0].rotations);
+}
+
+void test_skip_drops_missed_slots_inside_the_window() {
+    auto scheduler = outage(MissedFeedPolicy::Skip, DAY_0 + 11 * HOUR, DAY_0 + 12 * HOUR + 30 * MINUTE);
+    TEST_ASSERT_EQUAL(0, fired.size());
+    TEST_ASSERT_EQUAL(1, scheduler->getStats().skipped);
+
+    tickThrough(*scheduler, DAY_0 + 12 * HOUR + 30 * MINUTE, DAY_0 + 31 * HOUR);
+    TEST_ASSERT_EQUAL(1, fired.size());
+    TEST_ASSERT_EQUAL(DAY_0 + 31 * HOUR, fired[0].slotSec);
+}
+
+void test_skip_drops_missed_slots_outside_the_window() {
+    auto scheduler = outage(MissedFeedPolicy::Skip, DAY_0 + 11 * HOUR, DAY_0 + 15 * HOUR);
+    TEST_ASSERT_EQUAL(0, fired.size());
+    TEST_ASSERT_EQUAL(1, scheduler->getStats().skipped);
+}
+
+void test_back_on_within_tolerance_is_on_time() {
+    auto scheduler = outage(MissedFeedPolicy::Skip, DAY_0 + 11 * HOUR, DAY_0 + 12 * HOUR + 4 * MINUTE);
+    TEST_ASSERT_EQUAL(1, fired.size());
+    TEST_ASSERT_EQUAL(1, scheduler->getStats().fired);
+}
+
+/************************
+ * Reboots and the clock
+ ************************/
+void test_persisted_last_fired_stops_a_second_firing_after_reboot() {
+    {
+        auto scheduler = bootWithSchedules(MissedFeedPolicy::FeedLatest);
+        tickThrough(*scheduler, DAY_0 + 7 * HOUR - 10, DAY_0 + 7 * HOUR + 10);
+        TEST_ASSERT_EQUAL(1, fired.size());
+    }
+    // rebooted straight away, still inside the slot's tolerance
+    auto scheduler = boot(MissedFeedPolicy::FeedLatest);
+    TEST_ASSERT_EQUAL(DAY_0 + 7 * HOUR, scheduler->getLastFiredKey() >> 8);
+    tickThrough(*scheduler, DAY_0 + 7 * HOUR + 20, DAY_0 + 7 * HOUR + 10 * MINUTE);
+    TEST_ASSERT_EQUAL(1, fired.size());
+    TEST_ASSERT_EQUAL(DAY_0 + 12 * HOUR, scheduler->getNextSlot().epochSec);
+}
+
+void test_clock_going_backwards_does_not_fire_a_slot_twice() {
+    auto scheduler = bootWithSchedules(MissedFeedPolicy::FeedLatest);
+    tickThrough(*scheduler, DAY_0 + 7 * HOUR - 10, DAY_0 + 7 * HOUR + 10);
+    TEST_ASSERT_EQUAL(1, fired.size());
+
+    // NTP pulls the clock back 20 minutes, then it runs through 07:00 again
+    tickThrough(*scheduler, DAY_0 + 7 * HOUR - 20 * MINUTE, DAY_0 + 7 * HOUR + 10 * MINUTE);
+    TEST_ASSERT_EQUAL(1, fired.size());
+    TEST_ASSERT_EQUAL(0, scheduler->getStats().caughtUp);
+
+    // and still fires the next one
+    tickThrough(*scheduler, DAY_0 + 12 * HOUR - 10, DAY_0 + 12 * HOUR + 10);
+    TEST_ASSERT_EQUAL(2, fired.size());
+}
+
+void test_clock_far_ahead_does_not_hold_off_feeds() {
+    {
+        auto scheduler = bootWithSchedules(MissedFeedPolicy::FeedLatest);
+        // a bad first sync, three days ahead
+        tickThrough(*scheduler, DAY_0 + 3 * 24 * HOUR + 7 * HOUR - 10, DAY_0 + 3 * 24 * HOUR + 7 * HOUR + 10);
+        TEST_ASSERT_EQUAL(1, fired.size());
+    }
+    fired.clear();
+    auto scheduler = boot(MissedFeedPolicy::FeedLatest);
+    tickThrough(*scheduler, DAY_0 + 12 * HOUR - 10, DAY_0 + 12 * HOUR + 10);
+    TEST_ASSERT_EQUAL(1, fired.size());
+    TEST_ASSERT_EQUAL(DAY_0 + 12 * HOUR, fired[0].slotSec);
+}
+
+/************************
+ * A full feed queue
+ ************************/
+void test_refused_slot_is_retried_not_lost() {
+    auto scheduler = bootWithSchedules(MissedFeedPolicy::FeedLatest);
+    tickThrough(*scheduler, DAY_0 + 7 * HOUR - 10, DAY_0 + 7 * HOUR - 1);
+    kv->resetWriteCount();
+
+    accepting = false;
+    tickThrough(*scheduler, DAY_0 + 7 * HOUR, DAY_0 + 7 * HOUR + 25);
+    TEST_ASSERT_EQUAL(0, fired.size());
+    // offered every REFUSED_RETRY_SEC, not every tick, and not marked fired
+    TEST_ASSERT_EQUAL(3, scheduler->getStats().refused);
+    TEST_ASSERT_EQUAL(0, kv->getWriteCount());
+    TEST_ASSERT_EQUAL(0, scheduler->getLastFiredKey());
+
+    accepting = true;
+    tickThrough(*scheduler, DAY_0 + 7 * HOUR + 26, DAY_0 + 7 * HOUR + 40);
+    TEST_ASSERT_EQUAL(1, fired.size());
+    TEST_ASSERT_EQUAL(DAY_0 + 7 * HOUR, fired[0].slotSec);
+    TEST_ASSERT_EQUAL(1, scheduler->getStats().fired);
+    TEST_ASSERT_EQUAL(DAY_0 + 7 * HOUR, scheduler->getLastFiredKey() >> 8);
+}
+
+void test_refused_past_tolerance_follows_the_missed_feed_policy() {
+    {
+        auto scheduler = bootWithSchedules(MissedFeedPolicy::FeedLatest);
+        accepting = false;
+        tickThrough(*scheduler, DAY_0 + 7 * HOUR - 10, DAY_0 + 7 * HOUR + 10 * MINUTE);
+        accepting = true;
+        tickThrough(*scheduler, DAY_0 + 7 * HOUR + 10 * MINUTE, DAY_0 + 7 * HOUR + 11 * MINUTE);
+        TEST_ASSERT_EQUAL(1, fired.size());
+        TEST_ASSERT_EQUAL(1, scheduler->getStats().caughtUp);
+    }
+    fired.clear();
+    delete kv;
+    kv = new hal::MemoryKeyValueStore();
+
+    auto scheduler = bootWithSchedules(MissedFeedPolicy::Skip);
+    accepting = false;
+    tickThrough(*scheduler, DAY_0 + 7 * HOUR - 10, DAY_0 + 7 * HOUR + 10 * MINUTE);
+    accepting = true;
+    tickThrough(*scheduler, DAY_0 + 7 * HOUR + 10 * MINUTE, DAY_0 + 7 * HOUR + 11 * MINUTE);
+    TEST_ASSERT_EQUAL(0, fired.size());
+    TEST_ASSERT_EQUAL(1, scheduler->getStats().skipped);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_fires_each_slot_once_on_time);
+    RUN_TEST(test_feed_latest_catches_up_inside_the_window);
+    RUN_TEST(test_feed_latest_skips_outside_the_window);
+    RUN_TEST(test_feed_latest_feeds_only_the_newest_missed_slot);
+    RUN_TEST(test_skip_drops_missed_slots_inside_the_window);
+    RUN_TEST(test_skip_drops_missed_slots_outside_the_window);
+    RUN_TEST(test_back_on_within_tolerance_is_on_time);
+    RUN_TEST(test_persisted_last_fired_stops_a_second_firing_after_reboot);
+    RUN_TEST(test_clock_going_backwards_does_not_fire_a_slot_twice);
+    RUN_TEST(test_clock_far_ahead_does_not_hold_off_feeds);
+    RUN_TEST(test_refused_slot_is_retried_not_lost);
+    RUN_TEST(test_refused_past_tolerance_follows_the_missed_feed_policy);
+    return UNITY_END();
+}
@@ -0,0 +1,229 @@
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "memory-kv-store.h"
+#include "static-assets.h"
+#include "web-server.h"
+
+namespace static_assets = feeder::web_server::static_assets;
+
+// what each gzipped asset may cost on the wire, and how well gzip has to do
+const size_t ASSET_GZIPPED_BUDGET_BYTES = 2048;
+const double MAX_GZIP_RATIO = 0.6;
+
+void setUp() {}
+void tearDown() {}
+
+// gzip's trailer ends with the uncompressed size, little endian
+size_t uncompressedSize(const static_assets::StaticAsset& asset) {
+    const uint8_t* trailer = asset.gzipped + asset.gzippedLength - 4;
+    return trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (static_cast<size_t>(trailer[3]) << 24);
+}
+
+/************************
+ * Embedded assets
+ ************************/
+void test_assets_are_gzipped_and_small() {
+    TEST_ASSERT_GREATER_THAN(0, static_assets::ASSET_COUNT);
+    for (size_t i = 0; i < static_assets::ASSET_COUNT; i++) {
+        const auto& asset = static_assets::ASSETS[i];
+        TEST_ASSERT_GREATER_THAN(18, asset.gzippedLength);
+        TEST_ASSERT_EQUAL(0x1f, asset.gzipped[0]);
+        TEST_ASSERT_EQUAL(0x8b, asset.gzipped[1]);
+        TEST_ASSERT_LESS_OR_EQUAL(ASSET_GZIPPED_BUDGET_BYTES, asset.gzippedLength);
+        TEST_ASSERT_LESS_THAN(MAX_GZIP_RATIO * uncompressedSize(asset), asset.gzippedLength);
+    }
+}
+
+void test_asset_paths_are_content_addressed() {
+    for (size_t i = 0; i < static_assets::ASSET_COUNT; i++) {
+        const auto& asset = static_assets::ASSETS[i];
+        // /static/app.<hash>.css, and the ETag is that hash
+        std::string hash(asset.etag + 1, strlen(asset.etag) - 2);
+        TEST_ASSERT_EQUAL(16, hash.size());
+        TEST_ASSERT_NOT_NULL(strstr(asset.path, ("." + hash + ".").c_str()));
+        TEST_ASSERT_EQUAL(0, strncmp(asset.path, "/static/", 8));
+        TEST_ASSERT_EQUAL_STRING(asset.path, static_assets::pathFor(asset.name));
+    }
+    TEST_ASSERT_EQUAL_STRING("", static_assets::pathFor("missing.css"));
+}
+
+/************************
+ * etagMatches
+ ************************/
+void test_etag_matches_strong_and_weak_tags() {
+    TEST_ASSERT_TRUE(static_assets::etagMatches("\"abc\"", "\"abc\""));
+    TEST_ASSERT_TRUE(static_assets::etagMatches("W/\"abc\"", "\"abc\""));
+    TEST_ASSERT_TRUE(static_assets::etagMatches("\"x\", W/\"abc\"", "\"abc\""));
+    TEST_ASSERT_TRUE(static_assets::etagMatches("\"x\",\"abc\" ", "\"abc\""));
+    TEST_ASSERT_TRUE(static_assets::etagMatches("*", "\"abc\""));
+}
+
+void test_etag_does_not_match_others() {
+    TEST_ASSERT_FALSE(static_assets::etagMatches(nullptr, "\"abc\""));
+    TEST_ASSERT_FALSE(static_assets::etagMatches("", "\"abc\""));
+    TEST_ASSERT_FALSE(static_assets::etagMatches("\"ab\"", "\"abc\""));
+    // a prefix isn't a match
+    TEST_ASSERT_FALSE(static_assets::etagMatches("\"abc\"", "\"ab\""));
+    TEST_ASSERT_FALSE(static_assets::etagMatches("\"abcd\", W/\"x\"", "\"abc\""));
+    TEST_ASSERT_FALSE(static_assets::etagMatches("abc", "\"abc\""));
+}
+
+void test_respond_is_304_with_no_body_on_a_match() {
+    const auto& asset = static_assets::ASSETS[0];
+    const auto fresh = static_assets::respond(asset, "");
+    TEST_ASSERT_EQUAL(200, fresh.status);
+    TEST_ASSERT_EQUAL(asset.gzippedLength, fresh.bodyLength);
+
+    const std::string weak = std::string("W/") + asset.etag;
+    const auto revalidated = static_assets::respond(asset, weak.c_str());
+    TEST_ASSERT_EQUAL(304, revalidated.status);
+    TEST_ASSERT_EQUAL(0, revalidated.bodyLength);
+}
+
+/************************
+ * On the wire
+ *
+ * The web server on an ephemeral loopback port, polled from the test
+ * between reads of the response.
+ ************************/
+using TestWebServer = feeder::web_server::FeederWebServer<feeding_store::FEEDINGS_IN_MEMORY, feeding_store::FEEDINGS_TO_KEEP>;
+
+struct Response {
+    std::string head;
+    std::string body;
+
+    int status() const { return head.size() > 12 ? atoi(head.c_str() + 9) : 0; }
+
+    // the header's value, empty when it isn't there
+    std::string header(const char* name) const {
+        const std::string key = std::string("\r\n") + name + ": ";
+        const size_t at = head.find(key);
+        if (at == std::string::npos) return "";
+        const size_t from = at + key.size();
+        return head.substr(from, head.find("\r\n", from) - from);
+    }
+};
+
+struct Fixture {
+    hal::MemoryKeyValueStore kv;
+    std::unique_ptr<TestWebServer> server;
+
+    Fixture() {
+        auto journal = std::make_shared<feeding_store::FeedingJournal<feeding_store::FEEDINGS_TO_KEEP>>(kv);
+        auto store = std::make_shared<feeding_store::FeedingStore<feeding_store::FEEDINGS_IN_MEMORY>>();
+        journal->load(*store);
+        server = std::make_unique<TestWebServer>(store, journal, std::make_shared<feeder::idempotency::IdempotencyLedger>(kv),
+                                                 std::make_shared<feeder::feed_queue::FeedQueue>(),
+                                                 std::make_shared<feeder::dosing::DoseCalibration>(kv),
+                                                 std::make_shared<feeder::live_events::LiveEvents>(), [](feeder::metrics::Snapshot&) {}, 0);
+        TEST_ASSERT_TRUE(server->setupWebServer());
+    }
+
+    Response get(const char* path, const char* headers = "") {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(server->getPort());
+        TEST_ASSERT_EQUAL(0, connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)));
+
+        char request[256];
+        const int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: feeder\r\n%s\r\n", path, headers);
+        TEST_ASSERT_EQUAL(length, send(fd, request, length, MSG_NOSIGNAL));
+
+        std::string received;
+        Response response;
+        size_t contentLength = 0;
+        for (int pass = 0; pass < 1000; pass++) {
+            server->loopWebServer(hal::millis(), 1);
+            char buffer[4096];
+            ssize_t got;
+            while ((got = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) received.append(buffer, got);
+
+            if (response.head.empty()) {
+                const size_t end = received.find("\r\n\r\n");
+                if (end == std::string::npos) continue;
+                response.head = received.substr(0, end + 2);
+                received.erase(0, end + 4);
+                contentLength = strtoul(response.header("Content-Length").c_str(), nullptr, 10);
+            }
+            if (received.size() >= contentLength) break;
+        }
+        close(fd);
+        response.body = received;
+        return response;
+    }
+};
+
+void test_asset_is_served_gzipped_and_immutable() {
+    Fixture fixture;
+    for (size_t i = 0; i < static_assets::ASSET_COUNT; i++) {
+        const auto& asset = static_assets::ASSETS[i];
+        const auto response = fixture.get(asset.path);
+        TEST_ASSERT_EQUAL(200, response.status());
+        TEST_ASSERT_EQUAL_STRING("gzip", response.header("Content-Encoding").c_str());
+        TEST_ASSERT_EQUAL_STRING(static_assets::CACHE_CONTROL, response.header("Cache-Control").c_str());
+        TEST_ASSERT_NOT_NULL(strstr(response.header("Cache-Control").c_str(), "immutable"));
+        TEST_ASSERT_EQUAL_STRING(asset.etag, response.header("ETag").c_str());
+        TEST_ASSERT_EQUAL_STRING(asset.contentType, response.header("Content-Type").c_str());
+        // exactly the embedded bytes, nothing re-encoded
+        TEST_ASSERT_EQUAL(asset.gzippedLength, response.body.size());
+        TEST_ASSERT_EQUAL_MEMORY(asset.gzipped, response.body.data(), asset.gzippedLength);
+    }
+}
+
+void test_asset_revalidation_is_a_bodyless_304() {
+    Fixture fixture;
+    const auto& asset = static_assets::ASSETS[0];
+    for (const std::string& tag : {std::string(asset.etag), "W/" + std::string(asset.etag), "\"stale\", " + std::string(asset.etag)}) {
+        const std::string header = "If-None-Match: " + tag + "\r\n";
+        const auto response = fixture.get(asset.path, header.c_str());
+        TEST_ASSERT_EQUAL(304, response.status());
+        TEST_ASSERT_EQUAL(0, response.body.size());
+        TEST_ASSERT_EQUAL_STRING(asset.etag, response.header("ETag").c_str());
+        TEST_ASSERT_EQUAL_STRING(static_assets::CACHE_CONTROL, response.header("Cache-Control").c_str());
+    }
+
+    const auto changed = fixture.get(asset.path, "If-None-Match: \"stale\"\r\n");
+    TEST_ASSERT_EQUAL(200, changed.status());
+    TEST_ASSERT_EQUAL(asset.gzippedLength, changed.body.size());
+}
+
+void test_root_page_links_the_content_addressed_paths() {
+    Fixture fixture;
+    const auto response = fixture.get("/");
+    TEST_ASSERT_EQUAL(200, response.status());
+    for (size_t i = 0; i < static_assets::ASSET_COUNT; i++) {
+        TEST_ASSERT_NOT_NULL(strstr(response.body.c_str(), static_assets::ASSETS[i].path));
+    }
+}
+
+void test_only_content_addressed_paths_are_immutable() {
+    Fixture fixture;
+    const auto response = fixture.get("/api/feedings");
+    TEST_ASSERT_EQUAL(200, response.status());
+    TEST_ASSERT_EQUAL_STRING("no-cache", response.header("Cache-Control").c_str());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_assets_are_gzipped_and_small);
+    RUN_TEST(test_asset_paths_are_content_addressed);
+    RUN_TEST(test_etag_matches_strong_and_weak_tags);
+    RUN_TEST(test_etag_does_not_match_others);
+    RUN_TEST(test_respond_is_304_with_no_body_on_a_match);
+    RUN_TEST(test_asset_is_served_gzipped_and_immutable);
+    RUN_TEST(test_asset_revalidation_is_a_bodyless_304);
+    RUN_TEST(test_root_page_links_the_content_addressed_paths);
+    RUN_TEST(test_only_content_addressed_paths_are_immutable);
+    return UNITY_END();
+}